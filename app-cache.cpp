@@ -0,0 +1,421 @@
+#include "app-cache.h"
+#include "utils.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/*
+ * MurmurHash3 x64 128, with the two halves of the salt as seeds
+ */
+static inline uint64_t app_cache_rotl(uint64_t x, int r)
+{
+  return (x << r) | (x >> (64 - r));
+}
+
+static inline uint64_t app_cache_fmix(uint64_t k)
+{
+  k ^= k >> 33;
+  k *= 0xff51afd7ed558ccdULL;
+  k ^= k >> 33;
+  k *= 0xc4ceb9fe1a85ec53ULL;
+  k ^= k >> 33;
+  return k;
+}
+
+app_cache_key_t app_cache_hash(const void *data, size_t len,
+                               const app_cache_key_t &salt)
+{
+  const uint8_t *bytes = reinterpret_cast<const uint8_t *>(data);
+  const size_t n_blocks = len / 16;
+  const uint64_t c1 = 0x87c37b91114253d5ULL;
+  const uint64_t c2 = 0x4cf5ad432745937fULL;
+
+  uint64_t h1 = salt.lo;
+  uint64_t h2 = salt.hi;
+
+  for (size_t i = 0; i < n_blocks; i++)
+  {
+    uint64_t k1;
+    uint64_t k2;
+    memcpy(&k1, bytes + i * 16, 8);
+    memcpy(&k2, bytes + i * 16 + 8, 8);
+
+    k1 *= c1;
+    k1 = app_cache_rotl(k1, 31);
+    k1 *= c2;
+    h1 ^= k1;
+    h1 = app_cache_rotl(h1, 27);
+    h1 += h2;
+    h1 = h1 * 5 + 0x52dce729;
+
+    k2 *= c2;
+    k2 = app_cache_rotl(k2, 33);
+    k2 *= c1;
+    h2 ^= k2;
+    h2 = app_cache_rotl(h2, 31);
+    h2 += h1;
+    h2 = h2 * 5 + 0x38495ab5;
+  }
+
+  const uint8_t *tail = bytes + n_blocks * 16;
+  uint64_t k1 = 0;
+  uint64_t k2 = 0;
+  switch (len & 15)
+  {
+  case 15: k2 ^= (uint64_t)tail[14] << 48; [[fallthrough]];
+  case 14: k2 ^= (uint64_t)tail[13] << 40; [[fallthrough]];
+  case 13: k2 ^= (uint64_t)tail[12] << 32; [[fallthrough]];
+  case 12: k2 ^= (uint64_t)tail[11] << 24; [[fallthrough]];
+  case 11: k2 ^= (uint64_t)tail[10] << 16; [[fallthrough]];
+  case 10: k2 ^= (uint64_t)tail[9] << 8; [[fallthrough]];
+  case 9:
+    k2 ^= (uint64_t)tail[8];
+    k2 *= c2;
+    k2 = app_cache_rotl(k2, 33);
+    k2 *= c1;
+    h2 ^= k2;
+    [[fallthrough]];
+  case 8: k1 ^= (uint64_t)tail[7] << 56; [[fallthrough]];
+  case 7: k1 ^= (uint64_t)tail[6] << 48; [[fallthrough]];
+  case 6: k1 ^= (uint64_t)tail[5] << 40; [[fallthrough]];
+  case 5: k1 ^= (uint64_t)tail[4] << 32; [[fallthrough]];
+  case 4: k1 ^= (uint64_t)tail[3] << 24; [[fallthrough]];
+  case 3: k1 ^= (uint64_t)tail[2] << 16; [[fallthrough]];
+  case 2: k1 ^= (uint64_t)tail[1] << 8; [[fallthrough]];
+  case 1:
+    k1 ^= (uint64_t)tail[0];
+    k1 *= c1;
+    k1 = app_cache_rotl(k1, 31);
+    k1 *= c2;
+    h1 ^= k1;
+  }
+
+  h1 ^= len;
+  h2 ^= len;
+  h1 += h2;
+  h2 += h1;
+  h1 = app_cache_fmix(h1);
+  h2 = app_cache_fmix(h2);
+  h1 += h2;
+  h2 += h1;
+
+  // the all zero key marks an empty slot
+  if (h1 == 0 && h2 == 0)
+  {
+    h1 = 1;
+  }
+
+  return {h1, h2};
+}
+
+static inline bool app_cache_key_empty(const app_cache_key_t &key)
+{
+  return key.hi == 0 && key.lo == 0;
+}
+
+static inline app_cache_key_t *app_cache_slot(const app_cache_t &cache,
+                                              uint64_t i)
+{
+  return reinterpret_cast<app_cache_key_t *>(cache.slots +
+                                             i * cache.slot_size);
+}
+
+// keys stay 8 byte aligned whatever n_embd is
+static size_t app_cache_slot_size(uint32_t n_embd)
+{
+  return sizeof(app_cache_key_t) + ((n_embd * sizeof(float) + 7) & ~(size_t)7);
+}
+
+static size_t app_cache_file_size(uint32_t n_embd, uint64_t n_slots)
+{
+  return sizeof(app_cache_header_t) + n_slots * app_cache_slot_size(n_embd);
+}
+
+static bool app_cache_map(app_cache_t &cache, size_t size)
+{
+  void *map =
+      mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, cache.fd, 0);
+  if (map == MAP_FAILED)
+  {
+    LOG_ERR("mmap of cache '%s' failed: %s.\n", cache.path.c_str(),
+            strerror(errno));
+    return false;
+  }
+
+  cache.map = map;
+  cache.map_size = size;
+  cache.header = reinterpret_cast<app_cache_header_t *>(map);
+  cache.slots = reinterpret_cast<char *>(map) + sizeof(app_cache_header_t);
+  cache.slot_size = app_cache_slot_size(cache.header->n_embd);
+
+  return true;
+}
+
+static void app_cache_unmap(app_cache_t &cache)
+{
+  if (cache.map != NULL)
+  {
+    munmap(cache.map, cache.map_size);
+    cache.map = NULL;
+    cache.header = NULL;
+    cache.slots = NULL;
+  }
+}
+
+// (re)initializes the file as an empty table of 'n_slots'
+static bool app_cache_format(app_cache_t &cache, uint32_t n_embd,
+                             const app_cache_key_t &salt, uint64_t n_slots)
+{
+  app_cache_unmap(cache);
+
+  // truncating first zeroes every slot
+  const size_t size = app_cache_file_size(n_embd, n_slots);
+  if (ftruncate(cache.fd, 0) != 0 || ftruncate(cache.fd, size) != 0)
+  {
+    LOG_ERR("could not size cache '%s': %s.\n", cache.path.c_str(),
+            strerror(errno));
+    return false;
+  }
+
+  app_cache_header_t header = {};
+  memcpy(header.magic, APP_CACHE_MAGIC, sizeof(header.magic));
+  header.version = APP_CACHE_VERSION;
+  header.n_embd = n_embd;
+  header.salt = salt;
+  header.n_slots = n_slots;
+  header.n_entries = 0;
+
+  if (pwrite(cache.fd, &header, sizeof(header), 0) != sizeof(header))
+  {
+    LOG_ERR("could not write cache '%s': %s.\n", cache.path.c_str(),
+            strerror(errno));
+    return false;
+  }
+
+  return app_cache_map(cache, size);
+}
+
+bool app_cache_open(const std::string &path, uint32_t n_embd,
+                    const app_cache_key_t &salt, app_cache_t *cache)
+{
+  if (NULL == cache)
+  {
+    LOG_ERR("argument 'cache' is NULL.\n");
+    return false;
+  }
+
+  cache->path.assign(path);
+  cache->map = NULL;
+  cache->map_size = 0;
+  cache->header = NULL;
+  cache->slots = NULL;
+  cache->n_hits = 0;
+  cache->n_misses = 0;
+  cache->n_inserts = 0;
+
+  cache->fd = open(path.c_str(), O_RDWR | O_CREAT, 0644);
+  if (cache->fd < 0)
+  {
+    LOG_ERR("could not open cache '%s': %s.\n", path.c_str(),
+            strerror(errno));
+    return false;
+  }
+
+  if (flock(cache->fd, LOCK_EX | LOCK_NB) != 0)
+  {
+    LOG_ERR("cache '%s' is in use by another process.\n", path.c_str());
+    app_cache_close(cache);
+    return false;
+  }
+
+  struct stat st;
+  app_cache_header_t header = {};
+  const bool valid =
+      fstat(cache->fd, &st) == 0 &&
+      pread(cache->fd, &header, sizeof(header), 0) == sizeof(header) &&
+      memcmp(header.magic, APP_CACHE_MAGIC, sizeof(header.magic)) == 0 &&
+      header.version == APP_CACHE_VERSION &&
+      // probing masks with n_slots - 1
+      header.n_slots != 0 && (header.n_slots & (header.n_slots - 1)) == 0 &&
+      header.n_entries < header.n_slots &&
+      (size_t)st.st_size == app_cache_file_size(header.n_embd, header.n_slots);
+
+  if (valid && header.n_embd == n_embd && header.salt.hi == salt.hi &&
+      header.salt.lo == salt.lo)
+  {
+    if (!app_cache_map(*cache, st.st_size))
+    {
+      app_cache_close(cache);
+      return false;
+    }
+
+    LOG("cache '%s': %llu embeddings.\n", path.c_str(),
+        (unsigned long long)header.n_entries);
+
+    return true;
+  }
+
+  if (valid)
+  {
+    LOG("warning: cache '%s' was built for another model or settings, "
+        "starting over.\n",
+        path.c_str());
+  }
+
+  if (!app_cache_format(*cache, n_embd, salt, APP_CACHE_MIN_SLOTS))
+  {
+    app_cache_close(cache);
+    return false;
+  }
+
+  return true;
+}
+
+// linear probing; returns the slot holding 'key' or the empty slot where it
+// would go
+static uint64_t app_cache_find(const app_cache_t &cache,
+                               const app_cache_key_t &key)
+{
+  const uint64_t mask = cache.header->n_slots - 1;
+
+  uint64_t i = key.lo & mask;
+  while (true)
+  {
+    const app_cache_key_t *slot = app_cache_slot(cache, i);
+    if (app_cache_key_empty(*slot) ||
+        (slot->hi == key.hi && slot->lo == key.lo))
+    {
+      return i;
+    }
+
+    i = (i + 1) & mask;
+  }
+}
+
+bool app_cache_lookup(app_cache_t &cache, const app_cache_key_t &key,
+                      float *embd)
+{
+  const app_cache_key_t *slot =
+      app_cache_slot(cache, app_cache_find(cache, key));
+
+  if (app_cache_key_empty(*slot))
+  {
+    cache.n_misses++;
+    return false;
+  }
+
+  memcpy(embd, slot + 1, cache.header->n_embd * sizeof(float));
+  cache.n_hits++;
+
+  return true;
+}
+
+static bool app_cache_grow(app_cache_t &cache)
+{
+  const uint32_t n_embd = cache.header->n_embd;
+  const uint64_t n_slots = cache.header->n_slots;
+  const app_cache_key_t salt = cache.header->salt;
+
+  // rebuild into a new file next to the old one, then swap them
+  app_cache_t grown;
+  grown.path = cache.path + ".grow";
+  grown.map = NULL;
+  grown.fd = open(grown.path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+  if (grown.fd < 0)
+  {
+    LOG_ERR("could not create '%s': %s.\n", grown.path.c_str(),
+            strerror(errno));
+    return false;
+  }
+
+  if (!app_cache_format(grown, n_embd, salt, n_slots * 2))
+  {
+    app_cache_unmap(grown);
+    close(grown.fd);
+    unlink(grown.path.c_str());
+    return false;
+  }
+
+  for (uint64_t i = 0; i < n_slots; i++)
+  {
+    const app_cache_key_t *slot = app_cache_slot(cache, i);
+    if (app_cache_key_empty(*slot))
+    {
+      continue;
+    }
+
+    app_cache_key_t *dst = app_cache_slot(grown, app_cache_find(grown, *slot));
+    memcpy(dst + 1, slot + 1, n_embd * sizeof(float));
+    *dst = *slot;
+  }
+  grown.header->n_entries = cache.header->n_entries;
+
+  // lock before the rename so no other process can take the new file
+  if (flock(grown.fd, LOCK_EX | LOCK_NB) != 0 ||
+      rename(grown.path.c_str(), cache.path.c_str()) != 0)
+  {
+    LOG_ERR("could not replace cache '%s': %s.\n", cache.path.c_str(),
+            strerror(errno));
+    app_cache_unmap(grown);
+    close(grown.fd);
+    unlink(grown.path.c_str());
+    return false;
+  }
+
+  app_cache_unmap(cache);
+  close(cache.fd);
+
+  cache.fd = grown.fd;
+  cache.map = grown.map;
+  cache.map_size = grown.map_size;
+  cache.header = grown.header;
+  cache.slots = grown.slots;
+  cache.slot_size = grown.slot_size;
+
+  return true;
+}
+
+bool app_cache_insert(app_cache_t &cache, const app_cache_key_t &key,
+                      const float *embd)
+{
+  if ((cache.header->n_entries + 1) * 10 > cache.header->n_slots * 7 &&
+      !app_cache_grow(cache))
+  {
+    return false;
+  }
+
+  app_cache_key_t *slot = app_cache_slot(cache, app_cache_find(cache, key));
+  if (!app_cache_key_empty(*slot))
+  {
+    return true;
+  }
+
+  // vector first: a slot only counts once its key is set
+  memcpy(slot + 1, embd, cache.header->n_embd * sizeof(float));
+  *slot = key;
+
+  cache.header->n_entries++;
+  cache.n_inserts++;
+
+  return true;
+}
+
+void app_cache_close(app_cache_t *cache)
+{
+  if (NULL == cache)
+  {
+    return;
+  }
+
+  app_cache_unmap(*cache);
+
+  if (cache->fd >= 0)
+  {
+    close(cache->fd);
+    cache->fd = -1;
+  }
+}
@@ -0,0 +1,299 @@
+#include "app-distance.h"
+#include <cmath>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define APP_DISTANCE_X86
+#define APP_DISTANCE_AVX2 __attribute__((target("avx2,fma")))
+#define APP_DISTANCE_AVX512 __attribute__((target("avx512f")))
+#endif
+
+/*
+ * One kernel template per instruction set, instantiated for each of the
+ * three reductions below. Sums are kept in float over four independent
+ * accumulators: the result only ranks neighbours, it is not stored.
+ */
+
+typedef enum _app_distance_op
+{
+  DistanceOpDot = 0, // -sum a*b
+  DistanceOpL2,      // sum (a-b)^2
+  DistanceOpL1,      // sum |a-b|
+  DistanceOpCount
+} app_distance_op_t;
+
+template <int OP> static inline float app_distance_term(float a, float b)
+{
+  if constexpr (OP == DistanceOpDot)
+  {
+    return a * b;
+  }
+  else if constexpr (OP == DistanceOpL2)
+  {
+    return (a - b) * (a - b);
+  }
+  else
+  {
+    return std::abs(a - b);
+  }
+}
+
+template <int OP> static inline float app_distance_finish(float sum)
+{
+  return OP == DistanceOpDot ? -sum : sum;
+}
+
+/* scalar */
+
+template <int OP>
+static float app_distance_scalar(const float *a, const float *b, size_t n)
+{
+  float s0 = 0.0f, s1 = 0.0f, s2 = 0.0f, s3 = 0.0f;
+  size_t i = 0;
+  for (; i + 4 <= n; i += 4)
+  {
+    s0 += app_distance_term<OP>(a[i], b[i]);
+    s1 += app_distance_term<OP>(a[i + 1], b[i + 1]);
+    s2 += app_distance_term<OP>(a[i + 2], b[i + 2]);
+    s3 += app_distance_term<OP>(a[i + 3], b[i + 3]);
+  }
+  for (; i < n; i++)
+  {
+    s0 += app_distance_term<OP>(a[i], b[i]);
+  }
+
+  return app_distance_finish<OP>((s0 + s1) + (s2 + s3));
+}
+
+#ifdef APP_DISTANCE_X86
+
+/* AVX2 + FMA: 8 floats per register */
+
+template <int OP>
+APP_DISTANCE_AVX2 static inline __m256 app_distance_step_avx2(__m256 acc,
+                                                              __m256 a,
+                                                              __m256 b)
+{
+  if constexpr (OP == DistanceOpDot)
+  {
+    return _mm256_fmadd_ps(a, b, acc);
+  }
+  else if constexpr (OP == DistanceOpL2)
+  {
+    const __m256 d = _mm256_sub_ps(a, b);
+    return _mm256_fmadd_ps(d, d, acc);
+  }
+  else
+  {
+    const __m256 d = _mm256_sub_ps(a, b);
+    return _mm256_add_ps(_mm256_andnot_ps(_mm256_set1_ps(-0.0f), d), acc);
+  }
+}
+
+template <int OP>
+APP_DISTANCE_AVX2 static float app_distance_avx2(const float *a,
+                                                 const float *b, size_t n)
+{
+  __m256 s0 = _mm256_setzero_ps(), s1 = s0, s2 = s0, s3 = s0;
+  size_t i = 0;
+  for (; i + 32 <= n; i += 32)
+  {
+    s0 = app_distance_step_avx2<OP>(s0, _mm256_loadu_ps(a + i),
+                                    _mm256_loadu_ps(b + i));
+    s1 = app_distance_step_avx2<OP>(s1, _mm256_loadu_ps(a + i + 8),
+                                    _mm256_loadu_ps(b + i + 8));
+    s2 = app_distance_step_avx2<OP>(s2, _mm256_loadu_ps(a + i + 16),
+                                    _mm256_loadu_ps(b + i + 16));
+    s3 = app_distance_step_avx2<OP>(s3, _mm256_loadu_ps(a + i + 24),
+                                    _mm256_loadu_ps(b + i + 24));
+  }
+  for (; i + 8 <= n; i += 8)
+  {
+    s0 = app_distance_step_avx2<OP>(s0, _mm256_loadu_ps(a + i),
+                                    _mm256_loadu_ps(b + i));
+  }
+  s0 = _mm256_add_ps(_mm256_add_ps(s0, s1), _mm256_add_ps(s2, s3));
+
+  __m128 s = _mm_add_ps(_mm256_castps256_ps128(s0),
+                        _mm256_extractf128_ps(s0, 1));
+  s = _mm_add_ps(s, _mm_movehl_ps(s, s));
+  s = _mm_add_ss(s, _mm_shuffle_ps(s, s, 1));
+
+  float sum = _mm_cvtss_f32(s);
+  for (; i < n; i++)
+  {
+    sum += app_distance_term<OP>(a[i], b[i]);
+  }
+
+  return app_distance_finish<OP>(sum);
+}
+
+/* AVX-512F: 16 floats per register */
+
+template <int OP>
+APP_DISTANCE_AVX512 static inline __m512 app_distance_step_avx512(__m512 acc,
+                                                                  __m512 a,
+                                                                  __m512 b)
+{
+  if constexpr (OP == DistanceOpDot)
+  {
+    return _mm512_fmadd_ps(a, b, acc);
+  }
+  else if constexpr (OP == DistanceOpL2)
+  {
+    const __m512 d = _mm512_sub_ps(a, b);
+    return _mm512_fmadd_ps(d, d, acc);
+  }
+  else
+  {
+    return _mm512_add_ps(_mm512_abs_ps(_mm512_sub_ps(a, b)), acc);
+  }
+}
+
+template <int OP>
+APP_DISTANCE_AVX512 static float app_distance_avx512(const float *a,
+                                                     const float *b, size_t n)
+{
+  __m512 s0 = _mm512_setzero_ps(), s1 = s0, s2 = s0, s3 = s0;
+  size_t i = 0;
+  for (; i + 64 <= n; i += 64)
+  {
+    s0 = app_distance_step_avx512<OP>(s0, _mm512_loadu_ps(a + i),
+                                      _mm512_loadu_ps(b + i));
+    s1 = app_distance_step_avx512<OP>(s1, _mm512_loadu_ps(a + i + 16),
+                                      _mm512_loadu_ps(b + i + 16));
+    s2 = app_distance_step_avx512<OP>(s2, _mm512_loadu_ps(a + i + 32),
+                                      _mm512_loadu_ps(b + i + 32));
+    s3 = app_distance_step_avx512<OP>(s3, _mm512_loadu_ps(a + i + 48),
+                                      _mm512_loadu_ps(b + i + 48));
+  }
+  for (; i + 16 <= n; i += 16)
+  {
+    s0 = app_distance_step_avx512<OP>(s0, _mm512_loadu_ps(a + i),
+                                      _mm512_loadu_ps(b + i));
+  }
+  if (i < n)
+  {
+    // the tail in one masked pass; masked-off lanes load as zeros
+    const __mmask16 mask = (__mmask16)((1u << (n - i)) - 1);
+    s1 = app_distance_step_avx512<OP>(s1, _mm512_maskz_loadu_ps(mask, a + i),
+                                      _mm512_maskz_loadu_ps(mask, b + i));
+  }
+  s0 = _mm512_add_ps(_mm512_add_ps(s0, s1), _mm512_add_ps(s2, s3));
+
+  return app_distance_finish<OP>(_mm512_reduce_add_ps(s0));
+}
+
+#endif // APP_DISTANCE_X86
+
+#define APP_DISTANCE_KERNELS(isa)                                            \
+  {                                                                          \
+    app_distance_##isa<DistanceOpDot>, app_distance_##isa<DistanceOpL2>,     \
+        app_distance_##isa<DistanceOpL1>                                     \
+  }
+
+static const app_distance_fn_t
+    app_distance_kernels[DistanceIsaCount][DistanceOpCount] = {
+        APP_DISTANCE_KERNELS(scalar),
+#ifdef APP_DISTANCE_X86
+        APP_DISTANCE_KERNELS(avx2),
+        APP_DISTANCE_KERNELS(avx512),
+#endif
+};
+
+static bool app_distance_supported(app_distance_isa_t isa)
+{
+  switch (isa)
+  {
+  case DistanceScalar:
+    return true;
+#ifdef APP_DISTANCE_X86
+  case DistanceAVX2:
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma");
+  case DistanceAVX512:
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("avx512f");
+#endif
+  default:
+    return false;
+  }
+}
+
+static app_distance_isa_t app_distance_detect()
+{
+  int isa = DistanceIsaCount - 1;
+  while (isa > DistanceScalar &&
+         !app_distance_supported((app_distance_isa_t)isa))
+  {
+    isa--;
+  }
+
+  return (app_distance_isa_t)isa;
+}
+
+static app_distance_isa_t app_distance_isa = app_distance_detect();
+
+static app_distance_op_t app_distance_op(qdrant_distance_type_t distance)
+{
+  switch (distance)
+  {
+  case Euclid:
+    return DistanceOpL2;
+  case Manhattan:
+    return DistanceOpL1;
+  default:
+    return DistanceOpDot;
+  }
+}
+
+app_distance_fn_t app_distance_get(qdrant_distance_type_t distance)
+{
+  return app_distance_kernels[app_distance_isa][app_distance_op(distance)];
+}
+
+float app_distance_score(qdrant_distance_type_t distance, float value)
+{
+  switch (app_distance_op(distance))
+  {
+  case DistanceOpDot:
+    return -value;
+  case DistanceOpL2:
+    return std::sqrt(value);
+  default:
+    return value;
+  }
+}
+
+app_distance_isa_t app_distance_get_isa()
+{
+  return app_distance_isa;
+}
+
+bool app_distance_set_isa(app_distance_isa_t isa)
+{
+  if (isa < DistanceScalar || isa >= DistanceIsaCount ||
+      !app_distance_supported(isa))
+  {
+    return false;
+  }
+
+  app_distance_isa = isa;
+
+  return true;
+}
+
+const char *app_distance_isa_name(app_distance_isa_t isa)
+{
+  switch (isa)
+  {
+  case DistanceScalar:
+    return "scalar";
+  case DistanceAVX2:
+    return "avx2";
+  case DistanceAVX512:
+    return "avx512";
+  default:
+    return "unknown";
+  }
+}
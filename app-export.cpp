@@ -0,0 +1,334 @@
+#include "app-export.h"
+#include "nlohmann/json.hpp"
+#include "qdrant-json.h"
+#include "utils.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+
+// "\x93NUMPY", version 1.0, then the little endian length of the dict
+#define APP_EXPORT_NPY_MAGIC "\x93NUMPY\x01\x00"
+#define APP_EXPORT_NPY_PREFIX 10
+
+static void app_export_npy_header(uint32_t dim, size_t n_points, char *out)
+{
+  const size_t n_dict = APP_EXPORT_HEADER_BYTES - APP_EXPORT_NPY_PREFIX;
+
+  memcpy(out, APP_EXPORT_NPY_MAGIC, 8);
+  out[8] = (char)(n_dict & 0xff);
+  out[9] = (char)(n_dict >> 8);
+
+  char *dict = out + APP_EXPORT_NPY_PREFIX;
+  const int len = snprintf(dict, n_dict,
+                           "{'descr': '<f4', 'fortran_order': False, "
+                           "'shape': (%zu, %u), }",
+                           n_points, dim);
+
+  // space padded, newline terminated
+  memset(dict + len, ' ', n_dict - len - 1);
+  dict[n_dict - 1] = '\n';
+}
+
+bool app_export_create(const std::string &path, uint32_t dim,
+                       app_export_t *file)
+{
+  if (NULL == file)
+  {
+    LOG_ERR("argument 'file' is NULL.\n");
+    return false;
+  }
+
+  file->path = path;
+  file->sidecar = path + APP_EXPORT_SIDECAR;
+  file->dim = dim;
+  file->n_points = 0;
+  file->n_bytes = 0;
+  file->finished = false;
+  file->payloads = NULL;
+
+  const std::string tmp = path + ".tmp";
+  const std::string tmp_sidecar = file->sidecar + ".tmp";
+
+  file->vectors = fopen(tmp.c_str(), "wb");
+  if (NULL != file->vectors)
+  {
+    file->payloads = fopen(tmp_sidecar.c_str(), "wb");
+  }
+
+  if (NULL == file->vectors || NULL == file->payloads)
+  {
+    LOG_ERR("could not create '%s': %s.\n", path.c_str(), strerror(errno));
+    app_export_close(file);
+    return false;
+  }
+
+  file->vector_buffer.resize(APP_EXPORT_BUFFER_BYTES);
+  file->payload_buffer.resize(APP_EXPORT_BUFFER_BYTES);
+  setvbuf(file->vectors, file->vector_buffer.data(), _IOFBF,
+          file->vector_buffer.size());
+  setvbuf(file->payloads, file->payload_buffer.data(), _IOFBF,
+          file->payload_buffer.size());
+
+  // the shape is not known yet, the header is written again at the end
+  char header[APP_EXPORT_HEADER_BYTES];
+  app_export_npy_header(dim, 0, header);
+  if (fwrite(header, sizeof(header), 1, file->vectors) != 1)
+  {
+    LOG_ERR("could not write '%s': %s.\n", path.c_str(), strerror(errno));
+    app_export_close(file);
+    return false;
+  }
+  file->n_bytes = sizeof(header);
+
+  return true;
+}
+
+bool app_export_add(app_export_t &file, const qdrant_point_spec_t &point)
+{
+  if (point.vector.size() != file.dim)
+  {
+    LOG_ERR("point '%s' has %zu dims, the export %u.\n", point.id.c_str(),
+            point.vector.size(), file.dim);
+    return false;
+  }
+
+  std::string &line = file.line;
+  line.assign("{\"id\":");
+  qdrant_json_append_string(line, point.id);
+  line.append(",\"payload\":{");
+  qdrant_json_append_string(line, point.payload_x);
+  line.push_back(':');
+  qdrant_json_append_string(line, point.payload_y);
+  line.append("}}\n");
+
+  const size_t n_vector = file.dim * sizeof(float);
+  if (fwrite(point.vector.data(), 1, n_vector, file.vectors) != n_vector ||
+      fwrite(line.data(), 1, line.length(), file.payloads) != line.length())
+  {
+    LOG_ERR("could not write '%s': %s.\n", file.path.c_str(),
+            strerror(errno));
+    return false;
+  }
+
+  file.n_points++;
+  file.n_bytes += n_vector + line.length();
+
+  return true;
+}
+
+static bool app_export_commit(FILE *&stream, const std::string &path)
+{
+  bool written = fflush(stream) == 0 && fsync(fileno(stream)) == 0;
+  written = fclose(stream) == 0 && written;
+  stream = NULL;
+
+  const std::string tmp = path + ".tmp";
+  return written && rename(tmp.c_str(), path.c_str()) == 0;
+}
+
+bool app_export_finish(app_export_t &file)
+{
+  char header[APP_EXPORT_HEADER_BYTES];
+  app_export_npy_header(file.dim, file.n_points, header);
+
+  // the sidecar goes first: a vectors file is only there when complete
+  const bool written =
+      fflush(file.vectors) == 0 &&
+      pwrite(fileno(file.vectors), header, sizeof(header), 0) ==
+          (ssize_t)sizeof(header) &&
+      app_export_commit(file.payloads, file.sidecar) &&
+      app_export_commit(file.vectors, file.path);
+
+  if (!written)
+  {
+    LOG_ERR("could not write '%s': %s.\n", file.path.c_str(),
+            strerror(errno));
+    return false;
+  }
+
+  file.finished = true;
+
+  return true;
+}
+
+void app_export_close(app_export_t *file)
+{
+  if (NULL == file)
+  {
+    return;
+  }
+
+  if (NULL != file->vectors)
+  {
+    fclose(file->vectors);
+    file->vectors = NULL;
+  }
+
+  if (NULL != file->payloads)
+  {
+    fclose(file->payloads);
+    file->payloads = NULL;
+  }
+
+  if (!file->finished)
+  {
+    remove((file->path + ".tmp").c_str());
+    remove((file->sidecar + ".tmp").c_str());
+  }
+
+  file->vector_buffer.clear();
+  file->vector_buffer.shrink_to_fit();
+  file->payload_buffer.clear();
+  file->payload_buffer.shrink_to_fit();
+}
+
+// reads the shape of a float32, C order npy header
+static bool app_export_parse_header(const char *header, uint32_t *dim,
+                                    size_t *n_points)
+{
+  if (memcmp(header, APP_EXPORT_NPY_MAGIC, 6) != 0)
+  {
+    return false;
+  }
+
+  const std::string dict(header + APP_EXPORT_NPY_PREFIX,
+                         APP_EXPORT_HEADER_BYTES - APP_EXPORT_NPY_PREFIX);
+  if (dict.find("'descr': '<f4'") == std::string::npos ||
+      dict.find("'fortran_order': False") == std::string::npos)
+  {
+    return false;
+  }
+
+  const size_t shape = dict.find("'shape': (");
+  unsigned long long n = 0;
+  unsigned int d = 0;
+  if (shape == std::string::npos ||
+      sscanf(dict.c_str() + shape, "'shape': (%llu, %u)", &n, &d) != 2 ||
+      d == 0)
+  {
+    return false;
+  }
+
+  *n_points = n;
+  *dim = d;
+
+  return true;
+}
+
+bool app_export_open(const std::string &path, app_export_reader_t *reader)
+{
+  if (NULL == reader)
+  {
+    LOG_ERR("argument 'reader' is NULL.\n");
+    return false;
+  }
+
+  reader->line = NULL;
+  reader->line_size = 0;
+  reader->n_read = 0;
+  reader->payloads = NULL;
+
+  const std::string sidecar = path + APP_EXPORT_SIDECAR;
+
+  reader->vectors = fopen(path.c_str(), "rb");
+  if (NULL != reader->vectors)
+  {
+    reader->payloads = fopen(sidecar.c_str(), "rb");
+  }
+
+  if (NULL == reader->vectors || NULL == reader->payloads)
+  {
+    LOG_ERR("could not open '%s' and '%s': %s.\n", path.c_str(),
+            sidecar.c_str(), strerror(errno));
+    app_export_reader_close(reader);
+    return false;
+  }
+
+  reader->vector_buffer.resize(APP_EXPORT_BUFFER_BYTES);
+  reader->payload_buffer.resize(APP_EXPORT_BUFFER_BYTES);
+  setvbuf(reader->vectors, reader->vector_buffer.data(), _IOFBF,
+          reader->vector_buffer.size());
+  setvbuf(reader->payloads, reader->payload_buffer.data(), _IOFBF,
+          reader->payload_buffer.size());
+  posix_fadvise(fileno(reader->vectors), 0, 0, POSIX_FADV_SEQUENTIAL);
+  posix_fadvise(fileno(reader->payloads), 0, 0, POSIX_FADV_SEQUENTIAL);
+
+  char header[APP_EXPORT_HEADER_BYTES];
+  if (fread(header, sizeof(header), 1, reader->vectors) != 1 ||
+      !app_export_parse_header(header, &reader->dim, &reader->n_points))
+  {
+    LOG_ERR("'%s' is not an export of float32 vectors.\n", path.c_str());
+    app_export_reader_close(reader);
+    return false;
+  }
+
+  return true;
+}
+
+int app_export_read(app_export_reader_t &reader, qdrant_point_spec_t &point)
+{
+  if (reader.n_read == reader.n_points)
+  {
+    return 0;
+  }
+
+  point.vector.resize(reader.dim);
+  if (fread(point.vector.data(), sizeof(float), reader.dim, reader.vectors) !=
+      reader.dim)
+  {
+    LOG_ERR("vectors end at point %zu of %zu.\n", reader.n_read,
+            reader.n_points);
+    return -1;
+  }
+
+  const ssize_t len = getline(&reader.line, &reader.line_size, reader.payloads);
+  if (len <= 0)
+  {
+    LOG_ERR("payloads end at point %zu of %zu.\n", reader.n_read,
+            reader.n_points);
+    return -1;
+  }
+
+  const nlohmann::json json =
+      nlohmann::json::parse(reader.line, reader.line + len, nullptr, false);
+  if (!json.is_object() || !json.contains("id") || !json["id"].is_string() ||
+      !json.contains("payload") || !json["payload"].is_object() ||
+      json["payload"].size() != 1 || !json["payload"].begin()->is_string())
+  {
+    LOG_ERR("payload line %zu is malformed.\n", reader.n_read + 1);
+    return -1;
+  }
+
+  point.id = json["id"].get<std::string>();
+  point.payload_x = json["payload"].begin().key();
+  point.payload_y = json["payload"].begin()->get<std::string>();
+
+  reader.n_read++;
+
+  return 1;
+}
+
+void app_export_reader_close(app_export_reader_t *reader)
+{
+  if (NULL == reader)
+  {
+    return;
+  }
+
+  if (NULL != reader->vectors)
+  {
+    fclose(reader->vectors);
+    reader->vectors = NULL;
+  }
+
+  if (NULL != reader->payloads)
+  {
+    fclose(reader->payloads);
+    reader->payloads = NULL;
+  }
+
+  free(reader->line);
+  reader->line = NULL;
+  reader->line_size = 0;
+}
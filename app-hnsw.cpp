@@ -0,0 +1,725 @@
+#include "app-hnsw.h"
+#include "app-normalize.h"
+#include "utils.h"
+#include <algorithm>
+#include <cmath>
+#include <errno.h>
+#include <fcntl.h>
+#include <mutex>
+#include <queue>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/*
+ * Hierarchical navigable small world graph (Malkov & Yashunin). Nodes are
+ * queued by app_hnsw_add, drawing their level up front, so every link list
+ * has a fixed place before the build starts; the build then inserts nodes
+ * on several threads, each link list guarded by one of a set of striped
+ * locks. The finished arrays are written out as they are in memory.
+ */
+
+// striped locks over the link lists of all nodes; a thread holds one at a
+// time, so they can not deadlock
+#define APP_HNSW_LOCKS 4096
+
+#define APP_HNSW_SECTIONS 9
+
+typedef std::pair<float, uint32_t> app_hnsw_pair_t; // distance, node
+
+typedef struct _app_hnsw_visited
+{
+  std::vector<uint32_t> marks;
+  uint32_t epoch;
+} app_hnsw_visited_t;
+
+// per thread, cleared by bumping the epoch instead of the marks
+static app_hnsw_visited_t &app_hnsw_visited(size_t n)
+{
+  thread_local app_hnsw_visited_t visited = {{}, 0};
+
+  if (visited.marks.size() < n)
+  {
+    visited.marks.assign(n, 0);
+    visited.epoch = 0;
+  }
+
+  if (++visited.epoch == 0)
+  {
+    std::fill(visited.marks.begin(), visited.marks.end(), 0);
+    visited.epoch = 1;
+  }
+
+  return visited;
+}
+
+void app_hnsw_default_config(app_hnsw_config_t *config)
+{
+  config->m = APP_HNSW_DEFAULT_M;
+  config->ef_construction = APP_HNSW_DEFAULT_EF_CONSTRUCTION;
+  config->ef_search = APP_HNSW_DEFAULT_EF_SEARCH;
+  config->seed = 42;
+}
+
+bool app_hnsw_init(uint32_t dim, qdrant_distance_type_t distance,
+                   const app_hnsw_config_t &config, app_hnsw_t *index)
+{
+  if (NULL == index)
+  {
+    LOG_ERR("argument 'index' is NULL.\n");
+    return false;
+  }
+
+  if (dim == 0 || config.m < 2 || config.ef_construction == 0)
+  {
+    LOG_ERR("invalid index: %u dims, m %u, ef_construction %u.\n", dim,
+            config.m, config.ef_construction);
+    return false;
+  }
+
+  *index = {};
+  index->dim = dim;
+  index->distance = distance;
+  index->m = config.m;
+  index->m0 = 2 * config.m;
+  index->ef_construction = config.ef_construction;
+  index->ef_search = std::max<uint32_t>(config.ef_search, 1);
+  index->max_level = -1;
+  index->distance_fn = app_distance_get(distance);
+  index->id_offset_data.assign(1, 0);
+  index->payload_offset_data.assign(1, 0);
+  index->rng.seed(config.seed);
+
+  return true;
+}
+
+static inline const float *app_hnsw_vector(const app_hnsw_t &index,
+                                           uint32_t node)
+{
+  return index.vectors + (size_t)node * index.dim;
+}
+
+static inline const uint32_t *app_hnsw_links(const app_hnsw_t &index,
+                                             uint32_t node, int level)
+{
+  if (level == 0)
+  {
+    return index.links0 + (size_t)node * (1 + index.m0);
+  }
+
+  return index.upper + index.upper_offsets[node] +
+         (size_t)(level - 1) * (1 + index.m);
+}
+
+// the storage behind app_hnsw_links, while building
+static inline uint32_t *app_hnsw_links_mut(app_hnsw_t &index, uint32_t node,
+                                           int level)
+{
+  if (level == 0)
+  {
+    return index.link0_data.data() + (size_t)node * (1 + index.m0);
+  }
+
+  return index.upper_data.data() + index.upper_offset_data[node] +
+         (size_t)(level - 1) * (1 + index.m);
+}
+
+// copies the links of a node at a level; under its lock while building
+static inline uint32_t app_hnsw_neighbors(const app_hnsw_t &index,
+                                          uint32_t node, int level,
+                                          std::mutex *locks, uint32_t *out)
+{
+  const uint32_t *list = app_hnsw_links(index, node, level);
+
+  std::unique_lock<std::mutex> lock;
+  if (NULL != locks)
+  {
+    lock = std::unique_lock<std::mutex>(locks[node % APP_HNSW_LOCKS]);
+  }
+
+  const uint32_t n = list[0];
+  memcpy(out, list + 1, n * sizeof(uint32_t));
+
+  return n;
+}
+
+// moves 'node' to the closest point of a level, one hop at a time
+static void app_hnsw_greedy(const app_hnsw_t &index, const float *query,
+                            int level, std::mutex *locks, uint32_t &node,
+                            float &dist)
+{
+  std::vector<uint32_t> buf(index.m0);
+
+  bool changed = true;
+  while (changed)
+  {
+    changed = false;
+
+    const uint32_t n = app_hnsw_neighbors(index, node, level, locks, buf.data());
+    for (uint32_t j = 0; j < n; j++)
+    {
+      const float d =
+          index.distance_fn(query, app_hnsw_vector(index, buf[j]), index.dim);
+      if (d < dist)
+      {
+        dist = d;
+        node = buf[j];
+        changed = true;
+      }
+    }
+  }
+}
+
+// best first search of one level from 'entry', keeping the ef closest
+// points seen; 'out' is sorted, closest first
+static void app_hnsw_search_layer(const app_hnsw_t &index, const float *query,
+                                  uint32_t entry, float entry_dist, size_t ef,
+                                  int level, std::mutex *locks,
+                                  std::vector<app_hnsw_pair_t> &out)
+{
+  app_hnsw_visited_t &visited = app_hnsw_visited(index.n_points);
+  std::vector<uint32_t> buf(index.m0);
+
+  std::priority_queue<app_hnsw_pair_t, std::vector<app_hnsw_pair_t>,
+                      std::greater<app_hnsw_pair_t>>
+      candidates;
+  std::priority_queue<app_hnsw_pair_t> results; // farthest on top
+
+  visited.marks[entry] = visited.epoch;
+  candidates.emplace(entry_dist, entry);
+  results.emplace(entry_dist, entry);
+
+  while (!candidates.empty())
+  {
+    const app_hnsw_pair_t current = candidates.top();
+    if (current.first > results.top().first && results.size() >= ef)
+    {
+      break;
+    }
+    candidates.pop();
+
+    const uint32_t n =
+        app_hnsw_neighbors(index, current.second, level, locks, buf.data());
+    for (uint32_t j = 0; j < n; j++)
+    {
+      const uint32_t next = buf[j];
+      if (j + 1 < n)
+      {
+        __builtin_prefetch(app_hnsw_vector(index, buf[j + 1]));
+      }
+
+      if (visited.marks[next] == visited.epoch)
+      {
+        continue;
+      }
+      visited.marks[next] = visited.epoch;
+
+      const float d =
+          index.distance_fn(query, app_hnsw_vector(index, next), index.dim);
+      if (results.size() < ef || d < results.top().first)
+      {
+        candidates.emplace(d, next);
+        results.emplace(d, next);
+        if (results.size() > ef)
+        {
+          results.pop();
+        }
+      }
+    }
+  }
+
+  out.resize(results.size());
+  for (size_t k = out.size(); k > 0; k--)
+  {
+    out[k - 1] = results.top();
+    results.pop();
+  }
+}
+
+// keeps up to m of the sorted candidates, skipping those closer to an
+// already kept one than to the base: links then spread in every direction
+// instead of piling up in the densest one
+static void app_hnsw_select(const app_hnsw_t &index,
+                            const std::vector<app_hnsw_pair_t> &candidates,
+                            size_t m, std::vector<uint32_t> &out)
+{
+  out.clear();
+
+  if (candidates.size() <= m)
+  {
+    for (const auto &c : candidates)
+    {
+      out.push_back(c.second);
+    }
+    return;
+  }
+
+  for (const auto &c : candidates)
+  {
+    if (out.size() >= m)
+    {
+      break;
+    }
+
+    const float *v = app_hnsw_vector(index, c.second);
+
+    bool diverse = true;
+    for (const uint32_t kept : out)
+    {
+      if (index.distance_fn(v, app_hnsw_vector(index, kept), index.dim) <
+          c.first)
+      {
+        diverse = false;
+        break;
+      }
+    }
+
+    if (diverse)
+    {
+      out.push_back(c.second);
+    }
+  }
+}
+
+static void app_hnsw_insert(app_hnsw_t &index, uint32_t node,
+                            std::mutex *locks, std::mutex &top)
+{
+  const int level = index.levels[node];
+  const float *query = app_hnsw_vector(index, node);
+
+  // a node that raises the top level keeps the entry point locked until it
+  // is linked; that happens about once per m^level nodes
+  std::unique_lock<std::mutex> top_lock(top);
+  const int max_level = index.max_level;
+  uint32_t current = index.entry;
+  if (level <= max_level)
+  {
+    top_lock.unlock();
+  }
+
+  float dist =
+      index.distance_fn(query, app_hnsw_vector(index, current), index.dim);
+
+  for (int l = max_level; l > level; l--)
+  {
+    app_hnsw_greedy(index, query, l, locks, current, dist);
+  }
+
+  std::vector<app_hnsw_pair_t> found;
+  std::vector<app_hnsw_pair_t> pruned;
+  std::vector<uint32_t> selected;
+  std::vector<uint32_t> kept;
+
+  for (int l = std::min(level, max_level); l >= 0; l--)
+  {
+    app_hnsw_search_layer(index, query, current, dist, index.ef_construction,
+                          l, locks, found);
+    app_hnsw_select(index, found, index.m, selected);
+
+    {
+      std::lock_guard<std::mutex> lock(locks[node % APP_HNSW_LOCKS]);
+      uint32_t *list = app_hnsw_links_mut(index, node, l);
+      list[0] = selected.size();
+      memcpy(list + 1, selected.data(), selected.size() * sizeof(uint32_t));
+    }
+
+    // link back, pruning a full list with the same heuristic
+    const size_t cap = l == 0 ? index.m0 : index.m;
+    for (const uint32_t other : selected)
+    {
+      std::lock_guard<std::mutex> lock(locks[other % APP_HNSW_LOCKS]);
+      uint32_t *list = app_hnsw_links_mut(index, other, l);
+
+      if (list[0] < cap)
+      {
+        list[1 + list[0]] = node;
+        list[0]++;
+        continue;
+      }
+
+      const float *base = app_hnsw_vector(index, other);
+      pruned.clear();
+      pruned.emplace_back(index.distance_fn(base, query, index.dim), node);
+      for (uint32_t j = 0; j < list[0]; j++)
+      {
+        pruned.emplace_back(index.distance_fn(base,
+                                              app_hnsw_vector(index, list[1 + j]),
+                                              index.dim),
+                            list[1 + j]);
+      }
+      std::sort(pruned.begin(), pruned.end());
+
+      app_hnsw_select(index, pruned, cap, kept);
+      list[0] = kept.size();
+      memcpy(list + 1, kept.data(), kept.size() * sizeof(uint32_t));
+    }
+
+    current = found[0].second;
+    dist = found[0].first;
+  }
+
+  if (level > max_level)
+  {
+    index.entry = node;
+    index.max_level = level;
+  }
+}
+
+// points the views at the storage of an index being built
+static void app_hnsw_bind(app_hnsw_t &index)
+{
+  index.vectors = index.vector_data.data();
+  index.levels = index.level_data.data();
+  index.links0 = index.link0_data.data();
+  index.upper_offsets = index.upper_offset_data.data();
+  index.upper = index.upper_data.data();
+  index.id_offsets = index.id_offset_data.data();
+  index.ids = index.id_data.data();
+  index.payload_offsets = index.payload_offset_data.data();
+  index.payloads = index.payload_data.data();
+}
+
+bool app_hnsw_add(app_hnsw_t &index, std::string_view id,
+                  std::string_view payload, const float *vector)
+{
+  if (NULL != index.map || index.max_level >= 0)
+  {
+    LOG_ERR("the index is already built.\n");
+    return false;
+  }
+
+  const size_t offset = index.vector_data.size();
+  index.vector_data.resize(offset + index.dim);
+
+  // cosine is a dot product of unit vectors, as qdrant stores them
+  float *dst = index.vector_data.data() + offset;
+  if (index.distance == Cosine)
+  {
+    app_normalize(vector, dst, index.dim, 2); // euclidean
+  }
+  else
+  {
+    memcpy(dst, vector, index.dim * sizeof(float));
+  }
+
+  // level l with probability ~ m^-l
+  std::uniform_real_distribution<double> uniform(0.0, 1.0);
+  const double level = -std::log(1.0 - uniform(index.rng)) / std::log(index.m);
+  index.level_data.push_back(
+      (uint8_t)std::min<double>(level, APP_HNSW_MAX_LEVEL));
+
+  index.id_data.append(id);
+  index.id_offset_data.push_back(index.id_data.size());
+  index.payload_data.append(payload);
+  index.payload_offset_data.push_back(index.payload_data.size());
+
+  index.n_points++;
+
+  return true;
+}
+
+bool app_hnsw_build(app_hnsw_t &index, int n_threads)
+{
+  if (NULL != index.map || index.max_level >= 0)
+  {
+    LOG_ERR("the index is already built.\n");
+    return false;
+  }
+
+  const size_t n = index.n_points;
+
+  index.upper_offset_data.resize(n);
+  index.n_upper = 0;
+  for (size_t k = 0; k < n; k++)
+  {
+    index.upper_offset_data[k] = index.n_upper;
+    index.n_upper += (size_t)index.level_data[k] * (1 + index.m);
+  }
+
+  index.link0_data.assign(n * (1 + index.m0), 0);
+  index.upper_data.assign(index.n_upper, 0);
+  app_hnsw_bind(index);
+
+  if (n == 0)
+  {
+    return true;
+  }
+
+  index.entry = 0;
+  index.max_level = index.levels[0];
+
+  std::vector<std::mutex> locks(APP_HNSW_LOCKS);
+  std::mutex top;
+
+  parallel_for(n - 1, n_threads,
+               [&](size_t begin, size_t end)
+               {
+                 for (size_t k = begin; k < end; k++)
+                 {
+                   app_hnsw_insert(index, k + 1, locks.data(), top);
+                 }
+               });
+
+  return true;
+}
+
+bool app_hnsw_search(const app_hnsw_t &index, const float *query, size_t k,
+                     size_t ef, std::vector<app_hnsw_hit_t> &hits)
+{
+  hits.clear();
+
+  if (index.max_level < 0 || index.n_points == 0 || k == 0)
+  {
+    return index.max_level >= 0 || index.n_points == 0;
+  }
+
+  thread_local std::vector<float> unit;
+  if (index.distance == Cosine)
+  {
+    unit.resize(index.dim);
+    app_normalize(query, unit.data(), index.dim, 2); // euclidean
+    query = unit.data();
+  }
+
+  uint32_t current = index.entry;
+  float dist =
+      index.distance_fn(query, app_hnsw_vector(index, current), index.dim);
+
+  for (int l = index.max_level; l > 0; l--)
+  {
+    app_hnsw_greedy(index, query, l, NULL, current, dist);
+  }
+
+  thread_local std::vector<app_hnsw_pair_t> found;
+  app_hnsw_search_layer(index, query, current, dist,
+                        std::max(k, ef > 0 ? ef : index.ef_search), 0, NULL,
+                        found);
+
+  hits.resize(std::min(k, found.size()));
+  for (size_t r = 0; r < hits.size(); r++)
+  {
+    hits[r].node = found[r].second;
+    hits[r].score = app_distance_score(index.distance, found[r].first);
+  }
+
+  return true;
+}
+
+static size_t app_hnsw_align(size_t offset)
+{
+  return (offset + 63) & ~(size_t)63;
+}
+
+// byte size and offset of every section; offsets[APP_HNSW_SECTIONS] is the
+// file size
+static void app_hnsw_layout(const app_hnsw_header_t &header,
+                            size_t sizes[APP_HNSW_SECTIONS],
+                            size_t offsets[APP_HNSW_SECTIONS + 1])
+{
+  const size_t n = header.n_points;
+
+  sizes[0] = n * header.dim * sizeof(float);
+  sizes[1] = n * sizeof(uint8_t);
+  sizes[2] = n * (1 + 2 * (size_t)header.m) * sizeof(uint32_t);
+  sizes[3] = n * sizeof(uint64_t);
+  sizes[4] = header.n_upper * sizeof(uint32_t);
+  sizes[5] = (n + 1) * sizeof(uint64_t);
+  sizes[6] = header.n_id_bytes;
+  sizes[7] = (n + 1) * sizeof(uint64_t);
+  sizes[8] = header.n_payload_bytes;
+
+  size_t offset = app_hnsw_align(sizeof(header));
+  for (int s = 0; s < APP_HNSW_SECTIONS; s++)
+  {
+    offsets[s] = offset;
+    offset = app_hnsw_align(offset + sizes[s]);
+  }
+  offsets[APP_HNSW_SECTIONS] = offset;
+}
+
+bool app_hnsw_save(const app_hnsw_t &index, const std::string &path)
+{
+  if (NULL == index.id_offsets || (index.max_level < 0 && index.n_points > 0))
+  {
+    LOG_ERR("the index is not built.\n");
+    return false;
+  }
+
+  app_hnsw_header_t header = {};
+  memcpy(header.magic, APP_HNSW_MAGIC, sizeof(header.magic));
+  header.version = APP_HNSW_VERSION;
+  header.dim = index.dim;
+  header.distance = index.distance;
+  header.m = index.m;
+  header.ef_construction = index.ef_construction;
+  header.ef_search = index.ef_search;
+  header.entry = index.entry;
+  header.max_level = index.max_level;
+  header.n_points = index.n_points;
+  header.n_upper = index.n_upper;
+  header.n_id_bytes = index.n_points > 0 ? index.id_offsets[index.n_points] : 0;
+  header.n_payload_bytes =
+      index.n_points > 0 ? index.payload_offsets[index.n_points] : 0;
+
+  size_t sizes[APP_HNSW_SECTIONS];
+  size_t offsets[APP_HNSW_SECTIONS + 1];
+  app_hnsw_layout(header, sizes, offsets);
+
+  const void *sections[APP_HNSW_SECTIONS] = {
+      index.vectors,       index.levels, index.links0,
+      index.upper_offsets, index.upper,  index.id_offsets,
+      index.ids,           index.payload_offsets, index.payloads,
+  };
+
+  const std::string tmp = path + ".tmp";
+  FILE *file = fopen(tmp.c_str(), "wb");
+  if (NULL == file)
+  {
+    LOG_ERR("could not create '%s': %s.\n", tmp.c_str(), strerror(errno));
+    return false;
+  }
+
+  // large sequential writes; the sections are already laid out
+  std::vector<char> buffer(1 << 20);
+  setvbuf(file, buffer.data(), _IOFBF, buffer.size());
+
+  static const char zeros[64] = {};
+
+  // sections go out back to back, each padded up to the next one
+  bool written = fwrite(&header, sizeof(header), 1, file) == 1;
+  size_t at = sizeof(header);
+  for (int s = 0; s <= APP_HNSW_SECTIONS && written; s++)
+  {
+    const size_t pad = offsets[s] - at;
+    written = pad == 0 || fwrite(zeros, 1, pad, file) == pad;
+
+    if (s < APP_HNSW_SECTIONS && sizes[s] > 0)
+    {
+      written = written && fwrite(sections[s], 1, sizes[s], file) == sizes[s];
+    }
+    at = offsets[s] + (s < APP_HNSW_SECTIONS ? sizes[s] : 0);
+  }
+  written = fflush(file) == 0 && fsync(fileno(file)) == 0 && written;
+  written = fclose(file) == 0 && written;
+
+  if (!written || rename(tmp.c_str(), path.c_str()) != 0)
+  {
+    LOG_ERR("could not write '%s': %s.\n", path.c_str(), strerror(errno));
+    remove(tmp.c_str());
+    return false;
+  }
+
+  return true;
+}
+
+bool app_hnsw_load(const std::string &path, app_hnsw_t *index)
+{
+  if (NULL == index)
+  {
+    LOG_ERR("argument 'index' is NULL.\n");
+    return false;
+  }
+
+  *index = {};
+
+  const int fd = open(path.c_str(), O_RDONLY);
+  if (fd < 0)
+  {
+    LOG_ERR("could not open '%s': %s.\n", path.c_str(), strerror(errno));
+    return false;
+  }
+
+  struct stat st;
+  app_hnsw_header_t header;
+  if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(header) ||
+      pread(fd, &header, sizeof(header), 0) != (ssize_t)sizeof(header) ||
+      memcmp(header.magic, APP_HNSW_MAGIC, sizeof(header.magic)) != 0 ||
+      header.version != APP_HNSW_VERSION || header.dim == 0 || header.m < 2 ||
+      (header.n_points > 0 && header.entry >= header.n_points))
+  {
+    LOG_ERR("'%s' is not an HNSW index.\n", path.c_str());
+    close(fd);
+    return false;
+  }
+
+  size_t sizes[APP_HNSW_SECTIONS];
+  size_t offsets[APP_HNSW_SECTIONS + 1];
+  app_hnsw_layout(header, sizes, offsets);
+
+  if ((size_t)st.st_size != offsets[APP_HNSW_SECTIONS])
+  {
+    LOG_ERR("HNSW index '%s' is truncated.\n", path.c_str());
+    close(fd);
+    return false;
+  }
+
+  void *map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+
+  if (MAP_FAILED == map)
+  {
+    LOG_ERR("mmap of '%s' failed: %s.\n", path.c_str(), strerror(errno));
+    return false;
+  }
+
+  // searches jump all over the graph
+  madvise(map, st.st_size, MADV_RANDOM);
+
+  const char *base = (const char *)map;
+
+  index->map = map;
+  index->map_size = st.st_size;
+  index->dim = header.dim;
+  index->distance = (qdrant_distance_type_t)header.distance;
+  index->m = header.m;
+  index->m0 = 2 * header.m;
+  index->ef_construction = header.ef_construction;
+  index->ef_search = header.ef_search;
+  index->entry = header.entry;
+  index->max_level = header.max_level;
+  index->n_points = header.n_points;
+  index->n_upper = header.n_upper;
+  index->distance_fn = app_distance_get(index->distance);
+
+  index->vectors = (const float *)(base + offsets[0]);
+  index->levels = (const uint8_t *)(base + offsets[1]);
+  index->links0 = (const uint32_t *)(base + offsets[2]);
+  index->upper_offsets = (const uint64_t *)(base + offsets[3]);
+  index->upper = (const uint32_t *)(base + offsets[4]);
+  index->id_offsets = (const uint64_t *)(base + offsets[5]);
+  index->ids = base + offsets[6];
+  index->payload_offsets = (const uint64_t *)(base + offsets[7]);
+  index->payloads = base + offsets[8];
+
+  return true;
+}
+
+void app_hnsw_destroy(app_hnsw_t *index)
+{
+  if (NULL == index)
+  {
+    return;
+  }
+
+  if (NULL != index->map)
+  {
+    munmap(index->map, index->map_size);
+  }
+
+  *index = {};
+  index->max_level = -1;
+}
+
+std::string_view app_hnsw_id(const app_hnsw_t &index, uint32_t node)
+{
+  return std::string_view(index.ids + index.id_offsets[node],
+                          index.id_offsets[node + 1] - index.id_offsets[node]);
+}
+
+std::string_view app_hnsw_payload(const app_hnsw_t &index, uint32_t node)
+{
+  return std::string_view(index.payloads + index.payload_offsets[node],
+                          index.payload_offsets[node + 1] -
+                              index.payload_offsets[node]);
+}
@@ -0,0 +1,583 @@
+#include "app-ingest.h"
+#include "app-manifest.h"
+#include "app-metrics.h"
+#include "app-queue.h"
+#include "app-sink.h"
+#include "app-source.h"
+#include "utils.h"
+#include <atomic>
+#include <chrono>
+#include <thread>
+
+/*
+ * Ingestion runs as three stages connected by bounded queues:
+ *
+ *   reader/tokenizer --> decode (llama) --> upload (sink)
+ *
+ * so chunk N+1 is decoded while chunk N is serialized and uploaded. Chunks
+ * come from a fixed pool and go back to it once uploaded: a slow stage
+ * stalls the ones before it instead of letting memory grow.
+ */
+
+typedef struct _app_ingest_batch
+{
+  app_source_chunk_t chunk;
+  llama_input_vector_t inputs;
+  std::vector<float> embeddings;
+  std::vector<std::string> ids; // point id of every record
+  int n_prompts;
+} app_ingest_batch_t;
+
+// root of all content/position ids: uuid5(NAMESPACE_URL,
+// "https://github.com/lapuglisi/embed2vecdb")
+static const uuid_t app_ingest_namespace = {0x13, 0xc9, 0x57, 0x5c, 0xc9, 0xfe,
+                                            0x56, 0x92, 0x85, 0x8d, 0xb7, 0x26,
+                                            0x38, 0x41, 0x09, 0xb0};
+
+bool app_ingest_parse_id_mode(const std::string &name, app_id_mode_t *mode)
+{
+  if (name == "random")
+  {
+    *mode = RandomId;
+  }
+  else if (name == "content")
+  {
+    *mode = ContentId;
+  }
+  else if (name == "position")
+  {
+    *mode = PositionId;
+  }
+  else
+  {
+    LOG_ERR("unknown id mode '%s' (random, content or position).\n",
+            name.c_str());
+    return false;
+  }
+
+  return true;
+}
+
+static void app_ingest_make_ids(app_id_mode_t mode, const uuid_t source_ns,
+                                app_ingest_batch_t &batch)
+{
+  const std::vector<std::string_view> &records = batch.chunk.records;
+
+  batch.ids.resize(records.size());
+  for (size_t k = 0; k < records.size(); k++)
+  {
+    switch (mode)
+    {
+    case ContentId:
+      batch.ids[k] = generate_uuid_v5(source_ns, records[k]);
+      break;
+    case PositionId:
+      batch.ids[k] = generate_uuid_v5(
+          source_ns, std::to_string(batch.chunk.first_record + k));
+      break;
+    default:
+      batch.ids[k] = generate_uuid();
+      break;
+    }
+  }
+}
+
+static double app_ingest_seconds_since(
+    const std::chrono::steady_clock::time_point &t0)
+{
+  return std::chrono::duration<double>(std::chrono::steady_clock::now() - t0)
+      .count();
+}
+
+// keeps the records (and their ids) flagged in 'keep', in order; returns
+// how many were dropped
+static size_t app_ingest_filter(app_ingest_batch_t &batch,
+                                const std::vector<bool> &keep)
+{
+  std::vector<std::string_view> &records = batch.chunk.records;
+
+  size_t n_kept = 0;
+  for (size_t k = 0; k < records.size(); k++)
+  {
+    if (keep[k])
+    {
+      records[n_kept] = records[k];
+      batch.ids[n_kept].swap(batch.ids[k]);
+      n_kept++;
+    }
+  }
+
+  const size_t n_dropped = records.size() - n_kept;
+  records.resize(n_kept);
+  batch.ids.resize(n_kept);
+
+  return n_dropped;
+}
+
+// drops the records whose point is already stored
+static bool app_ingest_skip_existing(const qdrant_info_t &info,
+                                     const qdrant_colection_info_t &col,
+                                     app_ingest_batch_t &batch,
+                                     size_t *n_skipped)
+{
+  std::vector<bool> found;
+  if (!qdrant_points_exist(info, col, batch.ids, found))
+  {
+    return false;
+  }
+
+  found.flip();
+  *n_skipped += app_ingest_filter(batch, found);
+
+  return true;
+}
+
+// drops the records the previous run stored unchanged, and records the
+// others in the manifest
+static bool app_ingest_skip_unchanged(app_manifest_t &manifest,
+                                      app_id_mode_t mode,
+                                      const app_cache_key_t &salt,
+                                      app_ingest_batch_t &batch,
+                                      size_t *n_unchanged)
+{
+  const std::vector<std::string_view> &records = batch.chunk.records;
+  static const std::string any_id;
+
+  std::vector<bool> changed(records.size());
+  for (size_t k = 0; k < records.size(); k++)
+  {
+    const app_cache_key_t hash =
+        app_cache_hash(records[k].data(), records[k].length(), salt);
+
+    // random ids are not reproducible, the content alone has to match
+    if (app_manifest_claim(manifest, hash,
+                           mode == RandomId ? any_id : batch.ids[k]))
+    {
+      continue;
+    }
+
+    if (!app_manifest_add(manifest, hash, batch.ids[k]))
+    {
+      return false;
+    }
+
+    changed[k] = true;
+  }
+
+  *n_unchanged += app_ingest_filter(batch, changed);
+
+  return true;
+}
+
+// deletes the points of records no longer in the source, then stores the
+// manifest of this run
+static bool app_ingest_commit_manifest(const qdrant_info_t &info,
+                                       const qdrant_colection_info_t &col,
+                                       const app_manifest_t &manifest,
+                                       app_ingest_stats_t *stats)
+{
+  std::vector<std::string> removed;
+  app_manifest_removed(manifest, removed);
+
+  if (!removed.empty())
+  {
+    const auto t0 = std::chrono::steady_clock::now();
+    const bool deleted = qdrant_points_delete(info, col, removed);
+    stats->t_delete = app_ingest_seconds_since(t0);
+
+    if (!deleted)
+    {
+      LOG_ERR("could not delete %zu points of removed records.\n",
+              removed.size());
+      return false;
+    }
+
+    stats->n_deleted = removed.size();
+  }
+
+  return app_manifest_save(manifest);
+}
+
+bool app_ingest_run(const app_llama_args_t &args, const app_llama_data_t &data,
+                    const qdrant_info_t &info,
+                    const qdrant_colection_info_t &col,
+                    app_ingest_stats_t *stats)
+{
+  if (NULL == stats)
+  {
+    LOG_ERR("argument 'stats' is NULL.\n");
+    return false;
+  }
+
+  *stats = {};
+
+  if (llama_pooling_type(data.ctx) == LLAMA_POOLING_TYPE_NONE)
+  {
+    LOG_ERR("pooling type NONE yields per-token embeddings, which can not be "
+            "stored as points.\n");
+    return false;
+  }
+
+  app_source_t src;
+  if (!app_source_open(args.source, &src))
+  {
+    return false;
+  }
+
+  const auto t_start = std::chrono::steady_clock::now();
+  const int n_embd = data.n_embd_out;
+  const size_t depth = args.queue_depth;
+
+  // every queue full, plus one chunk in each stage
+  std::vector<app_ingest_batch_t> pool(2 * depth + 3);
+
+  app_queue<app_ingest_batch_t *> q_free(pool.size());
+  app_queue<app_ingest_batch_t *> q_decode(depth);
+  app_queue<app_ingest_batch_t *> q_upload(depth);
+
+  for (auto &batch : pool)
+  {
+    q_free.push(&batch);
+  }
+
+  std::atomic<bool> failed(false);
+  auto fail = [&]()
+  {
+    failed = true;
+    q_free.close();
+    q_decode.close();
+    q_upload.close();
+  };
+
+  app_id_mode_t id_mode = RandomId;
+  app_ingest_parse_id_mode(args.id_mode, &id_mode);
+
+  uuid_t source_ns;
+  uuid_generate_sha1(source_ns, app_ingest_namespace, args.source_id.data(),
+                     args.source_id.length());
+
+  app_manifest_t manifest;
+  const bool use_manifest = !args.manifest_path.empty();
+  if (use_manifest)
+  {
+    if (!app_manifest_load(args.manifest_path, args.source_id, col.name,
+                           &manifest))
+    {
+      app_source_close(&src);
+      return false;
+    }
+
+    // a recreated collection holds none of the previous points
+    if (args.recreate)
+    {
+      manifest.previous.clear();
+      manifest.claimed.clear();
+    }
+  }
+
+  // runs on the uploader thread, from within app_sink_add, app_sink_poll and
+  // app_sink_finish
+  app_sink_t sink;
+  const bool sink_ready = app_sink_open(
+      args, info, col,
+      [&](const qdrant_async_result_t &result, size_t n_points)
+      {
+        stats->n_requests += 1;
+        stats->t_request += result.seconds;
+
+        if (!result.success)
+        {
+          LOG_ERR("upsert of %zu points failed.\n", n_points);
+          fail();
+          return;
+        }
+
+        stats->n_records += n_points;
+      },
+      &sink);
+  if (!sink_ready)
+  {
+    app_source_close(&src);
+    return false;
+  }
+
+  LOG("ingesting '%s' (%s, queue depth %d) into %s %s.\n",
+      args.source.c_str(), src.mapped ? "mmap" : "streamed", args.queue_depth,
+      app_sink_name(sink.type), sink.target.c_str());
+
+  // stage 1: read, name and tokenize
+  std::thread reader(
+      [&]()
+      {
+        app_ingest_batch_t *batch;
+        while (!failed && q_free.pop(batch))
+        {
+          const auto t0 = std::chrono::steady_clock::now();
+
+          if (app_source_read(src, data.embd_sep, args.chunk_size,
+                              batch->chunk) == 0)
+          {
+            break;
+          }
+
+          app_metrics_add(MetricRecords, batch->chunk.records.size());
+
+          app_ingest_make_ids(id_mode, source_ns, *batch);
+
+          if (use_manifest &&
+              !app_ingest_skip_unchanged(manifest, id_mode, data.embd_salt,
+                                         *batch, &stats->n_unchanged))
+          {
+            fail();
+            break;
+          }
+
+          // existing points are dropped before they cost a decode
+          if (args.skip_existing)
+          {
+            const auto t1 = std::chrono::steady_clock::now();
+            const bool checked =
+                app_ingest_skip_existing(info, col, *batch, &stats->n_skipped);
+            const double t_check = app_ingest_seconds_since(t1);
+
+            stats->t_check += t_check;
+            stats->t_tokenize -= t_check;
+
+            if (!checked)
+            {
+              LOG_ERR("could not check records starting at %zu.\n",
+                      batch->chunk.first_record);
+              fail();
+              break;
+            }
+          }
+
+          batch->inputs.clear();
+          batch->n_prompts = 0;
+          if (!batch->chunk.records.empty())
+          {
+            batch->n_prompts =
+                app_llm_tokenize(data, batch->chunk.records, batch->inputs);
+          }
+
+          stats->t_tokenize += app_ingest_seconds_since(t0);
+
+          // an empty chunk still goes through, to release its pages
+          if (batch->n_prompts < 0 ||
+              (batch->n_prompts == 0 && !batch->chunk.records.empty()))
+          {
+            LOG_ERR("could not tokenize records starting at %zu.\n",
+                    batch->chunk.first_record);
+            fail();
+            break;
+          }
+
+          if (!q_decode.push(batch))
+          {
+            break;
+          }
+
+          app_metrics_set(MetricDecodeQueue, q_decode.size());
+        }
+
+        q_decode.close();
+      });
+
+  // stage 3: build points and feed the sink; the Qdrant one keeps up to
+  // 'window' requests in flight
+  std::thread uploader(
+      [&]()
+      {
+        qdrant_point_spec_t point;
+        point.payload_x = "text";
+
+        while (true)
+        {
+          // wake up in time to flush a partial request that is due and to
+          // keep requests in flight moving
+          app_ingest_batch_t *batch;
+          const long wait_ms = app_sink_wait_ms(sink);
+          const bool popped =
+              wait_ms < 0
+                  ? q_upload.pop(batch)
+                  : q_upload.pop_for(batch, std::chrono::milliseconds(wait_ms));
+
+          app_metrics_set(MetricUploadQueue, q_upload.size());
+
+          if (!popped)
+          {
+            if (q_upload.drained())
+            {
+              break;
+            }
+
+            app_sink_poll(sink);
+            continue;
+          }
+
+          if (failed)
+          {
+            continue;
+          }
+
+          const auto t0 = std::chrono::steady_clock::now();
+
+          for (int k = 0; k < batch->n_prompts && !failed; k++)
+          {
+            const float *embd = batch->embeddings.data() + (size_t)k * n_embd;
+
+            point.id.swap(batch->ids[k]);
+            point.payload_y.assign(batch->chunk.records[k]);
+            point.vector.assign(embd, embd + n_embd);
+
+            if (!app_sink_add(sink, point))
+            {
+              fail();
+            }
+          }
+
+          if (!failed)
+          {
+            app_sink_poll(sink);
+          }
+
+          stats->t_upload += app_ingest_seconds_since(t0);
+
+          // every sink keeps its own copy of the records, so the chunk and
+          // its source pages can be reused right away
+          app_source_release(src, batch->chunk.end_offset);
+
+          q_free.push(batch);
+        }
+
+        if (!failed && !app_sink_finish(sink))
+        {
+          fail();
+        }
+      });
+
+  // stage 2: decode, on the calling thread which owns the llama context
+  app_ingest_batch_t *batch;
+  while (q_decode.pop(batch))
+  {
+    app_metrics_set(MetricDecodeQueue, q_decode.size());
+
+    if (failed)
+    {
+      continue;
+    }
+
+    const auto t0 = std::chrono::steady_clock::now();
+
+    const bool decoded = app_llm_get_embeddings(
+        data, batch->n_prompts, batch->inputs, batch->embeddings, &stats->llama);
+
+    stats->t_decode += app_ingest_seconds_since(t0);
+
+    if (!decoded)
+    {
+      LOG_ERR("could not get embeddings for records starting at %zu.\n",
+              batch->chunk.first_record);
+      fail();
+      continue;
+    }
+
+    if (!q_upload.push(batch))
+    {
+      break;
+    }
+
+    app_metrics_set(MetricUploadQueue, q_upload.size());
+  }
+
+  q_upload.close();
+
+  reader.join();
+  uploader.join();
+
+  // only a complete run may drop points: a failed one did not see every record
+  if (use_manifest && !failed &&
+      !app_ingest_commit_manifest(info, col, manifest, stats))
+  {
+    failed = true;
+  }
+
+  stats->sink = std::string(app_sink_name(sink.type)) + " " + sink.target;
+  stats->t_finish = sink.t_finish;
+  if (sink.type == SinkQdrant)
+  {
+    stats->n_retries = sink.async.n_retried;
+    stats->n_bytes = sink.batcher.n_bytes;
+    stats->n_wire_bytes = sink.batcher.n_wire_bytes;
+    stats->n_compressed = sink.batcher.n_compressed;
+    stats->t_compress = sink.batcher.t_compress;
+  }
+  else if (!failed)
+  {
+    // local sinks hold every point once finished
+    stats->n_records = sink.n_points;
+  }
+
+  stats->t_wall = app_ingest_seconds_since(t_start);
+
+  LOG("ingested %zu records from '%s'.\n", stats->n_records,
+      args.source.c_str());
+
+  app_sink_close(&sink);
+  app_source_close(&src);
+
+  return !failed;
+}
+
+void app_ingest_print_stats(const app_ingest_stats_t &stats)
+{
+  const app_llama_stats_t &llama = stats.llama;
+  const double fill =
+      llama.n_capacity > 0 ? 100.0 * llama.n_tokens / llama.n_capacity : 0.0;
+
+  LOG("records ....... %zu\n", stats.n_records);
+  LOG("tokens ........ %llu\n", (unsigned long long)llama.n_tokens);
+  LOG("decode calls .. %llu\n", (unsigned long long)llama.n_decode);
+  LOG("batch fill .... %.1f%%\n", fill);
+  if (llama.n_cached + llama.n_uncached > 0)
+  {
+    LOG("cache ......... %llu hits, %llu misses (%.1f%% hit)\n",
+        (unsigned long long)llama.n_cached,
+        (unsigned long long)llama.n_uncached,
+        100.0 * llama.n_cached / (llama.n_cached + llama.n_uncached));
+  }
+  LOG("repeated ...... %llu prompts\n", (unsigned long long)llama.n_repeated);
+  if (stats.n_skipped > 0 || stats.t_check > 0.0)
+  {
+    LOG("skipped ....... %zu existing (checked in %.3f s)\n", stats.n_skipped,
+        stats.t_check);
+  }
+  if (stats.n_unchanged > 0 || stats.n_deleted > 0)
+  {
+    LOG("manifest ...... %zu unchanged, %zu deleted (in %.3f s)\n",
+        stats.n_unchanged, stats.n_deleted, stats.t_delete);
+  }
+  LOG("tokenize ...... %.3f s\n", stats.t_tokenize);
+  LOG("decode ........ %.3f s\n", stats.t_decode);
+  LOG("upload ........ %.3f s\n", stats.t_upload);
+  LOG("sink .......... %s, finished in %.3f s\n", stats.sink.c_str(),
+      stats.t_finish);
+  if (stats.n_requests == 0)
+  {
+    LOG("wall .......... %.3f s\n", stats.t_wall);
+    return;
+  }
+  LOG("requests ...... %llu (%llu retries, %.1f ms avg)\n",
+      (unsigned long long)stats.n_requests,
+      (unsigned long long)stats.n_retries,
+      stats.n_requests > 0 ? 1000.0 * stats.t_request / stats.n_requests
+                           : 0.0);
+  LOG("upsert size ... %.1f points, %.1f KiB avg\n",
+      stats.n_requests > 0 ? (double)stats.n_records / stats.n_requests : 0.0,
+      stats.n_requests > 0 ? stats.n_bytes / 1024.0 / stats.n_requests : 0.0);
+  LOG("on the wire ... %.1f of %.1f MiB (%.1f%%), %llu compressed in %.3f s\n",
+      stats.n_wire_bytes / 1048576.0, stats.n_bytes / 1048576.0,
+      stats.n_bytes > 0 ? 100.0 * stats.n_wire_bytes / stats.n_bytes : 0.0,
+      (unsigned long long)stats.n_compressed, stats.t_compress);
+  LOG("wall .......... %.3f s\n", stats.t_wall);
+}
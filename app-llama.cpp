@@ -1,11 +1,28 @@
 #include "app-llama.h"
+#include "app-hnsw.h"
+#include "app-ingest.h"
+#include "app-metrics.h"
+#include "app-server.h"
+#include "app-source.h"
 #include "llama-utils.h"
 #include "llama.h"
+#include "qdrant-async.h"
+#include "qdrant-batch.h"
 #include "qdrant.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
 #include <cstdint>
+#include <deque>
+#include <limits>
+#include <mutex>
+#include <set>
+#include <thread>
+#include <unordered_map>
 #include <math.h>
 #include <string.h>
 #include <sys/sysinfo.h>
+#include <unistd.h>
 
 #define APPARGS_PARSE(_idx, _max, _array, _test, _target) \
   if (strcmp(_array[_idx], _test) == 0)                   \
@@ -30,9 +47,56 @@ bool app_parse_args(int argc, char **argv, app_llama_args_t *args)
 	args->ubatch_size = 512;
 	args->ctx_size = 0; // Use model's
 	args->threads = 0;
+	args->n_parallel = 0; // as many as supported
+	args->tok_threads = 0; // same as --threads
+	args->n_contexts = 1;
+	args->context_threads = 0; // --threads over --contexts
+	args->bucketing = true;
 	args->verbose = false;
 	args->n_gpu_layers = 0;
+	args->chunk_size = APP_SOURCE_CHUNK_RECORDS;
+	args->queue_depth = APP_INGEST_QUEUE_DEPTH;
+	args->embd_sep.assign("\n");
+	args->cache_path.clear();
+	args->manifest_path.clear();
+	args->source_id.clear();
+	args->id_mode.assign("random");
+	args->skip_existing = false;
+	args->recreate = false;
 	args->qdrant_uri.assign(QDRANT_DEFAULT_URI);
+	args->qdrant_inflight = QDRANT_ASYNC_DEFAULT_WINDOW;
+	args->qdrant_retries = QDRANT_ASYNC_DEFAULT_RETRIES;
+	args->qdrant_http2 = false;
+	args->qdrant_batch_points = QDRANT_MAX_BATCH_POINTS;
+	args->qdrant_batch_kb = QDRANT_MAX_BODY_BYTES / 1024;
+	args->qdrant_batch_ms = QDRANT_BATCH_DEFAULT_LATENCY_MS;
+	args->qdrant_compress.assign("none");
+	args->qdrant_compress_level = QDRANT_COMPRESS_DEFAULT_LEVEL;
+	args->qdrant_compress_auto = true;
+	args->qdrant_link_mbps = 0;
+	args->quantize.assign("none");
+	args->quantize_range = 0.0f;
+	args->reduce.assign("none");
+	args->query.clear();
+	args->query_filter.clear();
+	args->query_batch = 1;
+	args->top_k = QDRANT_SEARCH_DEFAULT_LIMIT;
+	args->query_payload = true;
+	args->hnsw_path.clear();
+	args->hnsw_m = APP_HNSW_DEFAULT_M;
+	args->hnsw_ef_construction = APP_HNSW_DEFAULT_EF_CONSTRUCTION;
+	args->hnsw_ef = APP_HNSW_DEFAULT_EF_SEARCH;
+	args->export_path.clear();
+	args->replay_path.clear();
+	args->reduce_dim = 0;
+	args->pca_path.clear();
+	args->pca_samples = APP_REDUCE_PCA_SAMPLES;
+	args->serve.clear();
+	args->serve_wait_ms = APP_SERVER_DEFAULT_WAIT_MS;
+	args->serve_batch = APP_SERVER_DEFAULT_BATCH;
+	args->metrics_listen.clear();
+	args->metrics_path.clear();
+	args->metrics_interval = APP_METRICS_DEFAULT_INTERVAL_S;
 
   for (int i = 1; i < argc; i++)
   {
@@ -43,11 +107,76 @@ bool app_parse_args(int argc, char **argv, app_llama_args_t *args)
 		else APPARGS_PARSE(i, argc, argv, "--n_batch", args->batch_size = std::stoi)
 		else APPARGS_PARSE(i, argc, argv, "--n_ubatch", args->ubatch_size = std::stoi)
 		else APPARGS_PARSE(i, argc, argv, "--threads", args->threads = std::stoi)
+		else APPARGS_PARSE(i, argc, argv, "--parallel", args->n_parallel = std::stoi)
+		else APPARGS_PARSE(i, argc, argv, "--tok-threads", args->tok_threads = std::stoi)
+		else APPARGS_PARSE(i, argc, argv, "--contexts", args->n_contexts = std::stoi)
+		else APPARGS_PARSE(i, argc, argv, "--context-threads", args->context_threads = std::stoi)
 		else APPARGS_PARSE(i, argc, argv, "--qdrant", args->qdrant_uri.assign)
+		else APPARGS_PARSE(i, argc, argv, "--qdrant-inflight", args->qdrant_inflight = std::stoi)
+		else APPARGS_PARSE(i, argc, argv, "--qdrant-retries", args->qdrant_retries = std::stoi)
+		else APPARGS_PARSE(i, argc, argv, "--qdrant-batch-points", args->qdrant_batch_points = std::stoi)
+		else APPARGS_PARSE(i, argc, argv, "--qdrant-batch-kb", args->qdrant_batch_kb = std::stoi)
+		else APPARGS_PARSE(i, argc, argv, "--qdrant-batch-ms", args->qdrant_batch_ms = std::stoi)
+		else APPARGS_PARSE(i, argc, argv, "--qdrant-compress", args->qdrant_compress.assign)
+		else APPARGS_PARSE(i, argc, argv, "--qdrant-compress-level", args->qdrant_compress_level = std::stoi)
+		else APPARGS_PARSE(i, argc, argv, "--qdrant-link-mbps", args->qdrant_link_mbps = std::stoi)
+		else APPARGS_PARSE(i, argc, argv, "--quantize", args->quantize.assign)
+		else APPARGS_PARSE(i, argc, argv, "--quantize-range", args->quantize_range = std::stof)
+		else APPARGS_PARSE(i, argc, argv, "--query", args->query.assign)
+		else APPARGS_PARSE(i, argc, argv, "--query-filter", args->query_filter.assign)
+		else APPARGS_PARSE(i, argc, argv, "--query-batch", args->query_batch = std::stoi)
+		else APPARGS_PARSE(i, argc, argv, "--top-k", args->top_k = std::stoi)
+		else APPARGS_PARSE(i, argc, argv, "--hnsw", args->hnsw_path.assign)
+		else APPARGS_PARSE(i, argc, argv, "--hnsw-m", args->hnsw_m = std::stoi)
+		else APPARGS_PARSE(i, argc, argv, "--hnsw-ef-construction", args->hnsw_ef_construction = std::stoi)
+		else APPARGS_PARSE(i, argc, argv, "--hnsw-ef", args->hnsw_ef = std::stoi)
+		else APPARGS_PARSE(i, argc, argv, "--export", args->export_path.assign)
+		else APPARGS_PARSE(i, argc, argv, "--replay", args->replay_path.assign)
+		else APPARGS_PARSE(i, argc, argv, "--reduce", args->reduce.assign)
+		else APPARGS_PARSE(i, argc, argv, "--reduce-dim", args->reduce_dim = std::stoi)
+		else APPARGS_PARSE(i, argc, argv, "--pca-file", args->pca_path.assign)
+		else APPARGS_PARSE(i, argc, argv, "--pca-samples", args->pca_samples = std::stoi)
+		else APPARGS_PARSE(i, argc, argv, "--chunk", args->chunk_size = std::stoi)
+		else APPARGS_PARSE(i, argc, argv, "--queue-depth", args->queue_depth = std::stoi)
+		else APPARGS_PARSE(i, argc, argv, "--embd-separator", args->embd_sep.assign)
+		else APPARGS_PARSE(i, argc, argv, "--cache", args->cache_path.assign)
+		else APPARGS_PARSE(i, argc, argv, "--manifest", args->manifest_path.assign)
+		else APPARGS_PARSE(i, argc, argv, "--source-id", args->source_id.assign)
+		else APPARGS_PARSE(i, argc, argv, "--id-mode", args->id_mode.assign)
+		else APPARGS_PARSE(i, argc, argv, "--serve", args->serve.assign)
+		else APPARGS_PARSE(i, argc, argv, "--serve-wait-ms", args->serve_wait_ms = std::stoi)
+		else APPARGS_PARSE(i, argc, argv, "--serve-batch", args->serve_batch = std::stoi)
+		else APPARGS_PARSE(i, argc, argv, "--metrics", args->metrics_listen.assign)
+		else APPARGS_PARSE(i, argc, argv, "--metrics-file", args->metrics_path.assign)
+		else APPARGS_PARSE(i, argc, argv, "--metrics-interval", args->metrics_interval = std::stoi)
 		else if (strcmp(argv[i], "--verbose") == 0)
 		{
 			args->verbose = true;
 		}
+		else if (strcmp(argv[i], "--no-bucketing") == 0)
+		{
+			args->bucketing = false;
+		}
+		else if (strcmp(argv[i], "--qdrant-http2") == 0)
+		{
+			args->qdrant_http2 = true;
+		}
+		else if (strcmp(argv[i], "--qdrant-compress-always") == 0)
+		{
+			args->qdrant_compress_auto = false;
+		}
+		else if (strcmp(argv[i], "--skip-existing") == 0)
+		{
+			args->skip_existing = true;
+		}
+		else if (strcmp(argv[i], "--recreate") == 0)
+		{
+			args->recreate = true;
+		}
+		else if (strcmp(argv[i], "--query-no-payload") == 0)
+		{
+			args->query_payload = false;
+		}
   }
 	if (args->threads == 0)
 	{
@@ -55,7 +184,198 @@ bool app_parse_args(int argc, char **argv, app_llama_args_t *args)
 		LOG("params 'threads' not defined, using %d (nproc / 2)\n", args->threads);
 	}
 
-	if (args->model.length() == 0)
+	if (args->tok_threads <= 0)
+	{
+		args->tok_threads = args->threads;
+	}
+
+	if (args->n_contexts <= 0)
+	{
+		LOG_ERR("param --contexts must be greater than zero.\n");
+		return false;
+	}
+
+	if (args->context_threads <= 0)
+	{
+		args->context_threads = std::max(1, args->threads / args->n_contexts);
+	}
+
+	// every context needs batches of its own out of each chunk
+	if (args->n_contexts > 1 && args->chunk_size == APP_SOURCE_CHUNK_RECORDS)
+	{
+		args->chunk_size = APP_SOURCE_CHUNK_RECORDS * args->n_contexts;
+		LOG("info: %d contexts, setting chunk size to %d\n", args->n_contexts, args->chunk_size);
+	}
+
+	if (args->chunk_size <= 0)
+	{
+		LOG_ERR("param --chunk must be greater than zero.\n");
+		return false;
+	}
+
+	if (args->queue_depth <= 0)
+	{
+		LOG_ERR("param --queue-depth must be greater than zero.\n");
+		return false;
+	}
+
+	if (args->qdrant_inflight <= 0)
+	{
+		LOG_ERR("param --qdrant-inflight must be greater than zero.\n");
+		return false;
+	}
+
+	if (args->qdrant_batch_points <= 0 || args->qdrant_batch_kb <= 0)
+	{
+		LOG_ERR("params --qdrant-batch-points and --qdrant-batch-kb must be greater than zero.\n");
+		return false;
+	}
+
+	if (args->qdrant_batch_ms < 0)
+	{
+		LOG_ERR("param --qdrant-batch-ms can not be negative.\n");
+		return false;
+	}
+
+	qdrant_encoding_t encoding;
+	if (!qdrant_parse_encoding(args->qdrant_compress, &encoding))
+	{
+		return false;
+	}
+
+	if (args->qdrant_compress_level < 1 || args->qdrant_compress_level > 9)
+	{
+		LOG_ERR("param --qdrant-compress-level must be between 1 and 9.\n");
+		return false;
+	}
+
+	if (args->qdrant_link_mbps < 0)
+	{
+		LOG_ERR("param --qdrant-link-mbps can not be negative.\n");
+		return false;
+	}
+
+	qdrant_quantization_t quantization;
+	if (!qdrant_parse_quantization(args->quantize, &quantization))
+	{
+		return false;
+	}
+
+	if (!(args->quantize_range >= 0.0f))
+	{
+		LOG_ERR("param --quantize-range can not be negative.\n");
+		return false;
+	}
+
+	app_reduce_mode_t reduce_mode;
+	if (!app_reduce_parse_mode(args->reduce, &reduce_mode))
+	{
+		return false;
+	}
+
+	if (args->reduce_dim < 0 || (reduce_mode == Matryoshka && args->reduce_dim == 0))
+	{
+		LOG_ERR("param --reduce-dim must be greater than zero.\n");
+		return false;
+	}
+
+	if (reduce_mode == Pca && args->reduce_dim == 0 && args->pca_path.empty())
+	{
+		LOG_ERR("param --reduce pca needs --reduce-dim or --pca-file.\n");
+		return false;
+	}
+
+	if (args->top_k <= 0 || args->query_batch <= 0)
+	{
+		LOG_ERR("params --top-k and --query-batch must be greater than zero.\n");
+		return false;
+	}
+
+	if (!args->query.empty() && !args->source.empty())
+	{
+		LOG_ERR("params --query and --source can not be used together.\n");
+		return false;
+	}
+
+	if (args->hnsw_m < 2 || args->hnsw_ef_construction <= 0 || args->hnsw_ef <= 0)
+	{
+		LOG_ERR("param --hnsw-m must be at least 2, --hnsw-ef-construction and --hnsw-ef greater than zero.\n");
+		return false;
+	}
+
+	// the index is rebuilt from the source every time and has no payload index
+	if (!args->hnsw_path.empty() &&
+	    (args->skip_existing || !args->manifest_path.empty() || !args->query_filter.empty()))
+	{
+		LOG_ERR("params --skip-existing, --manifest and --query-filter need qdrant, not --hnsw.\n");
+		return false;
+	}
+
+	if (!args->export_path.empty() &&
+	    (!args->hnsw_path.empty() || !args->query.empty() || args->skip_existing || !args->manifest_path.empty()))
+	{
+		LOG_ERR("param --export can not be used with --hnsw, --query, --skip-existing or --manifest.\n");
+		return false;
+	}
+
+	if (!args->replay_path.empty() &&
+	    (!args->source.empty() || !args->query.empty() || !args->hnsw_path.empty() || !args->export_path.empty()))
+	{
+		LOG_ERR("param --replay can not be used with --source, --query, --hnsw or --export.\n");
+		return false;
+	}
+
+	if (args->pca_samples < 2)
+	{
+		LOG_ERR("param --pca-samples must be at least 2.\n");
+		return false;
+	}
+
+	if (!args->serve.empty() &&
+	    (!args->source.empty() || !args->query.empty() || !args->replay_path.empty() || !args->hnsw_path.empty() || !args->export_path.empty()))
+	{
+		LOG_ERR("param --serve can not be used with --source, --query, --replay, --hnsw or --export.\n");
+		return false;
+	}
+
+	if (args->serve_wait_ms < 0 || args->serve_batch <= 0)
+	{
+		LOG_ERR("param --serve-wait-ms can not be negative, --serve-batch must be greater than zero.\n");
+		return false;
+	}
+
+	if (args->metrics_interval <= 0)
+	{
+		LOG_ERR("param --metrics-interval must be greater than zero.\n");
+		return false;
+	}
+
+	app_id_mode_t id_mode;
+	if (!app_ingest_parse_id_mode(args->id_mode, &id_mode))
+	{
+		return false;
+	}
+
+	if (args->skip_existing && id_mode == RandomId)
+	{
+		LOG_ERR("param --skip-existing needs --id-mode content or position.\n");
+		return false;
+	}
+
+	// ids stay stable as long as the source is named the same way
+	if (args->source_id.empty())
+	{
+		args->source_id = args->source;
+	}
+
+	if (args->embd_sep.length() == 0)
+	{
+		LOG_ERR("param --embd-separator can not be empty.\n");
+		return false;
+	}
+
+	// a replay uploads stored vectors, it embeds nothing
+	if (args->model.length() == 0 && args->replay_path.empty())
 	{
 		LOG_ERR("param --model [MODEL_PATH] is mandatory.\n");
 		return false;
@@ -65,6 +385,150 @@ bool app_parse_args(int argc, char **argv, app_llama_args_t *args)
 }
 // clang-format on
 
+// embeds the first 'n' records of the source, full width
+static bool app_llm_sample(const app_llama_args_t &args,
+                           const app_llama_data_t &data, size_t n,
+                           std::vector<float> &samples)
+{
+  if (args.source.empty() || args.source == "-")
+  {
+    LOG_ERR("fitting a projection needs a --source file to sample.\n");
+    return false;
+  }
+
+  app_source_t src;
+  if (!app_source_open(args.source, &src))
+  {
+    return false;
+  }
+
+  app_source_chunk_t chunk;
+  llama_input_vector_t inputs;
+  std::vector<float> embeddings;
+
+  samples.clear();
+  bool success = true;
+  while (samples.size() < n * data.model_n_embed)
+  {
+    const size_t n_left = n - samples.size() / data.model_n_embed;
+    if (app_source_read(src, data.embd_sep,
+                        std::min<size_t>(n_left, args.chunk_size), chunk) == 0)
+    {
+      break;
+    }
+
+    inputs.clear();
+    const int n_prompts = app_llm_tokenize(data, chunk.records, inputs);
+    if (n_prompts <= 0 ||
+        !app_llm_get_embeddings(data, n_prompts, inputs, embeddings))
+    {
+      success = false;
+      break;
+    }
+
+    samples.insert(samples.end(), embeddings.begin(), embeddings.end());
+  }
+
+  app_source_close(&src);
+
+  return success;
+}
+
+static bool app_llm_init_reduce(const app_llama_args_t &args,
+                                const app_llama_data_t &data,
+                                app_reduce_mode_t mode, app_reduce_t *reduce)
+{
+  const int n_embd = data.model_n_embed;
+
+  reduce->mode = mode;
+  reduce->n_in = n_embd;
+  reduce->n_out = args.reduce_dim;
+  reduce->norm = data.embed_norm;
+  reduce->salt = data.embd_salt;
+
+  if (mode == Pca && !args.pca_path.empty() &&
+      access(args.pca_path.c_str(), F_OK) == 0)
+  {
+    if (!app_reduce_load(args.pca_path, reduce))
+    {
+      return false;
+    }
+
+    if (reduce->n_in != n_embd || reduce->salt.hi != data.embd_salt.hi ||
+        reduce->salt.lo != data.embd_salt.lo)
+    {
+      LOG_ERR("'%s' was fitted for another model.\n", args.pca_path.c_str());
+      return false;
+    }
+
+    if (args.reduce_dim > 0 && args.reduce_dim != reduce->n_out)
+    {
+      LOG_ERR("'%s' projects to %d dims, not %d.\n", args.pca_path.c_str(),
+              reduce->n_out, args.reduce_dim);
+      return false;
+    }
+
+    reduce->norm = data.embed_norm;
+
+    LOG("loaded PCA projection '%s' (%d -> %d).\n", args.pca_path.c_str(),
+        reduce->n_in, reduce->n_out);
+    return true;
+  }
+
+  if (reduce->n_out <= 0 || reduce->n_out >= n_embd)
+  {
+    LOG_ERR("param --reduce-dim must be below the model width (%d).\n",
+            n_embd);
+    return false;
+  }
+
+  if (mode == Matryoshka)
+  {
+    LOG("keeping the first %d of %d dims (matryoshka).\n", reduce->n_out,
+        n_embd);
+    return true;
+  }
+
+  if (llama_pooling_type(data.ctx) == LLAMA_POOLING_TYPE_NONE)
+  {
+    LOG_ERR("pooling type NONE yields per-token embeddings, PCA needs one per "
+            "record.\n");
+    return false;
+  }
+
+  std::vector<float> samples;
+  if (!app_llm_sample(args, data, args.pca_samples, samples))
+  {
+    return false;
+  }
+
+  const size_t n_samples = samples.size() / n_embd;
+  if (n_samples < (size_t)reduce->n_out)
+  {
+    LOG("warning: %zu samples for %d components, the projection will be "
+        "poor.\n",
+        n_samples, reduce->n_out);
+  }
+
+  if (!app_reduce_fit_pca(samples.data(), n_samples, n_embd, reduce->n_out,
+                          data.n_tok_threads, reduce))
+  {
+    return false;
+  }
+
+  if (!args.pca_path.empty())
+  {
+    if (!app_reduce_save(args.pca_path, *reduce))
+    {
+      return false;
+    }
+
+    LOG("saved PCA projection to '%s'.\n", args.pca_path.c_str());
+  }
+
+  return true;
+}
+
 bool app_llm_init(app_llama_args_t &args, app_llama_data_t *data)
 {
   if (NULL == data)
@@ -73,20 +537,21 @@ bool app_llm_init(app_llama_args_t &args, app_llama_data_t *data)
     return false;
   }
 
-  //
-
-  // if the number of prompts that would be encoded is known in advance, it's
-  // more efficient to specify the
-  //   --parallel argument accordingly. for convenience, if not specified, we
-  //   fallback to unified KV cache in order to support any number of prompts
+  data->model = NULL;
+  data->ctx = NULL;
+  data->ctxs.clear();
+  data->cache = NULL;
+  data->reduce = NULL;
+  data->tok_pool = NULL;
 
-  /*
-  if (params.n_parallel == 1)
+  // get max number of sequences per batch; --parallel 0 means "as many as
+  // llama.cpp supports"
+  const int32_t n_seq_limit = llama_max_parallel_sequences();
+  int32_t n_parallel = args.n_parallel;
+  if (n_parallel <= 0 || n_parallel > n_seq_limit)
   {
-    LOG_INF("%s: n_parallel == 1 -> unified KV cache is enabled\n", __func__);
-    params.kv_unified = true;
+    n_parallel = n_seq_limit;
   }
-  */
 
   // utilize the full context
   if (args.batch_size < args.ctx_size)
@@ -95,16 +560,14 @@ bool app_llm_init(app_llama_args_t &args, app_llama_data_t *data)
     args.batch_size = args.ctx_size;
   }
 
-  // for non-causal models, batch size must be equal to ubatch size
-  /*
-  if (params.attention_type != LLAMA_ATTENTION_TYPE_CAUSAL)
+  // for non-causal models, batch size must be equal to ubatch size: a packed
+  // batch holds whole sequences, which can not be split across ubatches
+  if (n_parallel > 1 && args.ubatch_size < args.batch_size)
   {
-    params.n_ubatch = params.n_batch;
+    LOG("info: packing %d sequences, setting ubatch size to %d\n", n_parallel,
+        args.batch_size);
+    args.ubatch_size = args.batch_size;
   }
-  */
-
-  // get max number of sequences per batch
-  data->n_seq_max = llama_max_parallel_sequences();
 
   llama_backend_init();
   // llama_numa_init(params.numa);
@@ -125,15 +588,45 @@ bool app_llm_init(app_llama_args_t &args, app_llama_data_t *data)
   cp.embeddings = true;
   cp.n_batch = args.batch_size;
   cp.n_ubatch = args.ubatch_size;
-  cp.n_threads = args.threads;
+  cp.n_threads = args.context_threads;
+  cp.n_threads_batch = args.context_threads;
   cp.n_ctx = args.ctx_size;
-  cp.n_seq_max = 1;
+  cp.n_seq_max = n_parallel;
 
-  data->ctx = llama_init_from_model(data->model, cp);
-  if (NULL == data->ctx)
+  // sequences of a packed batch share a unified KV cache, which must be able
+  // to hold a full batch
+  cp.kv_unified = true;
+  if (n_parallel > 1)
   {
-    LOG_ERR("unable to load llama context.\n");
-    return false;
+    const uint32_t n_ctx_min = args.batch_size;
+    const uint32_t n_ctx_model =
+        cp.n_ctx > 0 ? cp.n_ctx : llama_model_n_ctx_train(data->model);
+    if (n_ctx_model < n_ctx_min)
+    {
+      LOG("info: setting context size to %u to fit a full batch\n",
+          n_ctx_min);
+      cp.n_ctx = n_ctx_min;
+    }
+  }
+
+  // contexts share the weights; each has its own KV cache and buffers
+  for (int32_t c = 0; c < args.n_contexts; c++)
+  {
+    llama_context *context = llama_init_from_model(data->model, cp);
+    if (NULL == context)
+    {
+      LOG_ERR("unable to load llama context %d.\n", c);
+      return false;
+    }
+
+    data->ctxs.push_back(context);
+  }
+
+  data->ctx = data->ctxs[0];
+  if (args.n_contexts > 1)
+  {
+    LOG("info: %d llama contexts, %d threads each\n", args.n_contexts,
+        args.context_threads);
   }
 
   llama_model *model = data->model;
@@ -160,13 +653,66 @@ bool app_llm_init(app_llama_args_t &args, app_llama_data_t *data)
   }
 
   // Set extra values to data
-  data->n_batch = args.batch_size;
+  data->n_batch = std::min<int32_t>(args.batch_size, llama_n_ctx(ctx));
   data->n_ubatch = args.ubatch_size;
-  data->n_seq_max = 1; // TODO: add parameter for that?
-  data->embd_sep = "\n";
+  data->n_seq_max = llama_n_seq_max(ctx);
+  data->embd_sep = args.embd_sep;
   data->cls_sep = "\t";
   data->embed_norm = embedding_normalize_algorithm_t::Euclidean;
+  data->bucketing = args.bucketing;
+  data->n_tok_threads = args.tok_threads;
+  data->tok_pool = new worker_pool_t;
+  worker_pool_init(data->tok_pool, data->n_tok_threads);
   data->model_n_embed = llama_model_n_embd(data->model);
+  data->n_embd_out = data->model_n_embed;
+
+  // cached embeddings are only valid for the same model and settings
+  char desc[256];
+  llama_model_desc(model, desc, sizeof(desc));
+
+  char identity[512];
+  const int n_identity = snprintf(
+      identity, sizeof(identity), "%s|%llu|%llu|%d|%d|%d", desc,
+      (unsigned long long)llama_model_n_params(model),
+      (unsigned long long)llama_model_size(model), data->model_n_embed,
+      data->embed_norm, (int)pooling_type);
+  data->embd_salt = app_cache_hash(identity, n_identity, {0, 0});
+
+  if (!args.cache_path.empty())
+  {
+    if (pooling_type == LLAMA_POOLING_TYPE_NONE)
+    {
+      LOG("warning: pooling type NONE yields per-token embeddings, which are "
+          "not cached.\n");
+    }
+    else
+    {
+      data->cache = new app_cache_t;
+      if (!app_cache_open(args.cache_path, data->model_n_embed,
+                          data->embd_salt, data->cache))
+      {
+        delete data->cache;
+        data->cache = NULL;
+        return false;
+      }
+    }
+  }
+
+  app_reduce_mode_t reduce_mode = FullWidth;
+  app_reduce_parse_mode(args.reduce, &reduce_mode);
+  if (reduce_mode != FullWidth)
+  {
+    // set up on full width embeddings: the reduction is not active yet
+    app_reduce_t *reduce = new app_reduce_t;
+    if (!app_llm_init_reduce(args, *data, reduce_mode, reduce))
+    {
+      delete reduce;
+      return false;
+    }
+
+    data->reduce = reduce;
+    data->n_embd_out = reduce->n_out;
+  }
 
   return true;
 }
@@ -175,12 +721,34 @@ bool app_llm_destroy(app_llama_data_t *data)
 {
   if (NULL != data)
   {
-    if (NULL != data->ctx)
+    if (NULL != data->tok_pool)
+    {
+      worker_pool_destroy(data->tok_pool);
+      delete data->tok_pool;
+      data->tok_pool = NULL;
+    }
+
+    if (NULL != data->reduce)
+    {
+      delete data->reduce;
+      data->reduce = NULL;
+    }
+
+    if (NULL != data->cache)
+    {
+      LOG("closing cache '%s'.\n", data->cache->path.c_str());
+      app_cache_close(data->cache);
+      delete data->cache;
+      data->cache = NULL;
+    }
+
+    for (llama_context *context : data->ctxs)
     {
-      LOG("freeing llama context @ %p.\n", data->ctx);
-      llama_free(data->ctx);
-      data->ctx = NULL;
+      LOG("freeing llama context @ %p.\n", context);
+      llama_free(context);
     }
+    data->ctxs.clear();
+    data->ctx = NULL;
 
     if (NULL != data->model)
     {
@@ -198,107 +766,200 @@ bool app_llm_destroy(app_llama_data_t *data)
 
 int app_llm_tokenize(const app_llama_data_t &data, const std::string &text,
                      llama_input_vector_t &inputs)
+{
+  // split the prompt into lines
+  const std::vector<std::string_view> prompts =
+      split_views(text, data.embd_sep);
+
+  return app_llm_tokenize(data, prompts, inputs);
+}
+
+typedef struct _app_llm_tokenize_ctx
+{
+  const llama_vocab *vocab;
+  enum llama_pooling_type pooling_type;
+  std::string added_sep_token;
+  std::string added_eos_token;
+  const char *rerank_prompt;
+} app_llm_tokenize_ctx_t;
+
+static void app_llm_tokenize_prompt(const app_llama_data_t &data,
+                                    const app_llm_tokenize_ctx_t &tc,
+                                    std::string_view prompt,
+                                    std::vector<llama_token> &arena)
+{
+  const llama_vocab *vocab = tc.vocab;
+
+  // split classification pairs and insert expected separator tokens
+  if (tc.pooling_type == LLAMA_POOLING_TYPE_RANK &&
+      prompt.find(data.cls_sep) != std::string::npos)
+  {
+    std::vector<std::string_view> pairs = split_views(prompt, data.cls_sep);
+    if (tc.rerank_prompt != nullptr)
+    {
+      const std::string query(pairs[0]);
+      const std::string doc(pairs[1]);
+      std::string final_prompt = tc.rerank_prompt;
+      string_replace_all(final_prompt, "{query}", query);
+      string_replace_all(final_prompt, "{document}", doc);
+
+      if (app_llama_tokenize_append(arena, vocab, final_prompt, true, true) <
+          0)
+      {
+        LOG("warning: app_llama_tokenize failed.\n");
+      }
+    }
+    else
+    {
+      std::string final_prompt;
+      for (size_t i = 0; i < pairs.size(); i++)
+      {
+        final_prompt += pairs[i];
+        if (i != pairs.size() - 1)
+        {
+          if (!tc.added_eos_token.empty())
+          {
+            final_prompt += tc.added_eos_token;
+          }
+          if (!tc.added_sep_token.empty())
+          {
+            final_prompt += tc.added_sep_token;
+          }
+        }
+      }
+
+      app_llama_tokenize_append(arena, vocab, final_prompt, true, true);
+    }
+  }
+  else
+  {
+    app_llama_tokenize_append(arena, vocab, prompt, true, true);
+  }
+}
+
+int app_llm_tokenize(const app_llama_data_t &data,
+                     const std::vector<std::string_view> &prompts,
+                     llama_input_vector_t &inputs)
 {
   llama_model *model = data.model;
-  enum llama_pooling_type pooling_type = llama_pooling_type(data.ctx);
 
-  const llama_vocab *vocab = llama_model_get_vocab(data.model);
+  app_llm_tokenize_ctx_t tc;
+  tc.vocab = llama_model_get_vocab(data.model);
+  tc.pooling_type = llama_pooling_type(data.ctx);
 
+  const llama_vocab *vocab = tc.vocab;
   if (NULL == vocab)
   {
     LOG_ERR("could not load the model's vocab\n");
+    app_metrics_add(MetricTokenizeErrors);
     return -1;
   }
 
-  // split the prompt into lines
-  std::vector<std::string> prompts = split_lines(text, data.embd_sep);
-
   // max batch size
   const uint64_t n_batch = data.n_batch;
 
   // get added sep and eos token, if any
-  const std::string added_sep_token =
-      llama_vocab_get_add_sep(vocab)
-          ? llama_vocab_get_text(vocab, llama_vocab_sep(vocab))
-          : "";
-  const std::string added_eos_token =
-      llama_vocab_get_add_eos(vocab)
-          ? llama_vocab_get_text(vocab, llama_vocab_eos(vocab))
-          : "";
-  const char *rerank_prompt = llama_model_chat_template(model, "rerank");
-
-  // tokenize the prompts and trim
-  for (const auto &prompt : prompts)
-  {
-    std::vector<llama_token> inp;
-
-    // split classification pairs and insert expected separator tokens
-    if (pooling_type == LLAMA_POOLING_TYPE_RANK &&
-        prompt.find(data.cls_sep) != std::string::npos)
-    {
-      std::vector<std::string> pairs = split_lines(prompt, data.cls_sep);
-      if (rerank_prompt != nullptr)
-      {
-        const std::string query = pairs[0];
-        const std::string doc = pairs[1];
-        std::string final_prompt = rerank_prompt;
-        string_replace_all(final_prompt, "{query}", query);
-        string_replace_all(final_prompt, "{document}", doc);
+  tc.added_sep_token = llama_vocab_get_add_sep(vocab)
+                           ? llama_vocab_get_text(vocab, llama_vocab_sep(vocab))
+                           : "";
+  tc.added_eos_token = llama_vocab_get_add_eos(vocab)
+                           ? llama_vocab_get_text(vocab, llama_vocab_eos(vocab))
+                           : "";
+  tc.rerank_prompt = llama_model_chat_template(model, "rerank");
 
-        if (!app_llama_tokenize(inp, vocab, final_prompt, true, true))
-        {
-          LOG("warning: app_llama_tokenize failed.\n");
-        }
-      }
-      else
-      {
-        std::string final_prompt;
-        for (size_t i = 0; i < pairs.size(); i++)
-        {
-          final_prompt += pairs[i];
-          if (i != pairs.size() - 1)
-          {
-            if (!added_eos_token.empty())
-            {
-              final_prompt += added_eos_token;
-            }
-            if (!added_sep_token.empty())
-            {
-              final_prompt += added_sep_token;
-            }
-          }
-        }
+  // prompts are cut into contiguous parts; every part is tokenized into its
+  // own arena, so workers never contend, and parts are appended in order
+  const size_t n_prompts = prompts.size();
+  const size_t first = inputs.size();
+  const size_t n_parts =
+      std::min<size_t>(n_prompts, std::max(1, data.n_tok_threads) * 8);
+
+  std::vector<std::vector<llama_token>> arenas(n_parts > 1 ? n_parts : 0);
+  std::vector<size_t> lengths(n_prompts);
+
+  auto tokenize_part = [&](size_t part, std::vector<llama_token> &arena)
+  {
+    const size_t begin = part * n_prompts / n_parts;
+    const size_t end = (part + 1) * n_prompts / n_parts;
+    for (size_t k = begin; k < end; k++)
+    {
+      const size_t n_before = arena.size();
+      app_llm_tokenize_prompt(data, tc, prompts[k], arena);
+      lengths[k] = arena.size() - n_before;
+    }
+  };
 
-        app_llama_tokenize(inp, vocab, final_prompt, true, true);
+  if (n_parts > 1)
+  {
+    auto tokenize_parts = [&](size_t begin, size_t end)
+    {
+      for (size_t part = begin; part < end; part++)
+      {
+        tokenize_part(part, arenas[part]);
       }
+    };
+
+    // the pool's workers outlive the call; n_tok_threads 1 stays serial
+    if (data.tok_pool != NULL && data.n_tok_threads > 1)
+    {
+      parallel_for(*data.tok_pool, n_parts, tokenize_parts);
     }
     else
     {
-      app_llama_tokenize(inp, vocab, prompt, true, true);
+      parallel_for(n_parts, data.n_tok_threads, tokenize_parts);
     }
 
-    if (inp.size() > n_batch)
+    size_t n_tokens = 0;
+    for (const auto &arena : arenas)
     {
-      LOG_ERR("number of tokens in input line (%lld) exceeds batch size "
+      n_tokens += arena.size();
+    }
+
+    inputs.tokens.reserve(inputs.tokens.size() + n_tokens);
+    for (const auto &arena : arenas)
+    {
+      inputs.tokens.insert(inputs.tokens.end(), arena.begin(), arena.end());
+    }
+  }
+  else if (n_parts == 1)
+  {
+    tokenize_part(0, inputs.tokens);
+  }
+
+  inputs.offsets.reserve(inputs.offsets.size() + n_prompts);
+  for (size_t k = 0; k < n_prompts; k++)
+  {
+    inputs.offsets.push_back(inputs.offsets.back() + lengths[k]);
+  }
+
+  for (size_t k = 0; k < n_prompts; k++)
+  {
+    if (lengths[k] > n_batch)
+    {
+      LOG_ERR("number of tokens in input line %zu (%lld) exceeds batch size "
               "(%lld), increase batch size and re-run\n",
-              (long long int)inp.size(), (long long int)n_batch);
+              k, (long long int)lengths[k], (long long int)n_batch);
+      inputs.tokens.resize(inputs.offsets[first]);
+      inputs.offsets.resize(first + 1);
+      app_metrics_add(MetricTokenizeErrors);
       return -1;
     }
-
-    inputs.push_back(inp);
   }
 
   // check if the last token is SEP/EOS
   // it should be automatically added by the tokenizer when
   // 'tokenizer.ggml.add_eos_token' is set to 'true'
-  for (auto &inp : inputs)
+  for (size_t k = first; k < inputs.size(); k++)
   {
-    if (inp.empty() || (inp.back() != llama_vocab_sep(vocab) &&
-                        inp.back() != llama_vocab_eos(vocab)))
+    const llama_token last =
+        inputs.length(k) > 0 ? inputs.data(k)[inputs.length(k) - 1] : -1;
+    if (last < 0 ||
+        (last != llama_vocab_sep(vocab) && last != llama_vocab_eos(vocab)))
     {
       LOG("last token in the prompt is not SEP or EOS\n");
       LOG("'tokenizer.ggml.add_eos_token' should be set to 'true' in "
           "the GGUF header\n");
+      break;
     }
   }
 
@@ -321,74 +982,391 @@ int app_llm_tokenize(const app_llama_data_t &data, const std::string &text,
   }
   */
 
+  app_metrics_add(MetricTokens, inputs.offsets.back() - inputs.offsets[first]);
+
   return prompts.size();
 }
 
-bool app_llm_get_embeddings(const app_llama_data_t &data, const int n_prompts,
-                            const llama_input_vector_t &inputs,
-                            std::vector<float> &embeddings)
+void app_llm_schedule(const app_llama_data_t &data, const int n_prompts,
+                      const llama_input_vector_t &inputs,
+                      app_llama_schedule_t &schedule)
+{
+  std::vector<int32_t> prompts(n_prompts);
+  for (int32_t k = 0; k < n_prompts; k++)
+  {
+    prompts[k] = k;
+  }
+
+  app_llm_schedule(data, prompts, inputs, schedule);
+}
+
+// schedules the given prompts only; 'prompts' is in input order
+void app_llm_schedule(const app_llama_data_t &data,
+                      const std::vector<int32_t> &prompts,
+                      const llama_input_vector_t &inputs,
+                      app_llama_schedule_t &schedule)
 {
-  // initialize batch
-  enum llama_pooling_type pooling_type = llama_pooling_type(data.ctx);
   const int32_t n_batch = data.n_batch;
   const int32_t n_seq_max = data.n_seq_max;
+  const int32_t n_prompts = prompts.size();
 
-  struct llama_batch batch = llama_batch_init(n_batch, 0, 1);
+  schedule.order.clear();
+  schedule.batches.clear();
+  schedule.n_tokens = 0;
 
-  // count number of embeddings
-  int n_embd_count = 0;
-  if (pooling_type == LLAMA_POOLING_TYPE_NONE)
+  for (const int32_t k : prompts)
   {
-    for (int k = 0; k < n_prompts; k++)
+    schedule.n_tokens += inputs.length(k);
+  }
+
+  if (!data.bucketing)
+  {
+    // input order: flush whenever the next prompt does not fit
+    int32_t n_tokens = 0;
+    for (const int32_t k : prompts)
+    {
+      const int32_t n_toks = inputs.length(k);
+      const int32_t n_seqs = schedule.order.size() -
+                             (schedule.batches.empty() ? 0
+                                                       : schedule.batches.back());
+      if (n_seqs > 0 && (n_tokens + n_toks > n_batch || n_seqs >= n_seq_max))
+      {
+        schedule.batches.push_back(schedule.order.size());
+        n_tokens = 0;
+      }
+
+      schedule.order.push_back(k);
+      n_tokens += n_toks;
+    }
+
+    if (n_prompts > 0)
     {
-      n_embd_count += inputs[k].size();
+      schedule.batches.push_back(schedule.order.size());
     }
+
+    return;
   }
-  else
+
+  // pending prompts by (length, index)
+  std::multiset<std::pair<int32_t, int32_t>> pending;
+  for (const int32_t k : prompts)
+  {
+    pending.emplace(inputs.length(k), k);
+  }
+
+  // fill one batch at a time with the longest prompt that still leaves room
+  // for the remaining sequence slots at the shortest pending length; this
+  // spreads long prompts over batches when n_seq_max is the binding limit
+  // and packs tokens tightly when n_batch is
+  while (!pending.empty())
+  {
+    const size_t begin = schedule.order.size();
+
+    int32_t n_room = n_batch;
+    int32_t n_slots = n_seq_max;
+    while (n_slots > 0 && !pending.empty())
+    {
+      const int32_t n_shortest = pending.begin()->first;
+      if (n_shortest > n_room && schedule.order.size() > begin)
+      {
+        break;
+      }
+
+      const int64_t n_others =
+          std::min<int64_t>(n_slots - 1, (int64_t)pending.size() - 1);
+      const int64_t budget =
+          std::max<int64_t>(n_room - n_others * n_shortest, n_shortest);
+
+      auto it = pending.upper_bound({(int32_t)std::min<int64_t>(budget, n_room),
+                                     std::numeric_limits<int32_t>::max()});
+      if (it != pending.begin())
+      {
+        --it;
+      }
+
+      schedule.order.push_back(it->second);
+      n_room -= it->first;
+      n_slots -= 1;
+
+      pending.erase(it);
+    }
+
+    // prompts keep input order inside a batch
+    std::sort(schedule.order.begin() + begin, schedule.order.end());
+    schedule.batches.push_back(schedule.order.size());
+  }
+}
+
+// batches of one decoder; the others steal from the back
+typedef struct _app_llama_worklist
+{
+  std::mutex mutex;
+  std::deque<int32_t> batches;
+} app_llama_worklist_t;
+
+// decodes batch 'b' of the schedule on 'ctx'; embeddings are scattered back
+// to the prompts' original rows
+static bool app_llm_decode_batch(const app_llama_data_t &data,
+                                 llama_context *ctx,
+                                 const llama_input_vector_t &inputs,
+                                 const app_llama_schedule_t &schedule,
+                                 const std::vector<int32_t> &rows, int32_t b,
+                                 llama_batch &batch,
+                                 std::vector<int32_t> &seq_rows, float *emb,
+                                 app_llama_stats_t &stats)
+{
+  const int32_t n_batch = data.n_batch;
+  const int n_embd = llama_model_n_embd(data.model);
+
+  app_llama_batch_clear(batch);
+  seq_rows.clear();
+
+  const int32_t begin = b > 0 ? schedule.batches[b - 1] : 0;
+  for (int32_t j = begin; j < schedule.batches[b]; j++)
+  {
+    const int32_t k = schedule.order[j];
+
+    app_llama_batch_add_seq(batch, inputs.data(k), inputs.length(k),
+                            seq_rows.size());
+    seq_rows.push_back(rows[k]);
+  }
+
+  const auto t_decode = std::chrono::steady_clock::now();
+  if (!app_llama_batch_decode(ctx, batch, emb, seq_rows, n_embd,
+                              data.embed_norm))
+  {
+    app_metrics_add(MetricDecodeErrors);
+    return false;
+  }
+
+  app_metrics_observe(MetricDecodeSeconds,
+                      std::chrono::duration<double>(
+                          std::chrono::steady_clock::now() - t_decode)
+                          .count());
+  app_metrics_observe(MetricBatchFill, (double)batch.n_tokens / n_batch);
+  app_metrics_add(MetricDecodes);
+  app_metrics_add(MetricDecodeTokens, batch.n_tokens);
+  app_metrics_add(MetricDecodeCapacity, n_batch);
+
+  stats.n_decode += 1;
+  stats.n_tokens += batch.n_tokens;
+  stats.n_capacity += n_batch;
+
+  return true;
+}
+
+// Decodes the schedule on every context at once. Batches are dealt round
+// robin, so each decoder gets long and short ones; a decoder that runs dry
+// steals from the back of another's list. Rows are fixed per prompt, so the
+// output is in input order whoever decodes what.
+static bool app_llm_decode_batches(const app_llama_data_t &data,
+                                   const llama_input_vector_t &inputs,
+                                   const app_llama_schedule_t &schedule,
+                                   const std::vector<int32_t> &rows,
+                                   float *emb, app_llama_stats_t *stats)
+{
+  const int32_t n_batches = schedule.batches.size();
+  const int32_t n_workers =
+      std::max<int32_t>(1, std::min<int32_t>(data.ctxs.size(), n_batches));
+
+  std::vector<app_llama_worklist_t> lists(n_workers);
+  for (int32_t b = 0; b < n_batches; b++)
   {
-    n_embd_count = n_prompts;
+    lists[b % n_workers].batches.push_back(b);
+  }
+
+  std::atomic<bool> failed(false);
+  std::vector<app_llama_stats_t> worker_stats(n_workers, app_llama_stats_t{});
+
+  auto next_batch = [&](int32_t w, int32_t *b)
+  {
+    for (int32_t i = 0; i < n_workers; i++)
+    {
+      app_llama_worklist_t &list = lists[(w + i) % n_workers];
+      std::lock_guard<std::mutex> lock(list.mutex);
+      if (!list.batches.empty())
+      {
+        *b = i == 0 ? list.batches.front() : list.batches.back();
+        i == 0 ? list.batches.pop_front() : list.batches.pop_back();
+        return true;
+      }
+    }
+
+    return false;
+  };
+
+  auto worker = [&](int32_t w)
+  {
+    llama_batch batch = llama_batch_init(data.n_batch, 0, 1);
+    std::vector<int32_t> seq_rows;
+
+    int32_t b;
+    while (!failed && next_batch(w, &b))
+    {
+      if (!app_llm_decode_batch(data, data.ctxs[w], inputs, schedule, rows, b,
+                                batch, seq_rows, emb, worker_stats[w]))
+      {
+        failed = true;
+      }
+    }
+
+    llama_batch_free(batch);
+  };
+
+  std::vector<std::thread> threads;
+  for (int32_t w = 1; w < n_workers; w++)
+  {
+    threads.emplace_back(worker, w);
+  }
+
+  // the calling thread decodes on the first context
+  worker(0);
+
+  for (auto &t : threads)
+  {
+    t.join();
+  }
+
+  if (stats != NULL)
+  {
+    for (const auto &ws : worker_stats)
+    {
+      stats->n_decode += ws.n_decode;
+      stats->n_tokens += ws.n_tokens;
+      stats->n_capacity += ws.n_capacity;
+    }
+  }
+
+  return !failed;
+}
+
+bool app_llm_get_embeddings(const app_llama_data_t &data, const int n_prompts,
+                            const llama_input_vector_t &inputs,
+                            std::vector<float> &embeddings,
+                            app_llama_stats_t *stats)
+{
+  enum llama_pooling_type pooling_type = llama_pooling_type(data.ctx);
+  const bool pooled = pooling_type != LLAMA_POOLING_TYPE_NONE;
+
+  // output row of every prompt, in input order
+  std::vector<int32_t> rows(n_prompts);
+
+  // count number of embeddings
+  int n_embd_count = 0;
+  for (int k = 0; k < n_prompts; k++)
+  {
+    rows[k] = n_embd_count;
+    n_embd_count += pooled ? 1 : inputs.length(k);
   }
 
   // allocate output
   const int n_embd = llama_model_n_embd(data.model);
 
-  const size_t embd_size = n_embd_count * n_embd;
-  embeddings.resize(embd_size);
+  const size_t embd_size = (size_t)n_embd_count * n_embd;
   embeddings.assign(embd_size, 0.0);
 
   float *emb = embeddings.data();
 
-  // break into batches
-  int e = 0; // number of embeddings already stored
-  int s = 0; // number of prompts in current batch
-  for (int k = 0; k < n_prompts; k++)
+  // prompts that need a decode; with pooling, cached ones are copied from
+  // the cache and repeated ones from their first occurrence
+  std::vector<int32_t> todo;
+  std::vector<app_cache_key_t> keys;
+  std::vector<std::pair<int32_t, int32_t>> repeats; // (prompt, original)
+  uint64_t n_cached = 0;
+  uint64_t n_uncached = 0;
+
+  if (pooled)
   {
-    // clamp to n_batch tokens
-    auto &inp = inputs[k];
+    keys.resize(n_prompts);
 
-    const uint64_t n_toks = inp.size();
+    std::unordered_map<uint64_t, int32_t> seen;
+    seen.reserve(n_prompts);
 
-    // encode if at capacity
-    if (batch.n_tokens + n_toks > n_batch || s >= n_seq_max)
+    for (int32_t k = 0; k < n_prompts; k++)
     {
-      float *out = emb + e * n_embd;
-      app_llama_batch_decode(data.ctx, batch, out, s, n_embd, data.embed_norm);
+      keys[k] = app_cache_hash(inputs.data(k),
+                               inputs.length(k) * sizeof(llama_token),
+                               data.embd_salt);
 
-      e += pooling_type == LLAMA_POOLING_TYPE_NONE ? batch.n_tokens : s;
-      s = 0;
+      // 128 bit keys; the map only needs the low half to find candidates
+      auto it = seen.find(keys[k].lo);
+      if (it != seen.end() && keys[it->second].hi == keys[k].hi)
+      {
+        repeats.emplace_back(k, it->second);
+        continue;
+      }
 
-      app_llama_batch_clear(batch);
+      if (data.cache != NULL)
+      {
+        if (app_cache_lookup(*data.cache, keys[k], emb + (size_t)rows[k] * n_embd))
+        {
+          n_cached++;
+          continue;
+        }
+
+        n_uncached++;
+      }
+
+      seen.emplace(keys[k].lo, k);
+      todo.push_back(k);
+    }
+  }
+  else
+  {
+    todo.resize(n_prompts);
+    for (int32_t k = 0; k < n_prompts; k++)
+    {
+      todo[k] = k;
+    }
+  }
+
+  // group prompts into batches
+  app_llama_schedule_t schedule;
+  app_llm_schedule(data, todo, inputs, schedule);
+
+  const bool success =
+      app_llm_decode_batches(data, inputs, schedule, rows, emb, stats);
+
+  if (success)
+  {
+    if (data.cache != NULL)
+    {
+      for (const int32_t k : todo)
+      {
+        if (!app_cache_insert(*data.cache, keys[k],
+                              emb + (size_t)rows[k] * n_embd))
+        {
+          break;
+        }
+      }
     }
 
-    // add to batch
-    // TODO: app_llama_batch_add_seq(batch, inp, s);
-    app_llama_batch_add_seq(batch, inp, s);
-    s += 1;
+    for (const auto &repeat : repeats)
+    {
+      memcpy(emb + (size_t)rows[repeat.first] * n_embd,
+             emb + (size_t)rows[repeat.second] * n_embd,
+             n_embd * sizeof(float));
+    }
+  }
+
+  if (success && data.reduce != NULL)
+  {
+    app_reduce_apply(*data.reduce, embeddings, n_embd_count);
   }
 
-  // final batch
-  float *out = emb + e * n_embd;
-  app_llama_batch_decode(data.ctx, batch, out, s, n_embd, data.embed_norm);
+  if (success)
+  {
+    app_metrics_add(MetricEmbeddings, n_embd_count);
+    app_metrics_add(MetricCacheHits, n_cached);
+  }
 
-  return true;
+  if (stats != NULL)
+  {
+    stats->n_prompts += n_prompts;
+    stats->n_cached += n_cached;
+    stats->n_uncached += n_uncached;
+    stats->n_repeated += repeats.size();
+  }
+
+  return success;
 }
@@ -0,0 +1,239 @@
+#include "app-manifest.h"
+#include "utils.h"
+#include <algorithm>
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <unordered_set>
+#include <uuid/uuid.h>
+
+typedef struct _app_manifest_header
+{
+  char magic[8];
+  uint32_t version;
+  uint32_t source_id_len;
+  uint32_t collection_len;
+  uint32_t reserved;
+  uint64_t n_entries;
+} app_manifest_header_t;
+
+static bool app_manifest_less(const app_manifest_entry_t &a,
+                              const app_manifest_entry_t &b)
+{
+  return a.hash.hi != b.hash.hi ? a.hash.hi < b.hash.hi
+                                : a.hash.lo < b.hash.lo;
+}
+
+bool app_manifest_load(const std::string &path, const std::string &source_id,
+                       const std::string &collection, app_manifest_t *manifest)
+{
+  if (NULL == manifest)
+  {
+    LOG_ERR("argument 'manifest' is NULL.\n");
+    return false;
+  }
+
+  manifest->path.assign(path);
+  manifest->source_id.assign(source_id);
+  manifest->collection.assign(collection);
+  manifest->previous.clear();
+  manifest->claimed.clear();
+  manifest->current.clear();
+
+  FILE *file = fopen(path.c_str(), "rb");
+  if (NULL == file)
+  {
+    if (errno != ENOENT)
+    {
+      LOG_ERR("could not open manifest '%s': %s.\n", path.c_str(),
+              strerror(errno));
+      return false;
+    }
+
+    LOG("manifest '%s' not found, every record is new.\n", path.c_str());
+    return true;
+  }
+
+  app_manifest_header_t header;
+  std::string file_source_id;
+  std::string file_collection;
+
+  bool valid =
+      fread(&header, sizeof(header), 1, file) == 1 &&
+      memcmp(header.magic, APP_MANIFEST_MAGIC, sizeof(header.magic)) == 0 &&
+      header.version == APP_MANIFEST_VERSION;
+  if (valid)
+  {
+    file_source_id.resize(header.source_id_len);
+    file_collection.resize(header.collection_len);
+    valid = fread(&file_source_id[0], 1, header.source_id_len, file) ==
+                header.source_id_len &&
+            fread(&file_collection[0], 1, header.collection_len, file) ==
+                header.collection_len;
+  }
+
+  if (!valid)
+  {
+    LOG_ERR("'%s' is not a manifest.\n", path.c_str());
+    fclose(file);
+    return false;
+  }
+
+  // the points of another source or collection are not ours to delete
+  if (file_source_id != source_id || file_collection != collection)
+  {
+    LOG("warning: manifest '%s' is for source '%s' in '%s', ignoring it.\n",
+        path.c_str(), file_source_id.c_str(), file_collection.c_str());
+    fclose(file);
+    return true;
+  }
+
+  manifest->previous.resize(header.n_entries);
+  if (fread(manifest->previous.data(), sizeof(app_manifest_entry_t),
+            header.n_entries, file) != header.n_entries)
+  {
+    LOG_ERR("manifest '%s' is truncated.\n", path.c_str());
+    manifest->previous.clear();
+    fclose(file);
+    return false;
+  }
+  fclose(file);
+
+  // saved sorted, but do not rely on it
+  if (!std::is_sorted(manifest->previous.begin(), manifest->previous.end(),
+                      app_manifest_less))
+  {
+    std::sort(manifest->previous.begin(), manifest->previous.end(),
+              app_manifest_less);
+  }
+  manifest->claimed.assign(manifest->previous.size(), false);
+
+  LOG("manifest '%s': %zu records.\n", path.c_str(),
+      manifest->previous.size());
+
+  return true;
+}
+
+// 'id' is the id this run would give the record; when not empty, the record
+// is unchanged only if it kept that id (position ids move with the record)
+bool app_manifest_claim(app_manifest_t &manifest, const app_cache_key_t &hash,
+                        const std::string &id)
+{
+  app_manifest_entry_t probe;
+  probe.hash = hash;
+  if (!id.empty() && uuid_parse(id.c_str(), probe.id) != 0)
+  {
+    return false;
+  }
+
+  // repeated records have one entry each; take the first unclaimed one
+  auto it = std::lower_bound(manifest.previous.begin(),
+                             manifest.previous.end(), probe, app_manifest_less);
+  for (; it != manifest.previous.end() && it->hash.hi == hash.hi &&
+         it->hash.lo == hash.lo;
+       ++it)
+  {
+    const size_t i = it - manifest.previous.begin();
+    if (!manifest.claimed[i] &&
+        (id.empty() || memcmp(it->id, probe.id, sizeof(probe.id)) == 0))
+    {
+      manifest.claimed[i] = true;
+      manifest.current.push_back(*it);
+      return true;
+    }
+  }
+
+  return false;
+}
+
+bool app_manifest_add(app_manifest_t &manifest, const app_cache_key_t &hash,
+                      const std::string &id)
+{
+  app_manifest_entry_t entry;
+  entry.hash = hash;
+  if (uuid_parse(id.c_str(), entry.id) != 0)
+  {
+    LOG_ERR("point id '%s' is not a UUID.\n", id.c_str());
+    return false;
+  }
+
+  manifest.current.push_back(entry);
+
+  return true;
+}
+
+void app_manifest_removed(const app_manifest_t &manifest,
+                          std::vector<std::string> &ids)
+{
+  ids.clear();
+
+  // a position id may have been reused by a record of this run
+  std::unordered_set<std::string> current;
+  current.reserve(manifest.current.size());
+
+  char id[36 + 1];
+  for (const auto &entry : manifest.current)
+  {
+    uuid_unparse_lower(entry.id, id);
+    current.insert(id);
+  }
+
+  for (size_t i = 0; i < manifest.previous.size(); i++)
+  {
+    if (manifest.claimed[i])
+    {
+      continue;
+    }
+
+    uuid_unparse_lower(manifest.previous[i].id, id);
+    if (current.count(id) == 0)
+    {
+      ids.push_back(id);
+    }
+  }
+}
+
+bool app_manifest_save(const app_manifest_t &manifest)
+{
+  std::vector<app_manifest_entry_t> entries(manifest.current);
+  std::sort(entries.begin(), entries.end(), app_manifest_less);
+
+  app_manifest_header_t header = {};
+  memcpy(header.magic, APP_MANIFEST_MAGIC, sizeof(header.magic));
+  header.version = APP_MANIFEST_VERSION;
+  header.source_id_len = manifest.source_id.length();
+  header.collection_len = manifest.collection.length();
+  header.n_entries = entries.size();
+
+  // written aside and renamed over, so a crash leaves the old one intact
+  const std::string tmp = manifest.path + ".tmp";
+  FILE *file = fopen(tmp.c_str(), "wb");
+  if (NULL == file)
+  {
+    LOG_ERR("could not create '%s': %s.\n", tmp.c_str(), strerror(errno));
+    return false;
+  }
+
+  bool written =
+      fwrite(&header, sizeof(header), 1, file) == 1 &&
+      fwrite(manifest.source_id.data(), 1, header.source_id_len, file) ==
+          header.source_id_len &&
+      fwrite(manifest.collection.data(), 1, header.collection_len, file) ==
+          header.collection_len &&
+      fwrite(entries.data(), sizeof(app_manifest_entry_t), entries.size(),
+             file) == entries.size();
+
+  written = fflush(file) == 0 && fsync(fileno(file)) == 0 && written;
+  written = fclose(file) == 0 && written;
+
+  if (!written || rename(tmp.c_str(), manifest.path.c_str()) != 0)
+  {
+    LOG_ERR("could not write manifest '%s': %s.\n", manifest.path.c_str(),
+            strerror(errno));
+    unlink(tmp.c_str());
+    return false;
+  }
+
+  return true;
+}
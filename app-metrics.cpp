@@ -0,0 +1,390 @@
+#include "app-metrics.h"
+#include "httpd.h"
+#include "utils.h"
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <errno.h>
+#include <mutex>
+#include <stdio.h>
+#include <string.h>
+#include <thread>
+
+// threads spread over this many copies of every metric
+#define APP_METRICS_SHARDS 16
+
+// histogram bounds, plus one bucket above the last
+#define APP_METRICS_MAX_BUCKETS 16
+
+#define APP_METRICS_CONTENT_TYPE "text/plain; version=0.0.4; charset=utf-8"
+
+typedef struct _app_metric_info
+{
+  const char *name;
+  const char *labels; // without braces, "" for none
+  const char *help;
+  app_metric_type_t type;
+  const double *bounds; // histograms: upper bounds, ascending
+  int n_bounds;
+} app_metric_info_t;
+
+static const double app_metrics_seconds[] = {0.001, 0.0025, 0.005, 0.01,
+                                             0.025, 0.05,   0.1,   0.25,
+                                             0.5,   1.0,    2.5,   5.0,
+                                             10.0};
+
+static const double app_metrics_ratio[] = {0.1, 0.2, 0.3, 0.4, 0.5, 0.6,
+                                           0.7, 0.8, 0.9, 0.95, 1.0};
+
+#define APP_METRICS_BOUNDS(b) b, (int)(sizeof(b) / sizeof(b[0]))
+
+// in app_metric_t order; metrics sharing a name differ by their labels
+static const app_metric_info_t app_metrics_info[] = {
+    {"embed2vecdb_records_total", "", "Records read from the source.",
+     MetricCounter, NULL, 0},
+    {"embed2vecdb_tokens_total", "", "Tokens out of the tokenizer.",
+     MetricCounter, NULL, 0},
+    {"embed2vecdb_decode_calls_total", "", "llama_decode calls.",
+     MetricCounter, NULL, 0},
+    {"embed2vecdb_decode_tokens_total", "", "Tokens decoded.", MetricCounter,
+     NULL, 0},
+    {"embed2vecdb_decode_capacity_tokens_total", "",
+     "Tokens the decoded batches could have held.", MetricCounter, NULL, 0},
+    {"embed2vecdb_embeddings_total", "",
+     "Embeddings returned, cached and repeated ones included.", MetricCounter,
+     NULL, 0},
+    {"embed2vecdb_cache_hits_total", "", "Embeddings served from the cache.",
+     MetricCounter, NULL, 0},
+    {"embed2vecdb_points_total", "", "Points the sink accepted.",
+     MetricCounter, NULL, 0},
+    {"embed2vecdb_upsert_requests_total", "", "Upsert requests completed.",
+     MetricCounter, NULL, 0},
+    {"embed2vecdb_upsert_retries_total", "", "Upsert attempts retried.",
+     MetricCounter, NULL, 0},
+    {"embed2vecdb_upsert_bytes_total", "",
+     "Upsert body bytes, before compression.", MetricCounter, NULL, 0},
+    {"embed2vecdb_upsert_wire_bytes_total", "", "Upsert body bytes sent.",
+     MetricCounter, NULL, 0},
+    {"embed2vecdb_errors_total", "stage=\"tokenize\"", "Failures, by stage.",
+     MetricCounter, NULL, 0},
+    {"embed2vecdb_errors_total", "stage=\"decode\"", "Failures, by stage.",
+     MetricCounter, NULL, 0},
+    {"embed2vecdb_errors_total", "stage=\"upload\"", "Failures, by stage.",
+     MetricCounter, NULL, 0},
+    {"embed2vecdb_queue_depth", "queue=\"decode\"",
+     "Chunks waiting in a pipeline queue.", MetricGauge, NULL, 0},
+    {"embed2vecdb_queue_depth", "queue=\"upload\"",
+     "Chunks waiting in a pipeline queue.", MetricGauge, NULL, 0},
+    {"embed2vecdb_upserts_in_flight", "", "Upsert requests in flight.",
+     MetricGauge, NULL, 0},
+    {"embed2vecdb_decode_duration_seconds", "", "One llama_decode call.",
+     MetricHistogram, APP_METRICS_BOUNDS(app_metrics_seconds)},
+    {"embed2vecdb_batch_fill_ratio", "",
+     "Tokens of a decoded batch over its capacity.", MetricHistogram,
+     APP_METRICS_BOUNDS(app_metrics_ratio)},
+    {"embed2vecdb_upsert_duration_seconds", "",
+     "One upsert, from submission to completion, retries included.",
+     MetricHistogram, APP_METRICS_BOUNDS(app_metrics_seconds)},
+};
+
+static_assert(sizeof(app_metrics_info) / sizeof(app_metrics_info[0]) ==
+                  MetricCount,
+              "app_metrics_info must list every app_metric_t");
+
+// one cache line (or three) per metric and shard, so threads on different
+// shards never share one
+typedef struct alignas(64) _app_metrics_shard
+{
+  std::atomic<uint64_t> count; // counters, histogram observations
+  std::atomic<uint64_t> sum;   // histograms: the bits of a double
+  std::atomic<uint64_t> buckets[APP_METRICS_MAX_BUCKETS]; // not cumulative
+} app_metrics_shard_t;
+
+static app_metrics_shard_t app_metrics_shards[MetricCount][APP_METRICS_SHARDS];
+static std::atomic<uint64_t> app_metrics_gauges[MetricCount]; // double bits
+
+static httpd_t app_metrics_httpd;
+static bool app_metrics_serving = false;
+
+static std::thread app_metrics_dumper;
+static std::mutex app_metrics_mutex;
+static std::condition_variable app_metrics_wake;
+static bool app_metrics_stopping = false;
+static std::string app_metrics_path;
+
+static size_t app_metrics_shard()
+{
+  static std::atomic<size_t> next(0);
+  thread_local const size_t shard =
+      next.fetch_add(1, std::memory_order_relaxed) % APP_METRICS_SHARDS;
+
+  return shard;
+}
+
+static double app_metrics_to_double(uint64_t bits)
+{
+  double value;
+  memcpy(&value, &bits, sizeof(value));
+
+  return value;
+}
+
+static uint64_t app_metrics_to_bits(double value)
+{
+  uint64_t bits;
+  memcpy(&bits, &value, sizeof(bits));
+
+  return bits;
+}
+
+void app_metrics_add(app_metric_t metric, uint64_t n)
+{
+  app_metrics_shards[metric][app_metrics_shard()].count.fetch_add(
+      n, std::memory_order_relaxed);
+}
+
+void app_metrics_set(app_metric_t metric, double value)
+{
+  app_metrics_gauges[metric].store(app_metrics_to_bits(value),
+                                   std::memory_order_relaxed);
+}
+
+void app_metrics_observe(app_metric_t metric, double value)
+{
+  const app_metric_info_t &info = app_metrics_info[metric];
+  app_metrics_shard_t &shard = app_metrics_shards[metric][app_metrics_shard()];
+
+  int bucket = 0;
+  while (bucket < info.n_bounds && value > info.bounds[bucket])
+  {
+    bucket++;
+  }
+
+  shard.buckets[bucket].fetch_add(1, std::memory_order_relaxed);
+  shard.count.fetch_add(1, std::memory_order_relaxed);
+
+  // only this shard's threads add to it, so the loop rarely goes round
+  uint64_t old = shard.sum.load(std::memory_order_relaxed);
+  while (!shard.sum.compare_exchange_weak(
+      old, app_metrics_to_bits(app_metrics_to_double(old) + value),
+      std::memory_order_relaxed))
+  {
+  }
+}
+
+static void app_metrics_append(std::string &out, const char *name,
+                               const char *suffix, const std::string &labels,
+                               const char *value)
+{
+  out.append(name);
+  out.append(suffix);
+  if (!labels.empty())
+  {
+    out.push_back('{');
+    out.append(labels);
+    out.push_back('}');
+  }
+  out.push_back(' ');
+  out.append(value);
+  out.push_back('\n');
+}
+
+void app_metrics_write(std::string &out)
+{
+  static const char *types[] = {"counter", "gauge", "histogram"};
+
+  char value[64];
+  out.clear();
+
+  for (int m = 0; m < MetricCount; m++)
+  {
+    const app_metric_info_t &info = app_metrics_info[m];
+
+    if (m == 0 || strcmp(info.name, app_metrics_info[m - 1].name) != 0)
+    {
+      out.append("# HELP ").append(info.name).append(" ");
+      out.append(info.help).append("\n");
+      out.append("# TYPE ").append(info.name).append(" ");
+      out.append(types[info.type]).append("\n");
+    }
+
+    uint64_t count = 0;
+    double sum = 0.0;
+    uint64_t buckets[APP_METRICS_MAX_BUCKETS] = {};
+    for (const app_metrics_shard_t &shard : app_metrics_shards[m])
+    {
+      count += shard.count.load(std::memory_order_relaxed);
+      sum += app_metrics_to_double(shard.sum.load(std::memory_order_relaxed));
+      for (int b = 0; b <= info.n_bounds; b++)
+      {
+        buckets[b] += shard.buckets[b].load(std::memory_order_relaxed);
+      }
+    }
+
+    switch (info.type)
+    {
+    case MetricCounter:
+      snprintf(value, sizeof(value), "%llu", (unsigned long long)count);
+      app_metrics_append(out, info.name, "", info.labels, value);
+      break;
+    case MetricGauge:
+      snprintf(value, sizeof(value), "%.9g",
+               app_metrics_to_double(
+                   app_metrics_gauges[m].load(std::memory_order_relaxed)));
+      app_metrics_append(out, info.name, "", info.labels, value);
+      break;
+    case MetricHistogram:
+    {
+      // shards are read one after the other, so the buckets are summed up
+      // to their own total rather than to 'count'
+      const std::string sep = info.labels[0] != '\0' ? "," : "";
+      uint64_t cumulative = 0;
+      for (int b = 0; b <= info.n_bounds; b++)
+      {
+        cumulative += buckets[b];
+
+        char le[48];
+        if (b < info.n_bounds)
+        {
+          snprintf(le, sizeof(le), "le=\"%g\"", info.bounds[b]);
+        }
+        else
+        {
+          snprintf(le, sizeof(le), "le=\"+Inf\"");
+        }
+
+        snprintf(value, sizeof(value), "%llu", (unsigned long long)cumulative);
+        app_metrics_append(out, info.name, "_bucket",
+                           info.labels + sep + le, value);
+      }
+
+      snprintf(value, sizeof(value), "%.9g", sum);
+      app_metrics_append(out, info.name, "_sum", info.labels, value);
+      snprintf(value, sizeof(value), "%llu", (unsigned long long)cumulative);
+      app_metrics_append(out, info.name, "_count", info.labels, value);
+      break;
+    }
+    default:
+      break;
+    }
+  }
+}
+
+// replaced in one rename, so a collector never reads half a file
+static bool app_metrics_dump(const std::string &path)
+{
+  std::string text;
+  app_metrics_write(text);
+
+  const std::string tmp = path + ".tmp";
+  FILE *file = fopen(tmp.c_str(), "w");
+  bool written = file != NULL &&
+                 fwrite(text.data(), 1, text.size(), file) == text.size();
+  written = file != NULL && fclose(file) == 0 && written;
+
+  if (!written || rename(tmp.c_str(), path.c_str()) != 0)
+  {
+    LOG_ERR("could not write '%s': %s.\n", path.c_str(), strerror(errno));
+    remove(tmp.c_str());
+    return false;
+  }
+
+  return true;
+}
+
+static void app_metrics_handle(const httpd_request_t &request,
+                               httpd_response_t &response)
+{
+  if (request.path != "/metrics")
+  {
+    response.status = 404;
+    response.content_type = "text/plain";
+    response.body = "try /metrics\n";
+    return;
+  }
+
+  if (request.method != "GET" && request.method != "HEAD")
+  {
+    response.status = 405;
+    response.content_type = "text/plain";
+    return;
+  }
+
+  response.content_type = APP_METRICS_CONTENT_TYPE;
+  app_metrics_write(response.body);
+}
+
+static bool app_metrics_listen(const std::string &listen)
+{
+  httpd_config_t config;
+  httpd_default_config(&config);
+  if (!httpd_parse_address(listen, &config) ||
+      !httpd_start(config, app_metrics_handle, &app_metrics_httpd))
+  {
+    return false;
+  }
+
+  app_metrics_serving = true;
+  LOG("metrics on %s/metrics\n", httpd_address(app_metrics_httpd).c_str());
+
+  return true;
+}
+
+bool app_metrics_start(const std::string &listen, const std::string &path,
+                       int interval_s)
+{
+  if (!listen.empty() && !app_metrics_listen(listen))
+  {
+    return false;
+  }
+
+  if (path.empty())
+  {
+    return true;
+  }
+
+  // fails early on a path that can not be written
+  if (!app_metrics_dump(path))
+  {
+    app_metrics_stop();
+    return false;
+  }
+
+  app_metrics_path = path;
+  app_metrics_stopping = false;
+  app_metrics_dumper = std::thread(
+      [interval_s]()
+      {
+        std::unique_lock<std::mutex> lock(app_metrics_mutex);
+        while (!app_metrics_wake.wait_for(lock,
+                                          std::chrono::seconds(interval_s),
+                                          [] { return app_metrics_stopping; }))
+        {
+          app_metrics_dump(app_metrics_path);
+        }
+      });
+
+  return true;
+}
+
+void app_metrics_stop()
+{
+  if (app_metrics_serving)
+  {
+    httpd_stop(&app_metrics_httpd);
+    app_metrics_serving = false;
+  }
+
+  if (app_metrics_dumper.joinable())
+  {
+    {
+      std::lock_guard<std::mutex> lock(app_metrics_mutex);
+      app_metrics_stopping = true;
+    }
+    app_metrics_wake.notify_all();
+    app_metrics_dumper.join();
+
+    // the final values
+    app_metrics_dump(app_metrics_path);
+  }
+}
@@ -0,0 +1,502 @@
+#include "app-normalize.h"
+#include <algorithm>
+#include <cmath>
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define APP_NORMALIZE_X86
+#define APP_NORMALIZE_AVX2 __attribute__((target("avx2,fma")))
+#define APP_NORMALIZE_AVX512 __attribute__((target("avx512f")))
+#endif
+
+/*
+ * Every instruction set provides one kernel per norm (max absolute,
+ * euclidean, integer p-norm) plus the scaled copy. Kernels are templates on
+ * the row width: N = 0 takes it at run time, the common embedding widths
+ * below are instantiated with it fixed so loops unroll without tails.
+ */
+
+typedef void (*app_normalize_fn_t)(const float *, float *, int, int);
+
+#define APP_NORMALIZE_WIDTHS 5
+
+static int app_normalize_slot(int n)
+{
+  switch (n)
+  {
+  case 384:
+    return 1;
+  case 768:
+    return 2;
+  case 1024:
+    return 3;
+  case 4096:
+    return 4;
+  default:
+    return 0;
+  }
+}
+
+// x^p for p >= 1, by squaring
+static inline double app_normalize_powi(double x, int p)
+{
+  double r = 1.0;
+  while (p > 0)
+  {
+    if (p & 1)
+    {
+      r *= x;
+    }
+    x *= x;
+    p >>= 1;
+  }
+
+  return r;
+}
+
+// the norm of a row from its reduction: max |x|, sum x^2 or sum |x|^p
+static float app_normalize_scale(double sum, int p)
+{
+  switch (p)
+  {
+  case 0:
+    sum /= 32760.0; // make an int16 range
+    break;
+  case 2:
+    sum = std::sqrt(sum);
+    break;
+  default:
+    sum = std::pow(sum, 1.0 / p);
+    break;
+  }
+
+  return sum > 0.0 ? 1.0 / sum : 0.0f;
+}
+
+// p-norms the kernels do not vectorize (p < 1)
+static double app_normalize_sum_pow(const float *inp, int n, int p)
+{
+  double sum = 0.0;
+  for (int i = 0; i < n; i++)
+  {
+    sum += std::pow(std::abs(inp[i]), p);
+  }
+
+  return sum;
+}
+
+/* scalar */
+
+template <int N>
+static void app_normalize_scalar(const float *inp, float *out, int n, int p)
+{
+  if (N > 0)
+  {
+    n = N;
+  }
+
+  double sum = 0.0;
+  if (p == 0)
+  {
+    float max = 0.0f;
+    for (int i = 0; i < n; i++)
+    {
+      max = std::max(max, std::abs(inp[i]));
+    }
+    sum = max;
+  }
+  else if (p >= 1)
+  {
+    // four chains, so the adds do not wait on each other
+    double acc[4] = {0.0, 0.0, 0.0, 0.0};
+    int i = 0;
+    if (p == 2)
+    {
+      for (; i + 4 <= n; i += 4)
+      {
+        for (int j = 0; j < 4; j++)
+        {
+          acc[j] += (double)inp[i + j] * inp[i + j];
+        }
+      }
+    }
+    else
+    {
+      for (; i + 4 <= n; i += 4)
+      {
+        for (int j = 0; j < 4; j++)
+        {
+          acc[j] += app_normalize_powi(std::abs((double)inp[i + j]), p);
+        }
+      }
+    }
+    for (; i < n; i++)
+    {
+      acc[0] += app_normalize_powi(std::abs((double)inp[i]), p);
+    }
+    sum = (acc[0] + acc[1]) + (acc[2] + acc[3]);
+  }
+  else
+  {
+    sum = app_normalize_sum_pow(inp, n, p);
+  }
+
+  const float norm = app_normalize_scale(sum, p);
+  for (int i = 0; i < n; i++)
+  {
+    out[i] = inp[i] * norm;
+  }
+}
+
+#ifdef APP_NORMALIZE_X86
+
+/* AVX2 + FMA: 4 doubles or 8 floats per register */
+
+APP_NORMALIZE_AVX2 static inline __m256d app_normalize_powi_avx2(__m256d x,
+                                                                 int p)
+{
+  __m256d r = _mm256_set1_pd(1.0);
+  while (p > 0)
+  {
+    if (p & 1)
+    {
+      r = _mm256_mul_pd(r, x);
+    }
+    x = _mm256_mul_pd(x, x);
+    p >>= 1;
+  }
+
+  return r;
+}
+
+APP_NORMALIZE_AVX2 static inline double app_normalize_hsum_avx2(__m256d v)
+{
+  const __m128d s =
+      _mm_add_pd(_mm256_castpd256_pd128(v), _mm256_extractf128_pd(v, 1));
+  return _mm_cvtsd_f64(_mm_add_sd(s, _mm_unpackhi_pd(s, s)));
+}
+
+template <int N>
+APP_NORMALIZE_AVX2 static void app_normalize_avx2(const float *inp,
+                                                  float *out, int n, int p)
+{
+  if (N > 0)
+  {
+    n = N;
+  }
+
+  double sum = 0.0;
+  int i = 0;
+  if (p == 0)
+  {
+    const __m256 sign = _mm256_set1_ps(-0.0f);
+    __m256 m0 = _mm256_setzero_ps(), m1 = m0, m2 = m0, m3 = m0;
+    for (; i + 32 <= n; i += 32)
+    {
+      m0 = _mm256_max_ps(_mm256_andnot_ps(sign, _mm256_loadu_ps(inp + i)), m0);
+      m1 = _mm256_max_ps(
+          _mm256_andnot_ps(sign, _mm256_loadu_ps(inp + i + 8)), m1);
+      m2 = _mm256_max_ps(
+          _mm256_andnot_ps(sign, _mm256_loadu_ps(inp + i + 16)), m2);
+      m3 = _mm256_max_ps(
+          _mm256_andnot_ps(sign, _mm256_loadu_ps(inp + i + 24)), m3);
+    }
+    m0 = _mm256_max_ps(_mm256_max_ps(m0, m1), _mm256_max_ps(m2, m3));
+
+    __m128 m = _mm_max_ps(_mm256_castps256_ps128(m0),
+                          _mm256_extractf128_ps(m0, 1));
+    m = _mm_max_ps(m, _mm_movehl_ps(m, m));
+    m = _mm_max_ss(m, _mm_shuffle_ps(m, m, 1));
+
+    float max = _mm_cvtss_f32(m);
+    for (; i < n; i++)
+    {
+      max = std::max(max, std::abs(inp[i]));
+    }
+    sum = max;
+  }
+  else if (p >= 1)
+  {
+    const __m256d sign = _mm256_set1_pd(-0.0);
+    __m256d a0 = _mm256_setzero_pd(), a1 = a0, a2 = a0, a3 = a0;
+    for (; i + 16 <= n; i += 16)
+    {
+      const __m256d x0 = _mm256_cvtps_pd(_mm_loadu_ps(inp + i));
+      const __m256d x1 = _mm256_cvtps_pd(_mm_loadu_ps(inp + i + 4));
+      const __m256d x2 = _mm256_cvtps_pd(_mm_loadu_ps(inp + i + 8));
+      const __m256d x3 = _mm256_cvtps_pd(_mm_loadu_ps(inp + i + 12));
+      if (p == 2)
+      {
+        a0 = _mm256_fmadd_pd(x0, x0, a0);
+        a1 = _mm256_fmadd_pd(x1, x1, a1);
+        a2 = _mm256_fmadd_pd(x2, x2, a2);
+        a3 = _mm256_fmadd_pd(x3, x3, a3);
+      }
+      else
+      {
+        a0 = _mm256_add_pd(
+            app_normalize_powi_avx2(_mm256_andnot_pd(sign, x0), p), a0);
+        a1 = _mm256_add_pd(
+            app_normalize_powi_avx2(_mm256_andnot_pd(sign, x1), p), a1);
+        a2 = _mm256_add_pd(
+            app_normalize_powi_avx2(_mm256_andnot_pd(sign, x2), p), a2);
+        a3 = _mm256_add_pd(
+            app_normalize_powi_avx2(_mm256_andnot_pd(sign, x3), p), a3);
+      }
+    }
+    sum = app_normalize_hsum_avx2(
+        _mm256_add_pd(_mm256_add_pd(a0, a1), _mm256_add_pd(a2, a3)));
+
+    for (; i < n; i++)
+    {
+      sum += app_normalize_powi(std::abs((double)inp[i]), p);
+    }
+  }
+  else
+  {
+    sum = app_normalize_sum_pow(inp, n, p);
+  }
+
+  const float norm = app_normalize_scale(sum, p);
+  const __m256 vnorm = _mm256_set1_ps(norm);
+
+  i = 0;
+  for (; i + 32 <= n; i += 32)
+  {
+    _mm256_storeu_ps(out + i, _mm256_mul_ps(_mm256_loadu_ps(inp + i), vnorm));
+    _mm256_storeu_ps(out + i + 8,
+                     _mm256_mul_ps(_mm256_loadu_ps(inp + i + 8), vnorm));
+    _mm256_storeu_ps(out + i + 16,
+                     _mm256_mul_ps(_mm256_loadu_ps(inp + i + 16), vnorm));
+    _mm256_storeu_ps(out + i + 24,
+                     _mm256_mul_ps(_mm256_loadu_ps(inp + i + 24), vnorm));
+  }
+  for (; i < n; i++)
+  {
+    out[i] = inp[i] * norm;
+  }
+}
+
+/* AVX-512F: 8 doubles or 16 floats per register */
+
+APP_NORMALIZE_AVX512 static inline __m512d
+app_normalize_powi_avx512(__m512d x, int p)
+{
+  __m512d r = _mm512_set1_pd(1.0);
+  while (p > 0)
+  {
+    if (p & 1)
+    {
+      r = _mm512_mul_pd(r, x);
+    }
+    x = _mm512_mul_pd(x, x);
+    p >>= 1;
+  }
+
+  return r;
+}
+
+template <int N>
+APP_NORMALIZE_AVX512 static void app_normalize_avx512(const float *inp,
+                                                      float *out, int n, int p)
+{
+  if (N > 0)
+  {
+    n = N;
+  }
+
+  double sum = 0.0;
+  int i = 0;
+  if (p == 0)
+  {
+    __m512 m0 = _mm512_setzero_ps(), m1 = m0, m2 = m0, m3 = m0;
+    for (; i + 64 <= n; i += 64)
+    {
+      m0 = _mm512_max_ps(_mm512_abs_ps(_mm512_loadu_ps(inp + i)), m0);
+      m1 = _mm512_max_ps(_mm512_abs_ps(_mm512_loadu_ps(inp + i + 16)), m1);
+      m2 = _mm512_max_ps(_mm512_abs_ps(_mm512_loadu_ps(inp + i + 32)), m2);
+      m3 = _mm512_max_ps(_mm512_abs_ps(_mm512_loadu_ps(inp + i + 48)), m3);
+    }
+    for (; i + 16 <= n; i += 16)
+    {
+      m0 = _mm512_max_ps(_mm512_abs_ps(_mm512_loadu_ps(inp + i)), m0);
+    }
+    m0 = _mm512_max_ps(_mm512_max_ps(m0, m1), _mm512_max_ps(m2, m3));
+
+    float max = _mm512_reduce_max_ps(m0);
+    for (; i < n; i++)
+    {
+      max = std::max(max, std::abs(inp[i]));
+    }
+    sum = max;
+  }
+  else if (p >= 1)
+  {
+    __m512d a0 = _mm512_setzero_pd(), a1 = a0, a2 = a0, a3 = a0;
+    for (; i + 32 <= n; i += 32)
+    {
+      const __m512d x0 = _mm512_cvtps_pd(_mm256_loadu_ps(inp + i));
+      const __m512d x1 = _mm512_cvtps_pd(_mm256_loadu_ps(inp + i + 8));
+      const __m512d x2 = _mm512_cvtps_pd(_mm256_loadu_ps(inp + i + 16));
+      const __m512d x3 = _mm512_cvtps_pd(_mm256_loadu_ps(inp + i + 24));
+      if (p == 2)
+      {
+        a0 = _mm512_fmadd_pd(x0, x0, a0);
+        a1 = _mm512_fmadd_pd(x1, x1, a1);
+        a2 = _mm512_fmadd_pd(x2, x2, a2);
+        a3 = _mm512_fmadd_pd(x3, x3, a3);
+      }
+      else
+      {
+        a0 = _mm512_add_pd(
+            app_normalize_powi_avx512(_mm512_abs_pd(x0), p), a0);
+        a1 = _mm512_add_pd(
+            app_normalize_powi_avx512(_mm512_abs_pd(x1), p), a1);
+        a2 = _mm512_add_pd(
+            app_normalize_powi_avx512(_mm512_abs_pd(x2), p), a2);
+        a3 = _mm512_add_pd(
+            app_normalize_powi_avx512(_mm512_abs_pd(x3), p), a3);
+      }
+    }
+    sum = _mm512_reduce_add_pd(
+        _mm512_add_pd(_mm512_add_pd(a0, a1), _mm512_add_pd(a2, a3)));
+
+    for (; i < n; i++)
+    {
+      sum += app_normalize_powi(std::abs((double)inp[i]), p);
+    }
+  }
+  else
+  {
+    sum = app_normalize_sum_pow(inp, n, p);
+  }
+
+  const float norm = app_normalize_scale(sum, p);
+  const __m512 vnorm = _mm512_set1_ps(norm);
+
+  i = 0;
+  for (; i + 64 <= n; i += 64)
+  {
+    _mm512_storeu_ps(out + i, _mm512_mul_ps(_mm512_loadu_ps(inp + i), vnorm));
+    _mm512_storeu_ps(out + i + 16,
+                     _mm512_mul_ps(_mm512_loadu_ps(inp + i + 16), vnorm));
+    _mm512_storeu_ps(out + i + 32,
+                     _mm512_mul_ps(_mm512_loadu_ps(inp + i + 32), vnorm));
+    _mm512_storeu_ps(out + i + 48,
+                     _mm512_mul_ps(_mm512_loadu_ps(inp + i + 48), vnorm));
+  }
+  if (i < n)
+  {
+    // the tail in one masked pass
+    for (; i + 16 <= n; i += 16)
+    {
+      _mm512_storeu_ps(out + i,
+                       _mm512_mul_ps(_mm512_loadu_ps(inp + i), vnorm));
+    }
+
+    const __mmask16 mask = (__mmask16)((1u << (n - i)) - 1);
+    _mm512_mask_storeu_ps(
+        out + i, mask,
+        _mm512_mul_ps(_mm512_maskz_loadu_ps(mask, inp + i), vnorm));
+  }
+}
+
+#endif // APP_NORMALIZE_X86
+
+#define APP_NORMALIZE_KERNELS(isa)                                           \
+  {                                                                          \
+    app_normalize_##isa<0>, app_normalize_##isa<384>,                        \
+        app_normalize_##isa<768>, app_normalize_##isa<1024>,                 \
+        app_normalize_##isa<4096>                                            \
+  }
+
+static const app_normalize_fn_t
+    app_normalize_kernels[NormalizeIsaCount][APP_NORMALIZE_WIDTHS] = {
+        APP_NORMALIZE_KERNELS(scalar),
+#ifdef APP_NORMALIZE_X86
+        APP_NORMALIZE_KERNELS(avx2),
+        APP_NORMALIZE_KERNELS(avx512),
+#endif
+};
+
+static bool app_normalize_supported(app_normalize_isa_t isa)
+{
+  switch (isa)
+  {
+  case NormalizeScalar:
+    return true;
+#ifdef APP_NORMALIZE_X86
+  case NormalizeAVX2:
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma");
+  case NormalizeAVX512:
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("avx512f");
+#endif
+  default:
+    return false;
+  }
+}
+
+static app_normalize_isa_t app_normalize_detect()
+{
+  int isa = NormalizeIsaCount - 1;
+  while (isa > NormalizeScalar &&
+         !app_normalize_supported((app_normalize_isa_t)isa))
+  {
+    isa--;
+  }
+
+  return (app_normalize_isa_t)isa;
+}
+
+static app_normalize_isa_t app_normalize_isa = app_normalize_detect();
+
+void app_normalize(const float *inp, float *out, int n, int norm)
+{
+  if (norm == -1) // no normalisation
+  {
+    if (out != inp)
+    {
+      memcpy(out, inp, (size_t)n * sizeof(float));
+    }
+    return;
+  }
+
+  app_normalize_kernels[app_normalize_isa][app_normalize_slot(n)](inp, out, n,
+                                                                  norm);
+}
+
+app_normalize_isa_t app_normalize_get_isa()
+{
+  return app_normalize_isa;
+}
+
+bool app_normalize_set_isa(app_normalize_isa_t isa)
+{
+  if (isa < NormalizeScalar || isa >= NormalizeIsaCount ||
+      !app_normalize_supported(isa))
+  {
+    return false;
+  }
+
+  app_normalize_isa = isa;
+
+  return true;
+}
+
+const char *app_normalize_isa_name(app_normalize_isa_t isa)
+{
+  switch (isa)
+  {
+  case NormalizeScalar:
+    return "scalar";
+  case NormalizeAVX2:
+    return "avx2";
+  case NormalizeAVX512:
+    return "avx512";
+  default:
+    return "unknown";
+  }
+}
@@ -0,0 +1,250 @@
+#include "app-query.h"
+#include "app-hnsw.h"
+#include "app-source.h"
+#include "qdrant-quantize.h"
+#include "utils.h"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+
+static double app_query_seconds_since(
+    const std::chrono::steady_clock::time_point &t0)
+{
+  return std::chrono::duration<double>(std::chrono::steady_clock::now() - t0)
+      .count();
+}
+
+static void app_query_print_result(size_t n, std::string_view text,
+                                   const qdrant_search_result_t &result)
+{
+  printf("query %zu: \"%.*s\"\n", n, (int)text.length(), text.data());
+
+  for (size_t r = 0; r < result.size(); r++)
+  {
+    const qdrant_scored_point_t &point = result[r];
+
+    // ingested points keep their record under "text"
+    std::string payload;
+    if (point.payload.is_object() && point.payload.contains("text") &&
+        point.payload["text"].is_string())
+    {
+      payload = point.payload["text"].get<std::string>();
+    }
+    else if (!point.payload.is_null())
+    {
+      payload = point.payload.dump();
+    }
+
+    printf("  %3zu  %9.5f  %s  %s\n", r + 1, point.score, point.id.c_str(),
+           payload.c_str());
+  }
+}
+
+// the results a qdrant search would give, from the local index
+static void app_query_search_index(const app_hnsw_t &index, int ef,
+                                   int n_threads, const float *queries,
+                                   size_t n,
+                                   const qdrant_search_params_t &params,
+                                   std::vector<qdrant_search_result_t> &results)
+{
+  results.resize(n);
+
+  parallel_for(n, n_threads,
+               [&](size_t begin, size_t end)
+               {
+                 std::vector<app_hnsw_hit_t> hits;
+                 for (size_t k = begin; k < end; k++)
+                 {
+                   app_hnsw_search(index, queries + k * index.dim,
+                                   params.limit, ef, hits);
+
+                   qdrant_search_result_t &result = results[k];
+                   result.resize(hits.size());
+                   for (size_t r = 0; r < hits.size(); r++)
+                   {
+                     result[r].id = app_hnsw_id(index, hits[r].node);
+                     result[r].score = hits[r].score;
+                     result[r].payload =
+                         params.with_payload
+                             ? nlohmann::json{{"text",
+                                               std::string(app_hnsw_payload(
+                                                   index, hits[r].node))}}
+                             : nlohmann::json();
+                   }
+                 }
+               });
+}
+
+bool app_query_run(const app_llama_args_t &args, const app_llama_data_t &data,
+                   const qdrant_info_t &info,
+                   const qdrant_colection_info_t &col,
+                   app_query_stats_t *stats)
+{
+  if (NULL == stats)
+  {
+    LOG_ERR("argument 'stats' is NULL.\n");
+    return false;
+  }
+
+  *stats = {};
+
+  if (llama_pooling_type(data.ctx) == LLAMA_POOLING_TYPE_NONE)
+  {
+    LOG_ERR("pooling type NONE yields per-token embeddings, which can not be "
+            "searched for.\n");
+    return false;
+  }
+
+  app_hnsw_t index = {};
+  const bool from_index = !args.hnsw_path.empty();
+  if (from_index)
+  {
+    if (!app_hnsw_load(args.hnsw_path, &index))
+    {
+      return false;
+    }
+
+    if (index.dim != col.size)
+    {
+      LOG_ERR("index '%s' holds %u dims, the queries have %u.\n",
+              args.hnsw_path.c_str(), index.dim, col.size);
+      app_hnsw_destroy(&index);
+      return false;
+    }
+
+    LOG("searching index '%s' (%zu points, %s).\n", args.hnsw_path.c_str(),
+        index.n_points, qdrant_get_distance(index.distance).c_str());
+  }
+
+  app_source_t src;
+  if (!app_source_open(args.query, &src))
+  {
+    app_hnsw_destroy(&index);
+    return false;
+  }
+
+  qdrant_search_params_t params;
+  qdrant_search_default_params(&params);
+  params.limit = args.top_k;
+  params.filter = args.query_filter;
+  params.with_payload = args.query_payload;
+
+  app_source_chunk_t chunk;
+  llama_input_vector_t inputs;
+  std::vector<float> embeddings;
+  std::vector<qdrant_search_result_t> results;
+
+  bool success = true;
+  while (app_source_read(src, data.embd_sep, args.query_batch, chunk) > 0)
+  {
+    const size_t n = chunk.records.size();
+    const auto t0 = std::chrono::steady_clock::now();
+
+    inputs.clear();
+    const int n_prompts = app_llm_tokenize(data, chunk.records, inputs);
+    const double t_tokenize = app_query_seconds_since(t0);
+
+    if (n_prompts != (int)n)
+    {
+      LOG_ERR("could not tokenize queries starting at %zu.\n",
+              chunk.first_record);
+      success = false;
+      break;
+    }
+
+    const auto t1 = std::chrono::steady_clock::now();
+    if (!app_llm_get_embeddings(data, n_prompts, inputs, embeddings))
+    {
+      LOG_ERR("could not get embeddings for queries starting at %zu.\n",
+              chunk.first_record);
+      success = false;
+      break;
+    }
+
+    // the query has to live in the same space as the stored vectors
+    qdrant_quantize(col, embeddings.data(), embeddings.size());
+    const double t_embed = app_query_seconds_since(t1);
+
+    const auto t2 = std::chrono::steady_clock::now();
+    bool searched = true;
+    if (from_index)
+    {
+      app_query_search_index(index, args.hnsw_ef, args.threads,
+                             embeddings.data(), n, params, results);
+    }
+    else if (n == 1)
+    {
+      results.resize(1);
+      searched = qdrant_points_search(info, col, embeddings.data(), params,
+                                      results[0]);
+    }
+    else
+    {
+      searched = qdrant_points_search_batch(info, col, embeddings.data(), n,
+                                            params, results);
+    }
+    const double t_search = app_query_seconds_since(t2);
+
+    if (!searched)
+    {
+      LOG_ERR("search for queries starting at %zu failed.\n",
+              chunk.first_record);
+      success = false;
+      break;
+    }
+
+    for (size_t k = 0; k < n; k++)
+    {
+      app_query_print_result(chunk.first_record + k + 1, chunk.records[k],
+                             results[k]);
+    }
+    printf("  (%zu quer%s: tokenize %.2f ms, embed %.2f ms, search %.2f ms)"
+           "\n",
+           n, n == 1 ? "y" : "ies", 1000.0 * t_tokenize, 1000.0 * t_embed,
+           1000.0 * t_search);
+
+    stats->n_queries += n;
+    stats->n_requests += 1;
+    stats->t_tokenize += t_tokenize;
+    stats->t_embed += t_embed;
+    stats->t_search += t_search;
+    stats->latency.push_back(t_tokenize + t_embed + t_search);
+  }
+
+  app_source_close(&src);
+  app_hnsw_destroy(&index);
+
+  return success;
+}
+
+static double app_query_percentile(const std::vector<double> &sorted,
+                                   double p)
+{
+  if (sorted.empty())
+  {
+    return 0.0;
+  }
+
+  // nearest rank
+  const size_t rank = (size_t)std::ceil(p / 100.0 * sorted.size());
+  return sorted[std::min(sorted.size(), std::max<size_t>(rank, 1)) - 1];
+}
+
+void app_query_print_stats(const app_query_stats_t &stats)
+{
+  const double n = stats.n_requests > 0 ? stats.n_requests : 1;
+
+  std::vector<double> sorted(stats.latency);
+  std::sort(sorted.begin(), sorted.end());
+
+  LOG("queries ....... %zu in %zu requests\n", stats.n_queries,
+      stats.n_requests);
+  LOG("tokenize ...... %.2f ms avg\n", 1000.0 * stats.t_tokenize / n);
+  LOG("embed ......... %.2f ms avg\n", 1000.0 * stats.t_embed / n);
+  LOG("search ........ %.2f ms avg\n", 1000.0 * stats.t_search / n);
+  LOG("end to end .... p50 %.2f, p95 %.2f, p99 %.2f, max %.2f ms\n",
+      1000.0 * app_query_percentile(sorted, 50),
+      1000.0 * app_query_percentile(sorted, 95),
+      1000.0 * app_query_percentile(sorted, 99),
+      1000.0 * (sorted.empty() ? 0.0 : sorted.back()));
+}
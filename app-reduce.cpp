@@ -0,0 +1,357 @@
+#include "app-reduce.h"
+#include "app-normalize.h"
+#include "utils.h"
+#include <algorithm>
+#include <cmath>
+#include <errno.h>
+#include <random>
+#include <stdio.h>
+#include <string.h>
+
+// covariance rows accumulated together, so the samples are streamed once
+// per block instead of once per row
+#define APP_REDUCE_COV_BLOCK 16
+
+bool app_reduce_parse_mode(const std::string &name, app_reduce_mode_t *mode)
+{
+  if (name == "none")
+  {
+    *mode = FullWidth;
+  }
+  else if (name == "matryoshka")
+  {
+    *mode = Matryoshka;
+  }
+  else if (name == "pca")
+  {
+    *mode = Pca;
+  }
+  else
+  {
+    LOG_ERR("unknown reduction '%s' (none, matryoshka or pca).\n",
+            name.c_str());
+    return false;
+  }
+
+  return true;
+}
+
+static float app_reduce_dot(const float *a, const float *b, int n)
+{
+  // independent chains; the compiler will not reorder a float sum itself
+  float s0 = 0.0f, s1 = 0.0f, s2 = 0.0f, s3 = 0.0f;
+  int i = 0;
+  for (; i + 4 <= n; i += 4)
+  {
+    s0 += a[i] * b[i];
+    s1 += a[i + 1] * b[i + 1];
+    s2 += a[i + 2] * b[i + 2];
+    s3 += a[i + 3] * b[i + 3];
+  }
+  for (; i < n; i++)
+  {
+    s0 += a[i] * b[i];
+  }
+
+  return (s0 + s1) + (s2 + s3);
+}
+
+// modified Gram-Schmidt on the rows of 'q' (n rows of d); a row that
+// collapses is replaced by a random direction
+static void app_reduce_orthonormalize(std::vector<float> &q, int n, int d,
+                                      std::mt19937 &rng)
+{
+  std::normal_distribution<float> gauss(0.0f, 1.0f);
+
+  for (int a = 0; a < n; a++)
+  {
+    float *qa = q.data() + (size_t)a * d;
+
+    for (int attempt = 0; attempt < 2; attempt++)
+    {
+      for (int b = 0; b < a; b++)
+      {
+        const float *qb = q.data() + (size_t)b * d;
+        const float proj = app_reduce_dot(qa, qb, d);
+        for (int i = 0; i < d; i++)
+        {
+          qa[i] -= proj * qb[i];
+        }
+      }
+
+      const float len = std::sqrt(app_reduce_dot(qa, qa, d));
+      if (len > 1e-6f)
+      {
+        for (int i = 0; i < d; i++)
+        {
+          qa[i] /= len;
+        }
+        break;
+      }
+
+      for (int i = 0; i < d; i++)
+      {
+        qa[i] = gauss(rng);
+      }
+    }
+  }
+}
+
+bool app_reduce_fit_pca(const float *samples, size_t n_samples, int n_in,
+                        int n_out, int n_threads, app_reduce_t *reduce)
+{
+  if (NULL == reduce)
+  {
+    LOG_ERR("argument 'reduce' is NULL.\n");
+    return false;
+  }
+
+  if (n_out <= 0 || n_out > n_in || n_samples < 2)
+  {
+    LOG_ERR("can not fit %d components of %d dims on %zu samples.\n", n_out,
+            n_in, n_samples);
+    return false;
+  }
+
+  const size_t d = n_in;
+
+  reduce->mode = Pca;
+  reduce->n_in = n_in;
+  reduce->n_out = n_out;
+  reduce->mean.assign(d, 0.0f);
+
+  std::vector<double> mean(d, 0.0);
+  for (size_t s = 0; s < n_samples; s++)
+  {
+    for (size_t i = 0; i < d; i++)
+    {
+      mean[i] += samples[s * d + i];
+    }
+  }
+  for (size_t i = 0; i < d; i++)
+  {
+    reduce->mean[i] = mean[i] / n_samples;
+  }
+
+  std::vector<float> centered(n_samples * d);
+  for (size_t s = 0; s < n_samples; s++)
+  {
+    for (size_t i = 0; i < d; i++)
+    {
+      centered[s * d + i] = samples[s * d + i] - reduce->mean[i];
+    }
+  }
+
+  // covariance, upper triangle, then mirrored
+  std::vector<float> cov(d * d, 0.0f);
+  const size_t n_blocks = (d + APP_REDUCE_COV_BLOCK - 1) / APP_REDUCE_COV_BLOCK;
+
+  parallel_for(n_blocks, n_threads,
+               [&](size_t begin, size_t end)
+               {
+                 for (size_t blk = begin; blk < end; blk++)
+                 {
+                   const size_t i0 = blk * APP_REDUCE_COV_BLOCK;
+                   const size_t i1 = std::min(d, i0 + APP_REDUCE_COV_BLOCK);
+
+                   for (size_t s = 0; s < n_samples; s++)
+                   {
+                     const float *x = centered.data() + s * d;
+                     for (size_t i = i0; i < i1; i++)
+                     {
+                       const float xi = x[i];
+                       float *row = cov.data() + i * d;
+                       for (size_t j = i; j < d; j++)
+                       {
+                         row[j] += xi * x[j];
+                       }
+                     }
+                   }
+                 }
+               });
+
+  double trace = 0.0;
+  for (size_t i = 0; i < d; i++)
+  {
+    for (size_t j = i; j < d; j++)
+    {
+      cov[i * d + j] /= n_samples;
+      cov[j * d + i] = cov[i * d + j];
+    }
+    trace += cov[i * d + i];
+  }
+
+  // subspace iteration: q <- orth(cov q). Any orthonormal basis of the top
+  // subspace gives the same distances, so the rows are not rotated onto the
+  // eigenvectors themselves.
+  std::mt19937 rng(42);
+  std::normal_distribution<float> gauss(0.0f, 1.0f);
+
+  std::vector<float> q((size_t)n_out * d);
+  for (auto &v : q)
+  {
+    v = gauss(rng);
+  }
+  app_reduce_orthonormalize(q, n_out, d, rng);
+
+  std::vector<float> z(q.size());
+  double captured = 0.0;
+
+  for (int it = 0; it < APP_REDUCE_PCA_ITERATIONS; it++)
+  {
+    parallel_for(n_out, n_threads,
+                 [&](size_t begin, size_t end)
+                 {
+                   for (size_t a = begin; a < end; a++)
+                   {
+                     const float *qa = q.data() + a * d;
+                     float *za = z.data() + a * d;
+                     for (size_t i = 0; i < d; i++)
+                     {
+                       za[i] = app_reduce_dot(cov.data() + i * d, qa, d);
+                     }
+                   }
+                 });
+
+    // Rayleigh quotients of an orthonormal basis: the variance it holds
+    captured = 0.0;
+    for (int a = 0; a < n_out; a++)
+    {
+      captured += app_reduce_dot(q.data() + (size_t)a * d,
+                                 z.data() + (size_t)a * d, d);
+    }
+
+    q.swap(z);
+    app_reduce_orthonormalize(q, n_out, d, rng);
+  }
+
+  reduce->components.swap(q);
+
+  LOG("pca: %d of %d dims hold %.1f%% of the variance of %zu samples.\n",
+      n_out, n_in, trace > 0.0 ? 100.0 * captured / trace : 0.0, n_samples);
+
+  return true;
+}
+
+bool app_reduce_load(const std::string &path, app_reduce_t *reduce)
+{
+  if (NULL == reduce)
+  {
+    LOG_ERR("argument 'reduce' is NULL.\n");
+    return false;
+  }
+
+  FILE *file = fopen(path.c_str(), "rb");
+  if (NULL == file)
+  {
+    LOG_ERR("could not open '%s': %s.\n", path.c_str(), strerror(errno));
+    return false;
+  }
+
+  app_reduce_header_t header;
+  if (fread(&header, sizeof(header), 1, file) != 1 ||
+      memcmp(header.magic, APP_REDUCE_MAGIC, sizeof(header.magic)) != 0 ||
+      header.version != APP_REDUCE_VERSION || header.n_out == 0 ||
+      header.n_out > header.n_in)
+  {
+    LOG_ERR("'%s' is not a PCA projection.\n", path.c_str());
+    fclose(file);
+    return false;
+  }
+
+  reduce->mode = Pca;
+  reduce->n_in = header.n_in;
+  reduce->n_out = header.n_out;
+  reduce->salt = header.salt;
+  reduce->mean.resize(header.n_in);
+  reduce->components.resize((size_t)header.n_out * header.n_in);
+
+  const bool complete =
+      fread(reduce->mean.data(), sizeof(float), reduce->mean.size(), file) ==
+          reduce->mean.size() &&
+      fread(reduce->components.data(), sizeof(float),
+            reduce->components.size(),
+            file) == reduce->components.size();
+  fclose(file);
+
+  if (!complete)
+  {
+    LOG_ERR("PCA projection '%s' is truncated.\n", path.c_str());
+    return false;
+  }
+
+  return true;
+}
+
+bool app_reduce_save(const std::string &path, const app_reduce_t &reduce)
+{
+  app_reduce_header_t header = {};
+  memcpy(header.magic, APP_REDUCE_MAGIC, sizeof(header.magic));
+  header.version = APP_REDUCE_VERSION;
+  header.n_in = reduce.n_in;
+  header.n_out = reduce.n_out;
+  header.salt = reduce.salt;
+
+  const std::string tmp = path + ".tmp";
+  FILE *file = fopen(tmp.c_str(), "wb");
+  if (NULL == file)
+  {
+    LOG_ERR("could not create '%s': %s.\n", tmp.c_str(), strerror(errno));
+    return false;
+  }
+
+  bool written =
+      fwrite(&header, sizeof(header), 1, file) == 1 &&
+      fwrite(reduce.mean.data(), sizeof(float), reduce.mean.size(), file) ==
+          reduce.mean.size() &&
+      fwrite(reduce.components.data(), sizeof(float),
+             reduce.components.size(), file) == reduce.components.size();
+  written = fclose(file) == 0 && written;
+
+  if (!written || rename(tmp.c_str(), path.c_str()) != 0)
+  {
+    LOG_ERR("could not write '%s': %s.\n", path.c_str(), strerror(errno));
+    remove(tmp.c_str());
+    return false;
+  }
+
+  return true;
+}
+
+void app_reduce_apply(const app_reduce_t &reduce, std::vector<float> &rows,
+                      size_t n_rows)
+{
+  const size_t n_in = reduce.n_in;
+  const size_t n_out = reduce.n_out;
+
+  // row k is read whole before row k is written, and rows only move left
+  std::vector<float> in(n_in);
+  std::vector<float> out(n_out);
+
+  for (size_t k = 0; k < n_rows; k++)
+  {
+    memcpy(in.data(), rows.data() + k * n_in, n_in * sizeof(float));
+
+    if (reduce.mode == Pca)
+    {
+      for (size_t i = 0; i < n_in; i++)
+      {
+        in[i] -= reduce.mean[i];
+      }
+
+      for (size_t a = 0; a < n_out; a++)
+      {
+        out[a] = app_reduce_dot(reduce.components.data() + a * n_in,
+                                in.data(), n_in);
+      }
+    }
+    else
+    {
+      memcpy(out.data(), in.data(), n_out * sizeof(float));
+    }
+
+    app_normalize(out.data(), rows.data() + k * n_out, n_out, reduce.norm);
+  }
+
+  rows.resize(n_rows * n_out);
+}
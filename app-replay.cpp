@@ -0,0 +1,127 @@
+#include "app-replay.h"
+#include "app-sink.h"
+#include "utils.h"
+#include <chrono>
+
+// points read between two polls of the request window
+#define APP_REPLAY_POLL_POINTS 256
+
+static double app_replay_seconds_since(
+    const std::chrono::steady_clock::time_point &t0)
+{
+  return std::chrono::duration<double>(std::chrono::steady_clock::now() - t0)
+      .count();
+}
+
+bool app_replay_run(const app_llama_args_t &args, const qdrant_info_t &info,
+                    const qdrant_colection_info_t &col,
+                    app_export_reader_t &reader, app_replay_stats_t *stats)
+{
+  if (NULL == stats)
+  {
+    LOG_ERR("argument 'stats' is NULL.\n");
+    return false;
+  }
+
+  *stats = {};
+
+  if (reader.dim != col.size)
+  {
+    LOG_ERR("export holds %u dims, collection '%s' %u.\n", reader.dim,
+            col.name.c_str(), col.size);
+    return false;
+  }
+
+  bool failed = false;
+
+  // callbacks run on this thread, from within add, poll and finish
+  app_sink_t sink;
+  const bool sink_ready = app_sink_open(
+      args, info, col,
+      [&](const qdrant_async_result_t &result, size_t n_points)
+      {
+        stats->n_requests += 1;
+        stats->t_request += result.seconds;
+
+        if (!result.success)
+        {
+          LOG_ERR("upsert of %zu points failed.\n", n_points);
+          failed = true;
+          return;
+        }
+
+        stats->n_points += n_points;
+      },
+      &sink);
+  if (!sink_ready)
+  {
+    return false;
+  }
+
+  LOG("replaying %zu points of %u dims into %s.\n", reader.n_points,
+      reader.dim, sink.target.c_str());
+
+  const auto t_start = std::chrono::steady_clock::now();
+
+  qdrant_point_spec_t point;
+  int read = 0;
+  while (!failed)
+  {
+    const auto t0 = std::chrono::steady_clock::now();
+    read = app_export_read(reader, point);
+    stats->t_read += app_replay_seconds_since(t0);
+
+    if (read <= 0)
+    {
+      break;
+    }
+
+    // blocks while the window is full
+    if (!app_sink_add(sink, point))
+    {
+      failed = true;
+    }
+    else if (sink.n_points % APP_REPLAY_POLL_POINTS == 0)
+    {
+      app_sink_poll(sink);
+    }
+  }
+
+  if (read < 0)
+  {
+    failed = true;
+  }
+
+  if (!failed && !app_sink_finish(sink))
+  {
+    failed = true;
+  }
+
+  stats->t_wall = app_replay_seconds_since(t_start);
+  stats->n_retries = sink.async.n_retried;
+  stats->n_bytes = sink.batcher.n_bytes;
+  stats->n_wire_bytes = sink.batcher.n_wire_bytes;
+
+  app_sink_close(&sink);
+
+  LOG("replayed %zu of %zu points.\n", stats->n_points, reader.n_points);
+
+  return !failed;
+}
+
+void app_replay_print_stats(const app_replay_stats_t &stats)
+{
+  LOG("points ........ %zu\n", stats.n_points);
+  LOG("read .......... %.3f s\n", stats.t_read);
+  LOG("requests ...... %llu (%llu retries, %.1f ms avg)\n",
+      (unsigned long long)stats.n_requests,
+      (unsigned long long)stats.n_retries,
+      stats.n_requests > 0 ? 1000.0 * stats.t_request / stats.n_requests
+                           : 0.0);
+  LOG("on the wire ... %.1f of %.1f MiB (%.1f%%)\n",
+      stats.n_wire_bytes / 1048576.0, stats.n_bytes / 1048576.0,
+      stats.n_bytes > 0 ? 100.0 * stats.n_wire_bytes / stats.n_bytes : 0.0);
+  LOG("wall .......... %.3f s (%.1f MiB/s sent)\n", stats.t_wall,
+      stats.t_wall > 0.0 ? stats.n_wire_bytes / 1048576.0 / stats.t_wall
+                         : 0.0);
+}
@@ -0,0 +1,602 @@
+#include "app-server.h"
+#include "app-metrics.h"
+#include "httpd.h"
+#include "qdrant-json.h"
+#include "qdrant-quantize.h"
+#include "utils.h"
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <errno.h>
+#include <fcntl.h>
+#include <mutex>
+#include <signal.h>
+#include <string.h>
+#include <thread>
+#include <unistd.h>
+#include <uuid/uuid.h>
+
+// the records of one request, waiting for the decoder
+typedef struct _app_server_job
+{
+  std::vector<std::string> records;
+  std::vector<float> embeddings; // one row per record
+  std::chrono::steady_clock::time_point queued;
+  bool done;
+  bool success;
+} app_server_job_t;
+
+typedef struct _app_server
+{
+  const app_llama_args_t *args;
+  const app_llama_data_t *data;
+  const qdrant_info_t *info; // app_run's, handed out like the others
+  qdrant_colection_info_t col;
+  std::chrono::milliseconds max_wait;
+  size_t max_records;
+  std::thread decoder; // owns the llama contexts
+
+  std::mutex mutex;             // guards what follows
+  std::condition_variable wake; // the decoder: work came, or stop
+  std::condition_variable done; // requests: a decode finished
+  std::deque<app_server_job_t *> pending;
+  size_t n_pending; // records in 'pending'
+  bool stopping;
+  uint64_t n_jobs;
+  uint64_t n_records;
+  uint64_t n_decodes; // coalesced app_llm_get_embeddings calls
+
+  std::mutex clients_mutex;                 // guards what follows
+  std::vector<const qdrant_info_t *> idle;  // clients no handler is using
+  std::vector<qdrant_info_t *> owned;       // opened here, closed on exit
+} app_server_t;
+
+// written to by the signal handler, read by app_server_run
+static int app_server_signal_fd = -1;
+
+static void app_server_on_signal(int)
+{
+  const char c = 0;
+  if (write(app_server_signal_fd, &c, 1) < 0)
+  {
+    // nothing to do in a handler
+  }
+}
+
+// embeds the records of 'jobs' in one go
+static bool app_server_embed(app_server_t &server,
+                             const std::vector<app_server_job_t *> &jobs)
+{
+  std::vector<std::string_view> views;
+  for (const app_server_job_t *job : jobs)
+  {
+    views.insert(views.end(), job->records.begin(), job->records.end());
+  }
+
+  llama_input_vector_t inputs;
+  const int n_prompts = app_llm_tokenize(*server.data, views, inputs);
+  if (n_prompts != (int)views.size())
+  {
+    return false;
+  }
+
+  std::vector<float> embeddings;
+  if (!app_llm_get_embeddings(*server.data, n_prompts, inputs, embeddings))
+  {
+    return false;
+  }
+
+  const size_t dim = server.data->n_embd_out;
+  size_t row = 0;
+  for (app_server_job_t *job : jobs)
+  {
+    const float *first = embeddings.data() + row * dim;
+    job->embeddings.assign(first, first + job->records.size() * dim);
+    row += job->records.size();
+  }
+
+  return true;
+}
+
+static void app_server_decode(app_server_t *server)
+{
+  std::vector<app_server_job_t *> jobs;
+
+  std::unique_lock<std::mutex> lock(server->mutex);
+  while (true)
+  {
+    server->wake.wait(lock, [&]
+                      { return server->stopping || !server->pending.empty(); });
+    if (server->pending.empty())
+    {
+      break;
+    }
+
+    // the oldest request waits at most max_wait for others to join it
+    const auto deadline = server->pending.front()->queued + server->max_wait;
+    server->wake.wait_until(lock, deadline,
+                            [&]
+                            {
+                              return server->stopping ||
+                                     server->n_pending >= server->max_records;
+                            });
+
+    // whole requests only; one larger than max_records goes alone
+    jobs.clear();
+    size_t n_records = 0;
+    while (!server->pending.empty() &&
+           (jobs.empty() || n_records + server->pending.front()->records.size() <=
+                                server->max_records))
+    {
+      jobs.push_back(server->pending.front());
+      n_records += jobs.back()->records.size();
+      server->pending.pop_front();
+    }
+    server->n_pending -= n_records;
+    lock.unlock();
+
+    const bool embedded = app_server_embed(*server, jobs);
+    for (app_server_job_t *job : jobs)
+    {
+      job->success = embedded;
+    }
+
+    // a bad record (too long, say) only fails its own request
+    if (!embedded && jobs.size() > 1)
+    {
+      for (app_server_job_t *job : jobs)
+      {
+        job->success = app_server_embed(*server, {job});
+      }
+    }
+
+    lock.lock();
+    for (app_server_job_t *job : jobs)
+    {
+      job->done = true;
+    }
+    server->n_jobs += jobs.size();
+    server->n_records += n_records;
+    server->n_decodes += 1;
+    server->done.notify_all();
+  }
+}
+
+// queues the job and waits for the decoder to embed it
+static bool app_server_submit(app_server_t &server, app_server_job_t &job)
+{
+  job.queued = std::chrono::steady_clock::now();
+  job.done = false;
+  job.success = false;
+
+  std::unique_lock<std::mutex> lock(server.mutex);
+  server.pending.push_back(&job);
+  server.n_pending += job.records.size();
+  server.wake.notify_one();
+
+  server.done.wait(lock, [&] { return job.done; });
+
+  return job.success;
+}
+
+static void app_server_error(httpd_response_t &response, int status,
+                             const std::string &message)
+{
+  response.status = status;
+  response.body = nlohmann::json{{"error", message}}.dump();
+}
+
+// "input": a string or an array of them
+static bool app_server_parse_input(const nlohmann::json &body,
+                                   std::vector<std::string> &records,
+                                   httpd_response_t &response)
+{
+  const nlohmann::json *input =
+      body.is_object() && body.contains("input") ? &body["input"] : NULL;
+
+  if (input != NULL && input->is_string())
+  {
+    records.push_back(input->get<std::string>());
+  }
+  else if (input != NULL && input->is_array())
+  {
+    for (const auto &record : *input)
+    {
+      if (!record.is_string())
+      {
+        app_server_error(response, 400, "\"input\" holds a non string");
+        return false;
+      }
+      records.push_back(record.get<std::string>());
+    }
+  }
+
+  if (records.empty())
+  {
+    app_server_error(response, 400,
+                     "\"input\" must be a string or an array of strings");
+    return false;
+  }
+
+  return true;
+}
+
+// a Qdrant client for this handler alone: a request holds its client's lock
+// for the whole transfer, so a shared one would run them one at a time
+static const qdrant_info_t *app_server_client_acquire(app_server_t &server)
+{
+  {
+    std::lock_guard<std::mutex> lock(server.clients_mutex);
+    if (!server.idle.empty())
+    {
+      const qdrant_info_t *client = server.idle.back();
+      server.idle.pop_back();
+      return client;
+    }
+  }
+
+  qdrant_info_t *client = new qdrant_info_t;
+  if (!qdrant_init(server.args->qdrant_uri, client))
+  {
+    LOG_ERR("could not open another qdrant client.\n");
+    qdrant_destroy(client);
+    delete client;
+    return NULL;
+  }
+
+  std::lock_guard<std::mutex> lock(server.clients_mutex);
+  server.owned.push_back(client);
+
+  return client;
+}
+
+static void app_server_client_release(app_server_t &server,
+                                      const qdrant_info_t *client)
+{
+  std::lock_guard<std::mutex> lock(server.clients_mutex);
+  server.idle.push_back(client);
+}
+
+// "ids", when given: one UUID string per record
+static bool app_server_check_ids(const nlohmann::json &body, size_t n,
+                                 httpd_response_t &response)
+{
+  if (!body.contains("ids"))
+  {
+    return true;
+  }
+
+  const nlohmann::json &ids = body["ids"];
+  if (!ids.is_array() || ids.size() != n)
+  {
+    app_server_error(response, 400, "\"ids\" must match \"input\" one to one");
+    return false;
+  }
+
+  uuid_t uuid;
+  for (const auto &id : ids)
+  {
+    if (!id.is_string() ||
+        uuid_parse(id.get_ref<const std::string &>().c_str(), uuid) != 0)
+    {
+      app_server_error(response, 400, "\"ids\" must be UUID strings");
+      return false;
+    }
+  }
+
+  return true;
+}
+
+static void app_server_embed_reply(app_server_t &server,
+                                   const app_server_job_t &job,
+                                   httpd_response_t &response)
+{
+  const size_t dim = server.data->n_embd_out;
+
+  std::string &out = response.body;
+  out.reserve(job.embeddings.size() * 12 + 32);
+  out.append("{\"dim\":").append(std::to_string(dim));
+  out.append(",\"embeddings\":[");
+  for (size_t k = 0; k < job.records.size(); k++)
+  {
+    if (k > 0)
+    {
+      out.push_back(',');
+    }
+    qdrant_json_append_vector(out, job.embeddings.data() + k * dim, dim);
+  }
+  out.append("]}");
+}
+
+static void app_server_upsert(app_server_t &server, const nlohmann::json &body,
+                              app_server_job_t &job,
+                              httpd_response_t &response)
+{
+  const size_t n = job.records.size();
+  const size_t dim = server.data->n_embd_out;
+
+  const bool has_ids = body.contains("ids");
+
+  qdrant_point_array_t points(n);
+  for (size_t k = 0; k < n; k++)
+  {
+    qdrant_point_spec_t &point = points[k];
+    point.id = has_ids ? body["ids"][k].get<std::string>() : generate_uuid();
+    point.payload_x = "text";
+    point.payload_y = job.records[k];
+    point.vector.assign(job.embeddings.begin() + k * dim,
+                        job.embeddings.begin() + (k + 1) * dim);
+    qdrant_quantize(server.col, point.vector.data(), point.vector.size());
+  }
+
+  const qdrant_info_t *client = app_server_client_acquire(server);
+  const bool inserted =
+      client != NULL && qdrant_points_insert(*client, server.col, points);
+  if (client != NULL)
+  {
+    app_server_client_release(server, client);
+  }
+
+  if (!inserted)
+  {
+    app_metrics_add(MetricUploadErrors);
+    app_server_error(response, 502, "upsert into qdrant failed");
+    return;
+  }
+  app_metrics_add(MetricPoints, n);
+
+  nlohmann::json reply = {{"status", "ok"}, {"ids", nlohmann::json::array()}};
+  for (const auto &point : points)
+  {
+    reply["ids"].push_back(point.id);
+  }
+  response.body = reply.dump();
+}
+
+static void app_server_search(app_server_t &server, const nlohmann::json &body,
+                              app_server_job_t &job,
+                              httpd_response_t &response)
+{
+  const size_t n = job.records.size();
+
+  qdrant_search_params_t params;
+  qdrant_search_default_params(&params);
+  params.limit = server.args->top_k;
+  params.filter = server.args->query_filter;
+  params.with_payload = server.args->query_payload;
+
+  if (body.contains("top_k"))
+  {
+    if (!body["top_k"].is_number_unsigned() || body["top_k"].get<size_t>() == 0)
+    {
+      app_server_error(response, 400, "\"top_k\" must be a positive integer");
+      return;
+    }
+    params.limit = body["top_k"].get<size_t>();
+  }
+
+  if (body.contains("filter"))
+  {
+    if (!body["filter"].is_object())
+    {
+      app_server_error(response, 400, "\"filter\" must be an object");
+      return;
+    }
+    params.filter = body["filter"].dump();
+  }
+
+  if (body.contains("with_payload") && body["with_payload"].is_boolean())
+  {
+    params.with_payload = body["with_payload"].get<bool>();
+  }
+
+  // the queries have to live in the same space as the stored vectors
+  qdrant_quantize(server.col, job.embeddings.data(), job.embeddings.size());
+
+  std::vector<qdrant_search_result_t> results;
+  const qdrant_info_t *client = app_server_client_acquire(server);
+  bool searched = false;
+  if (client != NULL && n == 1)
+  {
+    results.resize(1);
+    searched = qdrant_points_search(*client, server.col, job.embeddings.data(),
+                                    params, results[0]);
+  }
+  else if (client != NULL)
+  {
+    searched = qdrant_points_search_batch(
+        *client, server.col, job.embeddings.data(), n, params, results);
+  }
+
+  if (client != NULL)
+  {
+    app_server_client_release(server, client);
+  }
+
+  if (!searched)
+  {
+    app_server_error(response, 502, "search in qdrant failed");
+    return;
+  }
+
+  nlohmann::json reply = {{"results", nlohmann::json::array()}};
+  for (const auto &result : results)
+  {
+    nlohmann::json hits = nlohmann::json::array();
+    for (const auto &point : result)
+    {
+      hits.push_back(
+          {{"id", point.id}, {"score", point.score}, {"payload", point.payload}});
+    }
+    reply["results"].push_back(std::move(hits));
+  }
+  response.body = reply.dump();
+}
+
+static void app_server_handle(app_server_t &server,
+                              const httpd_request_t &request,
+                              httpd_response_t &response)
+{
+  if (request.path == "/health")
+  {
+    response.body =
+        nlohmann::json{{"status", "ok"}, {"dim", server.data->n_embd_out}}
+            .dump();
+    return;
+  }
+
+  if (request.path != "/embed" && request.path != "/upsert" &&
+      request.path != "/search")
+  {
+    app_server_error(response, 404, "no " + request.path);
+    return;
+  }
+
+  if (request.method != "POST")
+  {
+    app_server_error(response, 405, request.path + " takes POST");
+    return;
+  }
+
+  const nlohmann::json body =
+      nlohmann::json::parse(request.body, nullptr, false);
+  if (body.is_discarded() || !body.is_object())
+  {
+    app_server_error(response, 400, "the body is not a JSON object");
+    return;
+  }
+
+  app_server_job_t job;
+  if (!app_server_parse_input(body, job.records, response) ||
+      (request.path == "/upsert" &&
+       !app_server_check_ids(body, job.records.size(), response)))
+  {
+    return;
+  }
+
+  app_metrics_add(MetricRecords, job.records.size());
+
+  if (!app_server_submit(server, job))
+  {
+    app_server_error(response, 422, "could not embed the input");
+    return;
+  }
+
+  if (request.path == "/embed")
+  {
+    app_server_embed_reply(server, job, response);
+  }
+  else if (request.path == "/upsert")
+  {
+    app_server_upsert(server, body, job, response);
+  }
+  else
+  {
+    app_server_search(server, body, job, response);
+  }
+}
+
+bool app_server_run(const app_llama_args_t &args, const app_llama_data_t &data,
+                    const qdrant_info_t &info,
+                    const qdrant_colection_info_t &col)
+{
+  if (llama_pooling_type(data.ctx) == LLAMA_POOLING_TYPE_NONE)
+  {
+    LOG_ERR("pooling type NONE yields per-token embeddings, the server "
+            "needs one per record.\n");
+    return false;
+  }
+
+  httpd_config_t config;
+  httpd_default_config(&config);
+  if (!httpd_parse_address(args.serve, &config))
+  {
+    return false;
+  }
+
+  int fds[2];
+  if (pipe2(fds, O_CLOEXEC) != 0)
+  {
+    LOG_ERR("could not create a pipe: %s.\n", strerror(errno));
+    return false;
+  }
+
+  app_server_t server;
+  server.args = &args;
+  server.data = &data;
+  server.info = &info;
+  server.col = col;
+  server.max_wait = std::chrono::milliseconds(args.serve_wait_ms);
+  server.max_records = args.serve_batch;
+  server.n_pending = 0;
+  server.stopping = false;
+  server.n_jobs = 0;
+  server.n_records = 0;
+  server.n_decodes = 0;
+  server.idle.push_back(&info);
+  server.decoder = std::thread(app_server_decode, &server);
+
+  httpd_t httpd;
+  const bool started = httpd_start(
+      config,
+      [&server](const httpd_request_t &request, httpd_response_t &response)
+      { app_server_handle(server, request, response); },
+      &httpd);
+
+  if (started)
+  {
+    // the handler only writes to the pipe; the wait happens here
+    app_server_signal_fd = fds[1];
+    struct sigaction action = {};
+    action.sa_handler = app_server_on_signal;
+    sigemptyset(&action.sa_mask);
+    sigaction(SIGINT, &action, NULL);
+    sigaction(SIGTERM, &action, NULL);
+
+    LOG("serving on %s (batches of up to %zu records, %d ms wait).\n",
+        httpd_address(httpd).c_str(), server.max_records, args.serve_wait_ms);
+
+    char c;
+    while (read(fds[0], &c, 1) < 0 && errno == EINTR)
+    {
+    }
+
+    LOG("stopping.\n");
+    signal(SIGINT, SIG_DFL);
+    signal(SIGTERM, SIG_DFL);
+
+    // requests in progress still get their embeddings
+    httpd_stop(&httpd);
+  }
+
+  {
+    std::lock_guard<std::mutex> lock(server.mutex);
+    server.stopping = true;
+  }
+  server.wake.notify_one();
+  server.decoder.join();
+
+  close(fds[0]);
+  close(fds[1]);
+  app_server_signal_fd = -1;
+
+  // the handlers are done with them
+  for (qdrant_info_t *client : server.owned)
+  {
+    qdrant_destroy(client);
+    delete client;
+  }
+
+  if (started)
+  {
+    LOG("served %llu requests, %llu records in %llu decodes (%.1f records "
+        "per decode).\n",
+        (unsigned long long)server.n_jobs,
+        (unsigned long long)server.n_records,
+        (unsigned long long)server.n_decodes,
+        server.n_decodes > 0 ? (double)server.n_records / server.n_decodes
+                             : 0.0);
+  }
+
+  return started;
+}
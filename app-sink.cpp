@@ -0,0 +1,285 @@
+#include "app-sink.h"
+#include "app-metrics.h"
+#include "qdrant-quantize.h"
+#include "utils.h"
+#include <chrono>
+
+app_sink_type_t app_sink_type(const app_llama_args_t &args)
+{
+  if (!args.hnsw_path.empty())
+  {
+    return SinkHnsw;
+  }
+
+  if (!args.export_path.empty())
+  {
+    return SinkFile;
+  }
+
+  return SinkQdrant;
+}
+
+const char *app_sink_name(app_sink_type_t type)
+{
+  switch (type)
+  {
+  case SinkQdrant:
+    return "qdrant";
+  case SinkHnsw:
+    return "index";
+  case SinkFile:
+    return "file";
+  default:
+    return "unknown";
+  }
+}
+
+// the batcher's byte counts and window, as metrics
+static void app_sink_metrics(app_sink_t &sink)
+{
+  if (sink.type != SinkQdrant)
+  {
+    return;
+  }
+
+  app_metrics_add(MetricBytes, sink.batcher.n_bytes - sink.n_bytes_counted);
+  app_metrics_add(MetricWireBytes,
+                  sink.batcher.n_wire_bytes - sink.n_wire_bytes_counted);
+  app_metrics_set(MetricInFlight, sink.async.in_flight);
+
+  sink.n_bytes_counted = sink.batcher.n_bytes;
+  sink.n_wire_bytes_counted = sink.batcher.n_wire_bytes;
+}
+
+static bool app_sink_open_qdrant(const app_llama_args_t &args,
+                                 const qdrant_info_t &info,
+                                 qdrant_batch_callback_t callback,
+                                 app_sink_t *sink)
+{
+  qdrant_async_config_t config;
+  qdrant_async_default_config(&config);
+  config.window = args.qdrant_inflight;
+  config.http2 = args.qdrant_http2;
+  config.max_retries = args.qdrant_retries;
+
+  if (!qdrant_async_init(info, config, &sink->async))
+  {
+    return false;
+  }
+
+  qdrant_batch_config_t batch_config;
+  qdrant_batch_default_config(&batch_config);
+  batch_config.max_points = args.qdrant_batch_points;
+  batch_config.max_bytes = (size_t)args.qdrant_batch_kb * 1024;
+  batch_config.max_latency_ms = args.qdrant_batch_ms;
+  batch_config.level = args.qdrant_compress_level;
+  batch_config.auto_compress = args.qdrant_compress_auto;
+  batch_config.link_bps = args.qdrant_link_mbps * 1e6 / 8;
+  qdrant_parse_encoding(args.qdrant_compress, &batch_config.encoding);
+
+  auto measured = [callback](const qdrant_async_result_t &result,
+                            size_t n_points)
+  {
+    app_metrics_add(MetricRequests);
+    app_metrics_add(MetricRetries, result.attempts > 1 ? result.attempts - 1 : 0);
+    app_metrics_observe(MetricRequestSeconds, result.seconds);
+    if (!result.success)
+    {
+      app_metrics_add(MetricUploadErrors);
+    }
+
+    if (callback)
+    {
+      callback(result, n_points);
+    }
+  };
+
+  if (!qdrant_batcher_init(sink->async, sink->col, batch_config, measured,
+                           &sink->batcher))
+  {
+    qdrant_batcher_destroy(&sink->batcher);
+    qdrant_async_destroy(&sink->async);
+    return false;
+  }
+
+  sink->target = info.URI;
+  if (config.window > 1 || config.http2)
+  {
+    sink->target += " (" + std::to_string(config.window) + " in flight" +
+                    (config.http2 ? ", HTTP/2)" : ")");
+  }
+
+  return true;
+}
+
+bool app_sink_open(const app_llama_args_t &args, const qdrant_info_t &info,
+                   const qdrant_colection_info_t &col,
+                   qdrant_batch_callback_t callback, app_sink_t *sink)
+{
+  if (NULL == sink)
+  {
+    LOG_ERR("argument 'sink' is NULL.\n");
+    return false;
+  }
+
+  sink->type = app_sink_type(args);
+  sink->col = col;
+  sink->n_threads = args.threads;
+  sink->n_points = 0;
+  sink->t_finish = 0.0;
+  sink->n_bytes_counted = 0;
+  sink->n_wire_bytes_counted = 0;
+
+  switch (sink->type)
+  {
+  case SinkQdrant:
+    return app_sink_open_qdrant(args, info, callback, sink);
+  case SinkHnsw:
+  {
+    app_hnsw_config_t config;
+    app_hnsw_default_config(&config);
+    config.m = args.hnsw_m;
+    config.ef_construction = args.hnsw_ef_construction;
+    config.ef_search = args.hnsw_ef;
+
+    sink->target = args.hnsw_path;
+    return app_hnsw_init(col.size, col.distance, config, &sink->index);
+  }
+  case SinkFile:
+    sink->target = args.export_path;
+    return app_export_create(args.export_path, col.size, &sink->file);
+  default:
+    return false;
+  }
+}
+
+bool app_sink_add(app_sink_t &sink, qdrant_point_spec_t &point)
+{
+  bool added = false;
+
+  switch (sink.type)
+  {
+  case SinkQdrant:
+    qdrant_quantize(sink.col, point.vector.data(), point.vector.size());
+
+    // blocks while the window is full; callbacks run on this thread
+    added = qdrant_batcher_add(sink.batcher, point);
+    break;
+  case SinkHnsw:
+    qdrant_quantize(sink.col, point.vector.data(), point.vector.size());
+    added = app_hnsw_add(sink.index, point.id, point.payload_y,
+                         point.vector.data());
+    break;
+  case SinkFile:
+    added = app_export_add(sink.file, point);
+    break;
+  default:
+    break;
+  }
+
+  sink.n_points += added ? 1 : 0;
+
+  if (added)
+  {
+    app_metrics_add(MetricPoints);
+  }
+  else if (sink.type != SinkQdrant)
+  {
+    // failed upserts are counted as they complete
+    app_metrics_add(MetricUploadErrors);
+  }
+
+  app_sink_metrics(sink);
+
+  return added;
+}
+
+long app_sink_wait_ms(const app_sink_t &sink)
+{
+  return sink.type == SinkQdrant ? qdrant_batcher_wait_ms(sink.batcher) : -1;
+}
+
+void app_sink_poll(app_sink_t &sink)
+{
+  if (sink.type == SinkQdrant)
+  {
+    qdrant_batcher_poll(sink.batcher);
+    app_sink_metrics(sink);
+  }
+}
+
+bool app_sink_finish(app_sink_t &sink)
+{
+  const auto t0 = std::chrono::steady_clock::now();
+
+  bool finished = false;
+  switch (sink.type)
+  {
+  case SinkQdrant:
+    finished = qdrant_batcher_finish(sink.batcher);
+    qdrant_async_wait(sink.async);
+    app_sink_metrics(sink);
+    break;
+  case SinkHnsw:
+    finished = app_hnsw_build(sink.index, sink.n_threads) &&
+               app_hnsw_save(sink.index, sink.target);
+    if (finished)
+    {
+      LOG("indexed %zu points in '%s' (%d levels).\n", sink.index.n_points,
+          sink.target.c_str(), sink.index.max_level + 1);
+    }
+    break;
+  case SinkFile:
+    finished = app_export_finish(sink.file);
+    if (finished)
+    {
+      LOG("exported %zu points to '%s' (%.1f MiB).\n", sink.file.n_points,
+          sink.target.c_str(), sink.file.n_bytes / 1048576.0);
+    }
+    break;
+  default:
+    break;
+  }
+
+  sink.t_finish =
+      std::chrono::duration<double>(std::chrono::steady_clock::now() - t0)
+          .count();
+
+  if (!finished && sink.type != SinkQdrant)
+  {
+    app_metrics_add(MetricUploadErrors);
+  }
+
+  if (!finished)
+  {
+    LOG_ERR("could not finish %s sink '%s'.\n", app_sink_name(sink.type),
+            sink.target.c_str());
+  }
+
+  return finished;
+}
+
+void app_sink_close(app_sink_t *sink)
+{
+  if (NULL == sink)
+  {
+    return;
+  }
+
+  switch (sink->type)
+  {
+  case SinkQdrant:
+    qdrant_async_wait(sink->async);
+    qdrant_batcher_destroy(&sink->batcher);
+    qdrant_async_destroy(&sink->async);
+    break;
+  case SinkHnsw:
+    app_hnsw_destroy(&sink->index);
+    break;
+  case SinkFile:
+    app_export_close(&sink->file);
+    break;
+  default:
+    break;
+  }
+}
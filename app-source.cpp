@@ -0,0 +1,266 @@
+#include "app-source.h"
+#include "utils.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+bool app_source_open(const std::string &path, app_source_t *src)
+{
+  if (NULL == src)
+  {
+    LOG_ERR("argument 'src' is NULL.\n");
+    return false;
+  }
+
+  src->path.assign(path);
+  src->fd = -1;
+  src->mapped = false;
+  src->data = NULL;
+  src->size = 0;
+  src->offset = 0;
+  src->released = 0;
+  src->n_records = 0;
+  src->eof = false;
+  src->tail.clear();
+
+  // '-' streams from stdin
+  src->fd = (path == "-") ? dup(STDIN_FILENO) : open(path.c_str(), O_RDONLY);
+  if (src->fd < 0)
+  {
+    LOG_ERR("could not open source '%s': %s.\n", path.c_str(),
+            strerror(errno));
+    return false;
+  }
+
+  struct stat st;
+  if (fstat(src->fd, &st) == 0 && S_ISREG(st.st_mode))
+  {
+    src->size = st.st_size;
+    if (src->size == 0)
+    {
+      src->mapped = true;
+      return true;
+    }
+
+    void *addr = mmap(NULL, src->size, PROT_READ, MAP_PRIVATE, src->fd, 0);
+    if (addr != MAP_FAILED)
+    {
+      // records are consumed front to back, exactly once
+      madvise(addr, src->size, MADV_SEQUENTIAL);
+
+      src->data = reinterpret_cast<const char *>(addr);
+      src->mapped = true;
+
+      return true;
+    }
+
+    LOG("warning: mmap of '%s' failed (%s), falling back to read().\n",
+        path.c_str(), strerror(errno));
+    src->size = 0;
+  }
+
+  return true;
+}
+
+static void app_source_add_record(app_source_chunk_t &chunk,
+                                  std::string_view record,
+                                  const std::string &sep)
+{
+  // tolerate CRLF line endings on the default separator
+  if (sep == "\n" && !record.empty() && record.back() == '\r')
+  {
+    record.remove_suffix(1);
+  }
+
+  if (!record.empty())
+  {
+    chunk.records.push_back(record);
+  }
+}
+
+static size_t app_source_read_mapped(app_source_t &src, const std::string &sep,
+                                     size_t max_records,
+                                     app_source_chunk_t &chunk)
+{
+  const std::string_view view(src.data, src.size);
+
+  while (chunk.records.size() < max_records && src.offset < src.size)
+  {
+    size_t end = view.find(sep, src.offset);
+    size_t next = end + sep.length();
+    if (end == std::string_view::npos)
+    {
+      end = src.size;
+      next = src.size;
+    }
+
+    app_source_add_record(chunk, view.substr(src.offset, end - src.offset),
+                          sep);
+    src.offset = next;
+  }
+
+  return chunk.records.size();
+}
+
+static size_t app_source_read_stream(app_source_t &src,
+                                     const std::string &sep,
+                                     size_t max_records,
+                                     app_source_chunk_t &chunk)
+{
+  std::vector<char> &storage = chunk.storage;
+  storage.swap(src.tail);
+  src.tail.clear();
+
+  // read until enough complete records are buffered (or end of file)
+  size_t n_found = 0;
+  size_t pos = 0;
+  while (true)
+  {
+    const std::string_view view(storage.data(), storage.size());
+    while (n_found < max_records)
+    {
+      const size_t end = view.find(sep, pos);
+      if (end == std::string_view::npos)
+      {
+        break;
+      }
+
+      n_found++;
+      pos = end + sep.length();
+    }
+
+    if (n_found >= max_records || src.eof)
+    {
+      break;
+    }
+
+    const size_t old_size = storage.size();
+    storage.resize(old_size + APP_SOURCE_READ_SIZE);
+
+    const ssize_t n = read(src.fd, storage.data() + old_size,
+                           APP_SOURCE_READ_SIZE);
+    if (n <= 0)
+    {
+      if (n < 0)
+      {
+        LOG_ERR("read from '%s' failed: %s.\n", src.path.c_str(),
+                strerror(errno));
+      }
+
+      src.eof = true;
+      storage.resize(old_size);
+    }
+    else
+    {
+      storage.resize(old_size + n);
+    }
+  }
+
+  // 'pos' is the end of the last complete record; the rest is carried over,
+  // unless there is nothing left to read
+  size_t consumed = pos;
+  if (src.eof && n_found < max_records)
+  {
+    consumed = storage.size();
+  }
+
+  src.tail.assign(storage.begin() + consumed, storage.end());
+  storage.resize(consumed);
+  src.offset += consumed;
+
+  const std::string_view view(storage.data(), storage.size());
+  size_t start = 0;
+  while (start < view.length())
+  {
+    size_t end = view.find(sep, start);
+    size_t next = end + sep.length();
+    if (end == std::string_view::npos)
+    {
+      end = view.length();
+      next = view.length();
+    }
+
+    app_source_add_record(chunk, view.substr(start, end - start), sep);
+    start = next;
+  }
+
+  return chunk.records.size();
+}
+
+size_t app_source_read(app_source_t &src, const std::string &sep,
+                       size_t max_records, app_source_chunk_t &chunk)
+{
+  chunk.records.clear();
+  chunk.storage.clear();
+  chunk.first_record = src.n_records;
+
+  if (sep.empty() || max_records == 0)
+  {
+    LOG_ERR("invalid separator or record count.\n");
+    return 0;
+  }
+
+  size_t n_records = 0;
+  if (src.mapped)
+  {
+    n_records = app_source_read_mapped(src, sep, max_records, chunk);
+  }
+  else
+  {
+    // empty records are dropped, so keep reading until something comes out
+    while (n_records == 0 && !(src.eof && src.tail.empty()))
+    {
+      n_records = app_source_read_stream(src, sep, max_records, chunk);
+    }
+  }
+
+  chunk.end_offset = src.offset;
+  src.n_records += n_records;
+
+  return n_records;
+}
+
+void app_source_release(app_source_t &src, size_t offset)
+{
+  if (!src.mapped || NULL == src.data)
+  {
+    return;
+  }
+
+  // drop fully consumed pages so resident memory stays flat
+  static const size_t page_size = sysconf(_SC_PAGESIZE);
+  const size_t end = (offset / page_size) * page_size;
+
+  if (end > src.released)
+  {
+    madvise(const_cast<char *>(src.data) + src.released, end - src.released,
+            MADV_DONTNEED);
+    src.released = end;
+  }
+}
+
+void app_source_close(app_source_t *src)
+{
+  if (NULL == src)
+  {
+    return;
+  }
+
+  if (src->mapped && src->data != NULL)
+  {
+    munmap(const_cast<char *>(src->data), src->size);
+    src->data = NULL;
+  }
+
+  if (src->fd >= 0)
+  {
+    close(src->fd);
+    src->fd = -1;
+  }
+
+  src->tail.clear();
+  src->tail.shrink_to_fit();
+}
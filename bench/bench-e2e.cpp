@@ -0,0 +1,591 @@
+#include "app-llama.h"
+#include "app-normalize.h"
+#include "nlohmann/json.hpp"
+#include "qdrant-async.h"
+#include "qdrant-json.h"
+#include "qdrant.h"
+#include "utils.h"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <fstream>
+#include <random>
+#include <stdio.h>
+#include <string.h>
+
+/*
+ * bench-e2e: the ingest path stage by stage on synthetic corpora, one run
+ * per length distribution: tokenize, embed, normalize, serialize and,
+ * with --upload, send the bodies to --qdrant
+ *
+ *   bench-e2e --model MODEL [--docs N] [--lengths SPEC[,SPEC..]]
+ *             [--max-words N] [--json FILE] [--upload]
+ *
+ * A SPEC draws the words of every record:
+ *   fixed:N             always N
+ *   uniform:MIN:MAX     uniform in [MIN, MAX]
+ *   lognormal:MEDIAN:S  log-normal around MEDIAN, S the sigma of the log
+ *   bimodal:A:B:P       B with probability P, A otherwise (queries + docs)
+ *
+ * Stages run one after the other on every --chunk of records, so each one
+ * is timed alone; the usual --n_batch, --n_ubatch, --threads, --chunk and
+ * --qdrant-* params apply. Embeddings come back normalized already, the
+ * normalize stage runs app_normalize over them again to time it on its own.
+ * Uploads go uncompressed to a scratch collection, dropped at the end.
+ *
+ * Results go to --json (default bench-e2e.json): throughputs, batch fill
+ * and, per stage, p50/p95/p99/max of the per-chunk latency in ms.
+ */
+
+#define APP_BENCH_COLLECTION "embed2vecdb-bench-e2e"
+#define APP_BENCH_VOCABULARY 8192
+
+typedef enum _bench_length_kind
+{
+  LengthFixed = 0,
+  LengthUniform,
+  LengthLognormal,
+  LengthBimodal
+} bench_length_kind_t;
+
+typedef struct _bench_lengths
+{
+  std::string spec;
+  bench_length_kind_t kind;
+  double a;
+  double b;
+  double p;
+} bench_lengths_t;
+
+typedef struct _bench_upload
+{
+  qdrant_info_t info;
+  qdrant_async_t async;
+  qdrant_colection_info_t col;
+} bench_upload_t;
+
+static double seconds_since(const std::chrono::steady_clock::time_point &t0)
+{
+  return std::chrono::duration<double>(std::chrono::steady_clock::now() - t0)
+      .count();
+}
+
+static bool parse_lengths(const std::string &spec, bench_lengths_t *out)
+{
+  const std::vector<std::string> parts = split_lines(spec, ":");
+  const size_t n = parts.size();
+
+  out->spec = spec;
+  out->a = out->b = out->p = 0.0;
+
+  try
+  {
+    if (parts[0] == "fixed" && n == 2)
+    {
+      out->kind = LengthFixed;
+      out->a = std::stod(parts[1]);
+    }
+    else if (parts[0] == "uniform" && n == 3)
+    {
+      out->kind = LengthUniform;
+      out->a = std::stod(parts[1]);
+      out->b = std::stod(parts[2]);
+    }
+    else if (parts[0] == "lognormal" && n == 3)
+    {
+      out->kind = LengthLognormal;
+      out->a = std::stod(parts[1]);
+      out->b = std::stod(parts[2]);
+    }
+    else if (parts[0] == "bimodal" && n == 4)
+    {
+      out->kind = LengthBimodal;
+      out->a = std::stod(parts[1]);
+      out->b = std::stod(parts[2]);
+      out->p = std::stod(parts[3]);
+    }
+    else
+    {
+      return false;
+    }
+  }
+  catch (const std::exception &)
+  {
+    return false;
+  }
+
+  return out->a >= 1.0 && out->b >= 0.0 && out->p >= 0.0 && out->p <= 1.0 &&
+         (out->kind != LengthUniform || out->b >= out->a);
+}
+
+static int draw_words(std::mt19937 &rng, const bench_lengths_t &lengths,
+                      int max_words)
+{
+  double words = lengths.a;
+
+  switch (lengths.kind)
+  {
+  case LengthUniform:
+    words = std::uniform_int_distribution<int>((int)lengths.a,
+                                               (int)lengths.b)(rng);
+    break;
+  case LengthLognormal:
+    words = std::lognormal_distribution<double>(std::log(lengths.a),
+                                                lengths.b)(rng);
+    break;
+  case LengthBimodal:
+    words = std::bernoulli_distribution(lengths.p)(rng) ? lengths.b
+                                                        : lengths.a;
+    break;
+  default:
+    break;
+  }
+
+  return std::clamp((int)std::lround(words), 1, max_words);
+}
+
+// words repeat over a fixed vocabulary, the way text does
+static void make_records(const bench_lengths_t &lengths, size_t n_docs,
+                         int max_words, std::vector<std::string> &records)
+{
+  std::mt19937 rng(42);
+  std::uniform_int_distribution<int> chars(2, 10);
+  std::uniform_int_distribution<int> letter('a', 'z');
+
+  std::vector<std::string> vocabulary(APP_BENCH_VOCABULARY);
+  for (auto &word : vocabulary)
+  {
+    const int len = chars(rng);
+    for (int c = 0; c < len; c++)
+    {
+      word.push_back(letter(rng));
+    }
+  }
+
+  std::uniform_int_distribution<int> pick(0, APP_BENCH_VOCABULARY - 1);
+
+  records.assign(n_docs, std::string());
+  for (auto &record : records)
+  {
+    const int n = draw_words(rng, lengths, max_words);
+    for (int w = 0; w < n; w++)
+    {
+      record.append(vocabulary[pick(rng)]);
+      if (w + 1 < n)
+      {
+        record.push_back(' ');
+      }
+    }
+  }
+}
+
+// nearest rank, over a sorted copy
+static double percentile(std::vector<double> samples, double p)
+{
+  if (samples.empty())
+  {
+    return 0.0;
+  }
+
+  std::sort(samples.begin(), samples.end());
+  const size_t rank = (size_t)std::ceil(p / 100.0 * samples.size());
+
+  return samples[std::max<size_t>(rank, 1) - 1];
+}
+
+// never zero, it divides throughputs
+static double stage_seconds(const std::vector<double> &seconds)
+{
+  double total = 0.0;
+  for (const double s : seconds)
+  {
+    total += s;
+  }
+
+  return std::max(total, 1e-9);
+}
+
+static nlohmann::json stage_json(const std::vector<double> &seconds)
+{
+  nlohmann::json stage;
+  stage["seconds"] = stage_seconds(seconds);
+  stage["samples"] = seconds.size();
+  stage["p50_ms"] = 1000.0 * percentile(seconds, 50);
+  stage["p95_ms"] = 1000.0 * percentile(seconds, 95);
+  stage["p99_ms"] = 1000.0 * percentile(seconds, 99);
+  stage["max_ms"] = 1000.0 * percentile(seconds, 100);
+
+  return stage;
+}
+
+static bool upload_open(const app_llama_args_t &args, int n_embd,
+                        bench_upload_t *upload)
+{
+  upload->col.name = APP_BENCH_COLLECTION;
+  upload->col.size = n_embd;
+  upload->col.distance = Cosine;
+  upload->col.quantization = NoQuantization;
+  upload->col.quantize_range = 0.0f;
+
+  if (!qdrant_init(args.qdrant_uri, &upload->info))
+  {
+    return false;
+  }
+
+  bool exists = false;
+  if (!qdrant_collection_exists(upload->info, upload->col, &exists) ||
+      (exists && !qdrant_collection_delete(upload->info, upload->col)) ||
+      !qdrant_collection_create(upload->info, upload->col))
+  {
+    qdrant_destroy(&upload->info);
+    return false;
+  }
+
+  qdrant_async_config_t config;
+  qdrant_async_default_config(&config);
+  config.window = args.qdrant_inflight;
+  config.http2 = args.qdrant_http2;
+  config.max_retries = args.qdrant_retries;
+
+  if (!qdrant_async_init(upload->info, config, &upload->async))
+  {
+    qdrant_collection_delete(upload->info, upload->col);
+    qdrant_destroy(&upload->info);
+    return false;
+  }
+
+  return true;
+}
+
+static void upload_close(bench_upload_t *upload)
+{
+  qdrant_async_wait(upload->async);
+  qdrant_async_destroy(&upload->async);
+  qdrant_collection_delete(upload->info, upload->col);
+  qdrant_destroy(&upload->info);
+}
+
+static bool bench_run(const app_llama_args_t &args, app_llama_data_t &data,
+                      const bench_lengths_t &lengths, size_t n_docs,
+                      int max_words, bench_upload_t *upload,
+                      nlohmann::json &run)
+{
+  std::vector<std::string> records;
+  make_records(lengths, n_docs, max_words, records);
+
+  const int n_embd = data.n_embd_out;
+  const size_t chunk = args.chunk_size;
+  const size_t batch_points = args.qdrant_batch_points;
+
+  std::vector<double> t_tokenize, t_embed, t_normalize, t_serialize;
+  std::vector<double> prompt_tokens;
+  std::vector<double> request_seconds;
+  app_llama_stats_t llama = {};
+  uint64_t n_bytes = 0;
+  size_t n_requests = 0, n_failed = 0;
+
+  std::vector<std::string_view> views;
+  llama_input_vector_t inputs;
+  std::vector<float> embeddings;
+  std::vector<float> normalized;
+  qdrant_point_array_t points;
+  std::string body;
+
+  const std::string path =
+      upload ? qdrant_collection_path(QDRANT_POINTS_INSERT_PATH, upload->col)
+             : std::string();
+  const uint64_t n_retried = upload ? upload->async.n_retried : 0;
+  const auto t_start = std::chrono::steady_clock::now();
+
+  for (size_t first = 0; first < records.size(); first += chunk)
+  {
+    const size_t n = std::min(chunk, records.size() - first);
+    views.assign(records.begin() + first, records.begin() + first + n);
+
+    auto t0 = std::chrono::steady_clock::now();
+    inputs.clear();
+    const int n_prompts = app_llm_tokenize(data, views, inputs);
+    t_tokenize.push_back(seconds_since(t0));
+
+    if (n_prompts != (int)n)
+    {
+      LOG_ERR("could not tokenize records starting at %zu; raise --n_batch "
+              "or lower --max-words.\n",
+              first);
+      return false;
+    }
+
+    for (size_t k = 0; k < n; k++)
+    {
+      prompt_tokens.push_back(inputs.length(k));
+    }
+
+    t0 = std::chrono::steady_clock::now();
+    if (!app_llm_get_embeddings(data, n_prompts, inputs, embeddings, &llama))
+    {
+      LOG_ERR("could not get embeddings for records starting at %zu.\n",
+              first);
+      return false;
+    }
+    t_embed.push_back(seconds_since(t0));
+
+    normalized.resize(embeddings.size());
+    t0 = std::chrono::steady_clock::now();
+    for (size_t k = 0; k < n; k++)
+    {
+      app_normalize(embeddings.data() + k * n_embd,
+                    normalized.data() + k * n_embd, n_embd, data.embed_norm);
+    }
+    t_normalize.push_back(seconds_since(t0));
+
+    // bodies of --qdrant-batch-points, as the batcher would cut them
+    double t_chunk = 0.0;
+    for (size_t begin = 0; begin < n; begin += batch_points)
+    {
+      const size_t end = std::min(n, begin + batch_points);
+
+      points.resize(end - begin);
+      for (size_t k = begin; k < end; k++)
+      {
+        qdrant_point_spec_t &point = points[k - begin];
+        point.id = generate_uuid();
+        point.payload_x = "text";
+        point.payload_y = records[first + k];
+        point.vector.assign(embeddings.data() + k * n_embd,
+                            embeddings.data() + (k + 1) * n_embd);
+      }
+
+      if (upload)
+      {
+        body = qdrant_async_take_buffer(upload->async);
+      }
+      t0 = std::chrono::steady_clock::now();
+      qdrant_json_write_points(body, points);
+      t_chunk += seconds_since(t0);
+      n_bytes += body.size();
+
+      if (upload)
+      {
+        // blocks while the window is full
+        qdrant_async_submit(
+            upload->async, "PUT", path, std::move(body),
+            [&](const qdrant_async_result_t &result)
+            {
+              request_seconds.push_back(result.seconds);
+              n_failed += result.success ? 0 : 1;
+            });
+        n_requests++;
+        qdrant_async_poll(upload->async, 0);
+      }
+    }
+    t_serialize.push_back(t_chunk);
+  }
+
+  if (upload)
+  {
+    qdrant_async_wait(upload->async);
+  }
+  const double t_wall = seconds_since(t_start);
+
+  const double s_tokenize = stage_seconds(t_tokenize);
+  const double s_embed = stage_seconds(t_embed);
+  const double s_normalize = stage_seconds(t_normalize);
+  const double s_serialize = stage_seconds(t_serialize);
+  const double n_tokens = (double)llama.n_tokens;
+
+  run["lengths"] = lengths.spec;
+  run["records"] = records.size();
+  run["tokens"] = llama.n_tokens;
+  run["wall_seconds"] = t_wall;
+  run["prompt_tokens"] = {{"mean", n_tokens / records.size()},
+                          {"p50", percentile(prompt_tokens, 50)},
+                          {"p95", percentile(prompt_tokens, 95)},
+                          {"p99", percentile(prompt_tokens, 99)},
+                          {"max", percentile(prompt_tokens, 100)}};
+  run["tokenize"] = {{"tokens_per_s", n_tokens / s_tokenize}};
+  run["embed"] = {
+      {"tokens_per_s", n_tokens / s_embed},
+      {"embeddings_per_s", llama.n_prompts / s_embed},
+      {"decode_calls", llama.n_decode},
+      {"batch_fill", llama.n_capacity ? (double)llama.n_tokens /
+                                            llama.n_capacity
+                                      : 0.0}};
+  run["normalize"] = {
+      {"rows_per_s", records.size() / s_normalize},
+      {"mb_per_s", records.size() * n_embd * sizeof(float) / s_normalize /
+                       1e6}};
+  run["serialize"] = {{"bytes", n_bytes},
+                      {"bytes_per_point", (double)n_bytes / records.size()},
+                      {"mb_per_s", n_bytes / s_serialize / 1e6}};
+  run["stages"] = {{"tokenize", stage_json(t_tokenize)},
+                   {"embed", stage_json(t_embed)},
+                   {"normalize", stage_json(t_normalize)},
+                   {"serialize", stage_json(t_serialize)}};
+
+  if (upload)
+  {
+    nlohmann::json latency = stage_json(request_seconds);
+    latency.erase("seconds");
+
+    run["upload"] = {
+        {"requests", n_requests},
+        {"failed", n_failed},
+        {"retries", upload->async.n_retried - n_retried},
+        {"points_per_s", records.size() / t_wall},
+        {"mb_per_s", n_bytes / t_wall / 1e6},
+        {"latency", latency}};
+  }
+
+  printf("%-24s %9.0f %11.0f %9.0f %7.3f %9.1f %12.1f", lengths.spec.c_str(),
+         n_tokens / records.size(), n_tokens / s_embed,
+         llama.n_prompts / s_embed, run["embed"]["batch_fill"].get<double>(),
+         n_bytes / s_serialize / 1e6,
+         1000.0 * percentile(t_embed, 99));
+  if (upload)
+  {
+    printf(" %10.0f %8zu", records.size() / t_wall, n_failed);
+  }
+  printf("\n");
+
+  return n_failed == 0;
+}
+
+int main(int argc, char **argv)
+{
+  app_llama_args_t args;
+  if (!app_parse_args(argc, argv, &args))
+  {
+    return 1;
+  }
+
+  size_t n_docs = 20000;
+  int max_words = 200;
+  std::string specs = "fixed:16,uniform:4:128,lognormal:24:0.8,bimodal:8:160:0.1";
+  std::string json_path = "bench-e2e.json";
+  bool use_upload = false;
+  for (int i = 1; i < argc; i++)
+  {
+    if (strcmp(argv[i], "--upload") == 0)
+    {
+      use_upload = true;
+    }
+    else if (i + 1 >= argc)
+    {
+      break;
+    }
+    else if (strcmp(argv[i], "--docs") == 0)
+    {
+      n_docs = std::stoul(argv[++i]);
+    }
+    else if (strcmp(argv[i], "--lengths") == 0)
+    {
+      specs = argv[++i];
+    }
+    else if (strcmp(argv[i], "--max-words") == 0)
+    {
+      max_words = std::stoi(argv[++i]);
+    }
+    else if (strcmp(argv[i], "--json") == 0)
+    {
+      json_path = argv[++i];
+    }
+  }
+
+  std::vector<bench_lengths_t> distributions;
+  for (const std::string &spec : split_lines(specs, ","))
+  {
+    bench_lengths_t lengths;
+    if (!parse_lengths(spec, &lengths))
+    {
+      LOG_ERR("bad length distribution '%s'.\n", spec.c_str());
+      return 1;
+    }
+    distributions.push_back(lengths);
+  }
+
+  if (n_docs == 0 || max_words <= 0 || distributions.empty())
+  {
+    LOG_ERR("--docs, --max-words and --lengths must not be empty.\n");
+    return 1;
+  }
+
+  app_llama_data_t data;
+  if (!app_llm_init(args, &data))
+  {
+    app_llm_destroy(&data);
+    return 1;
+  }
+
+  bench_upload_t upload;
+  if (use_upload && !upload_open(args, data.n_embd_out, &upload))
+  {
+    LOG_ERR("could not prepare '%s' on %s.\n", APP_BENCH_COLLECTION,
+            args.qdrant_uri.c_str());
+    app_llm_destroy(&data);
+    return 1;
+  }
+
+  nlohmann::json report;
+  report["config"] = {{"model", args.model},
+                      {"docs", n_docs},
+                      {"max_words", max_words},
+                      {"n_embd", data.n_embd_out},
+                      {"n_batch", data.n_batch},
+                      {"n_ubatch", data.n_ubatch},
+                      {"n_seq_max", data.n_seq_max},
+                      {"threads", args.threads},
+                      {"tok_threads", data.n_tok_threads},
+                      {"chunk", args.chunk_size},
+                      {"batch_points", args.qdrant_batch_points},
+                      {"normalize_isa",
+                       app_normalize_isa_name(app_normalize_get_isa())},
+                      {"upload", use_upload ? args.qdrant_uri : ""}};
+  report["runs"] = nlohmann::json::array();
+
+  printf("\n%-24s %9s %11s %9s %7s %9s %12s", "lengths", "tok/rec",
+         "tokens/s", "embd/s", "fill", "ser MB/s", "embed p99 ms");
+  if (use_upload)
+  {
+    printf(" %10s %8s", "points/s", "failed");
+  }
+  printf("\n");
+
+  bool success = true;
+  for (const bench_lengths_t &lengths : distributions)
+  {
+    nlohmann::json run;
+    if (!bench_run(args, data, lengths, n_docs, max_words,
+                   use_upload ? &upload : NULL, run))
+    {
+      success = false;
+    }
+
+    if (!run.empty())
+    {
+      report["runs"].push_back(run);
+    }
+
+    if (!success)
+    {
+      break;
+    }
+  }
+
+  if (use_upload)
+  {
+    upload_close(&upload);
+  }
+  app_llm_destroy(&data);
+
+  std::ofstream out(json_path);
+  out << report.dump(2) << "\n";
+  if (!out)
+  {
+    LOG_ERR("could not write '%s'.\n", json_path.c_str());
+    return 1;
+  }
+
+  printf("\nresults in '%s'.\n", json_path.c_str());
+
+  return success ? 0 : 1;
+}
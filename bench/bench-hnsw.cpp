@@ -0,0 +1,325 @@
+#include "app-distance.h"
+#include "app-hnsw.h"
+#include "utils.h"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <random>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+/*
+ * bench-hnsw: distance kernels on every instruction set the CPU supports,
+ * then, for every metric, HNSW build rate, save and load time, and query
+ * rate and recall against brute force over a range of ef
+ *
+ *   bench-hnsw [--points N] [--dim N] [--queries N] [--k N] [--threads N]
+ *              [--m N] [--ef-construction N]
+ *
+ * Points are drawn around a few hundred gaussian centers, which is closer
+ * to embeddings than uniform noise. Exits non-zero when the recall at the
+ * largest ef is under APP_BENCH_MIN_RECALL.
+ */
+
+#define APP_BENCH_MIN_RECALL 0.9
+
+static double seconds_since(const std::chrono::steady_clock::time_point &t0)
+{
+  return std::chrono::duration<double>(std::chrono::steady_clock::now() - t0)
+      .count();
+}
+
+static void make_points(std::mt19937 &rng, size_t n, int dim, size_t n_centers,
+                        std::vector<float> &out)
+{
+  std::normal_distribution<float> gauss(0.0f, 1.0f);
+
+  std::vector<float> centers(n_centers * dim);
+  for (auto &v : centers)
+  {
+    v = gauss(rng);
+  }
+
+  out.resize(n * dim);
+  for (size_t k = 0; k < n; k++)
+  {
+    const float *c = centers.data() + (rng() % n_centers) * dim;
+    for (int i = 0; i < dim; i++)
+    {
+      out[k * dim + i] = c[i] + 0.35f * gauss(rng);
+    }
+  }
+}
+
+// kernel results are compared on the points as the index stores them
+static void exact_knn(const app_hnsw_t &index, const float *queries,
+                      size_t n_queries, size_t k, int n_threads,
+                      std::vector<uint32_t> &truth)
+{
+  truth.assign(n_queries * k, 0);
+
+  parallel_for(n_queries, n_threads,
+               [&](size_t begin, size_t end)
+               {
+                 std::vector<std::pair<float, uint32_t>> all(index.n_points);
+                 std::vector<float> q(index.dim);
+                 for (size_t s = begin; s < end; s++)
+                 {
+                   memcpy(q.data(), queries + s * index.dim,
+                          index.dim * sizeof(float));
+                   if (index.distance == Cosine)
+                   {
+                     double norm = 0.0;
+                     for (float v : q)
+                     {
+                       norm += (double)v * v;
+                     }
+                     for (float &v : q)
+                     {
+                       v /= std::sqrt(norm);
+                     }
+                   }
+
+                   for (uint32_t p = 0; p < index.n_points; p++)
+                   {
+                     all[p] = {index.distance_fn(
+                                   q.data(),
+                                   index.vectors + (size_t)p * index.dim,
+                                   index.dim),
+                               p};
+                   }
+                   std::partial_sort(all.begin(), all.begin() + k, all.end());
+                   for (size_t r = 0; r < k; r++)
+                   {
+                     truth[s * k + r] = all[r].second;
+                   }
+                 }
+               });
+}
+
+static void bench_kernels(int dim)
+{
+  const int n_rows = 4096;
+  const int repeat = 20;
+
+  std::mt19937 rng(7);
+  std::vector<float> rows;
+  make_points(rng, n_rows + 1, dim, 16, rows);
+
+  const qdrant_distance_type_t metrics[] = {DotProduct, Euclid, Manhattan};
+  const char *names[] = {"dot", "euclid", "manhattan"};
+  const app_distance_isa_t detected = app_distance_get_isa();
+
+  printf("%-10s %-8s %14s %9s\n", "kernel", "isa", "distances/s", "speedup");
+
+  for (int m = 0; m < 3; m++)
+  {
+    double t_scalar = 0.0;
+    for (int isa = DistanceScalar; isa < DistanceIsaCount; isa++)
+    {
+      if (!app_distance_set_isa((app_distance_isa_t)isa))
+      {
+        continue;
+      }
+
+      const app_distance_fn_t fn = app_distance_get(metrics[m]);
+      volatile float sink = 0.0f;
+
+      double best = 1e30;
+      for (int r = 0; r < repeat; r++)
+      {
+        const auto t0 = std::chrono::steady_clock::now();
+        float acc = 0.0f;
+        for (int k = 0; k < n_rows; k++)
+        {
+          acc += fn(rows.data(), rows.data() + (size_t)(k + 1) * dim, dim);
+        }
+        sink = acc;
+        best = std::min(best, seconds_since(t0));
+      }
+      (void)sink;
+
+      if (isa == DistanceScalar)
+      {
+        t_scalar = best;
+      }
+
+      printf("%-10s %-8s %14.0f %8.2fx\n", names[m],
+             app_distance_isa_name((app_distance_isa_t)isa), n_rows / best,
+             t_scalar / best);
+    }
+  }
+
+  app_distance_set_isa(detected);
+  printf("\n");
+}
+
+int main(int argc, char **argv)
+{
+  size_t n_points = 20000;
+  int dim = 128;
+  size_t n_queries = 500;
+  size_t k = 10;
+  int n_threads = std::max(1u, std::thread::hardware_concurrency());
+
+  app_hnsw_config_t config;
+  app_hnsw_default_config(&config);
+
+  for (int i = 1; i < argc; i++)
+  {
+    if (strcmp(argv[i], "--points") == 0 && i + 1 < argc)
+    {
+      n_points = atol(argv[++i]);
+    }
+    else if (strcmp(argv[i], "--dim") == 0 && i + 1 < argc)
+    {
+      dim = atoi(argv[++i]);
+    }
+    else if (strcmp(argv[i], "--queries") == 0 && i + 1 < argc)
+    {
+      n_queries = atol(argv[++i]);
+    }
+    else if (strcmp(argv[i], "--k") == 0 && i + 1 < argc)
+    {
+      k = atol(argv[++i]);
+    }
+    else if (strcmp(argv[i], "--threads") == 0 && i + 1 < argc)
+    {
+      n_threads = atoi(argv[++i]);
+    }
+    else if (strcmp(argv[i], "--m") == 0 && i + 1 < argc)
+    {
+      config.m = atoi(argv[++i]);
+    }
+    else if (strcmp(argv[i], "--ef-construction") == 0 && i + 1 < argc)
+    {
+      config.ef_construction = atoi(argv[++i]);
+    }
+    else
+    {
+      fprintf(stderr,
+              "usage: %s [--points N] [--dim N] [--queries N] [--k N] "
+              "[--threads N] [--m N] [--ef-construction N]\n",
+              argv[0]);
+      return 1;
+    }
+  }
+
+  if (n_points == 0 || dim <= 0 || n_queries == 0 || k == 0 ||
+      k > n_points || n_threads <= 0)
+  {
+    LOG_ERR("--points, --dim, --queries, --k and --threads must be positive, "
+            "and --k at most --points.\n");
+    return 1;
+  }
+
+  bench_kernels(dim);
+
+  std::mt19937 rng(42);
+  std::vector<float> points;
+  std::vector<float> queries;
+  make_points(rng, n_points + n_queries, dim, 256, points);
+  queries.assign(points.end() - n_queries * dim, points.end());
+  points.resize(n_points * dim);
+
+  const qdrant_distance_type_t metrics[] = {Cosine, DotProduct, Euclid,
+                                            Manhattan};
+  const size_t efs[] = {16, 32, 64, 128, 256};
+
+  const std::string path =
+      "/tmp/bench-hnsw-" + std::to_string(getpid()) + ".idx";
+
+  printf("%zu points of %d dims, %zu queries, top %zu, m %u, "
+         "ef_construction %u, %d threads\n\n",
+         n_points, dim, n_queries, k, config.m, config.ef_construction,
+         n_threads);
+
+  bool recall_ok = true;
+
+  for (const qdrant_distance_type_t metric : metrics)
+  {
+    app_hnsw_t built;
+    if (!app_hnsw_init(dim, metric, config, &built))
+    {
+      return 1;
+    }
+
+    for (size_t p = 0; p < n_points; p++)
+    {
+      app_hnsw_add(built, std::to_string(p), "", points.data() + p * dim);
+    }
+
+    auto t0 = std::chrono::steady_clock::now();
+    app_hnsw_build(built, n_threads);
+    const double t_build = seconds_since(t0);
+
+    t0 = std::chrono::steady_clock::now();
+    const bool saved = app_hnsw_save(built, path);
+    const double t_save = seconds_since(t0);
+    app_hnsw_destroy(&built);
+
+    app_hnsw_t index;
+    t0 = std::chrono::steady_clock::now();
+    const bool loaded = saved && app_hnsw_load(path, &index);
+    const double t_load = seconds_since(t0);
+    remove(path.c_str());
+
+    if (!loaded)
+    {
+      return 1;
+    }
+
+    printf("%s: build %.2f s (%.0f points/s), save %.1f ms, load %.3f ms "
+           "(%.1f MiB)\n",
+           qdrant_get_distance(metric).c_str(), t_build, n_points / t_build,
+           1000.0 * t_save, 1000.0 * t_load, index.map_size / 1048576.0);
+
+    std::vector<uint32_t> truth;
+    t0 = std::chrono::steady_clock::now();
+    exact_knn(index, queries.data(), n_queries, k, 1, truth);
+    const double t_exact = seconds_since(t0);
+
+    printf("  %-6s %12s %9s %9s\n", "ef", "queries/s", "speedup", "recall");
+    printf("  %-6s %12.0f %9s %9.4f\n", "exact", n_queries / t_exact, "1.00x",
+           1.0);
+
+    double recall = 0.0;
+    std::vector<app_hnsw_hit_t> hits;
+    for (const size_t ef : efs)
+    {
+      size_t n_found = 0;
+      t0 = std::chrono::steady_clock::now();
+      for (size_t s = 0; s < n_queries; s++)
+      {
+        app_hnsw_search(index, queries.data() + s * dim, k, ef, hits);
+
+        const uint32_t *expected = truth.data() + s * k;
+        for (const app_hnsw_hit_t &hit : hits)
+        {
+          n_found += std::count(expected, expected + k, hit.node);
+        }
+      }
+      const double t = seconds_since(t0);
+
+      recall = (double)n_found / (n_queries * k);
+      printf("  %-6zu %12.0f %8.1fx %9.4f\n", ef, n_queries / t, t_exact / t,
+             recall);
+    }
+
+    if (recall < APP_BENCH_MIN_RECALL)
+    {
+      recall_ok = false;
+    }
+
+    app_hnsw_destroy(&index);
+    printf("\n");
+  }
+
+  printf("recall: %s\n", recall_ok ? "ok" : "FAILED");
+
+  return recall_ok ? 0 : 1;
+}
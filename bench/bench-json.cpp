@@ -0,0 +1,188 @@
+#include "nlohmann/json.hpp"
+#include "qdrant-json.h"
+#include "qdrant-quantize.h"
+#include "qdrant.h"
+#include "utils.h"
+#include <chrono>
+#include <random>
+#include <stdio.h>
+#include <string.h>
+
+/*
+ * bench-json: upsert body serialization, nlohmann tree vs qdrant-json writer,
+ * then the writer on quantized vectors (body size per vector format)
+ *
+ *   bench-json [--points N] [--dim N] [--repeat N]
+ */
+
+// the body as qdrant_points_insert used to build it
+static void body_nlohmann(std::string &out, const qdrant_point_array_t &points)
+{
+  nlohmann::json data;
+  nlohmann::json itens = nlohmann::json::array();
+
+  for (auto &point : points)
+  {
+    nlohmann::json item;
+    item["id"] = point.id;
+    item["payload"][point.payload_x] = point.payload_y;
+    item["vector"] = nlohmann::json::array();
+
+    for (auto &vec : point.vector)
+    {
+      item["vector"].push_back(vec);
+    }
+
+    itens.push_back(item);
+  }
+  data["points"] = itens;
+
+  out = nlohmann::to_string(data);
+}
+
+template <typename F>
+static double bench(F fn, const qdrant_point_array_t &points, int repeat,
+                    std::string &out)
+{
+  double best = 1e30;
+  for (int r = 0; r < repeat; r++)
+  {
+    const auto t0 = std::chrono::steady_clock::now();
+    fn(out, points);
+    const auto t1 = std::chrono::steady_clock::now();
+
+    best = std::min(best, std::chrono::duration<double>(t1 - t0).count());
+  }
+
+  return best;
+}
+
+static bool same_points(const std::string &a, const std::string &b)
+{
+  const nlohmann::json ja = nlohmann::json::parse(a);
+  const nlohmann::json jb = nlohmann::json::parse(b);
+
+  const auto &pa = ja["points"];
+  const auto &pb = jb["points"];
+  if (pa.size() != pb.size())
+  {
+    return false;
+  }
+
+  for (size_t i = 0; i < pa.size(); i++)
+  {
+    if (pa[i]["id"] != pb[i]["id"] || pa[i]["payload"] != pb[i]["payload"])
+    {
+      return false;
+    }
+
+    const auto &va = pa[i]["vector"];
+    const auto &vb = pb[i]["vector"];
+    if (va.size() != vb.size())
+    {
+      return false;
+    }
+
+    // both must parse back to the very same float
+    for (size_t j = 0; j < va.size(); j++)
+    {
+      if (va[j].get<float>() != vb[j].get<float>())
+      {
+        return false;
+      }
+    }
+  }
+
+  return true;
+}
+
+int main(int argc, char **argv)
+{
+  int n_points = 1000;
+  int n_dim = 1024;
+  int repeat = 5;
+
+  for (int i = 1; i + 1 < argc; i++)
+  {
+    if (strcmp(argv[i], "--points") == 0)
+    {
+      n_points = std::stoi(argv[++i]);
+    }
+    else if (strcmp(argv[i], "--dim") == 0)
+    {
+      n_dim = std::stoi(argv[++i]);
+    }
+    else if (strcmp(argv[i], "--repeat") == 0)
+    {
+      repeat = std::stoi(argv[++i]);
+    }
+  }
+
+  // normalized embeddings live in [-1, 1]
+  std::mt19937 rng(42);
+  std::normal_distribution<float> dist(0.0f, 0.05f);
+
+  qdrant_point_array_t points(n_points);
+  for (auto &point : points)
+  {
+    point.id = generate_uuid();
+    point.payload_x = "text";
+    point.payload_y = "a \"quoted\" line with\ttabs and ünïcödé";
+    point.vector.resize(n_dim);
+    for (auto &v : point.vector)
+    {
+      v = dist(rng);
+    }
+  }
+
+  std::string out_nlohmann;
+  std::string out_writer;
+
+  const double t_nlohmann = bench(body_nlohmann, points, repeat, out_nlohmann);
+  const double t_writer = bench(
+      [](std::string &out, const qdrant_point_array_t &p)
+      { qdrant_json_write_points(out, p); },
+      points, repeat, out_writer);
+
+  const bool same = same_points(out_nlohmann, out_writer);
+
+  printf("points ......... %d x %d\n", n_points, n_dim);
+  printf("nlohmann ....... %.3f s, %.1f MB, %.1f MB/s, %.0f points/s\n",
+         t_nlohmann, out_nlohmann.size() / 1e6,
+         out_nlohmann.size() / 1e6 / t_nlohmann, n_points / t_nlohmann);
+  printf("qdrant-json .... %.3f s, %.1f MB, %.1f MB/s, %.0f points/s\n",
+         t_writer, out_writer.size() / 1e6, out_writer.size() / 1e6 / t_writer,
+         n_points / t_writer);
+  printf("speedup ........ %.2fx\n", t_nlohmann / t_writer);
+  printf("identical ...... %s\n", same ? "yes" : "NO");
+
+  qdrant_colection_info_t col;
+  col.size = n_dim;
+  col.quantize_range = qdrant_quantize_default_range(n_dim);
+
+  for (const qdrant_quantization_t format : {Float16, Uint8, Binary})
+  {
+    col.quantization = format;
+
+    qdrant_point_array_t quantized(points);
+    for (auto &point : quantized)
+    {
+      qdrant_quantize(col, point.vector.data(), point.vector.size());
+    }
+
+    std::string out;
+    const double t = bench(
+        [format](std::string &o, const qdrant_point_array_t &p)
+        { qdrant_json_write_points(o, p, format); },
+        quantized, repeat, out);
+
+    std::string label = qdrant_get_quantization(format) + " ";
+    label.resize(15, '.');
+
+    printf("%s %.3f s, %.1f MB (%.0f%%), %.0f points/s\n", label.c_str(), t,
+           out.size() / 1e6, 100.0 * out.size() / out_writer.size(),
+           n_points / t);
+  }
+
+  return same ? 0 : 1;
+}
@@ -0,0 +1,206 @@
+#include "app-normalize.h"
+#include "utils.h"
+#include <chrono>
+#include <cmath>
+#include <random>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+
+/*
+ * bench-normalize: embedding normalization, the former scalar loop vs
+ * app_normalize on every instruction set the CPU supports
+ *
+ *   bench-normalize [--rows N] [--repeat N]
+ *
+ * Every kernel output is checked against the former loop; exits non-zero
+ * when one differs by more than APP_BENCH_MAX_ULP.
+ */
+
+#define APP_BENCH_MAX_ULP 2
+
+// app_llama_embd_normalize as it was in llama-utils.cpp
+static void normalize_reference(const float *inp, float *out, int n,
+                                int embd_norm)
+{
+  double sum = 0.0;
+
+  switch (embd_norm)
+  {
+  case -1: // no normalisation
+  {
+    sum = 1.0;
+    break;
+  }
+  case 0: // max absolute
+  {
+    for (int i = 0; i < n; i++)
+    {
+      if (sum < std::abs(inp[i]))
+      {
+        sum = std::abs(inp[i]);
+      }
+    }
+    sum /= 32760.0; // make an int16 range
+    break;
+  }
+  case 2: // euclidean
+  {
+    for (int i = 0; i < n; i++)
+    {
+      sum += inp[i] * inp[i];
+    }
+    sum = std::sqrt(sum);
+    break;
+  }
+  default: // p-norm (euclidean is p-norm p=2)
+  {
+    for (int i = 0; i < n; i++)
+    {
+      sum += std::pow(std::abs(inp[i]), embd_norm);
+    }
+    sum = std::pow(sum, 1.0 / embd_norm);
+    break;
+  }
+  }
+
+  const float norm = sum > 0.0 ? 1.0 / sum : 0.0f;
+
+  for (int i = 0; i < n; i++)
+  {
+    out[i] = inp[i] * norm;
+  }
+}
+
+// distance in representable floats
+static int64_t ulp_distance(float a, float b)
+{
+  int32_t ia, ib;
+  memcpy(&ia, &a, sizeof(ia));
+  memcpy(&ib, &b, sizeof(ib));
+
+  // map to a monotonic integer line
+  const int64_t la = ia < 0 ? (int64_t)INT32_MIN - ia : ia;
+  const int64_t lb = ib < 0 ? (int64_t)INT32_MIN - ib : ib;
+
+  return la > lb ? la - lb : lb - la;
+}
+
+template <typename F>
+static double bench(F fn, const std::vector<float> &inp,
+                    std::vector<float> &out, int n_rows, int n, int norm,
+                    int repeat)
+{
+  double best = 1e30;
+  for (int r = 0; r < repeat; r++)
+  {
+    const auto t0 = std::chrono::steady_clock::now();
+    for (int k = 0; k < n_rows; k++)
+    {
+      fn(inp.data() + (size_t)k * n, out.data() + (size_t)k * n, n, norm);
+    }
+    const auto t1 = std::chrono::steady_clock::now();
+
+    best = std::min(best, std::chrono::duration<double>(t1 - t0).count());
+  }
+
+  return best;
+}
+
+int main(int argc, char **argv)
+{
+  int n_rows = 2048;
+  int repeat = 10;
+
+  for (int i = 1; i < argc; i++)
+  {
+    if (strcmp(argv[i], "--rows") == 0 && i + 1 < argc)
+    {
+      n_rows = atoi(argv[++i]);
+    }
+    else if (strcmp(argv[i], "--repeat") == 0 && i + 1 < argc)
+    {
+      repeat = atoi(argv[++i]);
+    }
+    else
+    {
+      fprintf(stderr, "usage: %s [--rows N] [--repeat N]\n", argv[0]);
+      return 1;
+    }
+  }
+
+  if (n_rows <= 0 || repeat <= 0)
+  {
+    LOG_ERR("--rows and --repeat must be positive.\n");
+    return 1;
+  }
+
+  // the specialized widths, plus two that take the generic path
+  const int widths[] = {384, 768, 1024, 4096, 1000, 37};
+  const int norms[] = {2, 0, 1, 3};
+
+  const app_normalize_isa_t detected = app_normalize_get_isa();
+
+  std::mt19937 rng(42);
+  std::normal_distribution<float> value(0.0f, 0.5f);
+
+  bool parity = true;
+
+  printf("%-6s %-5s %-8s %12s %9s %8s\n", "width", "norm", "kernel",
+         "rows/s", "speedup", "max ulp");
+
+  for (const int n : widths)
+  {
+    std::vector<float> inp((size_t)n_rows * n);
+    for (auto &v : inp)
+    {
+      v = value(rng);
+    }
+
+    std::vector<float> expected(inp.size());
+    std::vector<float> out(inp.size());
+
+    for (const int norm : norms)
+    {
+      const double t_ref = bench(normalize_reference, inp, expected, n_rows,
+                                 n, norm, repeat);
+      printf("%-6d %-5d %-8s %12.0f %9s %8s\n", n, norm, "former",
+             n_rows / t_ref, "1.00x", "-");
+
+      for (int isa = NormalizeScalar; isa < NormalizeIsaCount; isa++)
+      {
+        if (!app_normalize_set_isa((app_normalize_isa_t)isa))
+        {
+          continue;
+        }
+
+        const double t =
+            bench(app_normalize, inp, out, n_rows, n, norm, repeat);
+
+        int64_t max_ulp = 0;
+        for (size_t i = 0; i < out.size(); i++)
+        {
+          max_ulp = std::max(max_ulp, ulp_distance(out[i], expected[i]));
+        }
+
+        if (max_ulp > APP_BENCH_MAX_ULP)
+        {
+          parity = false;
+        }
+
+        printf("%-6d %-5d %-8s %12.0f %8.2fx %8lld%s\n", n, norm,
+               app_normalize_isa_name((app_normalize_isa_t)isa), n_rows / t,
+               t_ref / t, (long long)max_ulp,
+               max_ulp > APP_BENCH_MAX_ULP ? "  MISMATCH" : "");
+      }
+    }
+  }
+
+  app_normalize_set_isa(detected);
+
+  printf("parity: %s (default kernel: %s)\n", parity ? "ok" : "FAILED",
+         app_normalize_isa_name(detected));
+
+  return parity ? 0 : 1;
+}
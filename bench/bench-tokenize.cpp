@@ -0,0 +1,146 @@
+#include "app-llama.h"
+#include "utils.h"
+#include <chrono>
+#include <fstream>
+#include <random>
+#include <sstream>
+#include <stdio.h>
+#include <string.h>
+
+/*
+ * bench-tokenize: serial vs parallel app_llm_tokenize
+ *
+ *   bench-tokenize --model MODEL [--source FILE] [--lines N] [--words N]
+ *                  [--repeat N] [--tok-threads N]
+ *
+ * Without --source a synthetic corpus of N lines is generated.
+ */
+
+static std::string make_corpus(int n_lines, int n_words)
+{
+  std::mt19937 rng(42);
+  std::uniform_int_distribution<int> words(1, n_words);
+  std::uniform_int_distribution<int> chars(2, 10);
+  std::uniform_int_distribution<int> letter('a', 'z');
+
+  std::string corpus;
+  for (int i = 0; i < n_lines; i++)
+  {
+    const int n = words(rng);
+    for (int w = 0; w < n; w++)
+    {
+      const int len = chars(rng);
+      for (int c = 0; c < len; c++)
+      {
+        corpus.push_back(letter(rng));
+      }
+      corpus.push_back(w + 1 < n ? ' ' : '\n');
+    }
+  }
+
+  return corpus;
+}
+
+static double bench_tokenize(app_llama_data_t &data, int n_threads,
+                             const std::vector<std::string_view> &prompts,
+                             int repeat, llama_input_vector_t &inputs)
+{
+  data.n_tok_threads = n_threads;
+
+  double best = 1e30;
+  for (int r = 0; r < repeat; r++)
+  {
+    inputs.clear();
+
+    const auto t0 = std::chrono::steady_clock::now();
+    app_llm_tokenize(data, prompts, inputs);
+    const auto t1 = std::chrono::steady_clock::now();
+
+    best = std::min(best, std::chrono::duration<double>(t1 - t0).count());
+  }
+
+  return best;
+}
+
+int main(int argc, char **argv)
+{
+  app_llama_args_t args;
+  if (!app_parse_args(argc, argv, &args))
+  {
+    return 1;
+  }
+
+  int n_lines = 100000;
+  int n_words = 24;
+  int repeat = 3;
+  for (int i = 1; i + 1 < argc; i++)
+  {
+    if (strcmp(argv[i], "--lines") == 0)
+    {
+      n_lines = std::stoi(argv[++i]);
+    }
+    else if (strcmp(argv[i], "--words") == 0)
+    {
+      n_words = std::stoi(argv[++i]);
+    }
+    else if (strcmp(argv[i], "--repeat") == 0)
+    {
+      repeat = std::stoi(argv[++i]);
+    }
+  }
+
+  // prompts longer than a batch are rejected, lift the limit for the bench
+  args.batch_size = 65535;
+  args.n_parallel = 1;
+
+  app_llama_data_t data;
+  if (!app_llm_init(args, &data))
+  {
+    app_llm_destroy(&data);
+    return 1;
+  }
+
+  std::string corpus;
+  if (!args.source.empty())
+  {
+    std::ifstream in(args.source);
+    std::stringstream ss;
+    ss << in.rdbuf();
+    corpus = ss.str();
+  }
+  else
+  {
+    corpus = make_corpus(n_lines, n_words);
+  }
+
+  std::vector<std::string_view> prompts = split_views(corpus, data.embd_sep);
+  if (!prompts.empty() && prompts.back().empty())
+  {
+    prompts.pop_back();
+  }
+
+  llama_input_vector_t serial;
+  llama_input_vector_t parallel;
+
+  const double t_serial = bench_tokenize(data, 1, prompts, repeat, serial);
+  const double t_parallel =
+      bench_tokenize(data, args.tok_threads, prompts, repeat, parallel);
+
+  const size_t n_tokens = serial.tokens.size();
+  const bool identical =
+      serial.tokens == parallel.tokens && serial.offsets == parallel.offsets;
+
+  printf("\n");
+  printf("prompts ........ %zu\n", prompts.size());
+  printf("tokens ......... %zu\n", n_tokens);
+  printf("serial ......... %.3f s (%.0f tokens/s)\n", t_serial,
+         n_tokens / t_serial);
+  printf("parallel (%3d) . %.3f s (%.0f tokens/s)\n", args.tok_threads,
+         t_parallel, n_tokens / t_parallel);
+  printf("speedup ........ %.2fx\n", t_serial / t_parallel);
+  printf("identical ...... %s\n", identical ? "yes" : "NO");
+
+  app_llm_destroy(&data);
+
+  return identical ? 0 : 1;
+}
@@ -0,0 +1,395 @@
+#include "qdrant-async.h"
+#include "qdrant-batch.h"
+#include "qdrant-stub.h"
+#include "qdrant.h"
+#include "utils.h"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <random>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+
+/*
+ * bench-upload: the upload engine (batcher + async window) against the
+ * in-process Qdrant stand-in, no network and no Qdrant needed
+ *
+ *   bench-upload [--points N] [--dim N] [--batch-points N] [--compress ENC]
+ *                [--latency MS] [--jitter MS] [--mbps N] [--errors R]
+ *                [--throttle R] [--resets R] [--retries N]
+ *   bench-upload --serve PORT [--latency MS] [--jitter MS] [--mbps N]
+ *                [--errors R] [--throttle R] [--resets R]
+ *
+ * Three runs: a window sweep at --latency, the same upload over a link
+ * capped at --mbps (backpressure: time the producer spends blocked), and
+ * one with 503s, 429s and connection resets injected, which must still
+ * land every point. Exits non-zero when a run loses points.
+ *
+ * --serve only runs the stand-in, for embed2vecdb --qdrant http://..:PORT,
+ * until interrupted.
+ */
+
+typedef struct _bench_run
+{
+  double t_wall;
+  double t_blocked; // inside qdrant_batcher_add, waiting on the window
+  uint64_t n_requests;
+  uint64_t n_failed;
+  uint64_t n_retries;
+  uint64_t n_wire_bytes;
+  size_t n_stored; // points the stand-in holds afterwards
+  std::vector<double> latencies;
+} bench_run_t;
+
+static double seconds_since(const std::chrono::steady_clock::time_point &t0)
+{
+  return std::chrono::duration<double>(std::chrono::steady_clock::now() - t0)
+      .count();
+}
+
+// nearest rank, over a sorted copy
+static double percentile(std::vector<double> samples, double p)
+{
+  if (samples.empty())
+  {
+    return 0.0;
+  }
+
+  std::sort(samples.begin(), samples.end());
+  const size_t rank = (size_t)std::ceil(p / 100.0 * samples.size());
+
+  return samples[std::max<size_t>(rank, 1) - 1];
+}
+
+static void make_points(size_t n, int dim, qdrant_point_array_t &points)
+{
+  std::mt19937 rng(42);
+  std::normal_distribution<float> gauss(0.0f, 1.0f);
+
+  points.resize(n);
+  for (size_t k = 0; k < n; k++)
+  {
+    points[k].id = generate_uuid();
+    points[k].payload_x = "text";
+    points[k].payload_y = "record " + std::to_string(k);
+    points[k].vector.resize(dim);
+    for (float &v : points[k].vector)
+    {
+      v = gauss(rng);
+    }
+  }
+}
+
+static bool bench_upload(const qdrant_stub_config_t &stub_config,
+                         const qdrant_async_config_t &async_config,
+                         const qdrant_batch_config_t &batch_config,
+                         const qdrant_point_array_t &points, bench_run_t *run)
+{
+  qdrant_stub_t stub;
+  if (!qdrant_stub_start(stub_config, &stub))
+  {
+    return false;
+  }
+
+  qdrant_info_t info;
+  if (!qdrant_init(stub.URI, &info))
+  {
+    qdrant_stub_stop(&stub);
+    return false;
+  }
+
+  qdrant_colection_info_t col;
+  col.name = "bench-upload";
+  col.size = points[0].vector.size();
+  col.distance = Cosine;
+  col.quantization = NoQuantization;
+  col.quantize_range = 0.0f;
+
+  qdrant_async_t async;
+  qdrant_batcher_t batcher;
+  bool ready = qdrant_collection_create(info, col) &&
+               qdrant_async_init(info, async_config, &async);
+  if (ready &&
+      !qdrant_batcher_init(async, col, batch_config,
+                           [run](const qdrant_async_result_t &result, size_t)
+                           {
+                             run->latencies.push_back(result.seconds);
+                             run->n_failed += result.success ? 0 : 1;
+                           },
+                           &batcher))
+  {
+    qdrant_async_destroy(&async);
+    ready = false;
+  }
+
+  if (!ready)
+  {
+    qdrant_destroy(&info);
+    qdrant_stub_stop(&stub);
+    return false;
+  }
+
+  run->t_blocked = 0.0;
+  run->n_failed = 0;
+  run->latencies.clear();
+
+  const auto t0 = std::chrono::steady_clock::now();
+  for (const qdrant_point_spec_t &point : points)
+  {
+    const auto t1 = std::chrono::steady_clock::now();
+    qdrant_batcher_add(batcher, point);
+    run->t_blocked += seconds_since(t1);
+  }
+  qdrant_batcher_finish(batcher);
+  qdrant_async_wait(async);
+  run->t_wall = seconds_since(t0);
+
+  run->n_requests = batcher.n_requests;
+  run->n_retries = async.n_retried;
+  run->n_wire_bytes = batcher.n_wire_bytes;
+  run->n_stored = qdrant_stub_count(stub, col.name);
+
+  qdrant_batcher_destroy(&batcher);
+  qdrant_async_destroy(&async);
+  qdrant_destroy(&info);
+  qdrant_stub_stop(&stub);
+
+  return true;
+}
+
+static void print_header()
+{
+  printf("%-18s %10s %9s %9s %9s %8s %8s %7s %9s\n", "run", "points/s",
+         "MB/s", "p50 ms", "p99 ms", "blocked", "retries", "failed",
+         "stored");
+}
+
+static bool print_run(const char *name, const bench_run_t &run,
+                      size_t n_points)
+{
+  printf("%-18s %10.0f %9.1f %9.2f %9.2f %7.0f%% %8llu %7llu %9zu\n", name,
+         n_points / run.t_wall, run.n_wire_bytes / run.t_wall / 1e6,
+         1000.0 * percentile(run.latencies, 50),
+         1000.0 * percentile(run.latencies, 99),
+         100.0 * run.t_blocked / run.t_wall,
+         (unsigned long long)run.n_retries, (unsigned long long)run.n_failed,
+         run.n_stored);
+
+  return run.n_stored == n_points && run.n_failed == 0;
+}
+
+static int serve(const qdrant_stub_config_t &config)
+{
+  // taken by sigwait below, not by a handler
+  sigset_t signals;
+  sigemptyset(&signals);
+  sigaddset(&signals, SIGINT);
+  sigaddset(&signals, SIGTERM);
+  pthread_sigmask(SIG_BLOCK, &signals, NULL);
+
+  qdrant_stub_t stub;
+  if (!qdrant_stub_start(config, &stub))
+  {
+    return 1;
+  }
+
+  LOG("qdrant stand-in on %s (latency %ld+%ld ms, cap %.0f Mbps, errors "
+      "%.3f, throttle %.3f, resets %.3f).\n",
+      stub.URI.c_str(), config.latency_ms, config.jitter_ms,
+      config.max_bps * 8 / 1e6, config.error_rate, config.throttle_rate,
+      config.reset_rate);
+
+  int sig = 0;
+  sigwait(&signals, &sig);
+
+  const qdrant_stub_stats_t stats = qdrant_stub_get_stats(stub);
+  qdrant_stub_stop(&stub);
+
+  LOG("%llu requests, %.1f MiB, %llu upserts of %llu points, %llu searches, "
+      "%llu errors, %llu throttled, %llu resets.\n",
+      (unsigned long long)stats.n_requests, stats.n_bytes / 1048576.0,
+      (unsigned long long)stats.n_upserts, (unsigned long long)stats.n_points,
+      (unsigned long long)stats.n_searches,
+      (unsigned long long)stats.n_errors,
+      (unsigned long long)stats.n_throttled,
+      (unsigned long long)stats.n_resets);
+
+  return 0;
+}
+
+int main(int argc, char **argv)
+{
+  size_t n_points = 20000;
+  int dim = 384;
+  int port = -1;
+  double mbps = 400.0;
+  bool mbps_given = false;
+
+  // the runs default to a little latency, --serve to none
+  qdrant_stub_config_t stub_config;
+  qdrant_stub_default_config(&stub_config);
+  long latency_ms = -1;
+
+  // unset rates are 5%, 5% and 2% in the fault run, 0 with --serve
+  double errors = -1.0, throttle = -1.0, resets = -1.0;
+
+  qdrant_async_config_t async_config;
+  qdrant_async_default_config(&async_config);
+  async_config.max_retries = 8;
+  async_config.retry_backoff_ms = 10;
+
+  qdrant_batch_config_t batch_config;
+  qdrant_batch_default_config(&batch_config);
+
+  for (int i = 1; i < argc; i++)
+  {
+    if (i + 1 >= argc)
+    {
+      fprintf(stderr, "param %s needs a value.\n", argv[i]);
+      return 1;
+    }
+
+    if (strcmp(argv[i], "--points") == 0)
+    {
+      n_points = atol(argv[++i]);
+    }
+    else if (strcmp(argv[i], "--dim") == 0)
+    {
+      dim = atoi(argv[++i]);
+    }
+    else if (strcmp(argv[i], "--batch-points") == 0)
+    {
+      batch_config.max_points = atol(argv[++i]);
+    }
+    else if (strcmp(argv[i], "--compress") == 0)
+    {
+      if (!qdrant_parse_encoding(argv[++i], &batch_config.encoding))
+      {
+        fprintf(stderr, "unknown encoding '%s'.\n", argv[i]);
+        return 1;
+      }
+    }
+    else if (strcmp(argv[i], "--latency") == 0)
+    {
+      latency_ms = atol(argv[++i]);
+    }
+    else if (strcmp(argv[i], "--jitter") == 0)
+    {
+      stub_config.jitter_ms = atol(argv[++i]);
+    }
+    else if (strcmp(argv[i], "--mbps") == 0)
+    {
+      mbps = atof(argv[++i]);
+      mbps_given = true;
+    }
+    else if (strcmp(argv[i], "--errors") == 0)
+    {
+      errors = atof(argv[++i]);
+    }
+    else if (strcmp(argv[i], "--throttle") == 0)
+    {
+      throttle = atof(argv[++i]);
+    }
+    else if (strcmp(argv[i], "--resets") == 0)
+    {
+      resets = atof(argv[++i]);
+    }
+    else if (strcmp(argv[i], "--retries") == 0)
+    {
+      async_config.max_retries = atoi(argv[++i]);
+    }
+    else if (strcmp(argv[i], "--serve") == 0)
+    {
+      port = atoi(argv[++i]);
+    }
+    else
+    {
+      fprintf(stderr,
+              "usage: %s [--points N] [--dim N] [--batch-points N] "
+              "[--compress ENC] [--latency MS] [--jitter MS] [--mbps N] "
+              "[--errors R] [--throttle R] [--resets R] [--retries N] "
+              "[--serve PORT]\n",
+              argv[0]);
+      return 1;
+    }
+  }
+
+  if (port >= 0)
+  {
+    stub_config.port = port;
+    stub_config.latency_ms = std::max(latency_ms, 0L);
+    stub_config.max_bps = mbps_given ? mbps * 1e6 / 8 : 0.0;
+    stub_config.error_rate = std::max(errors, 0.0);
+    stub_config.throttle_rate = std::max(throttle, 0.0);
+    stub_config.reset_rate = std::max(resets, 0.0);
+    return serve(stub_config);
+  }
+
+  stub_config.latency_ms = latency_ms < 0 ? 5 : latency_ms;
+  if (n_points == 0 || dim <= 0 || batch_config.max_points == 0)
+  {
+    LOG_ERR("--points, --dim and --batch-points must be positive.\n");
+    return 1;
+  }
+
+  qdrant_point_array_t points;
+  make_points(n_points, dim, points);
+
+  printf("%zu points of %d dims, %zu per request, %s, latency %ld+%ld ms\n\n",
+         n_points, dim, batch_config.max_points,
+         qdrant_get_encoding(batch_config.encoding).c_str(),
+         stub_config.latency_ms, stub_config.jitter_ms);
+  print_header();
+
+  bool complete = true;
+  bench_run_t run;
+  char name[64];
+
+  for (const int window : {1, 2, 4, 8, 16})
+  {
+    async_config.window = window;
+    if (!bench_upload(stub_config, async_config, batch_config, points, &run))
+    {
+      return 1;
+    }
+
+    snprintf(name, sizeof(name), "window %d", window);
+    complete = print_run(name, run, n_points) && complete;
+  }
+
+  // backpressure: the link, not the window, sets the pace
+  async_config.window = 8;
+  qdrant_stub_config_t capped = stub_config;
+  capped.max_bps = mbps * 1e6 / 8;
+  if (mbps > 0.0)
+  {
+    if (!bench_upload(capped, async_config, batch_config, points, &run))
+    {
+      return 1;
+    }
+
+    snprintf(name, sizeof(name), "cap %.0f Mbps", mbps);
+    complete = print_run(name, run, n_points) && complete;
+  }
+
+  qdrant_stub_config_t faulty = stub_config;
+  faulty.error_rate = errors < 0.0 ? 0.05 : errors;
+  faulty.throttle_rate = throttle < 0.0 ? 0.05 : throttle;
+  faulty.reset_rate = resets < 0.0 ? 0.02 : resets;
+  if (!bench_upload(faulty, async_config, batch_config, points, &run))
+  {
+    return 1;
+  }
+
+  snprintf(name, sizeof(name), "faults %.0f%%",
+           100.0 * (faulty.error_rate + faulty.throttle_rate +
+                    faulty.reset_rate));
+  complete = print_run(name, run, n_points) && complete;
+
+  printf("\nevery point stored: %s\n", complete ? "yes" : "NO");
+
+  return complete ? 0 : 1;
+}
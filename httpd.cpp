@@ -0,0 +1,542 @@
+#include "httpd.h"
+#include "utils.h"
+#include <algorithm>
+#include <arpa/inet.h>
+#include <chrono>
+#include <errno.h>
+#include <stdlib.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#define HTTPD_RECV_BYTES (64 << 10)
+
+void httpd_default_config(httpd_config_t *config)
+{
+  config->host = HTTPD_DEFAULT_HOST;
+  config->port = 0;
+  config->backlog = HTTPD_DEFAULT_BACKLOG;
+  config->max_body = HTTPD_DEFAULT_MAX_BODY_BYTES;
+  config->unix_path.clear();
+}
+
+bool httpd_parse_address(const std::string &address, httpd_config_t *config)
+{
+  if (address.compare(0, 5, "unix:") == 0 && address.size() > 5)
+  {
+    config->unix_path = address.substr(5);
+    return true;
+  }
+
+  const size_t colon = address.rfind(':');
+  char *end = NULL;
+  const long port = colon == std::string::npos
+                        ? -1
+                        : strtol(address.c_str() + colon + 1, &end, 10);
+  if (port < 0 || port > 65535 || end == address.c_str() + colon + 1 ||
+      *end != '\0')
+  {
+    LOG_ERR("'%s' is neither HOST:PORT nor unix:PATH.\n", address.c_str());
+    return false;
+  }
+
+  config->host = colon == 0 ? "0.0.0.0" : address.substr(0, colon);
+  config->port = (int)port;
+  config->unix_path.clear();
+
+  return true;
+}
+
+std::string httpd_address(const httpd_t &httpd)
+{
+  if (!httpd.config.unix_path.empty())
+  {
+    return "unix:" + httpd.config.unix_path;
+  }
+
+  return "http://" + httpd.config.host + ":" + std::to_string(httpd.port);
+}
+
+const std::string *httpd_header(const httpd_request_t &request,
+                                const char *name)
+{
+  for (const auto &header : request.headers)
+  {
+    if (header.first == name)
+    {
+      return &header.second;
+    }
+  }
+
+  return NULL;
+}
+
+const char *httpd_status_text(int status)
+{
+  switch (status)
+  {
+  case 100:
+    return "Continue";
+  case 200:
+    return "OK";
+  case 204:
+    return "No Content";
+  case 400:
+    return "Bad Request";
+  case 404:
+    return "Not Found";
+  case 405:
+    return "Method Not Allowed";
+  case 411:
+    return "Length Required";
+  case 413:
+    return "Payload Too Large";
+  case 429:
+    return "Too Many Requests";
+  case 500:
+    return "Internal Server Error";
+  case 501:
+    return "Not Implemented";
+  case 503:
+    return "Service Unavailable";
+  default:
+    return "Unknown";
+  }
+}
+
+static bool httpd_send_all(int fd, const char *data, size_t len)
+{
+  while (len > 0)
+  {
+    const ssize_t n = send(fd, data, len, MSG_NOSIGNAL);
+    if (n < 0 && errno == EINTR)
+    {
+      continue;
+    }
+    if (n <= 0)
+    {
+      return false;
+    }
+
+    data += n;
+    len -= n;
+  }
+
+  return true;
+}
+
+// false once the peer is gone
+static bool httpd_recv_more(int fd, std::string &buffer)
+{
+  const size_t used = buffer.size();
+  buffer.resize(used + HTTPD_RECV_BYTES);
+
+  ssize_t n;
+  do
+  {
+    n = recv(fd, &buffer[used], HTTPD_RECV_BYTES, 0);
+  } while (n < 0 && errno == EINTR);
+
+  buffer.resize(used + std::max<ssize_t>(n, 0));
+
+  return n > 0;
+}
+
+static bool httpd_parse_head(const std::string &head, httpd_request_t &request)
+{
+  const size_t line_end = head.find("\r\n");
+  const std::string line = head.substr(0, line_end);
+
+  const size_t sp1 = line.find(' ');
+  const size_t sp2 = line.rfind(' ');
+  if (sp1 == std::string::npos || sp2 == sp1 ||
+      line.compare(sp2 + 1, 5, "HTTP/") != 0)
+  {
+    return false;
+  }
+
+  request.method = line.substr(0, sp1);
+  const std::string target = line.substr(sp1 + 1, sp2 - sp1 - 1);
+  const size_t mark = target.find('?');
+  request.path = target.substr(0, mark);
+  request.query =
+      mark == std::string::npos ? std::string() : target.substr(mark + 1);
+
+  request.headers.clear();
+  size_t pos = line_end + 2;
+  while (pos < head.size())
+  {
+    size_t end = head.find("\r\n", pos);
+    if (end == std::string::npos)
+    {
+      end = head.size();
+    }
+
+    const size_t colon = head.find(':', pos);
+    if (colon == std::string::npos || colon > end)
+    {
+      return false;
+    }
+
+    std::string name = head.substr(pos, colon - pos);
+    std::transform(name.begin(), name.end(), name.begin(), ::tolower);
+
+    size_t value = colon + 1;
+    while (value < end && (head[value] == ' ' || head[value] == '\t'))
+    {
+      value++;
+    }
+
+    request.headers.emplace_back(std::move(name),
+                                 head.substr(value, end - value));
+    pos = end + 2;
+  }
+
+  return true;
+}
+
+// reads one request off the connection; 'buffer' keeps whatever came after
+// it. Returns the status to fail with, 0 on success, -1 when the peer left.
+static int httpd_read_request(const httpd_t &httpd, int fd,
+                              std::string &buffer, httpd_request_t &request)
+{
+  size_t head_end;
+  while ((head_end = buffer.find("\r\n\r\n")) == std::string::npos)
+  {
+    if (buffer.size() > HTTPD_MAX_HEADER_BYTES)
+    {
+      return 400;
+    }
+    if (!httpd_recv_more(fd, buffer))
+    {
+      return -1;
+    }
+  }
+
+  if (!httpd_parse_head(buffer.substr(0, head_end), request))
+  {
+    return 400;
+  }
+
+  if (httpd_header(request, "transfer-encoding") != NULL)
+  {
+    return 411;
+  }
+
+  size_t length = 0;
+  const std::string *content_length = httpd_header(request, "content-length");
+  if (content_length != NULL)
+  {
+    char *end = NULL;
+    length = strtoull(content_length->c_str(), &end, 10);
+    if (end == content_length->c_str() || *end != '\0')
+    {
+      return 400;
+    }
+  }
+
+  if (length > httpd.config.max_body)
+  {
+    return 413;
+  }
+
+  const std::string *expect = httpd_header(request, "expect");
+  if (expect != NULL && strcasecmp(expect->c_str(), "100-continue") == 0 &&
+      buffer.size() < head_end + 4 + length)
+  {
+    const char *go_on = "HTTP/1.1 100 Continue\r\n\r\n";
+    httpd_send_all(fd, go_on, strlen(go_on));
+  }
+
+  const size_t total = head_end + 4 + length;
+  buffer.reserve(total);
+  while (buffer.size() < total)
+  {
+    if (!httpd_recv_more(fd, buffer))
+    {
+      return -1;
+    }
+  }
+
+  request.body.assign(buffer, head_end + 4, length);
+  buffer.erase(0, total);
+
+  return 0;
+}
+
+static bool httpd_write_response(int fd, const httpd_request_t &request,
+                                 const httpd_response_t &response, bool close)
+{
+  std::string head = "HTTP/1.1 " + std::to_string(response.status) + " " +
+                     httpd_status_text(response.status) + "\r\n";
+  if (!response.content_type.empty())
+  {
+    head += "Content-Type: " + response.content_type + "\r\n";
+  }
+  head += "Content-Length: " + std::to_string(response.body.size()) + "\r\n";
+  for (const auto &header : response.headers)
+  {
+    head += header.first + ": " + header.second + "\r\n";
+  }
+  if (close)
+  {
+    head += "Connection: close\r\n";
+  }
+  head += "\r\n";
+
+  // HEAD gets the length of the body it would have had, not the body
+  if (request.method != "HEAD" && response.body.size() < (64 << 10))
+  {
+    head += response.body;
+    return httpd_send_all(fd, head.data(), head.size());
+  }
+
+  return httpd_send_all(fd, head.data(), head.size()) &&
+         (request.method == "HEAD" ||
+          httpd_send_all(fd, response.body.data(), response.body.size()));
+}
+
+static void httpd_serve(httpd_t *httpd, int fd)
+{
+  std::string buffer;
+  httpd_request_t request;
+  httpd_response_t response;
+  bool reset = false;
+
+  while (true)
+  {
+    const int failed = httpd_read_request(*httpd, fd, buffer, request);
+    if (failed < 0)
+    {
+      break;
+    }
+
+    response.status = failed ? failed : 200;
+    response.content_type = "application/json";
+    response.body.clear();
+    response.headers.clear();
+    response.reset = false;
+
+    if (failed)
+    {
+      // what follows the bad request can not be trusted
+      httpd_write_response(fd, request, response, true);
+      break;
+    }
+
+    httpd->n_requests++;
+    httpd->handler(request, response);
+
+    if (response.reset)
+    {
+      reset = true;
+      break;
+    }
+
+    const std::string *connection = httpd_header(request, "connection");
+    const bool close =
+        connection != NULL && strcasecmp(connection->c_str(), "close") == 0;
+
+    if (!httpd_write_response(fd, request, response, close) || close)
+    {
+      break;
+    }
+  }
+
+  if (reset)
+  {
+    // closing with a zero linger sends a RST
+    struct linger linger = {1, 0};
+    setsockopt(fd, SOL_SOCKET, SO_LINGER, &linger, sizeof(linger));
+  }
+
+  std::lock_guard<std::mutex> lock(httpd->mutex);
+  close(fd);
+  httpd->connections.erase(fd);
+  if (httpd->connections.empty())
+  {
+    httpd->drained.notify_all();
+  }
+}
+
+static void httpd_accept(httpd_t *httpd)
+{
+  while (true)
+  {
+    const int fd = accept4(httpd->fd, NULL, NULL, SOCK_CLOEXEC);
+    const int error = errno;
+
+    bool stopping;
+    {
+      std::lock_guard<std::mutex> lock(httpd->mutex);
+      stopping = httpd->stopping;
+    }
+
+    if (stopping)
+    {
+      if (fd >= 0)
+      {
+        close(fd);
+      }
+      break;
+    }
+
+    if (fd < 0)
+    {
+      if (error != EINTR && error != ECONNABORTED)
+      {
+        // out of descriptors, most likely: let connections finish, which
+        // needs the mutex, so sleep without it
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+      }
+      continue;
+    }
+
+    if (httpd->config.unix_path.empty())
+    {
+      const int one = 1;
+      setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    }
+
+    // httpd_stop joins this thread before it drains the connections
+    std::lock_guard<std::mutex> lock(httpd->mutex);
+    httpd->connections.insert(fd);
+    httpd->n_connections++;
+    std::thread(httpd_serve, httpd, fd).detach();
+  }
+}
+
+static bool httpd_listen_tcp(httpd_t *httpd)
+{
+  const httpd_config_t &config = httpd->config;
+
+  struct sockaddr_in addr = {};
+  addr.sin_family = AF_INET;
+  addr.sin_port = htons(config.port);
+  if (inet_pton(AF_INET, config.host.c_str(), &addr.sin_addr) != 1)
+  {
+    LOG_ERR("'%s' is not an IPv4 address.\n", config.host.c_str());
+    return false;
+  }
+
+  httpd->fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  const int one = 1;
+  socklen_t len = sizeof(addr);
+  if (httpd->fd < 0 ||
+      setsockopt(httpd->fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one)) != 0 ||
+      bind(httpd->fd, (struct sockaddr *)&addr, sizeof(addr)) != 0 ||
+      listen(httpd->fd, config.backlog) != 0 ||
+      getsockname(httpd->fd, (struct sockaddr *)&addr, &len) != 0)
+  {
+    LOG_ERR("could not listen on %s:%d: %s.\n", config.host.c_str(),
+            config.port, strerror(errno));
+    return false;
+  }
+
+  httpd->port = ntohs(addr.sin_port);
+
+  return true;
+}
+
+static bool httpd_listen_unix(httpd_t *httpd)
+{
+  const std::string &path = httpd->config.unix_path;
+
+  struct sockaddr_un addr = {};
+  addr.sun_family = AF_UNIX;
+  if (path.size() >= sizeof(addr.sun_path))
+  {
+    LOG_ERR("socket path '%s' is too long.\n", path.c_str());
+    return false;
+  }
+  memcpy(addr.sun_path, path.c_str(), path.size() + 1);
+
+  // a socket left behind by a previous run would fail bind()
+  unlink(path.c_str());
+
+  httpd->fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if (httpd->fd < 0 ||
+      bind(httpd->fd, (struct sockaddr *)&addr, sizeof(addr)) != 0 ||
+      listen(httpd->fd, httpd->config.backlog) != 0)
+  {
+    LOG_ERR("could not listen on '%s': %s.\n", path.c_str(), strerror(errno));
+    return false;
+  }
+
+  return true;
+}
+
+bool httpd_start(const httpd_config_t &config, httpd_handler_t handler,
+                 httpd_t *httpd)
+{
+  if (NULL == httpd)
+  {
+    LOG_ERR("argument 'httpd' is NULL.\n");
+    return false;
+  }
+
+  httpd->config = config;
+  httpd->handler = std::move(handler);
+  httpd->port = 0;
+  httpd->stopping = false;
+  httpd->connections.clear();
+  httpd->n_connections = 0;
+  httpd->n_requests = 0;
+  httpd->fd = -1;
+
+  const bool listening = config.unix_path.empty() ? httpd_listen_tcp(httpd)
+                                                  : httpd_listen_unix(httpd);
+  if (!listening)
+  {
+    if (httpd->fd >= 0)
+    {
+      close(httpd->fd);
+      httpd->fd = -1;
+    }
+    return false;
+  }
+
+  httpd->acceptor = std::thread(httpd_accept, httpd);
+
+  return true;
+}
+
+void httpd_stop(httpd_t *httpd)
+{
+  if (NULL == httpd || httpd->fd < 0)
+  {
+    return;
+  }
+
+  {
+    std::lock_guard<std::mutex> lock(httpd->mutex);
+    httpd->stopping = true;
+  }
+
+  // wakes the acceptor out of accept()
+  shutdown(httpd->fd, SHUT_RDWR);
+  if (httpd->acceptor.joinable())
+  {
+    httpd->acceptor.join();
+  }
+
+  std::unique_lock<std::mutex> lock(httpd->mutex);
+  for (const int fd : httpd->connections)
+  {
+    shutdown(fd, SHUT_RDWR);
+  }
+  httpd->drained.wait(lock, [&] { return httpd->connections.empty(); });
+  lock.unlock();
+
+  close(httpd->fd);
+  httpd->fd = -1;
+
+  if (!httpd->config.unix_path.empty())
+  {
+    unlink(httpd->config.unix_path.c_str());
+  }
+}
@@ -0,0 +1,58 @@
+#ifndef __EMBED2VECDB_APP_CACHE_H__
+#define __EMBED2VECDB_APP_CACHE_H__
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+#define APP_CACHE_MAGIC "E2VCACHE"
+#define APP_CACHE_VERSION 1
+
+// initial slot count (power of two); the table doubles past 70% load
+#define APP_CACHE_MIN_SLOTS 4096
+
+typedef struct _app_cache_key
+{
+  uint64_t hi;
+  uint64_t lo;
+} app_cache_key_t;
+
+typedef struct _app_cache_header
+{
+  char magic[8];
+  uint32_t version;
+  uint32_t n_embd;
+  app_cache_key_t salt; // model identity, normalization and pooling
+  uint64_t n_slots;
+  uint64_t n_entries;
+} app_cache_header_t;
+
+// on-disk open addressing table of embeddings, mapped shared: each slot is
+// a key followed by n_embd floats, an all zero key marks an empty slot.
+// Used from one thread; a file lock keeps other processes out.
+typedef struct _app_cache
+{
+  std::string path;
+  int fd;
+  void *map;
+  size_t map_size;
+  app_cache_header_t *header;
+  char *slots;
+  size_t slot_size;
+  uint64_t n_hits;
+  uint64_t n_misses;
+  uint64_t n_inserts;
+} app_cache_t;
+
+app_cache_key_t app_cache_hash(const void *, size_t, const app_cache_key_t &);
+
+bool app_cache_open(const std::string &, uint32_t, const app_cache_key_t &,
+                    app_cache_t *);
+
+bool app_cache_lookup(app_cache_t &, const app_cache_key_t &, float *);
+
+bool app_cache_insert(app_cache_t &, const app_cache_key_t &, const float *);
+
+void app_cache_close(app_cache_t *);
+
+#endif // __EMBED2VECDB_APP_CACHE_H__
@@ -0,0 +1,36 @@
+#ifndef __EMBED2VECDB_APP_DISTANCE_H__
+#define __EMBED2VECDB_APP_DISTANCE_H__
+
+#include "qdrant.h"
+#include <cstddef>
+
+// instruction sets the kernels are built for; the best one the CPU supports
+// is picked on first use
+typedef enum _app_distance_isa
+{
+  DistanceScalar = 0,
+  DistanceAVX2,   // AVX2 + FMA
+  DistanceAVX512, // AVX-512F
+  DistanceIsaCount
+} app_distance_isa_t;
+
+// distance between two rows of n floats; smaller is closer
+typedef float (*app_distance_fn_t)(const float *, const float *, size_t);
+
+// kernel of a qdrant metric on the current instruction set. Dot and Cosine
+// give -dot (Cosine expects unit vectors), Euclid the squared L2 distance
+// and Manhattan the L1 distance.
+app_distance_fn_t app_distance_get(qdrant_distance_type_t);
+
+// the score qdrant reports for a kernel result
+float app_distance_score(qdrant_distance_type_t, float);
+
+app_distance_isa_t app_distance_get_isa();
+
+// forces an instruction set (benchmarks); fails if the CPU lacks it.
+// Kernels fetched before keep the set they were fetched on.
+bool app_distance_set_isa(app_distance_isa_t);
+
+const char *app_distance_isa_name(app_distance_isa_t);
+
+#endif // __EMBED2VECDB_APP_DISTANCE_H__
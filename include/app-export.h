@@ -0,0 +1,71 @@
+#ifndef __EMBED2VECDB_APP_EXPORT_H__
+#define __EMBED2VECDB_APP_EXPORT_H__
+
+#include "qdrant.h"
+#include <cstddef>
+#include <cstdint>
+#include <stdio.h>
+#include <string>
+#include <vector>
+
+/*
+ * Exported points: the vectors in a .npy file (float32, shape (n, dim),
+ * loadable by numpy.load), and next to it '<path>.jsonl' with one line per
+ * point, in the same order:
+ *   {"id":"..","payload":{"..":".."}}
+ * Both files go through large buffers, so reads and writes are sequential.
+ */
+
+#define APP_EXPORT_SIDECAR ".jsonl"
+
+// npy header, padded so the final shape can be written over it in place
+#define APP_EXPORT_HEADER_BYTES 128
+
+#define APP_EXPORT_BUFFER_BYTES (8 << 20)
+
+typedef struct _app_export
+{
+  std::string path;
+  std::string sidecar;
+  FILE *vectors;  // temporary files until app_export_finish
+  FILE *payloads;
+  std::vector<char> vector_buffer;
+  std::vector<char> payload_buffer;
+  std::string line;
+  uint32_t dim;
+  size_t n_points;
+  uint64_t n_bytes; // both files
+  bool finished;
+} app_export_t;
+
+typedef struct _app_export_reader
+{
+  FILE *vectors;
+  FILE *payloads;
+  std::vector<char> vector_buffer;
+  std::vector<char> payload_buffer;
+  char *line;
+  size_t line_size;
+  uint32_t dim;
+  size_t n_points;
+  size_t n_read;
+} app_export_reader_t;
+
+bool app_export_create(const std::string &, uint32_t, app_export_t *);
+
+bool app_export_add(app_export_t &, const qdrant_point_spec_t &);
+
+// writes the final shape and moves both files in place
+bool app_export_finish(app_export_t &);
+
+// an export that was not finished leaves nothing behind
+void app_export_close(app_export_t *);
+
+bool app_export_open(const std::string &, app_export_reader_t *);
+
+// 1 with the next point, 0 at the end, -1 on a malformed file
+int app_export_read(app_export_reader_t &, qdrant_point_spec_t &);
+
+void app_export_reader_close(app_export_reader_t *);
+
+#endif // __EMBED2VECDB_APP_EXPORT_H__
@@ -0,0 +1,127 @@
+#ifndef __EMBED2VECDB_APP_HNSW_H__
+#define __EMBED2VECDB_APP_HNSW_H__
+
+#include "app-distance.h"
+#include "qdrant.h"
+#include <cstddef>
+#include <cstdint>
+#include <random>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#define APP_HNSW_MAGIC "E2VHNSW\0"
+#define APP_HNSW_VERSION 1
+
+#define APP_HNSW_DEFAULT_M 16
+#define APP_HNSW_DEFAULT_EF_CONSTRUCTION 200
+#define APP_HNSW_DEFAULT_EF_SEARCH 64
+#define APP_HNSW_MAX_LEVEL 16
+
+typedef struct _app_hnsw_config
+{
+  uint32_t m;               // links per node on the upper levels, 2m on level 0
+  uint32_t ef_construction; // candidates kept while linking a node
+  uint32_t ef_search;       // default candidates kept while searching
+  uint32_t seed;            // of the level draw
+} app_hnsw_config_t;
+
+// file layout: this header, then every section of app_hnsw_t below in
+// order, each one 64-byte aligned, so a load only maps the file
+typedef struct _app_hnsw_header
+{
+  char magic[8];
+  uint32_t version;
+  uint32_t dim;
+  uint32_t distance; // qdrant_distance_type_t
+  uint32_t m;
+  uint32_t ef_construction;
+  uint32_t ef_search;
+  uint32_t entry;
+  int32_t max_level;
+  uint64_t n_points;
+  uint64_t n_upper;         // words of upper level links
+  uint64_t n_id_bytes;      // point ids, back to back
+  uint64_t n_payload_bytes; // payloads, back to back
+} app_hnsw_header_t;
+
+// node k has levels[k] + 1 link lists of (count, ids...): level 0 at
+// links0[k * (1 + m0)], level l > 0 at upper[upper_offsets[k] + (l - 1) *
+// (1 + m)]
+typedef struct _app_hnsw
+{
+  uint32_t dim;
+  qdrant_distance_type_t distance;
+  uint32_t m;
+  uint32_t m0;
+  uint32_t ef_construction;
+  uint32_t ef_search;
+  uint32_t entry;
+  int32_t max_level; // -1 until built
+  size_t n_points;
+  size_t n_upper;
+  app_distance_fn_t distance_fn;
+
+  // views, into the storage below or into the mapped file
+  const float *vectors;
+  const uint8_t *levels;
+  const uint32_t *links0;
+  const uint64_t *upper_offsets;
+  const uint32_t *upper;
+  const uint64_t *id_offsets; // n_points + 1
+  const char *ids;
+  const uint64_t *payload_offsets; // n_points + 1
+  const char *payloads;
+
+  // storage of an index being built
+  std::vector<float> vector_data;
+  std::vector<uint8_t> level_data;
+  std::vector<uint32_t> link0_data;
+  std::vector<uint64_t> upper_offset_data;
+  std::vector<uint32_t> upper_data;
+  std::vector<uint64_t> id_offset_data;
+  std::string id_data;
+  std::vector<uint64_t> payload_offset_data;
+  std::string payload_data;
+  std::mt19937 rng;
+
+  void *map; // NULL unless loaded
+  size_t map_size;
+} app_hnsw_t;
+
+typedef struct _app_hnsw_hit
+{
+  uint32_t node;
+  float score; // as qdrant reports it: similarity or distance
+} app_hnsw_hit_t;
+
+void app_hnsw_default_config(app_hnsw_config_t *);
+
+bool app_hnsw_init(uint32_t, qdrant_distance_type_t, const app_hnsw_config_t &,
+                   app_hnsw_t *);
+
+// queues a point; the graph is built by app_hnsw_build
+bool app_hnsw_add(app_hnsw_t &, std::string_view, std::string_view,
+                  const float *);
+
+// links every queued point, on n threads
+bool app_hnsw_build(app_hnsw_t &, int);
+
+// the k nearest points, closest first; ef = 0 takes the index default.
+// Thread safe once built.
+bool app_hnsw_search(const app_hnsw_t &, const float *, size_t, size_t,
+                     std::vector<app_hnsw_hit_t> &);
+
+// written to a temporary file, then renamed over the path
+bool app_hnsw_save(const app_hnsw_t &, const std::string &);
+
+// maps a saved index read-only; nothing is parsed or copied
+bool app_hnsw_load(const std::string &, app_hnsw_t *);
+
+void app_hnsw_destroy(app_hnsw_t *);
+
+std::string_view app_hnsw_id(const app_hnsw_t &, uint32_t);
+
+std::string_view app_hnsw_payload(const app_hnsw_t &, uint32_t);
+
+#endif // __EMBED2VECDB_APP_HNSW_H__
@@ -0,0 +1,54 @@
+#ifndef __EMBED2VECDB_APP_INGEST_H__
+#define __EMBED2VECDB_APP_INGEST_H__
+
+#include "app-llama.h"
+#include "qdrant.h"
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+// default number of chunks each pipeline queue holds
+#define APP_INGEST_QUEUE_DEPTH 2
+
+// how point ids are assigned
+typedef enum _app_id_mode
+{
+  RandomId = 0, // UUID v4, a re-run duplicates every point
+  ContentId,    // UUID v5 of the source id and the record text
+  PositionId    // UUID v5 of the source id and the record index
+} app_id_mode_t;
+
+bool app_ingest_parse_id_mode(const std::string &, app_id_mode_t *);
+
+typedef struct _app_ingest_stats
+{
+  app_llama_stats_t llama;
+  std::string sink; // where the points went
+  size_t n_records;  // records uploaded
+  size_t n_skipped;  // records whose point already existed
+  size_t n_unchanged; // records the manifest already had
+  size_t n_deleted;   // points of records gone from the source
+  uint64_t n_requests; // upsert requests completed
+  uint64_t n_retries;  // upsert attempts retried
+  uint64_t n_bytes;      // upsert body bytes, before compression
+  uint64_t n_wire_bytes; // upsert body bytes sent
+  uint64_t n_compressed; // upserts sent compressed
+  double t_compress;     // seconds spent compressing, on the worker
+  double t_request;    // sum of upsert latencies, seconds
+  double t_tokenize; // seconds spent reading and tokenizing
+  double t_check;    // seconds spent checking for existing points
+  double t_delete;   // seconds spent deleting points of removed records
+  double t_decode;   // seconds spent in app_llm_get_embeddings
+  double t_upload;   // seconds spent building and uploading points
+  double t_finish;   // seconds spent flushing, linking or closing the sink
+  double t_wall;     // end to end
+} app_ingest_stats_t;
+
+// embeds args.source into the sink the arguments pick (see app-sink.h)
+bool app_ingest_run(const app_llama_args_t &, const app_llama_data_t &,
+                    const qdrant_info_t &, const qdrant_colection_info_t &,
+                    app_ingest_stats_t *);
+
+void app_ingest_print_stats(const app_ingest_stats_t &);
+
+#endif // __EMBED2VECDB_APP_INGEST_H__
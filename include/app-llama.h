@@ -2,9 +2,13 @@
 #ifndef _EMBED2VECDB_APP_LLAMA_H_
 #define _EMBED2VECDB_APP_LLAMA_H_
 
+#include "app-cache.h"
+#include "app-reduce.h"
 #include "llama.h"
+#include "utils.h"
 #include <cstdint>
 #include <string>
+#include <string_view>
 #include <sys/types.h>
 #include <vector>
 
@@ -19,19 +23,67 @@ typedef struct _app_llama_args
 {
   std::string model;
   std::string source;
+  std::string query;        // records to search for, instead of ingesting
+  std::string query_filter; // qdrant filter (JSON) for every query
+  int32_t query_batch;      // queries per search request
+  int32_t top_k;
+  bool query_payload;
+  std::string hnsw_path;        // local HNSW index, in place of qdrant
+  int32_t hnsw_m;               // links per node
+  int32_t hnsw_ef_construction; // candidates kept while linking
+  int32_t hnsw_ef;              // candidates kept while searching
+  std::string export_path; // vectors file to write, in place of qdrant
+  std::string replay_path; // vectors file to upload to qdrant, no model
+  std::string embd_sep;
+  std::string cache_path;
+  std::string manifest_path; // records and point ids of the previous run
+  std::string source_id; // names the source in content/position point ids
+  std::string id_mode;
+  int32_t chunk_size;
+  int32_t queue_depth;
   int32_t ctx_size;
   int32_t n_gpu_layers;
+  int32_t n_parallel;
+  int32_t tok_threads;
+  int32_t n_contexts;      // llama contexts decoding side by side
+  int32_t context_threads; // threads of each one
   std::string qdrant_uri;
+  int32_t qdrant_inflight;
+  int32_t qdrant_retries;
+  bool qdrant_http2;
+  int32_t qdrant_batch_points;
+  int32_t qdrant_batch_kb;
+  int32_t qdrant_batch_ms;
+  std::string qdrant_compress;
+  int32_t qdrant_compress_level;
+  bool qdrant_compress_auto;
+  int32_t qdrant_link_mbps;
+  std::string quantize;  // vector format stored in qdrant
+  float quantize_range;  // uint8 clipping range, 0 = from the dimension
+  std::string reduce;    // none, matryoshka or pca
+  int32_t reduce_dim;    // width after reduction, 0 = from the PCA file
+  std::string pca_path;  // projection to load, or to save once fitted
+  int32_t pca_samples;   // records embedded to fit the projection
+  std::string serve;          // HOST:PORT or unix:PATH, daemon mode
+  int32_t serve_wait_ms;      // longest a request waits for others to join
+  int32_t serve_batch;        // records per coalesced decode
+  std::string metrics_listen; // HOST:PORT serving /metrics
+  std::string metrics_path;   // Prometheus text file, rewritten periodically
+  int32_t metrics_interval;   // seconds between file writes
   ushort batch_size;
   ushort ubatch_size;
   ushort threads;
+  bool bucketing;
+  bool skip_existing;
+  bool recreate;
   bool verbose;
 } app_llama_args_t;
 
 typedef struct _app_llama_data
 {
   llama_model *model;
-  llama_context *ctx;
+  llama_context *ctx;                // ctxs[0]
+  std::vector<llama_context *> ctxs; // all of them, sharing 'model'
   std::string cls_sep;
   std::string embd_sep;
   int32_t n_batch;
@@ -39,9 +91,50 @@ typedef struct _app_llama_data
   int32_t n_seq_max;
   int32_t embed_norm;
   int32_t model_n_embed;
+  int32_t n_embd_out; // width of the returned embeddings, after reduction
+  int32_t n_tok_threads;
+  worker_pool_t *tok_pool; // n_tok_threads, for app_llm_tokenize
+  bool bucketing;
+  app_cache_key_t embd_salt; // model identity, normalization and pooling
+  app_cache_t *cache;        // NULL without --cache
+  app_reduce_t *reduce;      // NULL without --reduce
 } app_llama_data_t;
 
-typedef std::vector<std::vector<int32_t>> llama_input_vector_t;
+typedef struct _app_llama_stats
+{
+  uint64_t n_decode;   // llama_decode calls
+  uint64_t n_prompts;  // prompts embedded
+  uint64_t n_tokens;   // tokens decoded
+  uint64_t n_capacity; // tokens the decoded batches could have held
+  uint64_t n_cached;   // prompts served from the cache
+  uint64_t n_uncached; // prompts looked up and not found
+  uint64_t n_repeated; // prompts that repeat another one of their call
+} app_llama_stats_t;
+
+// tokens of all prompts back to back in one arena; prompt k is
+// tokens[offsets[k], offsets[k + 1])
+typedef struct _llama_input_vector
+{
+  std::vector<llama_token> tokens;
+  std::vector<size_t> offsets = {0};
+
+  size_t size() const { return offsets.size() - 1; }
+  size_t length(size_t k) const { return offsets[k + 1] - offsets[k]; }
+  const llama_token *data(size_t k) const { return tokens.data() + offsets[k]; }
+
+  void clear()
+  {
+    tokens.clear();
+    offsets.assign(1, 0);
+  }
+} llama_input_vector_t;
+
+typedef struct _app_llama_schedule
+{
+  std::vector<int32_t> order;   // prompt indices, grouped by batch
+  std::vector<int32_t> batches; // end offset (into 'order') of every batch
+  uint64_t n_tokens;            // tokens over all batches
+} app_llama_schedule_t;
 
 bool app_parse_args(int, char **, app_llama_args_t *);
 
@@ -52,7 +145,18 @@ bool app_llm_destroy(app_llama_data_t *);
 int app_llm_tokenize(const app_llama_data_t &, const std::string &,
                      llama_input_vector_t &);
 
+int app_llm_tokenize(const app_llama_data_t &,
+                     const std::vector<std::string_view> &,
+                     llama_input_vector_t &);
+
+void app_llm_schedule(const app_llama_data_t &, const int,
+                      const llama_input_vector_t &, app_llama_schedule_t &);
+
+void app_llm_schedule(const app_llama_data_t &, const std::vector<int32_t> &,
+                      const llama_input_vector_t &, app_llama_schedule_t &);
+
 bool app_llm_get_embeddings(const app_llama_data_t &, const int,
-                            const llama_input_vector_t &, std::vector<float> &);
+                            const llama_input_vector_t &, std::vector<float> &,
+                            app_llama_stats_t * = NULL);
 
 #endif // _EMBED2VECDB_APP_LLAMA_H_
@@ -0,0 +1,45 @@
+#ifndef __EMBED2VECDB_APP_MANIFEST_H__
+#define __EMBED2VECDB_APP_MANIFEST_H__
+
+#include "app-cache.h"
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#define APP_MANIFEST_MAGIC "E2VMANIF"
+#define APP_MANIFEST_VERSION 1
+
+typedef struct _app_manifest_entry
+{
+  app_cache_key_t hash; // record content, salted like the embedding cache
+  unsigned char id[16]; // point id (UUID)
+} app_manifest_entry_t;
+
+// records of one source as stored by the previous run, and as seen by this
+// one. A record whose hash is in the previous run is unchanged; previous
+// entries no record claimed are points to delete. Used from one thread.
+typedef struct _app_manifest
+{
+  std::string path;
+  std::string source_id;
+  std::string collection;
+  std::vector<app_manifest_entry_t> previous; // sorted by hash
+  std::vector<bool> claimed;
+  std::vector<app_manifest_entry_t> current;
+} app_manifest_t;
+
+bool app_manifest_load(const std::string &, const std::string &,
+                       const std::string &, app_manifest_t *);
+
+bool app_manifest_claim(app_manifest_t &, const app_cache_key_t &,
+                        const std::string &);
+
+bool app_manifest_add(app_manifest_t &, const app_cache_key_t &,
+                      const std::string &);
+
+void app_manifest_removed(const app_manifest_t &, std::vector<std::string> &);
+
+bool app_manifest_save(const app_manifest_t &);
+
+#endif // __EMBED2VECDB_APP_MANIFEST_H__
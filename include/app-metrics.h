@@ -0,0 +1,77 @@
+#ifndef __EMBED2VECDB_APP_METRICS_H__
+#define __EMBED2VECDB_APP_METRICS_H__
+
+#include <cstdint>
+#include <string>
+
+/*
+ * Process-wide metrics, exposed in the Prometheus text format: on
+ * GET /metrics at --metrics HOST:PORT, and/or written to --metrics-file
+ * every --metrics-interval seconds (node_exporter's textfile collector
+ * reads that file as is).
+ *
+ * Recording is a relaxed atomic add on the calling thread's shard, so hot
+ * paths can afford it; shards are only summed when the metrics are read.
+ */
+
+#define APP_METRICS_DEFAULT_INTERVAL_S 15
+
+typedef enum _app_metric_type
+{
+  MetricCounter = 0,
+  MetricGauge,
+  MetricHistogram
+} app_metric_type_t;
+
+typedef enum _app_metric
+{
+  // counters
+  MetricRecords = 0,    // records read from the source
+  MetricTokens,         // tokens out of the tokenizer
+  MetricDecodes,        // llama_decode calls
+  MetricDecodeTokens,   // tokens decoded
+  MetricDecodeCapacity, // tokens the decoded batches could have held
+  MetricEmbeddings,     // embeddings returned, cached and repeated included
+  MetricCacheHits,      // embeddings served from --cache
+  MetricPoints,         // points the sink accepted
+  MetricRequests,       // upsert requests completed
+  MetricRetries,        // upsert attempts retried
+  MetricBytes,          // upsert body bytes, before compression
+  MetricWireBytes,      // upsert body bytes sent
+  MetricTokenizeErrors, // errors_total, by stage
+  MetricDecodeErrors,
+  MetricUploadErrors,
+
+  // gauges
+  MetricDecodeQueue, // chunks waiting to be decoded
+  MetricUploadQueue, // chunks waiting to be uploaded
+  MetricInFlight,    // upsert requests in flight
+
+  // histograms
+  MetricDecodeSeconds,  // one llama_decode call
+  MetricBatchFill,      // tokens of a decoded batch over n_batch
+  MetricRequestSeconds, // one upsert, submit to completion with retries
+
+  MetricCount
+} app_metric_t;
+
+// counters
+void app_metrics_add(app_metric_t, uint64_t = 1);
+
+// gauges
+void app_metrics_set(app_metric_t, double);
+
+// histograms
+void app_metrics_observe(app_metric_t, double);
+
+// every metric, in the Prometheus text exposition format (0.0.4)
+void app_metrics_write(std::string &);
+
+// 'listen' is HOST:PORT, unix:PATH or empty, 'path' a file or empty; both
+// empty is a no-op
+bool app_metrics_start(const std::string &, const std::string &, int);
+
+// stops serving, and writes the file one last time
+void app_metrics_stop();
+
+#endif // __EMBED2VECDB_APP_METRICS_H__
@@ -0,0 +1,27 @@
+#ifndef __EMBED2VECDB_APP_NORMALIZE_H__
+#define __EMBED2VECDB_APP_NORMALIZE_H__
+
+// instruction sets the kernels are built for; the best one the CPU supports
+// is picked on first use
+typedef enum _app_normalize_isa
+{
+  NormalizeScalar = 0,
+  NormalizeAVX2,   // AVX2 + FMA
+  NormalizeAVX512, // AVX-512F
+  NormalizeIsaCount
+} app_normalize_isa_t;
+
+// out = inp / norm(inp), for a row of n floats. 'norm' is an
+// embedding_normalize_algorithm_t or, above 2, the p of a p-norm. Sums are
+// accumulated in double; the reduction and the scaled copy run back to back
+// on the row while it is still in L1.
+void app_normalize(const float *, float *, int, int);
+
+app_normalize_isa_t app_normalize_get_isa();
+
+// forces an instruction set (benchmarks); fails if the CPU lacks it
+bool app_normalize_set_isa(app_normalize_isa_t);
+
+const char *app_normalize_isa_name(app_normalize_isa_t);
+
+#endif // __EMBED2VECDB_APP_NORMALIZE_H__
@@ -0,0 +1,27 @@
+#ifndef __EMBED2VECDB_APP_QUERY_H__
+#define __EMBED2VECDB_APP_QUERY_H__
+
+#include "app-llama.h"
+#include "qdrant.h"
+#include <cstddef>
+#include <vector>
+
+typedef struct _app_query_stats
+{
+  size_t n_queries;
+  size_t n_requests;    // search requests (one per batch of queries)
+  double t_tokenize;    // seconds, all batches
+  double t_embed;       // seconds spent in app_llm_get_embeddings
+  double t_search;      // seconds waiting on qdrant or in the local index
+  std::vector<double> latency; // end to end of every batch, seconds
+} app_query_stats_t;
+
+// embeds every record of args.query and prints its nearest points, from
+// qdrant or from the index at args.hnsw_path
+bool app_query_run(const app_llama_args_t &, const app_llama_data_t &,
+                   const qdrant_info_t &, const qdrant_colection_info_t &,
+                   app_query_stats_t *);
+
+void app_query_print_stats(const app_query_stats_t &);
+
+#endif // __EMBED2VECDB_APP_QUERY_H__
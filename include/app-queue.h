@@ -0,0 +1,99 @@
+#ifndef __EMBED2VECDB_APP_QUEUE_H__
+#define __EMBED2VECDB_APP_QUEUE_H__
+
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <mutex>
+
+// bounded multi-producer / multi-consumer queue; push blocks while the queue
+// is full (backpressure), pop blocks while it is empty. Once closed, push
+// fails and pop drains what is left.
+template <typename T> class app_queue
+{
+public:
+  explicit app_queue(size_t capacity) : capacity_(capacity ? capacity : 1) {}
+
+  bool push(T item)
+  {
+    std::unique_lock<std::mutex> lock(mutex_);
+    not_full_.wait(lock,
+                   [this] { return closed_ || items_.size() < capacity_; });
+    if (closed_)
+    {
+      return false;
+    }
+
+    items_.push_back(std::move(item));
+    not_empty_.notify_one();
+
+    return true;
+  }
+
+  bool pop(T &item)
+  {
+    std::unique_lock<std::mutex> lock(mutex_);
+    not_empty_.wait(lock, [this] { return closed_ || !items_.empty(); });
+    if (items_.empty())
+    {
+      return false;
+    }
+
+    item = std::move(items_.front());
+    items_.pop_front();
+    not_full_.notify_one();
+
+    return true;
+  }
+
+  // like pop, but gives up after 'timeout'; tell a timeout from the end of
+  // the stream with drained()
+  template <typename Rep, typename Period>
+  bool pop_for(T &item, const std::chrono::duration<Rep, Period> &timeout)
+  {
+    std::unique_lock<std::mutex> lock(mutex_);
+    not_empty_.wait_for(lock, timeout,
+                        [this] { return closed_ || !items_.empty(); });
+    if (items_.empty())
+    {
+      return false;
+    }
+
+    item = std::move(items_.front());
+    items_.pop_front();
+    not_full_.notify_one();
+
+    return true;
+  }
+
+  bool drained()
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return closed_ && items_.empty();
+  }
+
+  void close()
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    closed_ = true;
+    not_full_.notify_all();
+    not_empty_.notify_all();
+  }
+
+  size_t size()
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return items_.size();
+  }
+
+private:
+  std::mutex mutex_;
+  std::condition_variable not_full_;
+  std::condition_variable not_empty_;
+  std::deque<T> items_;
+  size_t capacity_;
+  bool closed_ = false;
+};
+
+#endif // __EMBED2VECDB_APP_QUEUE_H__
@@ -0,0 +1,61 @@
+#ifndef __EMBED2VECDB_APP_REDUCE_H__
+#define __EMBED2VECDB_APP_REDUCE_H__
+
+#include "app-cache.h"
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#define APP_REDUCE_MAGIC "E2VPCA\0\0"
+#define APP_REDUCE_VERSION 1
+
+// corpus records embedded to fit a PCA projection (default)
+#define APP_REDUCE_PCA_SAMPLES 4096
+
+// subspace iterations of the PCA fit
+#define APP_REDUCE_PCA_ITERATIONS 12
+
+// how embeddings are narrowed after decoding
+typedef enum _app_reduce_mode
+{
+  FullWidth = 0, // as the model returns them
+  Matryoshka,    // prefix of a Matryoshka-trained embedding
+  Pca            // projection on the top principal components of the corpus
+} app_reduce_mode_t;
+
+typedef struct _app_reduce_header
+{
+  char magic[8];
+  uint32_t version;
+  uint32_t n_in;
+  uint32_t n_out;
+  uint32_t reserved;
+  app_cache_key_t salt; // model identity, normalization and pooling
+} app_reduce_header_t;
+
+// rows of n_in floats become rows of n_out floats, normalized again with
+// 'norm' (an embedding_normalize_algorithm_t)
+typedef struct _app_reduce
+{
+  app_reduce_mode_t mode;
+  int n_in;
+  int n_out;
+  int norm;
+  app_cache_key_t salt;
+  std::vector<float> mean;       // Pca: n_in
+  std::vector<float> components; // Pca: n_out orthonormal rows of n_in
+} app_reduce_t;
+
+bool app_reduce_parse_mode(const std::string &, app_reduce_mode_t *);
+
+bool app_reduce_fit_pca(const float *, size_t, int, int, int, app_reduce_t *);
+
+bool app_reduce_load(const std::string &, app_reduce_t *);
+
+bool app_reduce_save(const std::string &, const app_reduce_t &);
+
+// reduces n_rows rows in place; the vector shrinks to n_rows * n_out
+void app_reduce_apply(const app_reduce_t &, std::vector<float> &, size_t);
+
+#endif // __EMBED2VECDB_APP_REDUCE_H__
@@ -0,0 +1,30 @@
+#ifndef __EMBED2VECDB_APP_REPLAY_H__
+#define __EMBED2VECDB_APP_REPLAY_H__
+
+#include "app-export.h"
+#include "app-llama.h"
+#include "qdrant.h"
+#include <cstddef>
+#include <cstdint>
+
+typedef struct _app_replay_stats
+{
+  size_t n_points;       // points qdrant acknowledged
+  uint64_t n_requests;   // upsert requests completed
+  uint64_t n_retries;    // upsert attempts retried
+  uint64_t n_bytes;      // upsert body bytes, before compression
+  uint64_t n_wire_bytes; // upsert body bytes sent
+  double t_read;         // seconds spent reading the export
+  double t_request;      // sum of upsert latencies, seconds
+  double t_wall;         // end to end
+} app_replay_stats_t;
+
+// streams an export (see app-export.h) into the collection, through the
+// same batcher and request window as an ingest
+bool app_replay_run(const app_llama_args_t &, const qdrant_info_t &,
+                    const qdrant_colection_info_t &, app_export_reader_t &,
+                    app_replay_stats_t *);
+
+void app_replay_print_stats(const app_replay_stats_t &);
+
+#endif // __EMBED2VECDB_APP_REPLAY_H__
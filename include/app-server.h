@@ -0,0 +1,32 @@
+#ifndef __EMBED2VECDB_APP_SERVER_H__
+#define __EMBED2VECDB_APP_SERVER_H__
+
+#include "app-llama.h"
+#include "qdrant.h"
+
+/*
+ * Daemon mode (--serve HOST:PORT or unix:PATH): the model and the Qdrant
+ * connection are set up once, then JSON requests are answered over HTTP/1.1
+ *
+ *   POST /embed  {"input": [..]}
+ *                -> {"dim": N, "embeddings": [[..], ..]}
+ *   POST /upsert {"input": [..], "ids": [..]}     ids optional, UUIDs if not
+ *                -> {"status": "ok", "ids": [..]}
+ *   POST /search {"input": [..], "top_k": K, "filter": {..}, "with_payload": b}
+ *                -> {"results": [[{"id": .., "score": .., "payload": ..}], ..]}
+ *   GET  /health -> {"status": "ok", "dim": N}
+ *
+ * where "input" may also be a single string. Records of concurrent requests
+ * are decoded together: the oldest waiting one holds the decode for at most
+ * --serve-wait-ms for others to join, and a decode takes up to --serve-batch
+ * records.
+ */
+
+#define APP_SERVER_DEFAULT_WAIT_MS 5
+#define APP_SERVER_DEFAULT_BATCH 256
+
+// serves until SIGINT or SIGTERM
+bool app_server_run(const app_llama_args_t &, const app_llama_data_t &,
+                    const qdrant_info_t &, const qdrant_colection_info_t &);
+
+#endif // __EMBED2VECDB_APP_SERVER_H__
@@ -0,0 +1,68 @@
+#ifndef __EMBED2VECDB_APP_SINK_H__
+#define __EMBED2VECDB_APP_SINK_H__
+
+#include "app-export.h"
+#include "app-hnsw.h"
+#include "app-llama.h"
+#include "qdrant-async.h"
+#include "qdrant-batch.h"
+#include "qdrant.h"
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+// where embedded points go
+typedef enum _app_sink_type
+{
+  SinkQdrant = 0, // upserts, through the batcher
+  SinkHnsw,       // a local index, linked and saved at the end (--hnsw)
+  SinkFile        // an export file, replayed into qdrant later (--export)
+} app_sink_type_t;
+
+// Same threading rules as the batcher: one thread adds, polls and
+// finishes, and Qdrant callbacks run on it.
+typedef struct _app_sink
+{
+  app_sink_type_t type;
+  std::string target; // path or URI, for logs
+  qdrant_colection_info_t col;
+  int n_threads; // linking the index
+
+  qdrant_async_t async;     // SinkQdrant
+  qdrant_batcher_t batcher; // SinkQdrant
+  app_hnsw_t index;         // SinkHnsw
+  app_export_t file;        // SinkFile
+
+  size_t n_points; // points accepted
+  double t_finish; // seconds in app_sink_finish
+
+  uint64_t n_bytes_counted;      // batcher bytes already in the metrics
+  uint64_t n_wire_bytes_counted;
+} app_sink_t;
+
+app_sink_type_t app_sink_type(const app_llama_args_t &);
+
+const char *app_sink_name(app_sink_type_t);
+
+// the callback reports every Qdrant upsert; local sinks do not call it
+bool app_sink_open(const app_llama_args_t &, const qdrant_info_t &,
+                   const qdrant_colection_info_t &, qdrant_batch_callback_t,
+                   app_sink_t *);
+
+// Qdrant and the index get the vector quantized in place; exports keep full
+// precision, replay quantizes them for the collection they go to
+bool app_sink_add(app_sink_t &, qdrant_point_spec_t &);
+
+// longest the caller may wait before app_sink_poll, -1 = no limit
+long app_sink_wait_ms(const app_sink_t &);
+
+void app_sink_poll(app_sink_t &);
+
+// sends what is buffered and waits for it, links and saves the index, or
+// completes the file
+bool app_sink_finish(app_sink_t &);
+
+// waits for requests still in flight; an unfinished export is removed
+void app_sink_close(app_sink_t *);
+
+#endif // __EMBED2VECDB_APP_SINK_H__
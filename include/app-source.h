@@ -0,0 +1,46 @@
+#ifndef __EMBED2VECDB_APP_SOURCE_H__
+#define __EMBED2VECDB_APP_SOURCE_H__
+
+#include <cstddef>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// number of records handed out by a single app_source_read call (default)
+#define APP_SOURCE_CHUNK_RECORDS 256
+
+// read(2) size used when the source can not be memory-mapped (pipes, fifos)
+#define APP_SOURCE_READ_SIZE (1 << 20)
+
+typedef struct _app_source
+{
+  std::string path;
+  int fd;
+  bool mapped;            // true: 'data' is a mmap of the whole file
+  const char *data;       // mapped file contents
+  size_t size;            // mapped file size
+  size_t offset;          // next unread byte of the source
+  size_t released;        // bytes already handed back to the kernel
+  size_t n_records;       // records handed out so far
+  bool eof;               // streamed input hit end of file
+  std::vector<char> tail; // streamed input: partial record carried over
+} app_source_t;
+
+typedef struct _app_source_chunk
+{
+  std::vector<std::string_view> records;
+  std::vector<char> storage; // backing bytes for streamed (non mmap) input
+  size_t first_record;       // index of records[0] within the source
+  size_t end_offset;         // source offset right after the last record
+} app_source_chunk_t;
+
+bool app_source_open(const std::string &, app_source_t *);
+
+size_t app_source_read(app_source_t &, const std::string &, size_t,
+                       app_source_chunk_t &);
+
+void app_source_release(app_source_t &, size_t);
+
+void app_source_close(app_source_t *);
+
+#endif // __EMBED2VECDB_APP_SOURCE_H__
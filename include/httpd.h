@@ -0,0 +1,95 @@
+#ifndef __EMBED2VECDB_HTTPD_H__
+#define __EMBED2VECDB_HTTPD_H__
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <set>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+/*
+ * A small HTTP/1.1 server: one thread per connection, keep-alive,
+ * Content-Length bodies only (no chunked uploads). Listens on TCP or on a
+ * Unix socket. Enough for local endpoints, not meant to face the internet.
+ */
+
+#define HTTPD_DEFAULT_HOST "127.0.0.1"
+#define HTTPD_DEFAULT_BACKLOG 64
+#define HTTPD_DEFAULT_MAX_BODY_BYTES (256 << 20)
+#define HTTPD_MAX_HEADER_BYTES (64 << 10)
+
+typedef std::vector<std::pair<std::string, std::string>> httpd_headers_t;
+
+typedef struct _httpd_request
+{
+  std::string method;
+  std::string path;  // without the query string
+  std::string query; // after '?', undecoded
+  httpd_headers_t headers; // names in lower case
+  std::string body;
+} httpd_request_t;
+
+typedef struct _httpd_response
+{
+  int status;
+  std::string content_type;
+  std::string body;
+  httpd_headers_t headers;
+  bool reset; // drop the connection with a RST instead of answering
+} httpd_response_t;
+
+// runs on the connection's thread, so it may block (latency) and several
+// may run at once
+typedef std::function<void(const httpd_request_t &, httpd_response_t &)>
+    httpd_handler_t;
+
+typedef struct _httpd_config
+{
+  std::string host; // IPv4 address to bind
+  int port;         // 0 = any free port, see httpd_t::port
+  std::string unix_path; // Unix socket to listen on instead, if not empty
+  int backlog;
+  size_t max_body; // larger requests get 413 and the connection is closed
+} httpd_config_t;
+
+typedef struct _httpd
+{
+  httpd_config_t config;
+  httpd_handler_t handler;
+  int fd;   // listening socket
+  int port; // bound port
+  std::thread acceptor;
+  std::mutex mutex; // guards what follows
+  std::condition_variable drained;
+  std::set<int> connections; // sockets being served
+  bool stopping;
+  std::atomic<uint64_t> n_connections;
+  std::atomic<uint64_t> n_requests;
+} httpd_t;
+
+void httpd_default_config(httpd_config_t *);
+
+// HOST:PORT (":PORT" listens on every interface) or unix:PATH
+bool httpd_parse_address(const std::string &, httpd_config_t *);
+
+// "http://HOST:PORT" or "unix:PATH", once started
+std::string httpd_address(const httpd_t &);
+
+bool httpd_start(const httpd_config_t &, httpd_handler_t, httpd_t *);
+
+// closes the listening socket and every connection, and waits for their
+// threads (and handlers) to finish; a Unix socket is unlinked
+void httpd_stop(httpd_t *);
+
+// value of a request header, NULL when absent; 'name' in lower case
+const std::string *httpd_header(const httpd_request_t &, const char *);
+
+const char *httpd_status_text(int);
+
+#endif // __EMBED2VECDB_HTTPD_H__
@@ -1,7 +1,14 @@
 #ifndef __EMBED2VECDB_APP_UTILS_H__
 #define __EMBED2VECDB_APP_UTILS_H__
 
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <mutex>
 #include <string>
+#include <thread>
+#include <string_view>
 #include <uuid/uuid.h>
 #include <vector>
 
@@ -10,9 +17,41 @@
 
 std::string generate_uuid(void);
 
+std::string generate_uuid_v5(const uuid_t, std::string_view);
+
 std::vector<std::string> split_lines(const std::string &, const std::string &);
 
+std::vector<std::string_view> split_views(std::string_view, std::string_view);
+
 void string_replace_all(std::string &, const std::string &,
                         const std::string &);
 
+void parallel_for(size_t, int, const std::function<void(size_t, size_t)> &);
+
+// threads kept for parallel_for calls that come often, so no call pays for
+// starting and joining them; the calling thread works too
+typedef struct _worker_pool
+{
+  std::vector<std::thread> threads;
+  std::mutex running; // one parallel_for at a time
+  std::mutex mutex;   // guards what follows
+  std::condition_variable wake;
+  std::condition_variable idle;
+  const std::function<void(size_t, size_t)> *fn;
+  std::atomic<size_t> next;
+  size_t n;
+  size_t block_size;
+  uint64_t generation; // bumped for every call
+  size_t n_busy;       // workers not done with the current call
+  bool stopping;
+} worker_pool_t;
+
+// 'n_threads' - 1 workers
+void worker_pool_init(worker_pool_t *, int);
+
+void worker_pool_destroy(worker_pool_t *);
+
+void parallel_for(worker_pool_t &, size_t,
+                  const std::function<void(size_t, size_t)> &);
+
 #endif // __EMBED2VECDB_APP_UTILS_H__
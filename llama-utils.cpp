@@ -1,11 +1,11 @@
 #include "llama-utils.h"
+#include "app-normalize.h"
 #include "utils.h"
-#include <cmath>
 #include <limits>
 
 bool app_llama_tokenize(std::vector<llama_token> &tokens,
                         const struct llama_vocab *vocab,
-                        const std::string &text, bool add_special,
+                        std::string_view text, bool add_special,
                         bool parse_special)
 {
   // upper limit for the number of tokens
@@ -41,14 +41,69 @@ bool app_llama_tokenize(std::vector<llama_token> &tokens,
   return true;
 }
 
-void app_llama_batch_add_seq(llama_batch &batch,
-                             const std::vector<int32_t> &tokens,
-                             llama_seq_id seq_id)
+int32_t app_llama_tokenize_append(std::vector<llama_token> &arena,
+                                  const struct llama_vocab *vocab,
+                                  std::string_view text, bool add_special,
+                                  bool parse_special)
 {
-  size_t n_tokens = tokens.size();
+  const size_t n_before = arena.size();
+
+  // upper limit for the number of tokens
+  int n_tokens = text.length() + 2 * add_special;
+
+  arena.resize(n_before + n_tokens);
+
+  n_tokens = llama_tokenize(vocab, text.data(), text.length(),
+                            arena.data() + n_before, n_tokens, add_special,
+                            parse_special);
+
+  if (n_tokens == std::numeric_limits<int32_t>::min())
+  {
+    LOG_ERR("Tokenization failed: input text too large, "
+            "tokenization result exceeds int32_t limit");
+    arena.resize(n_before);
+    return -1;
+  }
+
+  if (n_tokens < 0)
+  {
+    arena.resize(n_before - n_tokens);
+    int check = llama_tokenize(vocab, text.data(), text.length(),
+                               arena.data() + n_before, -n_tokens, add_special,
+                               parse_special);
+    if (check != -n_tokens)
+    {
+      LOG_ERR("tokenize failed: check != -n_tokens\n");
+    }
+    n_tokens = -n_tokens;
+  }
+
+  arena.resize(n_before + n_tokens);
+
+  return n_tokens;
+}
+
+void app_llama_batch_add_seq(llama_batch &batch, const llama_token *tokens,
+                             size_t n_tokens, llama_seq_id seq_id)
+{
+  // written in place: app_llama_batch_add would build a seq_id vector for
+  // every single token
   for (size_t i = 0; i < n_tokens; i++)
   {
-    app_llama_batch_add(batch, tokens[i], i, {seq_id}, true);
+    const int32_t j = batch.n_tokens;
+    if (!batch.seq_id[j])
+    {
+      LOG_ERR("llama_batch size exceeded\n");
+      return;
+    }
+
+    batch.token[j] = tokens[i];
+    batch.pos[j] = i;
+    batch.n_seq_id[j] = 1;
+    batch.seq_id[j][0] = seq_id;
+    batch.logits[j] = true;
+
+    batch.n_tokens++;
   }
 }
 
@@ -76,113 +131,67 @@ void app_llama_batch_add(struct llama_batch &batch, llama_token id,
 }
 
 bool app_llama_batch_decode(llama_context *ctx, llama_batch &batch,
-                            float *output, int n_seq, int n_embd, int embd_norm)
+                            float *output, const std::vector<int32_t> &seq_rows,
+                            int n_embd, int embd_norm)
 {
+  const int n_seq = seq_rows.size();
+
   const enum llama_pooling_type pooling_type = llama_pooling_type(ctx);
 
-  // clear previous kv_cache values (irrelevant for embeddings)
-  // llama_memory_clear(llama_get_memory(ctx), true);
+  // clear previous kv_cache values (irrelevant for embeddings); sequence ids
+  // restart at 0 on every batch and must not see the previous batch's cells
+  llama_memory_clear(llama_get_memory(ctx), true);
 
   // run model
   LOG("n_tokens = %d, n_seq = %d\n", batch.n_tokens, n_seq);
   if (llama_decode(ctx, batch) < 0)
   {
     LOG_ERR("llama_decode failed to process\n");
+    return false;
   }
 
-  for (int i = 0; i < batch.n_tokens; i++)
+  if (pooling_type != LLAMA_POOLING_TYPE_NONE)
   {
-    if (!batch.logits[i])
-    {
-      continue;
-    }
-
-    const float *embd = nullptr;
-    int embd_pos = 0;
-
-    if (pooling_type == LLAMA_POOLING_TYPE_NONE)
+    // one pooled embedding per sequence - supported only when pooling_type is
+    // not NONE
+    for (int s = 0; s < n_seq; s++)
     {
-      // try to get token embeddings
-      embd = llama_get_embeddings_ith(ctx, i);
-      embd_pos = i;
-
+      const float *embd = llama_get_embeddings_seq(ctx, s);
       if (NULL == embd)
       {
-        LOG_ERR("failed to get token embeddings\n");
-        break;
+        LOG_ERR("failed to get sequence embeddings\n");
+        return false;
       }
-    }
-    else
-    {
-      // try to get sequence embeddings - supported only when pooling_type is
-      // not NONE
-      embd = llama_get_embeddings_seq(ctx, batch.seq_id[i][0]);
-      embd_pos = batch.seq_id[i][0];
 
-      if (NULL == embd)
-      {
-        LOG_ERR("failed to get token embeddings\n");
-        break;
-      }
+      float *out = output + (size_t)seq_rows[s] * n_embd;
+      app_normalize(embd, out, n_embd, embd_norm);
     }
 
-    float *out = output + embd_pos * n_embd;
-    app_llama_embd_normalize(embd, out, n_embd, embd_norm);
+    return true;
   }
 
-  return true;
-}
-
-void app_llama_embd_normalize(const float *inp, float *out, int n,
-                              int embd_norm)
-{
-  double sum = 0.0;
-
-  switch (embd_norm)
-  {
-  case -1: // no normalisation
-  {
-    sum = 1.0;
-    break;
-  }
-  case 0: // max absolute
-  {
-    for (int i = 0; i < n; i++)
-    {
-      if (sum < std::abs(inp[i]))
-      {
-        sum = std::abs(inp[i]);
-      }
-    }
-    sum /= 32760.0; // make an int16 range
-    break;
-  }
-  case 2: // euclidean
+  for (int i = 0; i < batch.n_tokens; i++)
   {
-    for (int i = 0; i < n; i++)
+    if (!batch.logits[i])
     {
-      sum += inp[i] * inp[i];
+      continue;
     }
-    sum = std::sqrt(sum);
-    break;
-  }
-  default: // p-norm (euclidean is p-norm p=2)
-  {
-    for (int i = 0; i < n; i++)
+
+    // try to get token embeddings
+    const float *embd = llama_get_embeddings_ith(ctx, i);
+    if (NULL == embd)
     {
-      sum += std::pow(std::abs(inp[i]), embd_norm);
+      LOG_ERR("failed to get token embeddings\n");
+      return false;
     }
-    sum = std::pow(sum, 1.0 / embd_norm);
-    break;
-  }
-  }
 
-  const float norm = sum > 0.0 ? 1.0 / sum : 0.0f;
+    const int embd_pos = seq_rows[batch.seq_id[i][0]] + batch.pos[i];
 
-  for (int i = 0; i < n; i++)
-  {
-    out[i] = inp[i] * norm;
+    float *out = output + (size_t)embd_pos * n_embd;
+    app_normalize(embd, out, n_embd, embd_norm);
   }
+
+  return true;
 }
 
 std::string app_llama_token_to_piece(const struct llama_vocab *vocab,
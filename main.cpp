@@ -1,32 +1,132 @@
+#include "app-ingest.h"
 #include "app-llama.h"
+#include "app-metrics.h"
+#include "app-query.h"
+#include "app-replay.h"
+#include "app-server.h"
+#include "qdrant-quantize.h"
 #include "qdrant.h"
 #include "utils.h"
 #include <stdio.h>
 #include <uuid/uuid.h>
 
-int main(int argc, char **argv)
+static void app_collection_info(const app_llama_args_t &args,
+                                unsigned int size,
+                                qdrant_colection_info_t *col)
 {
-  printf(":: embed2vecdb ::\n");
+  col->name = "serominers";
+  col->size = size;
+  col->distance = qdrant_distance_type_t::Cosine;
+  qdrant_parse_quantization(args.quantize, &col->quantization);
+  col->quantize_range = args.quantize_range > 0.0f
+                            ? args.quantize_range
+                            : qdrant_quantize_default_range(col->size);
 
-  app_llama_args_t args;
-  if (!app_parse_args(argc, argv, &args))
+  if (col->quantization == Uint8)
+  {
+    // the uint8 map is affine: it keeps euclidean order, not angles. On the
+    // unit vectors we produce, euclidean and cosine rank alike.
+    col->distance = qdrant_distance_type_t::Euclid;
+    LOG("uint8 vectors: components in [-%g, %g], Euclid distance.\n",
+        col->quantize_range, col->quantize_range);
+  }
+}
+
+// creates the collection, or keeps the one there unless asked to start over;
+// false when the one there stores vectors of another shape
+static bool app_prepare_collection(const app_llama_args_t &args,
+                                   const qdrant_info_t &info,
+                                   const qdrant_colection_info_t &col)
+{
+  bool exists = false;
+  if (args.recreate)
+  {
+    qdrant_collection_delete(info, col)
+        ? LOG("qdrant_collection_delete succeeded\n")
+        : LOG_ERR("qdrant_collection_delete failed.\n");
+  }
+  else if (!qdrant_collection_exists(info, col, &exists))
+  {
+    LOG("warning: could not tell whether '%s' exists, creating it.\n",
+        col.name.c_str());
+  }
+
+  if (!exists)
+  {
+    qdrant_collection_create(info, col)
+        ? LOG("qdrant_collection_create succeeded\n")
+        : LOG_ERR("qdrant_collection_create failed.\n");
+    return true;
+  }
+
+  unsigned int size = 0;
+  std::string distance, datatype;
+  if (!qdrant_collection_params(info, col, &size, &distance, &datatype))
+  {
+    LOG_ERR("could not read the vector params of '%s'.\n", col.name.c_str());
+    return false;
+  }
+
+  const std::string want_distance = qdrant_get_distance(col.distance);
+  const std::string want_datatype = qdrant_collection_datatype(col);
+  if (size != col.size || distance != want_distance ||
+      datatype != want_datatype)
+  {
+    LOG_ERR("collection '%s' holds %u-d %s vectors by %s, this run makes "
+            "%u-d %s vectors by %s; check --reduce and --quantize or pass "
+            "--recreate.\n",
+            col.name.c_str(), size, datatype.c_str(), distance.c_str(),
+            col.size, want_datatype.c_str(), want_distance.c_str());
+    return false;
+  }
+
+  LOG("collection '%s' exists, upserting into it.\n", col.name.c_str());
+
+  return true;
+}
+
+// uploads an export; the collection takes the width of its vectors
+static int app_replay(const app_llama_args_t &args)
+{
+  app_export_reader_t reader;
+  if (!app_export_open(args.replay_path, &reader))
   {
-    LOG_ERR("could not parse arguments.\n");
     return 1;
   }
 
-  if (args.verbose)
+  qdrant_info_t info;
+  if (!qdrant_init(args.qdrant_uri, &info))
   {
-    printf("\n");
-    printf("model ......... %s\n", args.model.c_str());
-    printf("source ........ %s\n", args.source.c_str());
-    printf("qdrant_uri .... %s\n", args.qdrant_uri.c_str());
-    printf("ctx_size ...... %d\n", args.ctx_size);
-    printf("batch_size .... %d\n", args.batch_size);
-    printf("ubatch_size ... %d\n", args.ubatch_size);
-    printf("threads ....... %d\n", args.threads);
-    printf("n_gpu_layers .. %d\n", args.n_gpu_layers);
-    printf("\n");
+    LOG_ERR("qdrant_init failed.\n");
+    qdrant_destroy(&info);
+    app_export_reader_close(&reader);
+    return -1;
+  }
+
+  qdrant_colection_info_t col;
+  app_collection_info(args, reader.dim, &col);
+  if (!app_prepare_collection(args, info, col))
+  {
+    qdrant_destroy(&info);
+    app_export_reader_close(&reader);
+    return 1;
+  }
+
+  app_replay_stats_t stats;
+  const bool success = app_replay_run(args, info, col, reader, &stats);
+  app_replay_print_stats(stats);
+
+  qdrant_destroy(&info);
+  app_export_reader_close(&reader);
+
+  return success ? 0 : 1;
+}
+
+static int app_run(app_llama_args_t &args)
+{
+  if (!args.replay_path.empty())
+  {
+    return app_replay(args);
   }
 
   // Init app_llm
@@ -39,27 +139,85 @@ int main(int argc, char **argv)
     return -1;
   }
 
-  // Test for qdrant connection
+  // Test for qdrant connection; a local index or an export does without it
   qdrant_info_t info;
-  if (!qdrant_init(args.qdrant_uri, &info))
+  info.URI.assign(args.qdrant_uri);
+  info.client = NULL;
+
+  const bool use_qdrant = args.hnsw_path.empty() && args.export_path.empty();
+  if (use_qdrant && !qdrant_init(args.qdrant_uri, &info))
   {
     LOG_ERR("qdrant_init failed.\n");
+    qdrant_destroy(&info);
+    app_llm_destroy(&data);
     return -1;
   }
 
-  // test delete collection / create collection
   qdrant_colection_info_t col;
-  col.name = "serominers";
-  col.size = llama_model_n_embd(data.model);
-  col.distance = qdrant_distance_type_t::Cosine;
+  app_collection_info(args, data.n_embd_out, &col);
 
-  qdrant_collection_delete(info, col)
-      ? LOG("qdrant_collection_delete succeeded\n")
-      : LOG_ERR("qdrant_collection_delete failed.\n");
+  // queries only read the collection
+  if (!args.query.empty())
+  {
+    app_query_stats_t stats;
+    bool success = app_query_run(args, data, info, col, &stats);
+    app_query_print_stats(stats);
 
-  qdrant_collection_create(info, col)
-      ? LOG("qdrant_collection_create succeeded\n")
-      : LOG_ERR("qdrant_collection_create failed.\n");
+    qdrant_destroy(&info);
+    app_llm_destroy(&data);
+
+    return success ? 0 : 1;
+  }
+
+  if (!use_qdrant)
+  {
+    bool success = true;
+    if (!args.source.empty())
+    {
+      app_ingest_stats_t stats;
+      success = app_ingest_run(args, data, info, col, &stats);
+      app_ingest_print_stats(stats);
+    }
+    else
+    {
+      LOG_ERR("params --hnsw and --export need --source%s.\n",
+              args.export_path.empty() ? " or --query" : "");
+      success = false;
+    }
+
+    app_llm_destroy(&data);
+
+    return success ? 0 : 1;
+  }
+
+  if (!app_prepare_collection(args, info, col))
+  {
+    qdrant_destroy(&info);
+    app_llm_destroy(&data);
+    return 1;
+  }
+
+  if (!args.serve.empty())
+  {
+    bool success = app_server_run(args, data, info, col);
+
+    qdrant_destroy(&info);
+    app_llm_destroy(&data);
+
+    return success ? 0 : 1;
+  }
+
+  if (!args.source.empty())
+  {
+    app_ingest_stats_t stats;
+    bool success = app_ingest_run(args, data, info, col, &stats);
+    app_ingest_print_stats(stats);
+
+    qdrant_destroy(&info);
+    app_llm_destroy(&data);
+
+    return success ? 0 : 1;
+  }
 
   llama_input_vector_t result;
   std::string text("serominers sao brasileiros");
@@ -80,9 +238,6 @@ int main(int argc, char **argv)
     }
     else
     {
-      qdrant_colection_info_t col;
-      col.name = "serominers";
-
       qdrant_point_array_t points;
       qdrant_point_spec_t point;
 
@@ -90,6 +245,7 @@ int main(int argc, char **argv)
       point.payload_x = "sero";
       point.payload_y = "miners";
       point.vector.assign(embeddings.begin(), embeddings.end());
+      qdrant_quantize(col, point.vector.data(), point.vector.size());
 
       points.push_back(point);
 
@@ -97,7 +253,103 @@ int main(int argc, char **argv)
     }
   }
 
+  qdrant_destroy(&info);
   app_llm_destroy(&data);
 
   return 0;
 }
+
+int main(int argc, char **argv)
+{
+  printf(":: embed2vecdb ::\n");
+
+  app_llama_args_t args;
+  if (!app_parse_args(argc, argv, &args))
+  {
+    LOG_ERR("could not parse arguments.\n");
+    return 1;
+  }
+
+  if (args.verbose)
+  {
+    printf("\n");
+    printf("model ......... %s\n", args.model.c_str());
+    printf("source ........ %s\n", args.source.c_str());
+    if (!args.query.empty())
+    {
+      printf("query ......... %s (top %d, %d per request%s%s)\n",
+             args.query.c_str(), args.top_k, args.query_batch,
+             args.query_filter.empty() ? "" : ", filter ",
+             args.query_filter.c_str());
+    }
+    printf("cache ......... %s\n",
+           args.cache_path.empty() ? "(none)" : args.cache_path.c_str());
+    printf("manifest ...... %s\n",
+           args.manifest_path.empty() ? "(none)" : args.manifest_path.c_str());
+    printf("point ids ..... %s (source id '%s')%s\n", args.id_mode.c_str(),
+           args.source_id.c_str(), args.skip_existing ? ", skip existing" : "");
+    if (!args.hnsw_path.empty())
+    {
+      printf("hnsw .......... %s (m %d, ef_construction %d, ef %d)\n",
+             args.hnsw_path.c_str(), args.hnsw_m, args.hnsw_ef_construction,
+             args.hnsw_ef);
+    }
+    if (!args.export_path.empty() || !args.replay_path.empty())
+    {
+      printf("%s ........ %s\n",
+             args.export_path.empty() ? "replay" : "export",
+             args.export_path.empty() ? args.replay_path.c_str()
+                                      : args.export_path.c_str());
+    }
+    printf("qdrant_uri .... %s\n", args.qdrant_uri.c_str());
+    printf("inflight ...... %d%s\n", args.qdrant_inflight,
+           args.qdrant_http2 ? " (HTTP/2)" : "");
+    printf("upsert batch .. %d points, %d KiB, %d ms\n",
+           args.qdrant_batch_points, args.qdrant_batch_kb, args.qdrant_batch_ms);
+    printf("compress ...... %s (level %d%s)\n", args.qdrant_compress.c_str(),
+           args.qdrant_compress_level,
+           args.qdrant_compress_auto ? ", auto" : "");
+    printf("quantize ...... %s\n", args.quantize.c_str());
+    printf("reduce ........ %s (%d dims%s%s)\n", args.reduce.c_str(),
+           args.reduce_dim, args.pca_path.empty() ? "" : ", ",
+           args.pca_path.c_str());
+    printf("ctx_size ...... %d\n", args.ctx_size);
+    printf("batch_size .... %d\n", args.batch_size);
+    printf("ubatch_size ... %d\n", args.ubatch_size);
+    printf("chunk_size .... %d\n", args.chunk_size);
+    printf("queue_depth ... %d\n", args.queue_depth);
+    printf("threads ....... %d\n", args.threads);
+    printf("tok_threads ... %d\n", args.tok_threads);
+    printf("contexts ...... %d (%d threads each)\n", args.n_contexts,
+           args.context_threads);
+    printf("parallel ...... %d\n", args.n_parallel);
+    printf("n_gpu_layers .. %d\n", args.n_gpu_layers);
+    if (!args.serve.empty())
+    {
+      printf("serve ......... %s (%d records, %d ms wait)\n",
+             args.serve.c_str(), args.serve_batch, args.serve_wait_ms);
+    }
+    if (!args.metrics_listen.empty() || !args.metrics_path.empty())
+    {
+      printf("metrics ....... %s%s%s (every %d s)\n",
+             args.metrics_listen.c_str(),
+             args.metrics_listen.empty() || args.metrics_path.empty() ? ""
+                                                                      : ", ",
+             args.metrics_path.c_str(), args.metrics_interval);
+    }
+    printf("\n");
+  }
+
+  if (!app_metrics_start(args.metrics_listen, args.metrics_path,
+                         args.metrics_interval))
+  {
+    LOG_ERR("could not start metrics.\n");
+    return 1;
+  }
+
+  const int status = app_run(args);
+
+  app_metrics_stop();
+
+  return status;
+}
@@ -0,0 +1,443 @@
+#include "qdrant-async.h"
+#include "curl/curl.h"
+#include "nlohmann/json.hpp"
+#include "utils.h"
+#include <algorithm>
+#include <cstring>
+
+void qdrant_async_default_config(qdrant_async_config_t *config)
+{
+  if (NULL == config)
+  {
+    return;
+  }
+
+  config->window = QDRANT_ASYNC_DEFAULT_WINDOW;
+  config->http2 = false;
+  config->max_retries = QDRANT_ASYNC_DEFAULT_RETRIES;
+  config->retry_backoff_ms = QDRANT_ASYNC_DEFAULT_BACKOFF_MS;
+  config->timeout_ms = 0;
+}
+
+bool qdrant_async_init(const qdrant_info_t &info,
+                       const qdrant_async_config_t &config,
+                       qdrant_async_t *async)
+{
+  if (NULL == async)
+  {
+    LOG_ERR("argument 'async' is NULL.\n");
+    return false;
+  }
+
+  async->URI.assign(info.URI);
+  async->config = config;
+  async->config.window = std::max(1, config.window);
+  async->multi = NULL;
+  for (auto &headers : async->headers)
+  {
+    headers = NULL;
+  }
+  async->in_flight = 0;
+  async->n_succeeded = 0;
+  async->n_failed = 0;
+  async->n_retried = 0;
+
+  if (!qdrant_global_acquire())
+  {
+    return false;
+  }
+
+  async->multi = curl_multi_init();
+  if (NULL == async->multi)
+  {
+    LOG_ERR("curl_multi_init failed.\n");
+    qdrant_global_release();
+    return false;
+  }
+
+  if (async->config.http2)
+  {
+    // every request of the window shares one connection
+    curl_multi_setopt(async->multi, CURLMOPT_PIPELINING, CURLPIPE_MULTIPLEX);
+    curl_multi_setopt(async->multi, CURLMOPT_MAX_HOST_CONNECTIONS, 1L);
+  }
+  else
+  {
+    curl_multi_setopt(async->multi, CURLMOPT_MAX_HOST_CONNECTIONS,
+                      (long)async->config.window);
+  }
+
+  for (int i = 0; i < QDRANT_ENCODING_COUNT; i++)
+  {
+    const qdrant_encoding_t encoding = (qdrant_encoding_t)i;
+
+    struct curl_slist *headers = NULL;
+    headers = curl_slist_append(headers, "Content-Type: application/json");
+    headers = curl_slist_append(headers, "Expect:");
+    if (encoding != Identity)
+    {
+      const std::string header =
+          "Content-Encoding: " + qdrant_get_encoding(encoding);
+      headers = curl_slist_append(headers, header.c_str());
+    }
+
+    async->headers[i] = headers;
+  }
+
+  // easy handles live as long as the engine, so their connections do too
+  for (int i = 0; i < async->config.window; i++)
+  {
+    qdrant_async_request_t *req = new qdrant_async_request_t;
+    req->curl = curl_easy_init();
+    req->response = qdrant_malloc_write_data();
+    req->attempts = 0;
+    req->encoding = Identity;
+
+    if (NULL == req->curl || NULL == req->response)
+    {
+      LOG_ERR("curl_easy_init failed.\n");
+      async->slots.push_back(req);
+      qdrant_async_destroy(async);
+      return false;
+    }
+
+    async->slots.push_back(req);
+    async->idle.push_back(req);
+  }
+
+  return true;
+}
+
+void qdrant_async_destroy(qdrant_async_t *async)
+{
+  if (NULL == async || NULL == async->multi)
+  {
+    return;
+  }
+
+  for (qdrant_async_request_t *req : async->slots)
+  {
+    if (req->curl != NULL)
+    {
+      curl_multi_remove_handle(async->multi, req->curl);
+      curl_easy_cleanup(req->curl);
+    }
+
+    free_write_data(req->response);
+    delete req;
+  }
+
+  async->slots.clear();
+  async->idle.clear();
+  async->retries.clear();
+  async->buffers.clear();
+
+  for (auto &headers : async->headers)
+  {
+    if (headers != NULL)
+    {
+      curl_slist_free_all(headers);
+      headers = NULL;
+    }
+  }
+
+  curl_multi_cleanup(async->multi);
+  async->multi = NULL;
+
+  qdrant_global_release();
+}
+
+static void qdrant_async_start(qdrant_async_t &async,
+                               qdrant_async_request_t *req)
+{
+  CURL *curl = req->curl;
+
+  curl_easy_reset(curl);
+  qdrant_reset_write_data(req->response);
+
+  curl_easy_setopt(curl, CURLOPT_URL, req->url.c_str());
+  curl_easy_setopt(curl, CURLOPT_CUSTOMREQUEST, req->method.c_str());
+  curl_easy_setopt(curl, CURLOPT_NOPROGRESS, 1L);
+  curl_easy_setopt(curl, CURLOPT_NOSIGNAL, 1L);
+  curl_easy_setopt(curl, CURLOPT_TCP_KEEPALIVE, 1L);
+  curl_easy_setopt(curl, CURLOPT_HTTPHEADER, async.headers[req->encoding]);
+  curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, qdrant_curl_write_data);
+  curl_easy_setopt(curl, CURLOPT_WRITEDATA, req->response);
+  curl_easy_setopt(curl, CURLOPT_PRIVATE, req);
+  curl_easy_setopt(curl, CURLOPT_POSTFIELDS, req->body.data());
+  curl_easy_setopt(curl, CURLOPT_POSTFIELDSIZE_LARGE,
+                   (curl_off_t)req->body.length());
+
+  if (async.config.timeout_ms > 0)
+  {
+    curl_easy_setopt(curl, CURLOPT_TIMEOUT_MS, async.config.timeout_ms);
+  }
+
+  if (async.config.http2)
+  {
+    // h2c with prior knowledge for http://, ALPN for https://
+    curl_easy_setopt(curl, CURLOPT_HTTP_VERSION,
+                     async.URI.rfind("https", 0) == 0
+                         ? CURL_HTTP_VERSION_2TLS
+                         : CURL_HTTP_VERSION_2_PRIOR_KNOWLEDGE);
+    curl_easy_setopt(curl, CURLOPT_PIPEWAIT, 1L);
+  }
+
+  req->attempts++;
+  curl_multi_add_handle(async.multi, curl);
+}
+
+static void qdrant_async_finish(qdrant_async_t &async,
+                                qdrant_async_request_t *req, CURLcode code)
+{
+  qdrant_async_result_t result;
+  result.code = code;
+  result.status = 0;
+  result.attempts = req->attempts;
+  curl_easy_getinfo(req->curl, CURLINFO_RESPONSE_CODE, &result.status);
+
+  curl_off_t upload_bps = 0;
+  curl_easy_getinfo(req->curl, CURLINFO_SPEED_UPLOAD_T, &upload_bps);
+  result.upload_bps = (double)upload_bps;
+
+  result.body.assign(reinterpret_cast<const char *>(req->response->pointer),
+                     req->response->pointer_len);
+
+  // {"status": "ok", ...} or {"status": {"error": "..."}, ...}
+  nlohmann::json reply = nlohmann::json::parse(result.body, nullptr, false);
+  if (reply.is_object() && reply.contains("status"))
+  {
+    const nlohmann::json &status = reply["status"];
+    if (status.is_string())
+    {
+      result.qdrant_status = status.get<std::string>();
+    }
+    else if (status.is_object() && status.contains("error"))
+    {
+      result.qdrant_status = status["error"].dump();
+    }
+  }
+
+  result.success = code == CURLE_OK && result.status >= 200 &&
+                   result.status < 300 && result.qdrant_status == "ok";
+
+  // throttling, server errors and broken connections are worth a retry
+  const bool transient = code != CURLE_OK || result.status == 429 ||
+                         result.status >= 500;
+  if (!result.success && transient &&
+      req->attempts <= async.config.max_retries)
+  {
+    const long backoff = async.config.retry_backoff_ms
+                         << std::min(req->attempts - 1, 10);
+
+    LOG("warning: %s %s failed (curl %d, HTTP %ld), retry %d in %ld ms.\n",
+        req->method.c_str(), req->url.c_str(), code, result.status,
+        req->attempts, backoff);
+
+    req->retry_at =
+        std::chrono::steady_clock::now() + std::chrono::milliseconds(backoff);
+    async.retries.push_back(req);
+    async.n_retried++;
+
+    return;
+  }
+
+  if (result.success)
+  {
+    async.n_succeeded++;
+  }
+  else
+  {
+    async.n_failed++;
+    LOG_ERR("%s %s failed: curl %d (%s), HTTP %ld, qdrant '%s'.\n",
+            req->method.c_str(), req->url.c_str(), code,
+            curl_easy_strerror(code), result.status,
+            result.qdrant_status.c_str());
+  }
+
+  result.seconds = std::chrono::duration<double>(
+                       std::chrono::steady_clock::now() - req->submitted)
+                       .count();
+
+  // the slot is free before the callback runs, so it may submit again
+  qdrant_async_callback_t callback = std::move(req->callback);
+  req->body.clear();
+  async.buffers.push_back(std::move(req->body));
+  async.idle.push_back(req);
+  async.in_flight--;
+
+  if (callback)
+  {
+    callback(result);
+  }
+}
+
+long qdrant_async_wait_ms(const qdrant_async_t &async)
+{
+  if (async.in_flight == 0)
+  {
+    return -1;
+  }
+
+  long wait_ms = QDRANT_ASYNC_POLL_MS;
+  const auto now = std::chrono::steady_clock::now();
+  for (const qdrant_async_request_t *req : async.retries)
+  {
+    const long due =
+        std::chrono::duration_cast<std::chrono::milliseconds>(req->retry_at - now)
+            .count();
+    wait_ms = std::min(wait_ms, std::max(0L, due));
+  }
+
+  return wait_ms;
+}
+
+int qdrant_async_poll(qdrant_async_t &async, int timeout_ms)
+{
+  // restart retries that are due
+  const auto now = std::chrono::steady_clock::now();
+  for (size_t i = 0; i < async.retries.size();)
+  {
+    qdrant_async_request_t *req = async.retries[i];
+    if (req->retry_at <= now)
+    {
+      async.retries.erase(async.retries.begin() + i);
+      qdrant_async_start(async, req);
+    }
+    else
+    {
+      i++;
+    }
+  }
+
+  int running = 0;
+  curl_multi_perform(async.multi, &running);
+
+  if (running > 0 || !async.retries.empty())
+  {
+    int wait_ms = timeout_ms;
+    if (!async.retries.empty())
+    {
+      // wake up in time for the next retry
+      auto next = async.retries.front()->retry_at;
+      for (qdrant_async_request_t *req : async.retries)
+      {
+        next = std::min(next, req->retry_at);
+      }
+
+      const long due = std::chrono::duration_cast<std::chrono::milliseconds>(
+                           next - std::chrono::steady_clock::now())
+                           .count();
+      wait_ms = std::max(0, std::min<int>(wait_ms, due));
+    }
+
+    curl_multi_poll(async.multi, NULL, 0, wait_ms, NULL);
+    curl_multi_perform(async.multi, &running);
+  }
+
+  CURLMsg *msg;
+  int n_msgs;
+  while ((msg = curl_multi_info_read(async.multi, &n_msgs)) != NULL)
+  {
+    if (msg->msg != CURLMSG_DONE)
+    {
+      continue;
+    }
+
+    CURL *curl = msg->easy_handle;
+    const CURLcode code = msg->data.result;
+
+    qdrant_async_request_t *req = NULL;
+    curl_easy_getinfo(curl, CURLINFO_PRIVATE, &req);
+    curl_multi_remove_handle(async.multi, curl);
+
+    qdrant_async_finish(async, req, code);
+  }
+
+  return async.in_flight;
+}
+
+void qdrant_async_wait(qdrant_async_t &async)
+{
+  while (async.in_flight > 0)
+  {
+    qdrant_async_poll(async, 100);
+  }
+}
+
+std::string qdrant_async_take_buffer(qdrant_async_t &async)
+{
+  // keeps the capacity of an earlier body, so serializing the next one does
+  // not have to grow a fresh string
+  std::string buffer;
+  if (!async.buffers.empty())
+  {
+    buffer = std::move(async.buffers.back());
+    async.buffers.pop_back();
+  }
+
+  buffer.clear();
+
+  return buffer;
+}
+
+bool qdrant_async_submit(qdrant_async_t &async, const char *method,
+                         const std::string &path, std::string &&body,
+                         qdrant_async_callback_t callback)
+{
+  return qdrant_async_submit_encoded(async, method, path, std::move(body),
+                                     Identity, std::move(callback));
+}
+
+bool qdrant_async_submit_encoded(qdrant_async_t &async, const char *method,
+                                 const std::string &path, std::string &&body,
+                                 qdrant_encoding_t encoding,
+                                 qdrant_async_callback_t callback)
+{
+  if (NULL == async.multi)
+  {
+    LOG_ERR("qdrant async engine is not initialized.\n");
+    return false;
+  }
+
+  // backpressure: drive transfers until a slot frees up
+  while (async.idle.empty())
+  {
+    qdrant_async_poll(async, 100);
+  }
+
+  qdrant_async_request_t *req = async.idle.back();
+  async.idle.pop_back();
+
+  req->url.assign(async.URI);
+  req->url.append(path);
+  req->method.assign(method);
+  req->body = std::move(body);
+  req->encoding = encoding;
+  req->callback = std::move(callback);
+  req->attempts = 0;
+  req->submitted = std::chrono::steady_clock::now();
+
+  async.in_flight++;
+  qdrant_async_start(async, req);
+
+  // get the transfer going right away
+  int running = 0;
+  curl_multi_perform(async.multi, &running);
+
+  return true;
+}
+
+bool qdrant_points_insert_async(qdrant_async_t &async,
+                                const qdrant_colection_info_t &col,
+                                const qdrant_point_array_t &points,
+                                qdrant_async_callback_t callback)
+{
+  std::string body = qdrant_async_take_buffer(async);
+  qdrant_points_body(points, body, col.quantization);
+
+  return qdrant_async_submit(async, "PUT",
+                             qdrant_collection_path(QDRANT_POINTS_INSERT_PATH,
+                                                    col),
+                             std::move(body), std::move(callback));
+}
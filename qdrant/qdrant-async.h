@@ -0,0 +1,103 @@
+#ifndef __EMBED2VECDB_QDRANT_ASYNC_H__
+#define __EMBED2VECDB_QDRANT_ASYNC_H__
+
+#include "qdrant.h"
+#include <chrono>
+#include <deque>
+#include <functional>
+#include <string>
+#include <vector>
+
+#define QDRANT_ASYNC_DEFAULT_WINDOW 4
+#define QDRANT_ASYNC_DEFAULT_RETRIES 3
+#define QDRANT_ASYNC_DEFAULT_BACKOFF_MS 100
+
+// polling interval while requests are in flight
+#define QDRANT_ASYNC_POLL_MS 5
+
+typedef struct _qdrant_async_config
+{
+  int window;            // requests in flight (retries included)
+  bool http2;            // multiplex requests over one HTTP/2 connection
+  int max_retries;       // retries on transport errors, 429 and 5xx
+  long retry_backoff_ms; // first retry delay, doubled on every attempt
+  long timeout_ms;       // per attempt, 0 = none
+} qdrant_async_config_t;
+
+typedef struct _qdrant_async_result
+{
+  CURLcode code;             // transport result of the last attempt
+  long status;               // HTTP status, 0 when there was no response
+  std::string qdrant_status; // "ok" or the error qdrant reported
+  std::string body;          // raw response
+  int attempts;
+  double seconds;    // submit to completion
+  double upload_bps; // upload speed of the last attempt, bytes/s
+  bool success;   // transport ok, 2xx and qdrant status "ok"
+} qdrant_async_result_t;
+
+typedef std::function<void(const qdrant_async_result_t &)>
+    qdrant_async_callback_t;
+
+typedef struct _qdrant_async_request
+{
+  CURL *curl;
+  std::string url;
+  std::string method;
+  std::string body;
+  qdrant_encoding_t encoding;
+  curl_write_data_t *response;
+  qdrant_async_callback_t callback;
+  int attempts;
+  std::chrono::steady_clock::time_point submitted;
+  std::chrono::steady_clock::time_point retry_at;
+} qdrant_async_request_t;
+
+// upload engine on the curl multi interface. Not thread safe: submit, poll
+// and wait must come from one thread, which is also where callbacks run.
+typedef struct _qdrant_async
+{
+  std::string URI;
+  qdrant_async_config_t config;
+  CURLM *multi;
+  struct curl_slist *headers[QDRANT_ENCODING_COUNT]; // by body encoding
+  std::vector<qdrant_async_request_t *> slots; // one per window entry
+  std::vector<qdrant_async_request_t *> idle;
+  std::deque<qdrant_async_request_t *> retries; // waiting for retry_at
+  std::vector<std::string> buffers; // bodies of finished requests, reusable
+  int in_flight;                                // running + waiting retries
+  uint64_t n_succeeded;
+  uint64_t n_failed;
+  uint64_t n_retried;
+} qdrant_async_t;
+
+void qdrant_async_default_config(qdrant_async_config_t *);
+
+bool qdrant_async_init(const qdrant_info_t &, const qdrant_async_config_t &,
+                       qdrant_async_t *);
+
+void qdrant_async_destroy(qdrant_async_t *);
+
+std::string qdrant_async_take_buffer(qdrant_async_t &);
+
+bool qdrant_async_submit(qdrant_async_t &, const char *, const std::string &,
+                         std::string &&, qdrant_async_callback_t);
+
+bool qdrant_async_submit_encoded(qdrant_async_t &, const char *,
+                                 const std::string &, std::string &&,
+                                 qdrant_encoding_t, qdrant_async_callback_t);
+
+int qdrant_async_poll(qdrant_async_t &, int);
+
+// longest a caller may go without qdrant_async_poll while requests are in
+// flight (transfers only move when polled), -1 when none are
+long qdrant_async_wait_ms(const qdrant_async_t &);
+
+void qdrant_async_wait(qdrant_async_t &);
+
+bool qdrant_points_insert_async(qdrant_async_t &,
+                                const qdrant_colection_info_t &,
+                                const qdrant_point_array_t &,
+                                qdrant_async_callback_t);
+
+#endif // __EMBED2VECDB_QDRANT_ASYNC_H__
@@ -0,0 +1,390 @@
+#include "qdrant-batch.h"
+#include "qdrant-json.h"
+#include "utils.h"
+#include <algorithm>
+
+void qdrant_batch_default_config(qdrant_batch_config_t *config)
+{
+  if (NULL == config)
+  {
+    return;
+  }
+
+  config->max_bytes = QDRANT_MAX_BODY_BYTES;
+  config->max_points = QDRANT_MAX_BATCH_POINTS;
+  config->max_latency_ms = QDRANT_BATCH_DEFAULT_LATENCY_MS;
+  config->encoding = Identity;
+  config->level = QDRANT_COMPRESS_DEFAULT_LEVEL;
+  config->auto_compress = true;
+  config->link_bps = 0.0;
+}
+
+bool qdrant_batcher_init(qdrant_async_t &async,
+                         const qdrant_colection_info_t &col,
+                         const qdrant_batch_config_t &config,
+                         qdrant_batch_callback_t callback,
+                         qdrant_batcher_t *batcher)
+{
+  if (NULL == batcher)
+  {
+    LOG_ERR("argument 'batcher' is NULL.\n");
+    return false;
+  }
+
+  batcher->async = &async;
+  batcher->path = qdrant_collection_path(QDRANT_POINTS_INSERT_PATH, col);
+  batcher->format = col.quantization;
+  batcher->config = config;
+  batcher->config.max_points = std::max<size_t>(1, config.max_points);
+  batcher->callback = std::move(callback);
+  batcher->body.clear();
+  batcher->spill.clear();
+  batcher->n_points = 0;
+  batcher->compress.todo = NULL;
+  batcher->compress.done = NULL;
+  batcher->n_pending = 0;
+  batcher->compressing = false;
+  batcher->balance = 0.0;
+  batcher->n_samples = 0;
+  batcher->n_since_probe = 0;
+  batcher->n_requests = 0;
+  batcher->n_bytes = 0;
+  batcher->n_wire_bytes = 0;
+  batcher->n_compressed = 0;
+  batcher->t_compress = 0.0;
+  batcher->n_oversized = 0;
+
+  if (config.encoding != Identity)
+  {
+    batcher->jobs.resize(QDRANT_BATCH_COMPRESS_DEPTH);
+    for (auto &job : batcher->jobs)
+    {
+      batcher->free_jobs.push_back(&job);
+    }
+
+    if (!qdrant_compress_start(config.encoding, config.level,
+                               batcher->jobs.size(), &batcher->compress))
+    {
+      return false;
+    }
+
+    batcher->compressing = true;
+  }
+
+  return true;
+}
+
+void qdrant_batcher_destroy(qdrant_batcher_t *batcher)
+{
+  if (NULL == batcher)
+  {
+    return;
+  }
+
+  qdrant_compress_stop(&batcher->compress);
+
+  batcher->jobs.clear();
+  batcher->free_jobs.clear();
+  batcher->n_pending = 0;
+}
+
+// weighs what compressing a body cost against the upload time it saved, at
+// the configured link speed or else the upload speed curl measured for it
+// (bytes over the whole request, so server time makes the link look slower)
+static void qdrant_batcher_account(qdrant_batcher_t &batcher, size_t raw,
+                                   size_t wire, double seconds,
+                                   double upload_bps)
+{
+  if (batcher.config.link_bps > 0.0)
+  {
+    upload_bps = batcher.config.link_bps;
+  }
+
+  if (upload_bps <= 0.0)
+  {
+    return;
+  }
+
+  const double saved = ((double)raw - (double)wire) / upload_bps;
+  const double excess = seconds - saved;
+
+  batcher.balance = batcher.n_samples == 0
+                        ? excess
+                        : 0.75 * batcher.balance + 0.25 * excess;
+  batcher.n_samples++;
+
+  if (!batcher.config.auto_compress || batcher.n_samples < 4)
+  {
+    return;
+  }
+
+  if (batcher.compressing && batcher.balance > 0.0)
+  {
+    batcher.compressing = false;
+    LOG("compression costs %.2f ms more than it saves per request, "
+        "turning it off.\n",
+        1000.0 * batcher.balance);
+  }
+  else if (!batcher.compressing && batcher.balance < 0.0)
+  {
+    batcher.compressing = true;
+    LOG("compression saves %.2f ms per request, turning it back on.\n",
+        -1000.0 * batcher.balance);
+  }
+}
+
+static bool qdrant_batcher_submit_job(qdrant_batcher_t &batcher,
+                                      qdrant_compress_job_t *job)
+{
+  batcher.n_pending--;
+  batcher.t_compress += job->seconds;
+
+  qdrant_batcher_t *self = &batcher;
+  const size_t n_points = job->n_points;
+
+  bool submitted;
+  if (job->success)
+  {
+    const size_t raw = job->raw.size();
+    const size_t wire = job->wire.size();
+    const double seconds = job->seconds;
+
+    batcher.n_wire_bytes += wire;
+    batcher.n_compressed++;
+
+    submitted = qdrant_async_submit_encoded(
+        *batcher.async, "PUT", batcher.path, std::move(job->wire),
+        batcher.config.encoding,
+        [self, n_points, raw, wire, seconds](const qdrant_async_result_t &result)
+        {
+          if (result.success)
+          {
+            qdrant_batcher_account(*self, raw, wire, seconds,
+                                   result.upload_bps);
+          }
+
+          if (self->callback)
+          {
+            self->callback(result, n_points);
+          }
+        });
+  }
+  else
+  {
+    LOG("warning: compression failed, sending the body as is.\n");
+
+    batcher.n_wire_bytes += job->raw.size();
+    submitted = qdrant_async_submit(
+        *batcher.async, "PUT", batcher.path, std::string(job->raw),
+        [self, n_points](const qdrant_async_result_t &result)
+        {
+          if (self->callback)
+          {
+            self->callback(result, n_points);
+          }
+        });
+  }
+
+  // 'raw' keeps its capacity for the next body
+  batcher.free_jobs.push_back(job);
+
+  return submitted;
+}
+
+// submits compressed bodies as they come back; 'wait' blocks for all of them
+static bool qdrant_batcher_drain(qdrant_batcher_t &batcher, bool wait)
+{
+  bool success = true;
+
+  qdrant_compress_job_t *job;
+  while (batcher.n_pending > 0)
+  {
+    const bool popped =
+        wait ? batcher.compress.done->pop(job)
+             : batcher.compress.done->pop_for(job, std::chrono::seconds(0));
+    if (!popped)
+    {
+      break;
+    }
+
+    success = qdrant_batcher_submit_job(batcher, job) && success;
+  }
+
+  return success;
+}
+
+static void qdrant_batcher_open(qdrant_batcher_t &batcher)
+{
+  // a body handed to the compressor leaves its old 'raw' buffer behind
+  if (batcher.body.capacity() == 0)
+  {
+    batcher.body = qdrant_async_take_buffer(*batcher.async);
+  }
+
+  batcher.body.clear();
+  qdrant_json_begin_points(batcher.body);
+  batcher.n_points = 0;
+  batcher.opened = std::chrono::steady_clock::now();
+}
+
+bool qdrant_batcher_flush(qdrant_batcher_t &batcher)
+{
+  if (batcher.n_points == 0)
+  {
+    return true;
+  }
+
+  qdrant_json_end_points(batcher.body);
+
+  const size_t n_points = batcher.n_points;
+  batcher.n_points = 0;
+  batcher.n_requests++;
+  batcher.n_bytes += batcher.body.size();
+
+  bool compress = false;
+  if (batcher.compress.todo != NULL)
+  {
+    compress = batcher.compressing ||
+               ++batcher.n_since_probe % QDRANT_BATCH_COMPRESS_PROBE == 0;
+  }
+
+  if (compress)
+  {
+    if (batcher.free_jobs.empty())
+    {
+      // the worker is behind; wait for the oldest body
+      qdrant_compress_job_t *job;
+      if (!batcher.compress.done->pop(job) ||
+          !qdrant_batcher_submit_job(batcher, job))
+      {
+        return false;
+      }
+    }
+
+    qdrant_compress_job_t *job = batcher.free_jobs.back();
+    batcher.free_jobs.pop_back();
+
+    job->raw.swap(batcher.body);
+    job->wire = qdrant_async_take_buffer(*batcher.async);
+    job->n_points = n_points;
+
+    batcher.n_pending++;
+    if (!batcher.compress.todo->push(job))
+    {
+      return false;
+    }
+
+    return qdrant_batcher_drain(batcher, false);
+  }
+
+  batcher.n_wire_bytes += batcher.body.size();
+
+  qdrant_batcher_t *self = &batcher;
+  return qdrant_async_submit(
+      *batcher.async, "PUT", batcher.path, std::move(batcher.body),
+      [self, n_points](const qdrant_async_result_t &result)
+      {
+        if (self->callback)
+        {
+          self->callback(result, n_points);
+        }
+      });
+}
+
+bool qdrant_batcher_finish(qdrant_batcher_t &batcher)
+{
+  const bool flushed = qdrant_batcher_flush(batcher);
+
+  return qdrant_batcher_drain(batcher, true) && flushed;
+}
+
+bool qdrant_batcher_add(qdrant_batcher_t &batcher,
+                        const qdrant_point_spec_t &point)
+{
+  if (batcher.n_points == 0)
+  {
+    qdrant_batcher_open(batcher);
+  }
+
+  const size_t mark = batcher.body.size();
+  qdrant_json_append_point(batcher.body, point, batcher.n_points == 0,
+                           batcher.format);
+
+  // 2 bytes for the closing "]}"
+  const size_t limit = batcher.config.max_bytes;
+  if (batcher.body.size() + 2 > limit)
+  {
+    if (batcher.n_points == 0)
+    {
+      // can't be split; let the server decide
+      batcher.n_oversized++;
+      LOG("warning: point '%s' alone is %zu bytes, over the %zu byte limit.\n",
+          point.id.c_str(), batcher.body.size() + 2, limit);
+    }
+    else
+    {
+      // the point opens the next request; skip its leading ','
+      batcher.spill.assign(batcher.body, mark + 1, std::string::npos);
+      batcher.body.resize(mark);
+
+      if (!qdrant_batcher_flush(batcher))
+      {
+        return false;
+      }
+
+      qdrant_batcher_open(batcher);
+      batcher.body.append(batcher.spill);
+    }
+  }
+
+  batcher.n_points++;
+
+  if (batcher.n_points >= batcher.config.max_points ||
+      batcher.body.size() + 2 >= limit)
+  {
+    return qdrant_batcher_flush(batcher);
+  }
+
+  return true;
+}
+
+long qdrant_batcher_wait_ms(const qdrant_batcher_t &batcher)
+{
+  // compressed bodies are picked up, and requests in flight moved along, by
+  // polling
+  long pending = batcher.n_pending > 0 ? 1 : -1;
+  const long in_flight = qdrant_async_wait_ms(*batcher.async);
+  if (in_flight >= 0)
+  {
+    pending = pending < 0 ? in_flight : std::min(pending, in_flight);
+  }
+
+  if (batcher.n_points == 0 || batcher.config.max_latency_ms <= 0)
+  {
+    return pending;
+  }
+
+  const long age = std::chrono::duration_cast<std::chrono::milliseconds>(
+                       std::chrono::steady_clock::now() - batcher.opened)
+                       .count();
+  const long due = std::max(0L, batcher.config.max_latency_ms - age);
+
+  return pending < 0 ? due : std::min(due, pending);
+}
+
+bool qdrant_batcher_poll(qdrant_batcher_t &batcher)
+{
+  // sends, receives and restarts due retries; callbacks run from here
+  qdrant_async_poll(*batcher.async, 0);
+
+  bool success = qdrant_batcher_drain(batcher, false);
+
+  if (batcher.n_points > 0 && batcher.config.max_latency_ms > 0 &&
+      std::chrono::steady_clock::now() - batcher.opened >=
+          std::chrono::milliseconds(batcher.config.max_latency_ms))
+  {
+    success = qdrant_batcher_flush(batcher) && success;
+  }
+
+  return success;
+}
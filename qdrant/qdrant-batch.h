@@ -0,0 +1,92 @@
+#ifndef __EMBED2VECDB_QDRANT_BATCH_H__
+#define __EMBED2VECDB_QDRANT_BATCH_H__
+
+#include "qdrant-async.h"
+#include "qdrant-compress.h"
+#include "qdrant.h"
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <vector>
+
+#define QDRANT_BATCH_DEFAULT_LATENCY_MS 250
+
+// bodies being compressed ahead of submission
+#define QDRANT_BATCH_COMPRESS_DEPTH 4
+
+// while compression is off, every Nth request is still compressed to see
+// whether it started to pay off
+#define QDRANT_BATCH_COMPRESS_PROBE 32
+
+typedef struct _qdrant_batch_config
+{
+  size_t max_bytes;           // request body limit (uncompressed)
+  size_t max_points;          // points per request
+  long max_latency_ms;        // longest a buffered point waits, 0 = until full
+  qdrant_encoding_t encoding; // Content-Encoding of request bodies
+  int level;                  // zlib level
+  bool auto_compress; // turn compression off while it costs more than it saves
+  double link_bps;    // link speed for that decision, bytes/s, 0 = measure
+} qdrant_batch_config_t;
+
+// result of one request and the number of points it carried
+typedef std::function<void(const qdrant_async_result_t &, size_t)>
+    qdrant_batch_callback_t;
+
+// turns a stream of points into upsert requests on an async engine: points
+// are serialized as they come in and a request is submitted as soon as it
+// is full (bytes or points) or its oldest point is 'max_latency_ms' old.
+// Same threading rules as the engine; must outlive qdrant_async_wait.
+typedef struct _qdrant_batcher
+{
+  qdrant_async_t *async;
+  std::string path;
+  qdrant_quantization_t format; // of the collection's vectors
+  qdrant_batch_config_t config;
+  qdrant_batch_callback_t callback;
+  std::string body;  // open request, without the closing "]}"
+  std::string spill; // point that did not fit in the open request
+  size_t n_points;   // points in the open request
+  std::chrono::steady_clock::time_point opened; // first point added
+
+  qdrant_compress_t compress; // worker, when config.encoding is not Identity
+  std::vector<qdrant_compress_job_t> jobs;
+  std::vector<qdrant_compress_job_t *> free_jobs;
+  size_t n_pending;   // jobs with the worker
+  bool compressing;   // false while auto_compress has turned it off
+  double balance;     // moving average of compress time - transfer time saved
+  uint64_t n_samples; // requests that fed 'balance'
+  uint64_t n_since_probe;
+
+  uint64_t n_requests;   // requests submitted
+  uint64_t n_bytes;      // body bytes, before compression
+  uint64_t n_wire_bytes; // body bytes sent
+  uint64_t n_compressed; // requests sent compressed
+  double t_compress;     // seconds spent compressing
+  uint64_t n_oversized;  // points larger than max_bytes on their own
+} qdrant_batcher_t;
+
+void qdrant_batch_default_config(qdrant_batch_config_t *);
+
+bool qdrant_batcher_init(qdrant_async_t &, const qdrant_colection_info_t &,
+                         const qdrant_batch_config_t &,
+                         qdrant_batch_callback_t, qdrant_batcher_t *);
+
+void qdrant_batcher_destroy(qdrant_batcher_t *);
+
+bool qdrant_batcher_add(qdrant_batcher_t &, const qdrant_point_spec_t &);
+
+bool qdrant_batcher_flush(qdrant_batcher_t &);
+
+bool qdrant_batcher_finish(qdrant_batcher_t &);
+
+// longest the caller may wait before qdrant_batcher_poll: a partial request
+// coming due, a compressed body, or requests in flight; -1 = no limit
+long qdrant_batcher_wait_ms(const qdrant_batcher_t &);
+
+// moves requests in flight along, submits compressed bodies and flushes a
+// partial request that is due
+bool qdrant_batcher_poll(qdrant_batcher_t &);
+
+#endif // __EMBED2VECDB_QDRANT_BATCH_H__
@@ -0,0 +1,172 @@
+#include "qdrant-compress.h"
+#include "utils.h"
+#include <algorithm>
+#include <chrono>
+#include <zlib.h>
+
+// zlib window bits: +16 selects the gzip wrapper, plain is the zlib wrapper
+// that HTTP calls 'deflate'
+static int qdrant_compress_window_bits(qdrant_encoding_t encoding)
+{
+  return encoding == Gzip ? 15 + 16 : 15;
+}
+
+static bool qdrant_compress_run(z_stream &zs, const std::string &in,
+                                std::string &out)
+{
+  if (deflateReset(&zs) != Z_OK)
+  {
+    return false;
+  }
+
+  out.resize(deflateBound(&zs, in.size()));
+
+  zs.next_in = reinterpret_cast<Bytef *>(const_cast<char *>(in.data()));
+  zs.avail_in = in.size();
+  zs.next_out = reinterpret_cast<Bytef *>(&out[0]);
+  zs.avail_out = out.size();
+
+  // the output is sized by deflateBound, so one call finishes the stream
+  if (deflate(&zs, Z_FINISH) != Z_STREAM_END)
+  {
+    return false;
+  }
+
+  out.resize(zs.total_out);
+
+  return true;
+}
+
+bool qdrant_compress_body(qdrant_encoding_t encoding, int level,
+                          const std::string &in, std::string &out)
+{
+  z_stream zs = {};
+  if (deflateInit2(&zs, level, Z_DEFLATED,
+                   qdrant_compress_window_bits(encoding), 8,
+                   Z_DEFAULT_STRATEGY) != Z_OK)
+  {
+    LOG_ERR("deflateInit2 failed.\n");
+    return false;
+  }
+
+  const bool success = qdrant_compress_run(zs, in, out);
+  deflateEnd(&zs);
+
+  return success;
+}
+
+bool qdrant_decompress_body(const std::string &in, std::string &out)
+{
+  // +32: zlib detects the gzip or zlib wrapper by itself
+  z_stream zs = {};
+  if (inflateInit2(&zs, 15 + 32) != Z_OK)
+  {
+    LOG_ERR("inflateInit2 failed.\n");
+    return false;
+  }
+
+  zs.next_in = reinterpret_cast<Bytef *>(const_cast<char *>(in.data()));
+  zs.avail_in = in.size();
+
+  out.resize(std::max<size_t>(in.size() * 4, 4096));
+
+  int status = Z_OK;
+  while (status == Z_OK)
+  {
+    if (zs.total_out == out.size())
+    {
+      out.resize(out.size() * 2);
+    }
+
+    zs.next_out = reinterpret_cast<Bytef *>(&out[zs.total_out]);
+    zs.avail_out = out.size() - zs.total_out;
+    status = inflate(&zs, Z_NO_FLUSH);
+  }
+
+  out.resize(zs.total_out);
+  inflateEnd(&zs);
+
+  return status == Z_STREAM_END;
+}
+
+static void qdrant_compress_worker(qdrant_compress_t *compress)
+{
+  // one stream for the whole run, reset between bodies
+  z_stream zs = {};
+  const bool ready =
+      deflateInit2(&zs, compress->level, Z_DEFLATED,
+                   qdrant_compress_window_bits(compress->encoding), 8,
+                   Z_DEFAULT_STRATEGY) == Z_OK;
+  if (!ready)
+  {
+    LOG_ERR("deflateInit2 failed.\n");
+  }
+
+  qdrant_compress_job_t *job;
+  while (compress->todo->pop(job))
+  {
+    const auto t0 = std::chrono::steady_clock::now();
+
+    job->success = ready && qdrant_compress_run(zs, job->raw, job->wire);
+    job->seconds = std::chrono::duration<double>(
+                       std::chrono::steady_clock::now() - t0)
+                       .count();
+
+    if (!compress->done->push(job))
+    {
+      break;
+    }
+  }
+
+  if (ready)
+  {
+    deflateEnd(&zs);
+  }
+}
+
+bool qdrant_compress_start(qdrant_encoding_t encoding, int level,
+                           size_t depth, qdrant_compress_t *compress)
+{
+  if (NULL == compress)
+  {
+    LOG_ERR("argument 'compress' is NULL.\n");
+    return false;
+  }
+
+  if (encoding == Identity)
+  {
+    LOG_ERR("nothing to compress with encoding 'identity'.\n");
+    return false;
+  }
+
+  compress->encoding = encoding;
+  compress->level = level;
+  compress->todo = new app_queue<qdrant_compress_job_t *>(depth);
+
+  // never blocks the worker: at most 'depth' jobs are out at a time
+  compress->done = new app_queue<qdrant_compress_job_t *>(depth);
+  compress->worker = std::thread(qdrant_compress_worker, compress);
+
+  return true;
+}
+
+void qdrant_compress_stop(qdrant_compress_t *compress)
+{
+  if (NULL == compress || NULL == compress->todo)
+  {
+    return;
+  }
+
+  compress->todo->close();
+  compress->done->close();
+
+  if (compress->worker.joinable())
+  {
+    compress->worker.join();
+  }
+
+  delete compress->todo;
+  delete compress->done;
+  compress->todo = NULL;
+  compress->done = NULL;
+}
@@ -0,0 +1,42 @@
+#ifndef __EMBED2VECDB_QDRANT_COMPRESS_H__
+#define __EMBED2VECDB_QDRANT_COMPRESS_H__
+
+#include "app-queue.h"
+#include "qdrant.h"
+#include <string>
+#include <thread>
+
+#define QDRANT_COMPRESS_DEFAULT_LEVEL 1
+
+typedef struct _qdrant_compress_job
+{
+  std::string raw;  // body to compress
+  std::string wire; // compressed body
+  size_t n_points;
+  double seconds; // time spent compressing
+  bool success;
+} qdrant_compress_job_t;
+
+// gzip/deflate on a worker thread: jobs go in through 'todo' and come back,
+// in order, through 'done'
+typedef struct _qdrant_compress
+{
+  qdrant_encoding_t encoding;
+  int level;
+  app_queue<qdrant_compress_job_t *> *todo;
+  app_queue<qdrant_compress_job_t *> *done;
+  std::thread worker;
+} qdrant_compress_t;
+
+bool qdrant_compress_body(qdrant_encoding_t, int, const std::string &,
+                          std::string &);
+
+// gzip or deflate (zlib) body back to what was compressed
+bool qdrant_decompress_body(const std::string &, std::string &);
+
+bool qdrant_compress_start(qdrant_encoding_t, int, size_t,
+                           qdrant_compress_t *);
+
+void qdrant_compress_stop(qdrant_compress_t *);
+
+#endif // __EMBED2VECDB_QDRANT_COMPRESS_H__
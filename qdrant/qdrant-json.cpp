@@ -0,0 +1,256 @@
+#include "qdrant-json.h"
+#include <charconv>
+#include <cmath>
+#include <cstring>
+
+// longest shortest-round-trip float, e.g. "-1.17549435e-38"
+#define QDRANT_JSON_FLOAT_MAX 16
+
+// significant digits that round-trip any float16
+#define QDRANT_JSON_HALF_DIGITS 5
+
+static const char qdrant_json_hex[] = "0123456789abcdef";
+
+// length of the valid UTF-8 sequence starting at s[0], 0 if invalid
+static size_t qdrant_json_utf8_length(const unsigned char *s, size_t n)
+{
+  size_t len;
+  unsigned int min;
+  unsigned int cp;
+
+  if (s[0] < 0xc2)
+  {
+    return 0; // continuation byte or overlong lead
+  }
+  else if (s[0] < 0xe0)
+  {
+    len = 2, min = 0x80, cp = s[0] & 0x1f;
+  }
+  else if (s[0] < 0xf0)
+  {
+    len = 3, min = 0x800, cp = s[0] & 0x0f;
+  }
+  else if (s[0] < 0xf5)
+  {
+    len = 4, min = 0x10000, cp = s[0] & 0x07;
+  }
+  else
+  {
+    return 0;
+  }
+
+  if (len > n)
+  {
+    return 0;
+  }
+
+  for (size_t i = 1; i < len; i++)
+  {
+    if ((s[i] & 0xc0) != 0x80)
+    {
+      return 0;
+    }
+    cp = (cp << 6) | (s[i] & 0x3f);
+  }
+
+  if (cp < min || cp > 0x10ffff || (cp >= 0xd800 && cp <= 0xdfff))
+  {
+    return 0;
+  }
+
+  return len;
+}
+
+void qdrant_json_append_string(std::string &out, std::string_view text)
+{
+  const unsigned char *s = reinterpret_cast<const unsigned char *>(text.data());
+  const size_t n = text.length();
+
+  out.push_back('"');
+
+  // copy runs of plain characters in one go
+  size_t run = 0;
+  size_t i = 0;
+  while (i < n)
+  {
+    const unsigned char c = s[i];
+    if (c >= 0x20 && c < 0x80 && c != '"' && c != '\\')
+    {
+      i++;
+      continue;
+    }
+
+    if (c >= 0x80)
+    {
+      const size_t len = qdrant_json_utf8_length(s + i, n - i);
+      if (len > 0)
+      {
+        i += len;
+        continue;
+      }
+    }
+
+    out.append(text.data() + run, i - run);
+
+    switch (c)
+    {
+    case '"':
+      out.append("\\\"");
+      break;
+    case '\\':
+      out.append("\\\\");
+      break;
+    case '\n':
+      out.append("\\n");
+      break;
+    case '\r':
+      out.append("\\r");
+      break;
+    case '\t':
+      out.append("\\t");
+      break;
+    case '\b':
+      out.append("\\b");
+      break;
+    case '\f':
+      out.append("\\f");
+      break;
+    default:
+      if (c < 0x20)
+      {
+        const char esc[] = {'\\', 'u', '0', '0', qdrant_json_hex[c >> 4],
+                            qdrant_json_hex[c & 0x0f]};
+        out.append(esc, sizeof(esc));
+      }
+      else
+      {
+        // invalid UTF-8 byte: U+FFFD, as nlohmann's 'replace' handler does
+        out.append("\xef\xbf\xbd");
+      }
+      break;
+    }
+
+    i++;
+    run = i;
+  }
+
+  out.append(text.data() + run, n - run);
+  out.push_back('"');
+}
+
+static inline char *qdrant_json_write_float(char *p, float value)
+{
+  if (!std::isfinite(value))
+  {
+    // not representable in JSON, nlohmann writes null as well
+    memcpy(p, "null", 4);
+    return p + 4;
+  }
+
+  return std::to_chars(p, p + QDRANT_JSON_FLOAT_MAX, value).ptr;
+}
+
+static inline char *qdrant_json_write_value(char *p, float value,
+                                           qdrant_quantization_t format)
+{
+  switch (format)
+  {
+  case Float16:
+    if (!std::isfinite(value))
+    {
+      return qdrant_json_write_float(p, value);
+    }
+    return std::to_chars(p, p + QDRANT_JSON_FLOAT_MAX, value,
+                         std::chars_format::general, QDRANT_JSON_HALF_DIGITS)
+        .ptr;
+  case Uint8:
+  case Binary:
+    return std::to_chars(p, p + QDRANT_JSON_FLOAT_MAX, (int)value).ptr;
+  default:
+    return qdrant_json_write_float(p, value);
+  }
+}
+
+void qdrant_json_append_float(std::string &out, float value)
+{
+  char buffer[QDRANT_JSON_FLOAT_MAX];
+  char *end = qdrant_json_write_float(buffer, value);
+  out.append(buffer, end - buffer);
+}
+
+void qdrant_json_append_vector(std::string &out, const float *vector,
+                               size_t n, qdrant_quantization_t format)
+{
+  out.push_back('[');
+
+  // reserve the worst case once, format in place, then trim
+  const size_t offset = out.size();
+  out.resize(offset + n * (QDRANT_JSON_FLOAT_MAX + 1));
+
+  char *begin = &out[offset];
+  char *p = begin;
+  for (size_t i = 0; i < n; i++)
+  {
+    if (i > 0)
+    {
+      *p++ = ',';
+    }
+    p = qdrant_json_write_value(p, vector[i], format);
+  }
+
+  out.resize(offset + (p - begin));
+  out.push_back(']');
+}
+
+void qdrant_json_begin_points(std::string &out)
+{
+  out.append("{\"points\":[");
+}
+
+void qdrant_json_append_point(std::string &out,
+                              const qdrant_point_spec_t &point, bool first,
+                              qdrant_quantization_t format)
+{
+  if (!first)
+  {
+    out.push_back(',');
+  }
+
+  out.append("{\"id\":");
+  qdrant_json_append_string(out, point.id);
+  out.append(",\"payload\":{");
+  qdrant_json_append_string(out, point.payload_x);
+  out.push_back(':');
+  qdrant_json_append_string(out, point.payload_y);
+  out.append("},\"vector\":");
+  qdrant_json_append_vector(out, point.vector.data(), point.vector.size(),
+                            format);
+  out.push_back('}');
+}
+
+void qdrant_json_end_points(std::string &out)
+{
+  out.append("]}");
+}
+
+void qdrant_json_write_points(std::string &out,
+                              const qdrant_point_array_t &points,
+                              qdrant_quantization_t format)
+{
+  out.clear();
+
+  size_t estimate = 16;
+  for (const auto &point : points)
+  {
+    estimate += 64 + point.id.size() + point.payload_x.size() +
+                point.payload_y.size() + point.vector.size() * 11;
+  }
+  out.reserve(estimate);
+
+  qdrant_json_begin_points(out);
+  for (size_t i = 0; i < points.size(); i++)
+  {
+    qdrant_json_append_point(out, points[i], i == 0, format);
+  }
+  qdrant_json_end_points(out);
+}
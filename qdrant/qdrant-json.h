@@ -0,0 +1,33 @@
+#ifndef __EMBED2VECDB_QDRANT_JSON_H__
+#define __EMBED2VECDB_QDRANT_JSON_H__
+
+#include "qdrant.h"
+#include <string>
+#include <string_view>
+
+/*
+ * Streaming writer for upsert bodies: emits
+ *   {"points":[{"id":"..","payload":{"..":".."},"vector":[..]},..]}
+ * straight into a caller owned buffer, with shortest round-trip floats.
+ * Quantized vectors (see qdrant_quantize) are written as what they are:
+ * float16 with 5 significant digits, uint8 and binary as integers.
+ */
+
+void qdrant_json_append_string(std::string &, std::string_view);
+
+void qdrant_json_append_float(std::string &, float);
+
+void qdrant_json_append_vector(std::string &, const float *, size_t,
+                               qdrant_quantization_t = NoQuantization);
+
+void qdrant_json_begin_points(std::string &);
+
+void qdrant_json_append_point(std::string &, const qdrant_point_spec_t &,
+                              bool, qdrant_quantization_t = NoQuantization);
+
+void qdrant_json_end_points(std::string &);
+
+void qdrant_json_write_points(std::string &, const qdrant_point_array_t &,
+                              qdrant_quantization_t = NoQuantization);
+
+#endif // __EMBED2VECDB_QDRANT_JSON_H__
@@ -0,0 +1,80 @@
+#include "qdrant-quantize.h"
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+
+// largest finite float16, and the smallest normal one
+#define QDRANT_HALF_MAX 65504.0f
+#define QDRANT_HALF_MIN_NORMAL 6.103515625e-05f
+
+float qdrant_quantize_default_range(unsigned int size)
+{
+  return size > 0 ? 4.0f / std::sqrt((float)size) : 1.0f;
+}
+
+float qdrant_round_half(float value)
+{
+  if (!std::isfinite(value))
+  {
+    return value;
+  }
+
+  const float magnitude = std::fabs(value);
+  if (magnitude >= QDRANT_HALF_MAX)
+  {
+    return std::copysign(QDRANT_HALF_MAX, value);
+  }
+
+  if (magnitude < QDRANT_HALF_MIN_NORMAL)
+  {
+    // subnormal float16: a fixed step of 2^-24
+    return std::copysign(std::nearbyint(magnitude * 16777216.0f) / 16777216.0f,
+                         value);
+  }
+
+  // drop the 13 mantissa bits float16 lacks, rounding to nearest even
+  uint32_t bits;
+  memcpy(&bits, &value, sizeof(bits));
+  bits += 0x0fff + ((bits >> 13) & 1);
+  bits &= ~(uint32_t)0x1fff;
+  memcpy(&value, &bits, sizeof(value));
+
+  return value;
+}
+
+void qdrant_quantize(const qdrant_colection_info_t &col, float *vector,
+                     size_t n)
+{
+  switch (col.quantization)
+  {
+  case Float16:
+  {
+    for (size_t i = 0; i < n; i++)
+    {
+      vector[i] = qdrant_round_half(vector[i]);
+    }
+    break;
+  }
+  case Uint8:
+  {
+    // affine, so euclidean distances keep their order
+    const float scale = 127.5f / col.quantize_range;
+    for (size_t i = 0; i < n; i++)
+    {
+      const float q = std::nearbyint(vector[i] * scale + 127.5f);
+      vector[i] = q > 255.0f ? 255.0f : (q >= 0.0f ? q : 0.0f); // NaN too
+    }
+    break;
+  }
+  case Binary:
+  {
+    for (size_t i = 0; i < n; i++)
+    {
+      vector[i] = vector[i] > 0.0f ? 1.0f : -1.0f;
+    }
+    break;
+  }
+  default:
+    break;
+  }
+}
@@ -0,0 +1,19 @@
+#ifndef __EMBED2VECDB_QDRANT_QUANTIZE_H__
+#define __EMBED2VECDB_QDRANT_QUANTIZE_H__
+
+#include "qdrant.h"
+#include <cstddef>
+
+// clipping range for Uint8 when none is given: 4 standard deviations of a
+// component of a unit vector with 'size' roughly isotropic dimensions
+float qdrant_quantize_default_range(unsigned int);
+
+// nearest float16 value (ties to even), saturated to +-65504
+float qdrant_round_half(float);
+
+// maps a vector, in place, to the values the collection stores: float16
+// roundings, integers 0..255 or +1/-1. The results are exact floats, so the
+// JSON writer only has to pick their format.
+void qdrant_quantize(const qdrant_colection_info_t &, float *, size_t);
+
+#endif // __EMBED2VECDB_QDRANT_QUANTIZE_H__
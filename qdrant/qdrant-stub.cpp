@@ -0,0 +1,666 @@
+#include "qdrant-stub.h"
+#include "qdrant-compress.h"
+#include "utils.h"
+#include <algorithm>
+#include <cmath>
+#include <thread>
+
+typedef std::chrono::steady_clock qdrant_stub_clock;
+
+void qdrant_stub_default_config(qdrant_stub_config_t *config)
+{
+  config->host = HTTPD_DEFAULT_HOST;
+  config->port = 0;
+  config->latency_ms = 0;
+  config->jitter_ms = 0;
+  config->max_bps = 0.0;
+  config->error_rate = 0.0;
+  config->throttle_rate = 0.0;
+  config->reset_rate = 0.0;
+  config->seed = 42;
+}
+
+static void qdrant_stub_reply(httpd_response_t &response, nlohmann::json result,
+                              const qdrant_stub_clock::time_point &t0)
+{
+  nlohmann::json reply;
+  reply["result"] = std::move(result);
+  reply["status"] = "ok";
+  reply["time"] =
+      std::chrono::duration<double>(qdrant_stub_clock::now() - t0).count();
+
+  response.status = 200;
+  response.body = reply.dump();
+}
+
+static void qdrant_stub_error(httpd_response_t &response, int status,
+                              const std::string &message)
+{
+  nlohmann::json reply;
+  reply["status"]["error"] = message;
+  reply["time"] = 0.0;
+
+  response.status = status;
+  response.body = reply.dump();
+}
+
+// the cap is one link shared by every connection: a body is through once
+// the bodies ahead of it are
+static void qdrant_stub_transfer(qdrant_stub_t *stub, size_t n_bytes)
+{
+  if (stub->config.max_bps <= 0.0)
+  {
+    return;
+  }
+
+  qdrant_stub_clock::time_point done;
+  {
+    std::lock_guard<std::mutex> lock(stub->mutex);
+    const auto start = std::max(qdrant_stub_clock::now(), stub->link_free);
+    stub->link_free =
+        start + std::chrono::duration_cast<qdrant_stub_clock::duration>(
+                    std::chrono::duration<double>(n_bytes /
+                                                  stub->config.max_bps));
+    done = stub->link_free;
+  }
+
+  std::this_thread::sleep_until(done);
+}
+
+static std::string qdrant_stub_id(const nlohmann::json &id)
+{
+  return id.is_string() ? id.get<std::string>() : id.dump();
+}
+
+static nlohmann::json qdrant_stub_id_json(const std::string &id)
+{
+  // integer ids go back as integers
+  if (!id.empty() && std::all_of(id.begin(), id.end(), ::isdigit))
+  {
+    return std::stoull(id);
+  }
+
+  return id;
+}
+
+static bool qdrant_stub_parse_distance(const std::string &name,
+                                       qdrant_distance_type_t *distance)
+{
+  for (const qdrant_distance_type_t d : {DotProduct, Cosine, Euclid, Manhattan})
+  {
+    if (qdrant_get_distance(d) == name)
+    {
+      *distance = d;
+      return true;
+    }
+  }
+
+  return false;
+}
+
+// only {"must": [{"key": k, "match": {"value": v}}, ..]}, what --query-filter
+// is documented with
+static bool qdrant_stub_check_filter(const nlohmann::json &filter)
+{
+  if (!filter.is_object())
+  {
+    return false;
+  }
+
+  for (const auto &item : filter.items())
+  {
+    if (item.key() != "must" || !item.value().is_array())
+    {
+      return false;
+    }
+
+    for (const auto &cond : item.value())
+    {
+      if (!cond.is_object() || !cond.contains("key") ||
+          !cond["key"].is_string() || !cond.contains("match") ||
+          !cond["match"].is_object() || !cond["match"].contains("value"))
+      {
+        return false;
+      }
+    }
+  }
+
+  return true;
+}
+
+static bool qdrant_stub_filter_match(const nlohmann::json &filter,
+                                     const nlohmann::json &payload)
+{
+  if (filter.is_null() || !filter.contains("must"))
+  {
+    return true;
+  }
+
+  for (const auto &cond : filter["must"])
+  {
+    const std::string &key = cond["key"].get_ref<const std::string &>();
+    if (!payload.contains(key) || payload[key] != cond["match"]["value"])
+    {
+      return false;
+    }
+  }
+
+  return true;
+}
+
+// higher is better for dot and cosine, lower for the distances, as Qdrant
+// reports them
+static float qdrant_stub_score(qdrant_distance_type_t distance, const float *a,
+                               const float *b, size_t n)
+{
+  double sum = 0.0;
+  double na = 0.0;
+  double nb = 0.0;
+
+  for (size_t i = 0; i < n; i++)
+  {
+    switch (distance)
+    {
+    case Euclid:
+      sum += ((double)a[i] - b[i]) * ((double)a[i] - b[i]);
+      break;
+    case Manhattan:
+      sum += std::fabs((double)a[i] - b[i]);
+      break;
+    default:
+      sum += (double)a[i] * b[i];
+      na += (double)a[i] * a[i];
+      nb += (double)b[i] * b[i];
+      break;
+    }
+  }
+
+  switch (distance)
+  {
+  case Cosine:
+    return na > 0.0 && nb > 0.0 ? sum / std::sqrt(na * nb) : 0.0;
+  case Euclid:
+    return std::sqrt(sum);
+  default:
+    return sum;
+  }
+}
+
+static bool qdrant_stub_vector(const nlohmann::json &json, unsigned int size,
+                               std::vector<float> &vector)
+{
+  if (!json.is_array() || json.size() != size)
+  {
+    return false;
+  }
+
+  vector.resize(size);
+  for (unsigned int i = 0; i < size; i++)
+  {
+    if (!json[i].is_number())
+    {
+      return false;
+    }
+    vector[i] = json[i].get<float>();
+  }
+
+  return true;
+}
+
+static bool qdrant_stub_search_one(const qdrant_stub_collection_t &col,
+                                   const nlohmann::json &query,
+                                   nlohmann::json &hits)
+{
+  std::vector<float> vector;
+  if (!query.is_object() || !query.contains("vector") ||
+      !qdrant_stub_vector(query["vector"], col.size, vector))
+  {
+    return false;
+  }
+
+  const nlohmann::json filter = query.value("filter", nlohmann::json());
+  if (!filter.is_null() && !qdrant_stub_check_filter(filter))
+  {
+    return false;
+  }
+
+  const size_t limit = query.value("limit", (size_t)QDRANT_SEARCH_DEFAULT_LIMIT);
+  const bool with_payload = query.value("with_payload", false);
+  const bool ascending = col.distance == Euclid || col.distance == Manhattan;
+
+  std::vector<std::pair<float, size_t>> scored;
+  for (size_t row = 0; row < col.ids.size(); row++)
+  {
+    if (qdrant_stub_filter_match(filter, col.payloads[row]))
+    {
+      const float score =
+          qdrant_stub_score(col.distance, vector.data(),
+                            col.vectors.data() + row * col.size, col.size);
+      scored.emplace_back(ascending ? score : -score, row);
+    }
+  }
+
+  const size_t n = std::min(limit, scored.size());
+  std::partial_sort(scored.begin(), scored.begin() + n, scored.end());
+
+  hits = nlohmann::json::array();
+  for (size_t k = 0; k < n; k++)
+  {
+    const size_t row = scored[k].second;
+
+    nlohmann::json hit;
+    hit["id"] = qdrant_stub_id_json(col.ids[row]);
+    hit["version"] = 0;
+    hit["score"] = ascending ? scored[k].first : -scored[k].first;
+    if (with_payload)
+    {
+      hit["payload"] = col.payloads[row];
+    }
+    hits.push_back(std::move(hit));
+  }
+
+  return true;
+}
+
+static bool qdrant_stub_upsert(qdrant_stub_collection_t &col,
+                               const nlohmann::json &body, size_t *n_points)
+{
+  if (!body.is_object() || !body.contains("points") ||
+      !body["points"].is_array())
+  {
+    return false;
+  }
+
+  // checked first, so a bad point leaves the collection as it was
+  std::vector<float> vectors(body["points"].size() * col.size);
+  std::vector<float> vector;
+  size_t k = 0;
+  for (const auto &point : body["points"])
+  {
+    if (!point.is_object() || !point.contains("id") ||
+        !point.contains("vector") ||
+        !qdrant_stub_vector(point["vector"], col.size, vector))
+    {
+      return false;
+    }
+    std::copy(vector.begin(), vector.end(), vectors.begin() + k++ * col.size);
+  }
+
+  k = 0;
+  for (const auto &point : body["points"])
+  {
+    const std::string id = qdrant_stub_id(point["id"]);
+
+    auto it = col.rows.find(id);
+    if (it == col.rows.end())
+    {
+      it = col.rows.emplace(id, col.ids.size()).first;
+      col.ids.push_back(id);
+      col.vectors.resize(col.vectors.size() + col.size);
+      col.payloads.emplace_back();
+    }
+
+    const size_t row = it->second;
+    std::copy(vectors.begin() + k * col.size,
+              vectors.begin() + (k + 1) * col.size,
+              col.vectors.begin() + row * col.size);
+    col.payloads[row] = point.value("payload", nlohmann::json::object());
+    k++;
+  }
+
+  *n_points = k;
+
+  return true;
+}
+
+static void qdrant_stub_delete(qdrant_stub_collection_t &col,
+                               const std::string &id)
+{
+  const auto it = col.rows.find(id);
+  if (it == col.rows.end())
+  {
+    return;
+  }
+
+  // the last row moves into the hole
+  const size_t row = it->second;
+  const size_t last = col.ids.size() - 1;
+  col.rows.erase(it);
+
+  if (row != last)
+  {
+    col.ids[row] = std::move(col.ids[last]);
+    col.payloads[row] = std::move(col.payloads[last]);
+    std::copy(col.vectors.begin() + last * col.size,
+              col.vectors.begin() + (last + 1) * col.size,
+              col.vectors.begin() + row * col.size);
+    col.rows[col.ids[row]] = row;
+  }
+
+  col.ids.pop_back();
+  col.payloads.pop_back();
+  col.vectors.resize(last * col.size);
+}
+
+// /collections/{name}[/points[/delete|/search[/batch]]|/exists]; called
+// with the stub locked
+static void qdrant_stub_route(qdrant_stub_t *stub,
+                              const httpd_request_t &request,
+                              const std::vector<std::string> &parts,
+                              const nlohmann::json &body,
+                              const qdrant_stub_clock::time_point &t0,
+                              httpd_response_t &response)
+{
+  const std::string &method = request.method;
+  const std::string &name = parts[2];
+
+  std::string rest;
+  for (size_t k = 3; k < parts.size(); k++)
+  {
+    rest += (k > 3 ? "/" : "") + parts[k];
+  }
+
+  auto found = stub->collections.find(name);
+  qdrant_stub_collection_t *col =
+      found == stub->collections.end() ? NULL : &found->second;
+
+  if (rest.empty())
+  {
+    if (method == "PUT")
+    {
+      qdrant_stub_collection_t created = {};
+      const nlohmann::json vectors = body.value("vectors", nlohmann::json());
+      if (col != NULL)
+      {
+        qdrant_stub_error(response, 400,
+                          "Collection `" + name + "` already exists!");
+      }
+      else if (!vectors.is_object() || !vectors.contains("size") ||
+               !vectors["size"].is_number_unsigned() ||
+               !vectors.contains("distance") ||
+               !vectors["distance"].is_string() ||
+               !qdrant_stub_parse_distance(vectors["distance"], &created.distance))
+      {
+        qdrant_stub_error(response, 400, "expected vectors.size and distance");
+      }
+      else
+      {
+        created.size = vectors["size"].get<unsigned int>();
+        created.datatype = vectors.contains("datatype") &&
+                                   vectors["datatype"].is_string()
+                               ? vectors["datatype"].get<std::string>()
+                               : "float32";
+        stub->collections.emplace(name, std::move(created));
+        qdrant_stub_reply(response, true, t0);
+      }
+    }
+    else if (method == "DELETE")
+    {
+      const bool erased = stub->collections.erase(name) > 0;
+      qdrant_stub_reply(response, erased, t0);
+    }
+    else if (method == "GET" && col != NULL)
+    {
+      nlohmann::json info;
+      info["status"] = "green";
+      info["points_count"] = col->ids.size();
+      info["config"]["params"]["vectors"]["size"] = col->size;
+      info["config"]["params"]["vectors"]["distance"] =
+          qdrant_get_distance(col->distance);
+      info["config"]["params"]["vectors"]["datatype"] = col->datatype;
+      qdrant_stub_reply(response, info, t0);
+    }
+    else
+    {
+      qdrant_stub_error(response, col ? 405 : 404,
+                        "Collection `" + name + "` doesn't exist!");
+    }
+    return;
+  }
+
+  if (rest == "exists" && method == "GET")
+  {
+    qdrant_stub_reply(response, {{"exists", col != NULL}}, t0);
+    return;
+  }
+
+  if (col == NULL)
+  {
+    qdrant_stub_error(response, 404,
+                      "Collection `" + name + "` doesn't exist!");
+    return;
+  }
+
+  if (rest == "points" && method == "PUT")
+  {
+    size_t n_points = 0;
+    if (!qdrant_stub_upsert(*col, body, &n_points))
+    {
+      qdrant_stub_error(response, 400,
+                        "expected points with an id and a vector of " +
+                            std::to_string(col->size) + " numbers");
+      return;
+    }
+
+    stub->stats.n_upserts++;
+    stub->stats.n_points += n_points;
+    qdrant_stub_reply(response,
+                      {{"operation_id", stub->stats.n_upserts},
+                       {"status", "completed"}},
+                      t0);
+  }
+  else if (rest == "points" && method == "POST")
+  {
+    nlohmann::json points = nlohmann::json::array();
+    for (const auto &id : body.value("ids", nlohmann::json::array()))
+    {
+      const auto it = col->rows.find(qdrant_stub_id(id));
+      if (it != col->rows.end())
+      {
+        points.push_back({{"id", id}, {"payload", col->payloads[it->second]}});
+      }
+    }
+    qdrant_stub_reply(response, points, t0);
+  }
+  else if (rest == "points/delete" && method == "POST")
+  {
+    for (const auto &id : body.value("points", nlohmann::json::array()))
+    {
+      qdrant_stub_delete(*col, qdrant_stub_id(id));
+    }
+    qdrant_stub_reply(response,
+                      {{"operation_id", 0}, {"status", "completed"}}, t0);
+  }
+  else if (rest == "points/search" && method == "POST")
+  {
+    nlohmann::json hits;
+    if (!qdrant_stub_search_one(*col, body, hits))
+    {
+      qdrant_stub_error(response, 400, "bad search request");
+      return;
+    }
+
+    stub->stats.n_searches++;
+    qdrant_stub_reply(response, std::move(hits), t0);
+  }
+  else if (rest == "points/search/batch" && method == "POST")
+  {
+    nlohmann::json results = nlohmann::json::array();
+    for (const auto &query : body.value("searches", nlohmann::json::array()))
+    {
+      nlohmann::json hits;
+      if (!qdrant_stub_search_one(*col, query, hits))
+      {
+        qdrant_stub_error(response, 400, "bad search request");
+        return;
+      }
+      results.push_back(std::move(hits));
+    }
+
+    stub->stats.n_searches += results.size();
+    qdrant_stub_reply(response, std::move(results), t0);
+  }
+  else
+  {
+    qdrant_stub_error(response, 404, "no " + method + " " + request.path);
+  }
+}
+
+static void qdrant_stub_handle(qdrant_stub_t *stub,
+                               const httpd_request_t &request,
+                               httpd_response_t &response)
+{
+  const auto t0 = qdrant_stub_clock::now();
+
+  qdrant_stub_transfer(stub, request.body.size());
+
+  const std::vector<std::string> parts = split_lines(request.path, "/");
+  const bool collections = parts.size() >= 3 && parts[0].empty() &&
+                           parts[1] == "collections" && !parts[2].empty();
+  const bool points = collections && parts.size() >= 4 && parts[3] == "points";
+
+  long delay_ms = stub->config.latency_ms;
+  double fault = 1.0;
+  {
+    std::lock_guard<std::mutex> lock(stub->mutex);
+    stub->stats.n_requests++;
+    stub->stats.n_bytes += request.body.size();
+
+    if (stub->config.jitter_ms > 0)
+    {
+      delay_ms += stub->rng() % (stub->config.jitter_ms + 1);
+    }
+    if (points)
+    {
+      fault = std::uniform_real_distribution<double>(0.0, 1.0)(stub->rng);
+    }
+  }
+
+  if (delay_ms > 0)
+  {
+    std::this_thread::sleep_for(std::chrono::milliseconds(delay_ms));
+  }
+
+  const qdrant_stub_config_t &config = stub->config;
+  if (fault < config.reset_rate)
+  {
+    std::lock_guard<std::mutex> lock(stub->mutex);
+    stub->stats.n_resets++;
+    response.reset = true;
+    return;
+  }
+  if (fault < config.reset_rate + config.error_rate)
+  {
+    std::lock_guard<std::mutex> lock(stub->mutex);
+    stub->stats.n_errors++;
+    qdrant_stub_error(response, 503, "injected failure");
+    return;
+  }
+  if (fault < config.reset_rate + config.error_rate + config.throttle_rate)
+  {
+    std::lock_guard<std::mutex> lock(stub->mutex);
+    stub->stats.n_throttled++;
+    qdrant_stub_error(response, 429, "injected rate limit");
+    return;
+  }
+
+  if (!collections)
+  {
+    if (request.path == "/" &&
+        (request.method == "GET" || request.method == "HEAD"))
+    {
+      response.body = "{\"title\":\"qdrant stand-in\",\"version\":\"0\"}";
+    }
+    else
+    {
+      qdrant_stub_error(response, 404, "no " + request.method + " " +
+                                           request.path);
+    }
+    return;
+  }
+
+  std::string decoded;
+  const std::string *encoding = httpd_header(request, "content-encoding");
+  const bool compressed = encoding != NULL && *encoding != "identity";
+  if (compressed && !qdrant_decompress_body(request.body, decoded))
+  {
+    qdrant_stub_error(response, 400, "could not decode the " + *encoding +
+                                         " body");
+    return;
+  }
+
+  const std::string &text = compressed ? decoded : request.body;
+  nlohmann::json body;
+  if (!text.empty())
+  {
+    body = nlohmann::json::parse(text, nullptr, false);
+    if (body.is_discarded())
+    {
+      qdrant_stub_error(response, 400, "the body is not JSON");
+      return;
+    }
+  }
+
+  std::lock_guard<std::mutex> lock(stub->mutex);
+  qdrant_stub_route(stub, request, parts, body, t0, response);
+}
+
+bool qdrant_stub_start(const qdrant_stub_config_t &config, qdrant_stub_t *stub)
+{
+  if (NULL == stub)
+  {
+    LOG_ERR("argument 'stub' is NULL.\n");
+    return false;
+  }
+
+  stub->config = config;
+  stub->collections.clear();
+  stub->rng.seed(config.seed);
+  stub->link_free = qdrant_stub_clock::now();
+  stub->stats = {};
+
+  httpd_config_t httpd_config;
+  httpd_default_config(&httpd_config);
+  httpd_config.host = config.host;
+  httpd_config.port = config.port;
+
+  if (!httpd_start(httpd_config,
+                   [stub](const httpd_request_t &request,
+                          httpd_response_t &response)
+                   { qdrant_stub_handle(stub, request, response); },
+                   &stub->httpd))
+  {
+    return false;
+  }
+
+  stub->URI = "http://" + config.host + ":" + std::to_string(stub->httpd.port);
+
+  return true;
+}
+
+void qdrant_stub_stop(qdrant_stub_t *stub)
+{
+  if (NULL == stub)
+  {
+    return;
+  }
+
+  httpd_stop(&stub->httpd);
+  stub->collections.clear();
+}
+
+qdrant_stub_stats_t qdrant_stub_get_stats(qdrant_stub_t &stub)
+{
+  std::lock_guard<std::mutex> lock(stub.mutex);
+
+  return stub.stats;
+}
+
+size_t qdrant_stub_count(qdrant_stub_t &stub, const std::string &name)
+{
+  std::lock_guard<std::mutex> lock(stub.mutex);
+
+  const auto it = stub.collections.find(name);
+
+  return it == stub.collections.end() ? 0 : it->second.ids.size();
+}
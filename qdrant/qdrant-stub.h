@@ -0,0 +1,86 @@
+#ifndef __EMBED2VECDB_QDRANT_STUB_H__
+#define __EMBED2VECDB_QDRANT_STUB_H__
+
+#include "httpd.h"
+#include "nlohmann/json.hpp"
+#include "qdrant.h"
+#include <chrono>
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <random>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+/*
+ * An in-process stand-in for Qdrant: the REST endpoints this client calls
+ * (collections, exists, upsert, retrieve, delete, search and batch search)
+ * over plain HTTP/1.1, points kept in memory, and knobs to make it slow or
+ * unreliable. Upload benchmarks and tests run against it on one box, with
+ * no network and no Qdrant.
+ *
+ * Faults only hit the points endpoints, so setting up a collection always
+ * works. HTTP/2 (--qdrant-http2) is not spoken.
+ */
+
+typedef struct _qdrant_stub_config
+{
+  std::string host;
+  int port;             // 0 = any free port
+  long latency_ms;      // added to every request
+  long jitter_ms;       // plus up to this much, uniform
+  double max_bps;       // request bytes/s over all connections, 0 = no cap
+  double error_rate;    // points requests answered 503
+  double throttle_rate; // points requests answered 429
+  double reset_rate;    // points requests dropped with a connection reset
+  uint32_t seed;        // faults and jitter
+} qdrant_stub_config_t;
+
+typedef struct _qdrant_stub_collection
+{
+  unsigned int size;
+  qdrant_distance_type_t distance;
+  std::string datatype;
+  std::unordered_map<std::string, size_t> rows; // point id to row
+  std::vector<std::string> ids;
+  std::vector<float> vectors; // row major
+  std::vector<nlohmann::json> payloads;
+} qdrant_stub_collection_t;
+
+typedef struct _qdrant_stub_stats
+{
+  uint64_t n_requests;
+  uint64_t n_bytes;     // request bodies, as received
+  uint64_t n_upserts;   // upsert requests that succeeded
+  uint64_t n_points;    // points they carried
+  uint64_t n_searches;  // queries, batch ones counted one by one
+  uint64_t n_errors;    // injected 503
+  uint64_t n_throttled; // injected 429
+  uint64_t n_resets;    // injected resets
+} qdrant_stub_stats_t;
+
+typedef struct _qdrant_stub
+{
+  qdrant_stub_config_t config;
+  httpd_t httpd;
+  std::string URI; // http://host:port, for qdrant_init
+  std::mutex mutex; // everything below
+  std::map<std::string, qdrant_stub_collection_t> collections;
+  std::mt19937 rng;
+  std::chrono::steady_clock::time_point link_free; // capped link idle again
+  qdrant_stub_stats_t stats;
+} qdrant_stub_t;
+
+void qdrant_stub_default_config(qdrant_stub_config_t *);
+
+bool qdrant_stub_start(const qdrant_stub_config_t &, qdrant_stub_t *);
+
+void qdrant_stub_stop(qdrant_stub_t *);
+
+qdrant_stub_stats_t qdrant_stub_get_stats(qdrant_stub_t &);
+
+// points stored in a collection, 0 when there is no such collection
+size_t qdrant_stub_count(qdrant_stub_t &, const std::string &);
+
+#endif // __EMBED2VECDB_QDRANT_STUB_H__
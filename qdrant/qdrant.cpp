@@ -1,15 +1,50 @@
 #include "qdrant.h"
+#include "qdrant-json.h"
 #include "curl/curl.h"
 #include "nlohmann/json.hpp"
 #include "utils.h"
+#include <algorithm>
 #include <cstdlib>
 #include <cstring>
 #include <exception>
+#include <mutex>
+#include <unordered_set>
 #include <uuid/uuid.h>
 
+// curl_global_init is not thread safe and must run once per process, not
+// once per request; clients share it
+static std::mutex qdrant_global_lock;
+static int qdrant_global_refs = 0;
+
+bool qdrant_global_acquire()
+{
+  std::lock_guard<std::mutex> lock(qdrant_global_lock);
+  if (qdrant_global_refs == 0)
+  {
+    CURLcode res = curl_global_init(CURL_GLOBAL_ALL);
+    if (res != CURLE_OK)
+    {
+      LOG_ERR("curl_global_init failed: %d.\n", res);
+      return false;
+    }
+  }
+
+  qdrant_global_refs++;
+
+  return true;
+}
+
+void qdrant_global_release()
+{
+  std::lock_guard<std::mutex> lock(qdrant_global_lock);
+  if (qdrant_global_refs > 0 && --qdrant_global_refs == 0)
+  {
+    curl_global_cleanup();
+  }
+}
+
 bool qdrant_init(const std::string &qdrant_uri, qdrant_info_t *info)
 {
-  bool success = true;
   if (NULL == info)
   {
     LOG_ERR("argument 'info' is NULL.\n");
@@ -17,41 +52,146 @@ bool qdrant_init(const std::string &qdrant_uri, qdrant_info_t *info)
   }
 
   info->URI.assign(qdrant_uri);
+  info->client = NULL;
 
-  // Call curl_global_init
-  CURLcode res = curl_global_init(CURL_GLOBAL_ALL);
-  if (res != 0)
+  if (!qdrant_global_acquire())
   {
-    LOG_ERR("curl_global_init failed: %d.\n", res);
     return false;
   }
 
-  CURL *curl = curl_easy_init();
-  if (NULL == curl)
+  qdrant_client_t *client = new qdrant_client_t;
+  client->curl = curl_easy_init();
+  client->headers = NULL;
+  client->response = qdrant_malloc_write_data();
+  client->status = 0;
+
+  info->client = client;
+
+  if (NULL == client->curl || NULL == client->response)
   {
     LOG_ERR("curl_easy_init failed.\n");
-    curl_global_cleanup();
+    qdrant_destroy(info);
     return false;
   }
 
+  // built once, reused by every request; an empty 'Expect:' stops curl from
+  // waiting a round trip for '100 Continue' before sending large bodies
+  client->headers =
+      curl_slist_append(client->headers, "Content-Type: application/json");
+  client->headers = curl_slist_append(client->headers, "Expect:");
+
   // Now check if qdrant is online
-  curl_easy_setopt(curl, CURLOPT_URL, info->URI.c_str());
+  bool success = qdrant_request(*info, "HEAD", "", NULL);
+  if (!success)
+  {
+    LOG_ERR("qdrant is ofline.\n");
+  }
+
+  return success;
+}
+
+void qdrant_destroy(qdrant_info_t *info)
+{
+  if (NULL == info || NULL == info->client)
+  {
+    return;
+  }
+
+  qdrant_client_t *client = info->client;
+  if (client->curl != NULL)
+  {
+    curl_easy_cleanup(client->curl);
+  }
+
+  if (client->headers != NULL)
+  {
+    curl_slist_free_all(client->headers);
+  }
+
+  free_write_data(client->response);
+
+  delete client;
+  info->client = NULL;
+
+  qdrant_global_release();
+}
+
+bool qdrant_request(const qdrant_info_t &info, const char *method,
+                    const std::string &path, const std::string *body,
+                    std::string *response)
+{
+  qdrant_client_t *client = info.client;
+  if (NULL == client)
+  {
+    LOG_ERR("qdrant client is not initialized.\n");
+    return false;
+  }
+
+  std::lock_guard<std::mutex> lock(client->lock);
+
+  CURL *curl = client->curl;
+  std::string url(info.URI);
+  url.append(path);
+
+  // reset options only: the connection cache survives, so the next request
+  // goes out on the same keep-alive connection
+  curl_easy_reset(curl);
+  qdrant_reset_write_data(client->response);
+
+  curl_easy_setopt(curl, CURLOPT_URL, url.c_str());
   curl_easy_setopt(curl, CURLOPT_FOLLOWLOCATION, 1L);
-  curl_easy_setopt(curl, CURLOPT_NOBODY, 1L);
   curl_easy_setopt(curl, CURLOPT_NOPROGRESS, 1L);
+  curl_easy_setopt(curl, CURLOPT_NOSIGNAL, 1L);
+  curl_easy_setopt(curl, CURLOPT_TCP_KEEPALIVE, 1L);
+  curl_easy_setopt(curl, CURLOPT_HTTPHEADER, client->headers);
+  curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, qdrant_curl_write_data);
+  curl_easy_setopt(curl, CURLOPT_WRITEDATA, client->response);
 
-  res = curl_easy_perform(curl);
-  success = (CURLE_OK == res);
+  if (strcmp(method, "HEAD") == 0)
+  {
+    curl_easy_setopt(curl, CURLOPT_NOBODY, 1L);
+  }
+  else
+  {
+    curl_easy_setopt(curl, CURLOPT_CUSTOMREQUEST, method);
+  }
 
-  if (!success)
+  if (body != NULL)
   {
-    LOG_ERR("qdrant is ofline.\n");
+    // sent straight from the caller's buffer, no copy
+    curl_easy_setopt(curl, CURLOPT_POSTFIELDS, body->data());
+    curl_easy_setopt(curl, CURLOPT_POSTFIELDSIZE_LARGE,
+                     (curl_off_t)body->length());
   }
 
-  curl_easy_cleanup(curl);
-  curl_global_cleanup();
+  CURLcode res = curl_easy_perform(curl);
 
-  return success;
+  client->status = 0;
+  curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &client->status);
+
+  const char *text = reinterpret_cast<const char *>(client->response->pointer);
+  const size_t text_len = client->response->pointer_len;
+
+  if (response != NULL)
+  {
+    response->assign(text, text_len);
+  }
+
+  if (res != CURLE_OK)
+  {
+    LOG_ERR("%s %s failed: %s.\n", method, url.c_str(),
+            curl_easy_strerror(res));
+    return false;
+  }
+
+  if (client->status < 200 || client->status >= 300)
+  {
+    LOG_ERR("%s %s returned HTTP %ld: %.*s\n", method, url.c_str(),
+            client->status, (int)text_len, text);
+    return false;
+  }
+
+  return true;
 }
 
 std::string qdrant_get_distance(qdrant_distance_type_t distance)
@@ -91,28 +231,93 @@ std::string qdrant_get_distance(qdrant_distance_type_t distance)
   return param;
 }
 
-/***
- *** CURL related
- ***/
-int qdrant_curl_callback_nop(char *, size_t s, size_t n, void *)
+std::string qdrant_get_encoding(qdrant_encoding_t encoding)
 {
-  return s * n;
+  switch (encoding)
+  {
+  case Gzip:
+    return "gzip";
+  case Deflate:
+    return "deflate";
+  default:
+    return "identity";
+  }
 }
 
-int qcc_read_data(char *buffer, size_t size, size_t nmemb, void *userdata)
+bool qdrant_parse_encoding(const std::string &name,
+                           qdrant_encoding_t *encoding)
 {
-  const size_t total = size * nmemb;
-  const char *udata = reinterpret_cast<const char *>(userdata);
-  if (NULL == udata)
+  if (name == "none" || name == "identity")
   {
-    return 0;
+    *encoding = Identity;
+  }
+  else if (name == "gzip")
+  {
+    *encoding = Gzip;
+  }
+  else if (name == "deflate")
+  {
+    *encoding = Deflate;
+  }
+  else
+  {
+    LOG_ERR("unknown encoding '%s' (none, gzip or deflate).\n", name.c_str());
+    return false;
   }
 
-  LOG("size is %ld, nmemb is %ld\n", size, nmemb);
-  LOG("userdata is %p | %s\n", userdata, udata);
-  memcpy(buffer, udata, total);
+  return true;
+}
 
-  return total;
+std::string qdrant_get_quantization(qdrant_quantization_t quantization)
+{
+  switch (quantization)
+  {
+  case Float16:
+    return "float16";
+  case Uint8:
+    return "uint8";
+  case Binary:
+    return "binary";
+  default:
+    return "none";
+  }
+}
+
+bool qdrant_parse_quantization(const std::string &name,
+                               qdrant_quantization_t *quantization)
+{
+  if (name == "none")
+  {
+    *quantization = NoQuantization;
+  }
+  else if (name == "float16")
+  {
+    *quantization = Float16;
+  }
+  else if (name == "uint8")
+  {
+    *quantization = Uint8;
+  }
+  else if (name == "binary")
+  {
+    *quantization = Binary;
+  }
+  else
+  {
+    LOG_ERR("unknown quantization '%s' (none, float16, uint8 or binary).\n",
+            name.c_str());
+    return false;
+  }
+
+  return true;
+}
+
+/***
+ *** CURL related
+ ***/
+int qdrant_curl_callback_nop(char *, size_t s, size_t n, void *)
+{
+  return s * n;
 }
 
 int qdrant_curl_write_data(char *buffer, size_t size, size_t nmemb,
@@ -124,286 +329,508 @@ int qdrant_curl_write_data(char *buffer, size_t size, size_t nmemb,
     return 0;
   }
 
+  // responses may arrive in several chunks: append, growing geometrically
   size_t total = size * nmemb;
-  if (data->pointer_len < total)
-  {
-    // Must realloc data
-    data->pointer_len = total;
-    data->pointer = realloc(data->pointer, total);
-  }
-  else
+  if (data->pointer_len + total > data->pointer_cap)
   {
-    // pointer_len >= total
-    data->pointer_len = total;
+    size_t cap = data->pointer_cap > 0 ? data->pointer_cap : 512;
+    while (cap < data->pointer_len + total)
+    {
+      cap *= 2;
+    }
+
+    void *pointer = realloc(data->pointer, cap);
+    if (NULL == pointer)
+    {
+      return 0;
+    }
+
+    data->pointer = pointer;
+    data->pointer_cap = cap;
   }
 
-  memset(data->pointer, 0x00, data->pointer_len);
-  memcpy(data->pointer, buffer, total);
+  memcpy(reinterpret_cast<char *>(data->pointer) + data->pointer_len, buffer,
+         total);
+  data->pointer_len += total;
 
   return total;
 }
 
+std::string qdrant_collection_path(const char *path,
+                                   const qdrant_colection_info_t &col)
+{
+  std::string param(path);
+  string_replace_all(param, "{collection_name}", col.name);
+
+  return param;
+}
+
+std::string qdrant_collection_datatype(const qdrant_colection_info_t &col)
+{
+  switch (col.quantization)
+  {
+  case Float16:
+  case Uint8:
+    return qdrant_get_quantization(col.quantization);
+  case Binary:
+    // +1/-1 are exact in float16
+    return "float16";
+  default:
+    return "float32";
+  }
+}
+
 bool qdrant_collection_create(const qdrant_info_t &info,
                               const qdrant_colection_info_t &col)
 {
-  bool success = true;
+  nlohmann::json put_data;
 
-  std::string url;
-  std::string param(QDRANT_COLLECTIONS_PATH);
+  put_data["vectors"]["size"] = col.size;
+  put_data["vectors"]["distance"] = qdrant_get_distance(col.distance);
 
-  string_replace_all(param, "{collection_name}", col.name);
+  switch (col.quantization)
+  {
+  case Float16:
+  case Uint8:
+    put_data["vectors"]["datatype"] = qdrant_collection_datatype(col);
+    break;
+  case Binary:
+    // searches run on the bits kept in RAM and rescore from disk
+    put_data["vectors"]["datatype"] = qdrant_collection_datatype(col);
+    put_data["vectors"]["on_disk"] = true;
+    put_data["quantization_config"]["binary"]["always_ram"] = true;
+    break;
+  default:
+    break;
+  }
 
-  url.assign(info.URI);
-  url.append(param);
+  std::string data = nlohmann::to_string(put_data);
+  std::string result;
 
-  CURLcode res = curl_global_init(CURL_GLOBAL_ALL);
-  if (res != CURLE_OK)
+  LOG("sending JSON '%s'.\n", data.c_str());
+
+  bool success =
+      qdrant_request(info, "PUT",
+                     qdrant_collection_path(QDRANT_COLLECTIONS_PATH, col),
+                     &data, &result);
+  if (success)
+  {
+    LOG("got result string ... '%s'\n", result.c_str());
+  }
+
+  return success;
+}
+
+bool qdrant_collection_delete(const qdrant_info_t &info,
+                              const qdrant_colection_info_t &col)
+{
+  std::string result;
+
+  bool success =
+      qdrant_request(info, "DELETE",
+                     qdrant_collection_path(QDRANT_COLLECTIONS_PATH, col),
+                     NULL, &result);
+  if (success)
+  {
+    LOG("got result string ... %s\n", result.c_str());
+  }
+
+  return success;
+}
+
+bool qdrant_collection_exists(const qdrant_info_t &info,
+                              const qdrant_colection_info_t &col,
+                              bool *exists)
+{
+  std::string result;
+
+  bool success =
+      qdrant_request(info, "GET",
+                     qdrant_collection_path(QDRANT_COLLECTION_EXISTS_PATH, col),
+                     NULL, &result);
+  if (!success)
   {
     return false;
   }
 
-  CURL *curl = curl_easy_init();
-  if (NULL == curl)
+  nlohmann::json reply = nlohmann::json::parse(result, nullptr, false);
+  if (!reply.is_object() || !reply.contains("result") ||
+      !reply["result"].is_object() || !reply["result"].contains("exists") ||
+      !reply["result"]["exists"].is_boolean())
   {
-    LOG_ERR("curl_easy_init failed.\n");
+    LOG_ERR("unexpected reply '%s'.\n", result.c_str());
     return false;
   }
 
-  nlohmann::json put_data;
-  nlohmann::json collection_spec;
+  *exists = reply["result"]["exists"].get<bool>();
 
-  collection_spec["size"] = 1024;
-  collection_spec["distance"] = "Cosine";
+  return true;
+}
 
-  put_data["vectors"]["size"] = col.size;
-  put_data["vectors"]["distance"] = qdrant_get_distance(col.distance);
+bool qdrant_collection_params(const qdrant_info_t &info,
+                              const qdrant_colection_info_t &col,
+                              unsigned int *size, std::string *distance,
+                              std::string *datatype)
+{
+  std::string result;
 
-  std::string data = nlohmann::to_string(put_data);
+  bool success =
+      qdrant_request(info, "GET",
+                     qdrant_collection_path(QDRANT_COLLECTIONS_PATH, col),
+                     NULL, &result);
+  if (!success)
+  {
+    return false;
+  }
 
-  LOG("sending JSON '%s'.\n", data.c_str());
-  LOG("to %s\n", url.c_str());
+  // {"result": {"config": {"params": {"vectors": {"size": .., ..}}}}}
+  const nlohmann::json reply = nlohmann::json::parse(result, nullptr, false);
+  const nlohmann::json *vectors = &reply;
+  for (const char *key : {"result", "config", "params", "vectors"})
+  {
+    if (!vectors->is_object() || !vectors->contains(key))
+    {
+      vectors = NULL;
+      break;
+    }
+    vectors = &(*vectors)[key];
+  }
 
-  // Setup curl
+  if (vectors == NULL || !vectors->is_object() ||
+      !vectors->contains("size") || !(*vectors)["size"].is_number_unsigned() ||
+      !vectors->contains("distance") || !(*vectors)["distance"].is_string())
   {
-    struct curl_slist *headers = NULL;
-    headers = curl_slist_append(headers, "Content-Type: application/json");
+    LOG_ERR("unexpected collection info '%s'.\n", result.c_str());
+    return false;
+  }
 
-    curl_easy_setopt(curl, CURLOPT_URL, url.c_str());
+  *size = (*vectors)["size"].get<unsigned int>();
+  *distance = (*vectors)["distance"].get<std::string>();
+  *datatype = vectors->contains("datatype") && (*vectors)["datatype"].is_string()
+                  ? (*vectors)["datatype"].get<std::string>()
+                  : "float32";
 
-    // CURLOPT_UPLOAD for CURL is Method = 'PUT'
-    curl_easy_setopt(curl, CURLOPT_UPLOAD, 1L);
+  return true;
+}
 
-    curl_easy_setopt(curl, CURLOPT_READFUNCTION, qcc_read_data);
-    curl_easy_setopt(curl, CURLOPT_READDATA, data.c_str());
-    curl_easy_setopt(curl, CURLOPT_INFILESIZE_LARGE, (curl_off_t)data.length());
+/****************************
+ * points API interface
+ *****************************/
+void qdrant_points_body(const qdrant_point_array_t &points, std::string &body,
+                        qdrant_quantization_t format)
+{
+  qdrant_json_write_points(body, points, format);
+}
+
+bool qdrant_points_insert(const qdrant_info_t &info,
+                          const qdrant_colection_info_t &col,
+                          const qdrant_point_array_t &points)
+{
+  const std::string path =
+      qdrant_collection_path(QDRANT_POINTS_INSERT_PATH, col);
 
-    curl_write_data_t *data = qdrant_malloc_write_data();
-    curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, qdrant_curl_write_data);
-    curl_easy_setopt(curl, CURLOPT_WRITEDATA, data);
+  std::string data_json;
+  std::string result;
 
-    res = curl_easy_perform(curl);
-    if (res != CURLE_OK)
-    {
-      success = false;
-      LOG_ERR("curl_easy_perform failed: %d.\n", res);
-    }
-    else
+  // one request per QDRANT_MAX_BODY_BYTES / QDRANT_MAX_BATCH_POINTS slice
+  size_t first = 0;
+  while (first < points.size())
+  {
+    data_json.clear();
+    qdrant_json_begin_points(data_json);
+
+    size_t n = 0;
+    while (first + n < points.size() && n < QDRANT_MAX_BATCH_POINTS)
     {
-      LOG("got result length ... %ld\n", data->pointer_len);
-      LOG("got result string ... '%.*s'\n", data->pointer_len,
-          (char *)data->pointer);
+      const size_t mark = data_json.size();
+      qdrant_json_append_point(data_json, points[first + n], n == 0,
+                               col.quantization);
+
+      if (n > 0 && data_json.size() + 2 > QDRANT_MAX_BODY_BYTES)
+      {
+        data_json.resize(mark);
+        break;
+      }
+
+      n++;
     }
 
-    free_write_data(data);
+    qdrant_json_end_points(data_json);
 
-    if (headers)
+    LOG("json length is %ld (%zu points).\n", data_json.length(), n);
+
+    if (!qdrant_request(info, "PUT", path, &data_json, &result))
     {
-      curl_slist_free_all(headers);
-      headers = NULL;
+      LOG_ERR("upsert of points %zu..%zu failed.\n", first, first + n - 1);
+      return false;
     }
-  }
 
-  curl_easy_cleanup(curl);
-  curl_global_cleanup();
+    LOG("got return string ... %s\n", result.c_str());
 
-  return success;
+    first += n;
+  }
+
+  return true;
 }
 
-bool qdrant_collection_delete(const qdrant_info_t &info,
-                              const qdrant_colection_info_t &col)
+bool qdrant_points_delete(const qdrant_info_t &info,
+                          const qdrant_colection_info_t &col,
+                          const std::vector<std::string> &ids)
 {
-  bool success = true;
+  const std::string path =
+      qdrant_collection_path(QDRANT_POINTS_DELETE_PATH, col);
 
-  std::string url;
-  std::string param(QDRANT_COLLECTIONS_PATH);
+  std::string data_json;
+  std::string result;
 
-  string_replace_all(param, "{collection_name}", col.name);
+  for (size_t first = 0; first < ids.size();
+       first += QDRANT_DELETE_BATCH_POINTS)
+  {
+    const size_t last =
+        std::min(ids.size(), first + QDRANT_DELETE_BATCH_POINTS);
 
-  url.assign(info.URI);
-  url.append(param);
+    data_json.assign("{\"points\":[");
+    for (size_t i = first; i < last; i++)
+    {
+      if (i > first)
+      {
+        data_json.push_back(',');
+      }
+      qdrant_json_append_string(data_json, ids[i]);
+    }
+    data_json.append("]}");
 
-  CURLcode res = curl_global_init(CURL_GLOBAL_ALL);
-  if (res != CURLE_OK)
-  {
-    return false;
+    if (!qdrant_request(info, "POST", path, &data_json, &result))
+    {
+      LOG_ERR("delete of points %zu..%zu failed.\n", first, last - 1);
+      return false;
+    }
   }
 
-  CURL *curl = curl_easy_init();
-  if (NULL == curl)
+  return true;
+}
+
+bool qdrant_points_exist(const qdrant_info_t &info,
+                         const qdrant_colection_info_t &col,
+                         const std::vector<std::string> &ids,
+                         std::vector<bool> &found)
+{
+  found.assign(ids.size(), false);
+  if (ids.empty())
   {
-    LOG_ERR("curl_easy_init failed.\n");
-    return false;
+    return true;
   }
 
-  // Setup curl
+  // POST on the points path retrieves points by id; ids only
+  std::string data_json("{\"ids\":[");
+  for (size_t i = 0; i < ids.size(); i++)
   {
-    struct curl_slist *headers = NULL;
-    headers = curl_slist_append(headers, "Content-Type: application/json");
-
-    curl_easy_setopt(curl, CURLOPT_URL, url.c_str());
-    curl_easy_setopt(curl, CURLOPT_CUSTOMREQUEST, "DELETE");
-
-    curl_write_data_t *data = qdrant_malloc_write_data();
-    curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, qdrant_curl_write_data);
-    curl_easy_setopt(curl, CURLOPT_WRITEDATA, data);
-
-    res = curl_easy_perform(curl);
-    if (res != CURLE_OK)
-    {
-      success = false;
-      LOG_ERR("curl_easy_perform failed: %d.\n", res);
-    }
-    else
+    if (i > 0)
     {
-      LOG("got result length ... %ld\n", data->pointer_len);
-      LOG("got result string ... %.*s\n", data->pointer_len,
-          (char *)data->pointer);
+      data_json.push_back(',');
     }
+    qdrant_json_append_string(data_json, ids[i]);
+  }
+  data_json.append("],\"with_payload\":false,\"with_vector\":false}");
+
+  std::string result;
+  if (!qdrant_request(info, "POST",
+                      qdrant_collection_path(QDRANT_POINTS_INSERT_PATH, col),
+                      &data_json, &result))
+  {
+    return false;
+  }
 
-    free_write_data(data);
+  nlohmann::json reply = nlohmann::json::parse(result, nullptr, false);
+  if (!reply.is_object() || !reply.contains("result") ||
+      !reply["result"].is_array())
+  {
+    LOG_ERR("unexpected reply '%.*s'.\n", 200, result.c_str());
+    return false;
+  }
 
-    if (headers)
+  // an id may be asked for more than once
+  std::unordered_set<std::string> present;
+  for (const auto &point : reply["result"])
+  {
+    if (point.contains("id") && point["id"].is_string())
     {
-      curl_slist_free_all(headers);
-      headers = NULL;
+      present.insert(point["id"].get<std::string>());
     }
   }
 
-  curl_easy_cleanup(curl);
-  curl_global_cleanup();
+  for (size_t i = 0; i < ids.size(); i++)
+  {
+    found[i] = present.count(ids[i]) > 0;
+  }
 
-  return success;
   return true;
 }
 
-/****************************
- * points API interface
- *****************************/
-int qpi_read_data(char *buffer, size_t size, size_t nmemb, void *userdata)
+void qdrant_search_default_params(qdrant_search_params_t *params)
 {
-  size_t total = size * nmemb;
-  if (userdata != NULL)
-  {
-    memcpy(buffer, userdata, total);
-    // LOG("buffer is '%.*s'.\n", (int)total, buffer);
-  }
-  else
+  params->limit = QDRANT_SEARCH_DEFAULT_LIMIT;
+  params->filter.clear();
+  params->with_payload = true;
+}
+
+// one search object; the vector is col.size floats, already quantized like
+// the stored ones
+static void qdrant_search_body(std::string &out,
+                               const qdrant_colection_info_t &col,
+                               const float *vector,
+                               const qdrant_search_params_t &params)
+{
+  out.append("{\"vector\":");
+  qdrant_json_append_vector(out, vector, col.size, col.quantization);
+  out.append(",\"limit\":");
+  out.append(std::to_string(params.limit));
+  out.append(",\"with_payload\":");
+  out.append(params.with_payload ? "true" : "false");
+  if (!params.filter.empty())
   {
-    total = 0;
+    out.append(",\"filter\":");
+    out.append(params.filter);
   }
-
-  return total;
+  out.push_back('}');
 }
 
-bool qdrant_points_insert(const qdrant_info_t &info,
-                          const qdrant_colection_info_t &col,
-                          const qdrant_point_array_t &points)
+static bool qdrant_search_parse(const nlohmann::json &points,
+                                qdrant_search_result_t &result)
 {
-  nlohmann::json data;
-  nlohmann::json itens = nlohmann::json::array();
+  result.clear();
+  if (!points.is_array())
+  {
+    return false;
+  }
 
-  for (auto &point : points)
+  for (const auto &point : points)
   {
-    nlohmann::json item;
-    item["id"] = point.id;
-    item["payload"][point.payload_x] = point.payload_y;
-    item["vector"] = nlohmann::json::array();
+    if (!point.is_object() || !point.contains("id") ||
+        !point.contains("score") || !point["score"].is_number())
+    {
+      return false;
+    }
 
-    for (auto &vec : point.vector)
+    qdrant_scored_point_t scored;
+    scored.id = point["id"].is_string() ? point["id"].get<std::string>()
+                                        : point["id"].dump();
+    scored.score = point["score"].get<float>();
+    if (point.contains("payload"))
     {
-      item["vector"].push_back(vec);
+      scored.payload = point["payload"];
     }
 
-    itens.push_back(item);
+    result.push_back(std::move(scored));
   }
-  data["points"] = itens;
 
-  std::string data_json = nlohmann::to_string(data);
-  // LOG_ERR("to send '%s' to API.\n", data_json.c_str());
+  return true;
+}
 
-  CURLcode res = curl_global_init(CURL_GLOBAL_ALL);
-  if (res != CURLE_OK)
+static bool qdrant_search_check_filter(const qdrant_search_params_t &params)
+{
+  if (params.filter.empty())
   {
-    LOG_ERR("curl_global_init failed.\n");
-    return false;
+    return true;
   }
 
-  CURL *curl = curl_easy_init();
-  if (NULL == curl)
+  // spliced into the body as is, so it has to be an object
+  if (!nlohmann::json::parse(params.filter, nullptr, false).is_object())
   {
-    LOG_ERR("curl_easy_init failed.\n");
-    curl_global_cleanup();
-
+    LOG_ERR("filter '%s' is not a JSON object.\n", params.filter.c_str());
     return false;
   }
-  else
-  {
-    nlohmann::json result;
 
-    std::string url(info.URI);
-    std::string path(QDRANT_POINTS_INSERT_PATH);
-    string_replace_all(path, "{collection_name}", col.name);
+  return true;
+}
+
+bool qdrant_points_search(const qdrant_info_t &info,
+                          const qdrant_colection_info_t &col,
+                          const float *vector,
+                          const qdrant_search_params_t &params,
+                          qdrant_search_result_t &result)
+{
+  result.clear();
+  if (!qdrant_search_check_filter(params))
+  {
+    return false;
+  }
 
-    url.append(path);
+  std::string data_json;
+  qdrant_search_body(data_json, col, vector, params);
 
-    LOG("sending payload to '%s'.\n", url.c_str());
-    LOG("json length is %ld.\n", data_json.length());
+  std::string reply_json;
+  if (!qdrant_request(info, "POST",
+                      qdrant_collection_path(QDRANT_POINTS_SEARCH_PATH, col),
+                      &data_json, &reply_json))
+  {
+    return false;
+  }
 
-    curl_easy_setopt(curl, CURLOPT_URL, url.c_str());
-    curl_easy_setopt(curl, CURLOPT_UPLOAD, 1L);
-    curl_easy_setopt(curl, CURLOPT_READDATA, data_json.c_str());
-    curl_easy_setopt(curl, CURLOPT_READFUNCTION, qpi_read_data);
-    curl_easy_setopt(curl, CURLOPT_INFILESIZE_LARGE, data_json.length());
+  nlohmann::json reply = nlohmann::json::parse(reply_json, nullptr, false);
+  if (!reply.is_object() || !reply.contains("result") ||
+      !qdrant_search_parse(reply["result"], result))
+  {
+    LOG_ERR("unexpected reply '%.*s'.\n", 200, reply_json.c_str());
+    return false;
+  }
 
-    curl_write_data_t *data = qdrant_malloc_write_data();
+  return true;
+}
 
-    curl_easy_setopt(curl, CURLOPT_WRITEDATA, data);
-    curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, qdrant_curl_write_data);
+bool qdrant_points_search_batch(const qdrant_info_t &info,
+                                const qdrant_colection_info_t &col,
+                                const float *vectors, size_t n_vectors,
+                                const qdrant_search_params_t &params,
+                                std::vector<qdrant_search_result_t> &results)
+{
+  results.assign(n_vectors, qdrant_search_result_t());
+  if (n_vectors == 0)
+  {
+    return true;
+  }
 
-    struct curl_slist *headers = NULL;
-    headers = curl_slist_append(headers, "Content-Type: application/json");
+  if (!qdrant_search_check_filter(params))
+  {
+    return false;
+  }
 
-    res = curl_easy_perform(curl);
-    if (res == CURLE_OK)
-    {
-      char *json = reinterpret_cast<char *>(data->pointer);
-      LOG("got return length ... %ld\n", data->pointer_len);
-      LOG("got return string ... %.*s\n", data->pointer_len, json);
-    }
-    else
+  std::string data_json("{\"searches\":[");
+  for (size_t k = 0; k < n_vectors; k++)
+  {
+    if (k > 0)
     {
-      LOG_ERR("curl_easy_perform failed.\n");
+      data_json.push_back(',');
     }
+    qdrant_search_body(data_json, col, vectors + k * col.size, params);
+  }
+  data_json.append("]}");
+
+  std::string reply_json;
+  if (!qdrant_request(
+          info, "POST",
+          qdrant_collection_path(QDRANT_POINTS_SEARCH_BATCH_PATH, col),
+          &data_json, &reply_json))
+  {
+    return false;
+  }
 
-    free_write_data(data);
+  nlohmann::json reply = nlohmann::json::parse(reply_json, nullptr, false);
+  if (!reply.is_object() || !reply.contains("result") ||
+      !reply["result"].is_array() || reply["result"].size() != n_vectors)
+  {
+    LOG_ERR("unexpected reply '%.*s'.\n", 200, reply_json.c_str());
+    return false;
+  }
 
-    if (headers != NULL)
+  for (size_t k = 0; k < n_vectors; k++)
+  {
+    if (!qdrant_search_parse(reply["result"][k], results[k]))
     {
-      curl_slist_free_all(headers);
+      LOG_ERR("unexpected reply '%.*s'.\n", 200, reply_json.c_str());
+      return false;
     }
   }
 
-  curl_global_cleanup();
-
   return true;
 }
@@ -4,11 +4,16 @@
 #include "curl/curl.h"
 #include "nlohmann/json.hpp"
 #include "utils.h"
+#include <mutex>
 #include <string>
 #include <vector>
 
 #define QDRANT_DEFAULT_URI "http://localhost:6333"
 
+// upsert request limits; qdrant rejects bodies over 32 MiB by default
+#define QDRANT_MAX_BODY_BYTES (8 << 20)
+#define QDRANT_MAX_BATCH_POINTS 256
+
 // qdrant API paths
 #define QDRANT_COLLECTIONS_PATH "/collections/{collection_name}"
 /* {"vectors": {"size": 4, "distance": "Cosine"}}
@@ -16,11 +21,31 @@
  * GET: retrieves collection stats
  */
 
+#define QDRANT_COLLECTION_EXISTS_PATH "/collections/{collection_name}/exists"
+/* GET: {"result": {"exists": true}, "status": "ok"}
+ */
+
+#define QDRANT_POINTS_DELETE_PATH "/collections/{collection_name}/points/delete"
+/* POST: Delete points
+ * {"points": ["id", ...]}
+ */
+
+// ids per delete request
+#define QDRANT_DELETE_BATCH_POINTS 1024
+
 #define QDRANT_POINTS_SEARCH_PATH "/collections/{collection_name}/points/search"
 /* POST: Search for points
  * {"vector": [0.2, 0.5, 0.2, 0.8], "limit": 2}
  */
 
+#define QDRANT_POINTS_SEARCH_BATCH_PATH                                       \
+  "/collections/{collection_name}/points/search/batch"
+/* POST: Several searches in one request, answered in order
+ * {"searches": [{"vector": [..], "limit": 2}, ..]}
+ */
+
+#define QDRANT_SEARCH_DEFAULT_LIMIT 10
+
 #define QDRANT_POINTS_INSERT_PATH "/collections/{collection_name}/points"
 /* PUT: Insert points
  * {"points": [{"id": 2, "payload": {"caga": "muito"}, "vector": [0.32, 0.75,
@@ -40,16 +65,38 @@ typedef enum _qdrant_distance_type
 
 std::string qdrant_get_distance(qdrant_distance_type_t);
 
-typedef struct _qdrant_info
+// Content-Encoding of request bodies
+typedef enum _qdrant_encoding
 {
-  std::string URI;
-} qdrant_info_t;
+  Identity = 0,
+  Gzip,
+  Deflate
+} qdrant_encoding_t;
+
+#define QDRANT_ENCODING_COUNT 3
+
+std::string qdrant_get_encoding(qdrant_encoding_t);
+bool qdrant_parse_encoding(const std::string &, qdrant_encoding_t *);
+
+// how vectors are stored (and sent): full floats, or quantized on our side
+typedef enum _qdrant_quantization
+{
+  NoQuantization = 0,
+  Float16, // float16 datatype
+  Uint8,   // uint8 datatype, affine map of [-range, range]
+  Binary   // sign bits: +1/-1 on disk, binary quantization in RAM
+} qdrant_quantization_t;
+
+std::string qdrant_get_quantization(qdrant_quantization_t);
+bool qdrant_parse_quantization(const std::string &, qdrant_quantization_t *);
 
 typedef struct _qdrant_collection_info
 {
   std::string name;
   unsigned int size;
   qdrant_distance_type_t distance;
+  qdrant_quantization_t quantization;
+  float quantize_range; // Uint8: components in [-range, range] map to 0..255
 } qdrant_colection_info_t;
 
 typedef struct _qdrant_point_spec
@@ -65,54 +112,141 @@ typedef struct _qdrant_point_spec
 typedef struct _curl_write_data
 {
   void *pointer;
-  size_t pointer_len;
+  size_t pointer_len; // bytes received so far
+  size_t pointer_cap; // bytes allocated
 } curl_write_data_t;
 
-inline curl_write_data_t *qdrant_malloc_write_data(size_t dsize = 512)
+inline curl_write_data_t *qdrant_malloc_write_data(
+    size_t dsize = QDRANT_WRITE_DATA_SIZE)
 {
-  curl_write_data_t *data = (curl_write_data_t *)malloc(
-      QDRANT_WRITE_DATA_SIZE * sizeof(curl_write_data_t));
+  curl_write_data_t *data =
+      (curl_write_data_t *)malloc(sizeof(curl_write_data_t));
 
   if (data != NULL)
   {
-    data->pointer_len = dsize;
-    data->pointer = malloc(data->pointer_len);
+    data->pointer_len = 0;
+    data->pointer_cap = dsize;
+    data->pointer = malloc(data->pointer_cap);
   }
 
   return data;
 }
 
+inline void qdrant_reset_write_data(curl_write_data_t *data)
+{
+  if (data != NULL)
+  {
+    data->pointer_len = 0;
+  }
+}
+
 inline void free_write_data(curl_write_data_t *data)
 {
   if (data != NULL)
   {
     if (data->pointer != NULL)
     {
-      LOG("freeing [curl_write_data_t*]->pointer.\n");
       free(data->pointer);
       data->pointer = NULL;
     }
 
-    LOG("freeing [curl_write_data_t*].\n");
     free(data);
   }
 }
 
+// long-lived connection to a qdrant server: one easy handle (so keep-alive
+// connections are reused across requests), one header list and one growable
+// response buffer. Requests on a client are serialized by 'lock'.
+typedef struct _qdrant_client
+{
+  CURL *curl;
+  struct curl_slist *headers;
+  curl_write_data_t *response;
+  long status; // HTTP status of the last request
+  std::mutex lock;
+} qdrant_client_t;
+
+// copies of a qdrant_info_t share its client
+typedef struct _qdrant_info
+{
+  std::string URI;
+  qdrant_client_t *client;
+} qdrant_info_t;
+
 typedef std::vector<qdrant_point_spec_t> qdrant_point_array_t;
 
+typedef struct _qdrant_search_params
+{
+  size_t limit;       // points per query
+  std::string filter; // JSON filter object, empty for none
+  bool with_payload;
+} qdrant_search_params_t;
+
+typedef struct _qdrant_scored_point
+{
+  std::string id;
+  float score;
+  nlohmann::json payload; // null without with_payload
+} qdrant_scored_point_t;
+
+// best match first
+typedef std::vector<qdrant_scored_point_t> qdrant_search_result_t;
+
 int qdrant_curl_callback_nop(char *, size_t, size_t, void *);
 int qdrant_curl_write_data(char *, size_t, size_t, void *);
 
+bool qdrant_global_acquire();
+void qdrant_global_release();
+
 bool qdrant_init(const std::string &, qdrant_info_t *);
+void qdrant_destroy(qdrant_info_t *);
+
+bool qdrant_request(const qdrant_info_t &, const char *, const std::string &,
+                    const std::string *, std::string * = NULL);
+
+std::string qdrant_collection_path(const char *,
+                                   const qdrant_colection_info_t &);
+
+// datatype the vectors of 'col' are stored as
+std::string qdrant_collection_datatype(const qdrant_colection_info_t &);
 
 bool qdrant_collection_create(const qdrant_info_t &,
                               const qdrant_colection_info_t &);
 bool qdrant_collection_delete(const qdrant_info_t &,
                               const qdrant_colection_info_t &);
+bool qdrant_collection_exists(const qdrant_info_t &,
+                              const qdrant_colection_info_t &, bool *);
+// size, distance and datatype ("float32" when unset) of an existing collection
+bool qdrant_collection_params(const qdrant_info_t &,
+                              const qdrant_colection_info_t &, unsigned int *,
+                              std::string *, std::string *);
 
 /* Points implementation */
+void qdrant_points_body(const qdrant_point_array_t &, std::string &,
+                        qdrant_quantization_t = NoQuantization);
+
 bool qdrant_points_insert(const qdrant_info_t &info,
                           const qdrant_colection_info_t &col,
                           const qdrant_point_array_t &points);
 
+bool qdrant_points_delete(const qdrant_info_t &,
+                          const qdrant_colection_info_t &,
+                          const std::vector<std::string> &);
+
+bool qdrant_points_exist(const qdrant_info_t &, const qdrant_colection_info_t &,
+                         const std::vector<std::string> &,
+                         std::vector<bool> &);
+
+void qdrant_search_default_params(qdrant_search_params_t *);
+
+bool qdrant_points_search(const qdrant_info_t &,
+                          const qdrant_colection_info_t &, const float *,
+                          const qdrant_search_params_t &,
+                          qdrant_search_result_t &);
+
+bool qdrant_points_search_batch(const qdrant_info_t &,
+                                const qdrant_colection_info_t &, const float *,
+                                size_t, const qdrant_search_params_t &,
+                                std::vector<qdrant_search_result_t> &);
+
 #endif // __EMBED2VECDB_QDRANT_H__
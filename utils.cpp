@@ -1,5 +1,7 @@
 #include "utils.h"
+#include <algorithm>
 #include <string>
+#include <thread>
 #include <uuid/uuid.h>
 #include <vector>
 
@@ -15,6 +17,19 @@ std::string generate_uuid()
   return std::string(uuid_string);
 }
 
+// name-based (SHA-1) UUID: the same namespace and name give the same UUID
+std::string generate_uuid_v5(const uuid_t ns, std::string_view name)
+{
+  uuid_t uuid;
+  char uuid_string[36 + 1] = {0x00};
+
+  uuid_generate_sha1(uuid, ns, name.data(), name.length());
+
+  uuid_unparse_lower(uuid, uuid_string);
+
+  return std::string(uuid_string);
+}
+
 std::vector<std::string> split_lines(const std::string &source,
                                      const std::string &sep)
 {
@@ -34,6 +49,25 @@ std::vector<std::string> split_lines(const std::string &source,
   return lines;
 }
 
+std::vector<std::string_view> split_views(std::string_view source,
+                                          std::string_view sep)
+{
+  std::vector<std::string_view> parts;
+  size_t start = 0;
+  size_t end = source.find(sep);
+
+  while (end != std::string_view::npos)
+  {
+    parts.push_back(source.substr(start, end - start));
+    start = end + sep.length();
+    end = source.find(sep, start);
+  }
+
+  parts.push_back(source.substr(start)); // Add the last part
+
+  return parts;
+}
+
 void string_replace_all(std::string &source, const std::string &find,
                         const std::string &replace)
 {
@@ -58,3 +92,145 @@ void string_replace_all(std::string &source, const std::string &find,
 
   source = std::move(builder);
 }
+
+void parallel_for(size_t n, int n_threads,
+                  const std::function<void(size_t, size_t)> &fn)
+{
+  // small blocks keep workers busy when items differ in cost
+  const size_t n_blocks = std::min<size_t>(n, std::max(1, n_threads) * 8);
+  if (n_threads <= 1 || n_blocks <= 1)
+  {
+    fn(0, n);
+    return;
+  }
+
+  const size_t block_size = (n + n_blocks - 1) / n_blocks;
+  std::atomic<size_t> next(0);
+
+  auto worker = [&]()
+  {
+    size_t begin;
+    while ((begin = next.fetch_add(block_size)) < n)
+    {
+      fn(begin, std::min(n, begin + block_size));
+    }
+  };
+
+  std::vector<std::thread> workers;
+  const size_t n_workers = std::min<size_t>(n_threads, n_blocks);
+  for (size_t i = 1; i < n_workers; i++)
+  {
+    workers.emplace_back(worker);
+  }
+
+  // the calling thread works too
+  worker();
+
+  for (auto &t : workers)
+  {
+    t.join();
+  }
+}
+
+// blocks of the current call, until there are none left
+static void worker_pool_work(worker_pool_t *pool)
+{
+  size_t begin;
+  while ((begin = pool->next.fetch_add(pool->block_size)) < pool->n)
+  {
+    (*pool->fn)(begin, std::min(pool->n, begin + pool->block_size));
+  }
+}
+
+static void worker_pool_loop(worker_pool_t *pool)
+{
+  uint64_t seen = 0;
+
+  std::unique_lock<std::mutex> lock(pool->mutex);
+  while (true)
+  {
+    pool->wake.wait(lock, [&]
+                    { return pool->stopping || pool->generation != seen; });
+    if (pool->stopping)
+    {
+      break;
+    }
+
+    seen = pool->generation;
+    lock.unlock();
+    worker_pool_work(pool);
+    lock.lock();
+
+    if (--pool->n_busy == 0)
+    {
+      pool->idle.notify_all();
+    }
+  }
+}
+
+void worker_pool_init(worker_pool_t *pool, int n_threads)
+{
+  pool->fn = NULL;
+  pool->next = 0;
+  pool->n = 0;
+  pool->block_size = 1;
+  pool->generation = 0;
+  pool->n_busy = 0;
+  pool->stopping = false;
+
+  for (int i = 1; i < n_threads; i++)
+  {
+    pool->threads.emplace_back(worker_pool_loop, pool);
+  }
+}
+
+void worker_pool_destroy(worker_pool_t *pool)
+{
+  if (NULL == pool)
+  {
+    return;
+  }
+
+  {
+    std::lock_guard<std::mutex> lock(pool->mutex);
+    pool->stopping = true;
+  }
+  pool->wake.notify_all();
+
+  for (auto &t : pool->threads)
+  {
+    t.join();
+  }
+  pool->threads.clear();
+}
+
+void parallel_for(worker_pool_t &pool, size_t n,
+                  const std::function<void(size_t, size_t)> &fn)
+{
+  const size_t n_blocks = std::min<size_t>(n, (pool.threads.size() + 1) * 8);
+  if (pool.threads.empty() || n_blocks <= 1)
+  {
+    fn(0, n);
+    return;
+  }
+
+  std::lock_guard<std::mutex> running(pool.running);
+
+  // every worker takes part in every call, if only to find nothing left
+  {
+    std::lock_guard<std::mutex> lock(pool.mutex);
+    pool.fn = &fn;
+    pool.n = n;
+    pool.block_size = (n + n_blocks - 1) / n_blocks;
+    pool.next = 0;
+    pool.n_busy = pool.threads.size();
+    pool.generation++;
+  }
+  pool.wake.notify_all();
+
+  worker_pool_work(&pool);
+
+  std::unique_lock<std::mutex> lock(pool.mutex);
+  pool.idle.wait(lock, [&] { return pool.n_busy == 0; });
+  pool.fn = NULL;
+}